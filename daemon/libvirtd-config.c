@@ -278,9 +278,14 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
 
     data->prio_workers = 5;
 
+    data->event_loop_threads = 0;
+
     data->max_requests = 20;
     data->max_client_requests = 5;
 
+    data->rpc_stats = 0;
+    data->interface_stats_max_age = 1000;
+
     data->log_buffer_size = 64;
 
     data->audit_level = 1;
@@ -290,6 +295,8 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->keepalive_count = 5;
     data->keepalive_required = 0;
 
+    data->compress_threshold = 4096;
+
     localhost = virGetHostname(NULL);
     if (localhost == NULL) {
         /* we couldn't resolve the hostname; assume that we are
@@ -342,6 +349,13 @@ daemonConfigFree(struct daemonConfig *data)
     }
     VIR_FREE(data->tls_allowed_dn_list);
 
+    tmp = data->client_weights;
+    while (tmp && *tmp) {
+        VIR_FREE(*tmp);
+        tmp++;
+    }
+    VIR_FREE(data->client_weights);
+
     tmp = data->sasl_allowed_username_list;
     while (tmp && *tmp) {
         VIR_FREE(*tmp);
@@ -426,9 +440,18 @@ daemonConfigLoadOptions(struct daemonConfig *data,
 
     GET_CONF_INT(conf, filename, prio_workers);
 
+    GET_CONF_INT(conf, filename, event_loop_threads);
+
     GET_CONF_INT(conf, filename, max_requests);
     GET_CONF_INT(conf, filename, max_client_requests);
 
+    if (remoteConfigGetStringList(conf, "client_weights",
+                                  &data->client_weights, filename) < 0)
+        goto error;
+
+    GET_CONF_INT(conf, filename, rpc_stats);
+    GET_CONF_INT(conf, filename, interface_stats_max_age);
+
     GET_CONF_INT(conf, filename, audit_level);
     GET_CONF_INT(conf, filename, audit_logging);
 
@@ -443,6 +466,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     GET_CONF_INT(conf, filename, keepalive_count);
     GET_CONF_INT(conf, filename, keepalive_required);
 
+    GET_CONF_INT(conf, filename, compress_threshold);
+
     return 0;
 
 error:
@@ -64,9 +64,16 @@ struct daemonConfig {
 
     int prio_workers;
 
+    int event_loop_threads;
+
     int max_requests;
     int max_client_requests;
 
+    char **client_weights;
+
+    int rpc_stats;
+    int interface_stats_max_age;
+
     int log_level;
     char *log_filters;
     char *log_outputs;
@@ -78,6 +85,8 @@ struct daemonConfig {
     int keepalive_interval;
     unsigned int keepalive_count;
     int keepalive_required;
+
+    int compress_threshold;
 };
 
 
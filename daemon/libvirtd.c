@@ -51,6 +51,7 @@
 #include "virnetlink.h"
 #include "virnetserver.h"
 #include "threads.h"
+#include "buf.h"
 #include "remote.h"
 #include "remote_driver.h"
 #include "hooks.h"
@@ -106,6 +107,9 @@ virNetSASLContextPtr saslCtxt = NULL;
 virNetServerProgramPtr remoteProgram = NULL;
 virNetServerProgramPtr qemuProgram = NULL;
 
+/* Whether the programs count their calls, see rpc_stats */
+static bool rpcStats = false;
+
 enum {
     VIR_DAEMON_ERR_NONE = 0,
     VIR_DAEMON_ERR_PIDFILE,
@@ -740,18 +744,188 @@ static void daemonShutdownHandler(virNetServerPtr srv,
     virNetServerQuit(srv);
 }
 
-static void daemonReloadHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
+/* What is needed to read the config file again on SIGHUP */
+struct daemonReloadData {
+    const char *configFile;
+    bool implicitConf;
+    bool privileged;
+};
+
+/* Entries are "pattern=weight", the pattern may itself
+ * contain '=' characters */
+static int daemonSetupClientWeights(virNetServerPtr srv,
+                                    struct daemonConfig *config)
+{
+    char **entry;
+
+    for (entry = config->client_weights ; entry && *entry ; entry++) {
+        char *pattern = NULL;
+        char *sep;
+        unsigned int weight;
+        int ret;
+
+        if (!(pattern = strdup(*entry))) {
+            virReportOOMError();
+            return -1;
+        }
+
+        if (!(sep = strrchr(pattern, '=')) || sep == pattern ||
+            virStrToLong_ui(sep + 1, NULL, 10, &weight) < 0 ||
+            weight == 0) {
+            VIR_ERROR(_("Invalid client weight '%s', "
+                        "expected 'pattern=weight' with a positive weight"),
+                      *entry);
+            VIR_FREE(pattern);
+            return -1;
+        }
+        *sep = '\0';
+
+        ret = virNetServerAddClientWeight(srv, pattern, weight);
+        VIR_FREE(pattern);
+        if (ret < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Only the worker limits of the daemon itself can be changed
+ * without a restart */
+static void daemonReloadWorkerLimits(virNetServerPtr srv,
+                                     struct daemonReloadData *data)
+{
+    struct daemonConfig *config = NULL;
+
+    if (!data->configFile)
+        return;
+
+    if (!(config = daemonConfigNew(data->privileged)) ||
+        daemonConfigLoadFile(config, data->configFile,
+                             data->implicitConf) < 0) {
+        VIR_WARN("Unable to reload %s, keeping the current worker limits",
+                 data->configFile);
+        goto cleanup;
+    }
+
+    if (config->min_workers < 0 || config->max_workers <= 0) {
+        VIR_WARN("Ignoring invalid worker limits min_workers=%d max_workers=%d",
+                 config->min_workers, config->max_workers);
+        goto cleanup;
+    }
+
+    if (virNetServerSetWorkerLimits(srv, config->min_workers,
+                                    config->max_workers) < 0)
+        VIR_WARN("Unable to apply worker limits min_workers=%d max_workers=%d",
+                 config->min_workers, config->max_workers);
+
+cleanup:
+    daemonConfigFree(config);
+}
+
+static void daemonReloadHandler(virNetServerPtr srv,
                                 siginfo_t *sig ATTRIBUTE_UNUSED,
-                                void *opaque ATTRIBUTE_UNUSED)
+                                void *opaque)
 {
         VIR_INFO("Reloading configuration on SIGHUP");
         virHookCall(VIR_HOOK_DRIVER_DAEMON, "-",
                     VIR_HOOK_DAEMON_OP_RELOAD, SIGHUP, "SIGHUP", NULL, NULL);
+        daemonReloadWorkerLimits(srv, opaque);
         if (virStateReload() < 0)
             VIR_WARN("Error while reloading drivers");
 }
 
-static int daemonSetupSignals(virNetServerPtr srv)
+static char *daemonFormatHistogram(const unsigned long long *buckets)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    for (i = 0 ; i < VIR_THREADPOOL_HISTOGRAM_BUCKETS ; i++) {
+        if (!buckets[i])
+            continue;
+        if (i == VIR_THREADPOOL_HISTOGRAM_BUCKETS - 1)
+            virBufferAsprintf(&buf, " >=%lluus:%llu",
+                              1ull << (i - 1), buckets[i]);
+        else
+            virBufferAsprintf(&buf, " <%lluus:%llu", 1ull << i, buckets[i]);
+    }
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+static void daemonLogProgramStats(virNetServerProgramPtr prog,
+                                  const char *progname)
+{
+    virNetServerProgramProcStats stats;
+    const char *name;
+    char *waitTime;
+    char *runTime;
+    size_t i;
+
+    for (i = 0 ; i < virNetServerProgramGetNProcs(prog) ; i++) {
+        if (virNetServerProgramGetProcStats(prog, i, &name, &stats) != 0 ||
+            !stats.calls)
+            continue;
+
+        waitTime = daemonFormatHistogram(stats.waitTime);
+        runTime = daemonFormatHistogram(stats.runTime);
+
+        VIR_INFO("%s %s: calls=%llu errors=%llu bytes_in=%llu bytes_out=%llu",
+                 progname, name, stats.calls, stats.errors,
+                 stats.bytesIn, stats.bytesOut);
+        VIR_INFO("%s %s wait time:%s", progname, name, NULLSTR(waitTime));
+        VIR_INFO("%s %s run time:%s", progname, name, NULLSTR(runTime));
+
+        VIR_FREE(waitTime);
+        VIR_FREE(runTime);
+    }
+}
+
+static void daemonStatsHandler(virNetServerPtr srv,
+                               siginfo_t *sig ATTRIBUTE_UNUSED,
+                               void *opaque ATTRIBUTE_UNUSED)
+{
+    virThreadPoolStats stats;
+    char *waitTime = NULL;
+    char *runTime = NULL;
+    unsigned long long resumed;
+    unsigned long long full;
+
+    if (virNetServerGetTLSResumeStats(srv, &resumed, &full) == 0)
+        VIR_INFO("TLS handshakes: resumed=%llu full=%llu", resumed, full);
+
+    if (rpcStats) {
+        daemonLogProgramStats(remoteProgram, "remote");
+        daemonLogProgramStats(qemuProgram, "qemu");
+    }
+
+    if (virNetServerGetWorkerStats(srv, &stats) < 0) {
+        VIR_INFO("No worker pool statistics, calls run in the event loop");
+        return;
+    }
+
+    waitTime = daemonFormatHistogram(stats.waitTime);
+    runTime = daemonFormatHistogram(stats.runTime);
+
+    VIR_INFO("Worker pool: min=%zu max=%zu workers=%zu free=%zu "
+             "prio=%zu free_prio=%zu queued=%zu jobs=%llu",
+             stats.minWorkers, stats.maxWorkers,
+             stats.nWorkers, stats.freeWorkers,
+             stats.nPrioWorkers, stats.freePrioWorkers,
+             stats.jobQueueDepth, stats.jobs);
+    VIR_INFO("Worker pool wait time:%s", NULLSTR(waitTime));
+    VIR_INFO("Worker pool run time:%s", NULLSTR(runTime));
+
+    VIR_FREE(waitTime);
+    VIR_FREE(runTime);
+}
+
+static int daemonSetupSignals(virNetServerPtr srv,
+                              struct daemonReloadData *reload)
 {
     if (virNetServerAddSignalHandler(srv, SIGINT, daemonShutdownHandler, NULL) < 0)
         return -1;
@@ -759,7 +933,9 @@ static int daemonSetupSignals(virNetServerPtr srv)
         return -1;
     if (virNetServerAddSignalHandler(srv, SIGTERM, daemonShutdownHandler, NULL) < 0)
         return -1;
-    if (virNetServerAddSignalHandler(srv, SIGHUP, daemonReloadHandler, NULL) < 0)
+    if (virNetServerAddSignalHandler(srv, SIGHUP, daemonReloadHandler, reload) < 0)
+        return -1;
+    if (virNetServerAddSignalHandler(srv, SIGUSR1, daemonStatsHandler, NULL) < 0)
         return -1;
     return 0;
 }
@@ -1067,6 +1243,7 @@ int main(int argc, char **argv) {
     struct daemonConfig *config;
     bool privileged = geteuid() == 0 ? true : false;
     bool implicit_conf = false;
+    struct daemonReloadData reload;
     char *run_dir = NULL;
     mode_t old_umask;
 
@@ -1323,6 +1500,29 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    if (daemonSetupClientWeights(srv, config) < 0) {
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+
+    if (config->compress_threshold < 0) {
+        VIR_ERROR(_("compress_threshold must not be negative"));
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+    virNetServerSetCompressThreshold(srv, config->compress_threshold);
+
+    if (config->event_loop_threads < 0) {
+        VIR_ERROR(_("event_loop_threads must not be negative"));
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+
+    if (virNetServerSetEventLoops(srv, config->event_loop_threads) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1346,6 +1546,11 @@ int main(int argc, char **argv) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
     }
+    if (config->rpc_stats &&
+        virNetServerProgramEnableStats(remoteProgram) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
     if (virNetServerAddProgram(srv, remoteProgram) < 0) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
@@ -1358,10 +1563,19 @@ int main(int argc, char **argv) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
     }
+    if (config->rpc_stats &&
+        virNetServerProgramEnableStats(qemuProgram) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
     if (virNetServerAddProgram(srv, qemuProgram) < 0) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
     }
+    rpcStats = !!config->rpc_stats;
+
+    if (config->interface_stats_max_age >= 0)
+        virNetlinkSetLinkStatsMaxAge(config->interface_stats_max_age);
 
     if (timeout != -1) {
         VIR_DEBUG("Registering shutdown timeout %d", timeout);
@@ -1369,7 +1583,10 @@ int main(int argc, char **argv) {
                                  timeout);
     }
 
-    if ((daemonSetupSignals(srv)) < 0) {
+    reload.configFile = remote_config_file;
+    reload.implicitConf = implicit_conf;
+    reload.privileged = privileged;
+    if ((daemonSetupSignals(srv, &reload)) < 0) {
         ret = VIR_DAEMON_ERR_SIGNAL;
         goto cleanup;
     }
@@ -1099,6 +1099,169 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_get_all_domain_stats_args *args,
+                                       remote_connect_get_all_domain_stats_ret *ret)
+{
+    virDomainPtr *doms = NULL;
+    virDomainStatsRecordPtr *retStats = NULL;
+    int nrecords = 0;
+    int i;
+    int rv = -1;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (args->doms.doms_len) {
+        if (VIR_ALLOC_N(doms, args->doms.doms_len + 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        for (i = 0; i < args->doms.doms_len; i++) {
+            if (!(doms[i] = get_nonnull_domain(priv->conn, args->doms.doms_val[i])))
+                goto cleanup;
+        }
+
+        if ((nrecords = virDomainListGetStats(doms, args->stats,
+                                              &retStats, args->flags)) < 0)
+            goto cleanup;
+    } else {
+        if ((nrecords = virConnectGetAllDomainStats(priv->conn, args->stats,
+                                                    &retStats, args->flags)) < 0)
+            goto cleanup;
+    }
+
+    if (nrecords > REMOTE_DOMAIN_STATS_RECORDS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domain stats records is %d, which exceeds max limit: %d"),
+                       nrecords, REMOTE_DOMAIN_STATS_RECORDS_MAX);
+        goto cleanup;
+    }
+
+    if (nrecords) {
+        if (VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        ret->retStats.retStats_len = nrecords;
+
+        for (i = 0; i < nrecords; i++) {
+            remote_domain_stats_record *dst = ret->retStats.retStats_val + i;
+
+            make_nonnull_domain(&dst->dom, retStats[i]->dom);
+
+            if (remoteSerializeTypedParameters(retStats[i]->params,
+                                               retStats[i]->nparams,
+                                               &dst->params.params_val,
+                                               &dst->params.params_len,
+                                               VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    } else {
+        ret->retStats.retStats_len = 0;
+        ret->retStats.retStats_val = NULL;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+                 (char *) ret);
+    }
+    virDomainStatsRecordListFree(retStats);
+    if (doms) {
+        for (i = 0; doms[i]; i++)
+            virDomainFree(doms[i]);
+        VIR_FREE(doms);
+    }
+    return rv;
+}
+
+static int
+remoteDispatchConnectGetStatsHistory(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                     virNetServerClientPtr client,
+                                     virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                     virNetMessageErrorPtr rerr,
+                                     remote_connect_get_stats_history_args *args,
+                                     remote_connect_get_stats_history_ret *ret)
+{
+    virDomainPtr dom = NULL;
+    virDomainStatsRecordPtr *samples = NULL;
+    int nsamples = 0;
+    int i;
+    int rv = -1;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (args->nsamples > REMOTE_STATS_HISTORY_SAMPLES_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("nsamples too large"));
+        goto cleanup;
+    }
+
+    if (args->dom.dom_len) {
+        if (!(dom = get_nonnull_domain(priv->conn, args->dom.dom_val[0])))
+            goto cleanup;
+
+        if ((nsamples = virDomainGetStatsHistory(dom, args->nsamples,
+                                                 &samples, args->flags)) < 0)
+            goto cleanup;
+    } else {
+        if ((nsamples = virNodeGetStatsHistory(priv->conn, args->nsamples,
+                                               &samples, args->flags)) < 0)
+            goto cleanup;
+    }
+
+    if (nsamples) {
+        if (VIR_ALLOC_N(ret->samples.samples_val, nsamples) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        ret->samples.samples_len = nsamples;
+
+        for (i = 0; i < nsamples; i++) {
+            remote_stats_history_sample *dst = ret->samples.samples_val + i;
+
+            if (remoteSerializeTypedParameters(samples[i]->params,
+                                               samples[i]->nparams,
+                                               &dst->params.params_val,
+                                               &dst->params.params_len,
+                                               VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    } else {
+        ret->samples.samples_len = 0;
+        ret->samples.samples_val = NULL;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t) xdr_remote_connect_get_stats_history_ret,
+                 (char *) ret);
+    }
+    virDomainStatsRecordListFree(samples);
+    if (dom)
+        virDomainFree(dom);
+    return rv;
+}
+
 static int
 remoteDispatchDomainGetSchedulerParametersFlags(virNetServerPtr server ATTRIBUTE_UNUSED,
                                                 virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -3729,6 +3892,18 @@ static int remoteDispatchSupportsFeature(
         goto done;
     }
 
+    /* Likewise, and asking for it means the client copes with it */
+    if (args->feature == VIR_DRV_FEATURE_PROGRAM_COMPRESSION) {
+        supported = virNetServerClientStartCompression(client);
+        goto done;
+    }
+
+    if (args->feature == VIR_DRV_FEATURE_PROGRAM_FRAGMENTS) {
+        virNetServerClientStartFragments(client);
+        supported = 1;
+        goto done;
+    }
+
     if (!priv->conn) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
         goto cleanup;
@@ -3797,6 +3972,52 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchConnectStartShm(virNetServerPtr server ATTRIBUTE_UNUSED,
+                              virNetServerClientPtr client,
+                              virNetMessagePtr msg,
+                              virNetMessageErrorPtr rerr,
+                              remote_connect_start_shm_args *args)
+{
+    virNetShmSessionPtr shm = NULL;
+    int rv = -1;
+    int fd = -1;
+
+    if (args->flags) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("unsupported flags (0x%x)"), args->flags);
+        goto cleanup;
+    }
+
+    /* The SASL layer, even without any security, would have to
+     * wrap the data on its way through the shared memory */
+    if (virNetServerClientGetAuth(client) == VIR_NET_SERVER_SERVICE_AUTH_SASL) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Shared memory cannot be used with SASL"));
+        goto cleanup;
+    }
+
+    if ((fd = virNetMessageDupFD(msg, 0)) < 0)
+        goto cleanup;
+
+    if (!(shm = virNetShmSessionNewServer(fd)))
+        goto cleanup;
+
+    /* Must come last, since the switch happens once the reply
+     * in @msg is sent, whether it reports success or not */
+    if (virNetServerClientSetShmSession(client, msg, shm) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virObjectUnref(shm);
+    return rv;
+}
+
 static int
 remoteDispatchDomainGetInterfaceParameters(virNetServerPtr server ATTRIBUTE_UNUSED,
                                            virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -45,6 +45,9 @@ struct daemonClientStream {
     unsigned int recvEOF : 1;
     unsigned int closed : 1;
 
+    /* Whether holes may be sent and received */
+    bool allowSkip;
+
     int filterID;
 
     virNetMessagePtr rx;
@@ -273,7 +276,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -300,6 +304,7 @@ cleanup:
 /*
  * @conn: a connection object to associate the stream with
  * @header: the method call to associate with the stream
+ * @allowSkip: whether the stream may carry holes
  *
  * Creates a new stream for this conn
  *
@@ -309,13 +314,14 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr header)
+                         virNetMessageHeaderPtr header,
+                         bool allowSkip)
 {
     daemonClientStream *stream;
     daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
 
-    VIR_DEBUG("client=%p, proc=%d, serial=%d, st=%p",
-              client, header->proc, header->serial, st);
+    VIR_DEBUG("client=%p, proc=%d, serial=%d, st=%p, allowSkip=%d",
+              client, header->proc, header->serial, st, allowSkip);
 
     if (VIR_ALLOC(stream) < 0) {
         virReportOOMError();
@@ -329,6 +335,7 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->serial = header->serial;
     stream->filterID = -1;
     stream->st = st;
+    stream->allowSkip = allowSkip;
 
     return stream;
 }
@@ -542,6 +549,53 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Recreates a hole sent by the client in place of data.
+ *
+ * Returns 0 if the hole was made, or a error RPC was sent,
+ * -1 upon fatal error
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    virNetMessageError rerr;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%d",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+    memset(&rerr, 0, sizeof(rerr));
+
+    if (!stream->allowSkip) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        goto error;
+    }
+
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    if (virStreamSendHole(stream->st, data.length, data.flags) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    VIR_INFO("Stream hole failed");
+    stream->closed = 1;
+    return virNetServerProgramSendReplyError(stream->prog,
+                                             client,
+                                             msg,
+                                             &rerr,
+                                             &msg->header);
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -646,7 +700,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -701,6 +758,8 @@ static int
 daemonStreamHandleRead(virNetServerClientPtr client,
                        daemonClientStream *stream)
 {
+    virNetMessagePtr msg;
+    virNetMessageError rerr;
     char *buffer;
     size_t bufferLen = VIR_NET_MESSAGE_PAYLOAD_MAX;
     int ret;
@@ -720,50 +779,77 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     if (!stream->tx)
         return 0;
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
+    if (!(msg = virNetMessageNew(false)))
         return -1;
 
-    ret = virStreamRecv(stream->st, buffer, bufferLen);
-    if (ret == -2) {
-        /* Should never get this, since we're only called when we know
-         * we're readable, but hey things change... */
-        ret = 0;
-    } else if (ret < 0) {
-        virNetMessagePtr msg;
-        virNetMessageError rerr;
+    if (stream->allowSkip) {
+        int inData;
+        long long length;
 
-        memset(&rerr, 0, sizeof(rerr));
+        if (virStreamInData(stream->st, &inData, &length) < 0)
+            goto error;
 
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-        else
-            ret = virNetServerProgramSendStreamError(remoteProgram,
-                                                     client,
-                                                     msg,
-                                                     &rerr,
-                                                     stream->procedure,
-                                                     stream->serial);
-    } else {
-        virNetMessagePtr msg;
-        stream->tx = 0;
-        if (ret == 0)
-            stream->recvEOF = 1;
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
+        if (!inData && length) {
+            /* Skip the hole here, and tell the client about it
+             * rather than sending it all those zeros */
+            if (virStreamSendHole(stream->st, length, 0) < 0)
+                goto error;
 
-        if (msg) {
+            stream->tx = 0;
             msg->cb = daemonStreamMessageFinished;
             msg->opaque = stream;
             stream->refs++;
-            ret = virNetServerProgramSendStreamData(remoteProgram,
-                                                    client,
-                                                    msg,
-                                                    stream->procedure,
-                                                    stream->serial,
-                                                    buffer, ret);
+            return virNetServerProgramSendStreamHole(remoteProgram,
+                                                     client,
+                                                     msg,
+                                                     stream->procedure,
+                                                     stream->serial,
+                                                     length, 0);
         }
+
+        /* Stop short of the next hole */
+        if (inData && length && length < bufferLen)
+            bufferLen = length;
     }
 
-    VIR_FREE(buffer);
-    return ret;
+    /* The data is read straight into the pooled buffer of the
+     * message, rather than into one of our own which would then
+     * have to be copied */
+    if (!(buffer = virNetServerProgramReserveStreamData(remoteProgram,
+                                                        msg,
+                                                        stream->procedure,
+                                                        stream->serial,
+                                                        bufferLen))) {
+        virNetMessageFree(msg);
+        return -1;
+    }
+
+    ret = virStreamRecv(stream->st, buffer, bufferLen);
+    if (ret == -2) {
+        /* Should never get this, since we're only called when we know
+         * we're readable, but hey things change... */
+        virNetMessageFree(msg);
+        return 0;
+    } else if (ret < 0) {
+        goto error;
+    }
+
+    stream->tx = 0;
+    if (ret == 0)
+        stream->recvEOF = 1;
+
+    msg->cb = daemonStreamMessageFinished;
+    msg->opaque = stream;
+    stream->refs++;
+    return virNetServerProgramSendReservedStreamData(client, msg, ret);
+
+error:
+    memset(&rerr, 0, sizeof(rerr));
+
+    return virNetServerProgramSendStreamError(remoteProgram,
+                                              client,
+                                              msg,
+                                              &rerr,
+                                              stream->procedure,
+                                              stream->serial);
 }
@@ -468,11 +468,23 @@ skip_function = (
     'virConnectListAllNodeDevices', # overridden in virConnect.py
     'virConnectListAllNWFilters', # overridden in virConnect.py
     'virConnectListAllSecrets', # overridden in virConnect.py
+    'virDomainListGetState', # Needs an array of domains, use virDomainState
+    'virNodeGetInfoAsync', # Needs a callback, not yet overridden
+    'virDomainGetInfoAsync', # Needs a callback, not yet overridden
+    'virDomainGetStateAsync', # Needs a callback, not yet overridden
+    'virDomainGetXMLDescAsync', # Needs a callback, not yet overridden
+    'virConnectGetAllDomainStats', # Returns records of typed parameters, not yet overridden
+    'virDomainListGetStats', # Needs an array of domains, not yet overridden
+    'virDomainStatsRecordListFree', # Only needed in C
+    'virNodeGetStatsHistory', # Returns records of typed parameters, not yet overridden
+    'virDomainGetStatsHistory', # Returns records of typed parameters, not yet overridden
 
     'virStreamRecvAll', # Pure python libvirt-override-virStream.py
     'virStreamSendAll', # Pure python libvirt-override-virStream.py
     'virStreamRecv', # overridden in libvirt-override-virStream.py
     'virStreamSend', # overridden in libvirt-override-virStream.py
+    'virStreamRecvFlags', # Needs a buffer like virStreamRecv, not yet overridden
+    'virStreamRecvHole', # Needs to return the length, not yet overridden
 
     'virConnectUnregisterCloseCallback', # overriden in virConnect.py
     'virConnectRegisterCloseCallback', # overriden in virConnect.py
@@ -205,6 +205,53 @@ typedef int
                                          int *state,
                                          int *reason,
                                          unsigned int flags);
+typedef int
+        (*virDrvDomainListGetState)     (virConnectPtr conn,
+                                         virDomainPtr *doms,
+                                         unsigned int ndoms,
+                                         int *states,
+                                         int *reasons,
+                                         unsigned int flags);
+typedef int
+        (*virDrvNodeGetInfoAsync)       (virConnectPtr conn,
+                                         virNodeInfoPtr info,
+                                         virConnectAsyncCallback cb,
+                                         void *opaque,
+                                         virFreeCallback freecb);
+typedef int
+        (*virDrvDomainGetInfoAsync)     (virDomainPtr domain,
+                                         virDomainInfoPtr info,
+                                         virConnectAsyncCallback cb,
+                                         void *opaque,
+                                         virFreeCallback freecb);
+typedef int
+        (*virDrvDomainGetStateAsync)    (virDomainPtr domain,
+                                         int *state,
+                                         int *reason,
+                                         unsigned int flags,
+                                         virConnectAsyncCallback cb,
+                                         void *opaque,
+                                         virFreeCallback freecb);
+typedef int
+        (*virDrvDomainGetXMLDescAsync)  (virDomainPtr domain,
+                                         unsigned int flags,
+                                         char **xml,
+                                         virConnectAsyncCallback cb,
+                                         void *opaque,
+                                         virFreeCallback freecb);
+typedef int
+        (*virDrvConnectGetAllDomainStats) (virConnectPtr conn,
+                                           virDomainPtr *doms,
+                                           unsigned int ndoms,
+                                           unsigned int stats,
+                                           virDomainStatsRecordPtr **retStats,
+                                           unsigned int flags);
+typedef int
+        (*virDrvConnectGetStatsHistory) (virConnectPtr conn,
+                                         virDomainPtr dom,
+                                         unsigned int nsamples,
+                                         virDomainStatsRecordPtr **retSamples,
+                                         unsigned int flags);
 typedef int
         (*virDrvDomainGetControlInfo)   (virDomainPtr domain,
                                          virDomainControlInfoPtr info,
@@ -1113,6 +1160,13 @@ struct _virDriver {
     virDrvDomainFSTrim                  domainFSTrim;
     virDrvDomainSendProcessSignal       domainSendProcessSignal;
     virDrvDomainOpenChannel             domainOpenChannel;
+    virDrvDomainListGetState            domainListGetState;
+    virDrvNodeGetInfoAsync              nodeGetInfoAsync;
+    virDrvDomainGetInfoAsync            domainGetInfoAsync;
+    virDrvDomainGetStateAsync           domainGetStateAsync;
+    virDrvDomainGetXMLDescAsync         domainGetXMLDescAsync;
+    virDrvConnectGetAllDomainStats      connectGetAllDomainStats;
+    virDrvConnectGetStatsHistory        connectGetStatsHistory;
 };
 
 typedef int
@@ -1668,6 +1722,19 @@ typedef int (*virDrvStreamSend)(virStreamPtr st,
 typedef int (*virDrvStreamRecv)(virStreamPtr st,
                                 char *data,
                                 size_t nbytes);
+typedef int (*virDrvStreamRecvFlags)(virStreamPtr st,
+                                     char *data,
+                                     size_t nbytes,
+                                     unsigned int flags);
+typedef int (*virDrvStreamSendHole)(virStreamPtr st,
+                                    long long length,
+                                    unsigned int flags);
+typedef int (*virDrvStreamRecvHole)(virStreamPtr st,
+                                    long long *length,
+                                    unsigned int flags);
+typedef int (*virDrvStreamInData)(virStreamPtr st,
+                                  int *inData,
+                                  long long *length);
 
 typedef int (*virDrvStreamEventAddCallback)(virStreamPtr stream,
                                             int events,
@@ -1690,6 +1757,10 @@ struct _virStreamDriver {
     virDrvStreamEventRemoveCallback streamRemoveCallback;
     virDrvStreamFinish              streamFinish;
     virDrvStreamAbort               streamAbort;
+    virDrvStreamRecvFlags           streamRecvFlags;
+    virDrvStreamSendHole            streamSendHole;
+    virDrvStreamRecvHole            streamRecvHole;
+    virDrvStreamInData              streamInData;
 };
 
 
@@ -50,6 +50,16 @@ struct virFDStreamData {
     virCommandPtr cmd;
     unsigned long long offset;
     unsigned long long length;
+    /* holes can be found and made in the file */
+    bool sparse;
+    bool writable;
+    /* sparse, but fd is the pipe of the I/O helper, which data and
+     * holes cross as frames */
+    bool framed;
+    virFileFrame frame;             /* the frame being read or written */
+    size_t frameDone;               /* bytes of its header written */
+    unsigned long long frameLeft;   /* bytes of data or hole left in it */
+    unsigned long long holeLeft;    /* writing, hole not sent yet */
 
     int watch;
     int events;         /* events the stream callback is subscribed for */
@@ -236,6 +246,124 @@ cleanup:
 }
 
 
+/*
+ * Reads the header of the next frame from the I/O helper, unless
+ * some of the current frame is left.
+ *
+ * Returns 1 if in a frame, 0 at the end of the stream, -2 if the
+ * header is not there yet, or -1 on error
+ */
+static int
+virFDStreamReadFrame(struct virFDStreamData *fdst)
+{
+    ssize_t got;
+
+    if (fdst->frameLeft)
+        return 1;
+
+retry:
+    got = read(fdst->fd, &fdst->frame, sizeof(fdst->frame));
+    if (got < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -2;
+        if (errno == EINTR)
+            goto retry;
+        virReportSystemError(errno, "%s",
+                             _("cannot read from stream"));
+        return -1;
+    }
+    if (got == 0)
+        return 0;
+
+    /* The helper writes each header at once, which a pipe
+     * passes on whole */
+    if (got != sizeof(fdst->frame) ||
+        fdst->frame.length == 0 ||
+        (fdst->frame.type != VIR_FILE_FRAME_DATA &&
+         fdst->frame.type != VIR_FILE_FRAME_HOLE)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed frame from I/O helper"));
+        return -1;
+    }
+
+    fdst->frameLeft = fdst->frame.length;
+    return 1;
+}
+
+
+/*
+ * Writes what is left of the header of the current frame.
+ *
+ * Returns 0 once it is written, -2 if it would block, -1 on error
+ */
+static int
+virFDStreamWriteFrame(struct virFDStreamData *fdst)
+{
+    while (fdst->frameDone < sizeof(fdst->frame)) {
+        ssize_t done = write(fdst->fd,
+                             (char *)&fdst->frame + fdst->frameDone,
+                             sizeof(fdst->frame) - fdst->frameDone);
+
+        if (done < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -2;
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("cannot write to stream"));
+            return -1;
+        }
+        fdst->frameDone += done;
+    }
+
+    return 0;
+}
+
+
+static int
+virFDStreamStartFrame(struct virFDStreamData *fdst,
+                      virFileFrameType type,
+                      unsigned long long length)
+{
+    memset(&fdst->frame, 0, sizeof(fdst->frame));
+    fdst->frame.type = type;
+    fdst->frame.length = length;
+    fdst->frameDone = 0;
+    if (type == VIR_FILE_FRAME_DATA)
+        fdst->frameLeft = length;
+
+    return virFDStreamWriteFrame(fdst);
+}
+
+
+/*
+ * Sends the I/O helper whatever is left of the frames written so
+ * far, including a hole at the end of the stream, waiting for it
+ * if need be.
+ */
+static int
+virFDStreamFlushFrames(struct virFDStreamData *fdst)
+{
+    unsigned long long hole = fdst->holeLeft;
+
+    if (fdst->frameDone == sizeof(fdst->frame) && !hole)
+        return 0;
+
+    if (virSetBlocking(fdst->fd, true) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot write to stream"));
+        return -1;
+    }
+
+    fdst->holeLeft = 0;
+    if (virFDStreamWriteFrame(fdst) < 0 ||
+        (hole && virFDStreamStartFrame(fdst, VIR_FILE_FRAME_HOLE, hole) < 0))
+        return -1;
+
+    return 0;
+}
+
+
 static int
 virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
 {
@@ -279,7 +407,13 @@ virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
     }
 
     /* mutex locked */
-    ret = VIR_CLOSE(fdst->fd);
+    if (fdst->framed && fdst->writable && !streamAbort &&
+        virFDStreamFlushFrames(fdst) < 0) {
+        VIR_FORCE_CLOSE(fdst->fd);
+        ret = -1;
+    } else {
+        ret = VIR_CLOSE(fdst->fd);
+    }
     if (fdst->cmd) {
         char buf[1024];
         ssize_t len;
@@ -379,6 +513,35 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->framed) {
+        /* Finish the header of the current frame, then start the
+         * frames of a pending hole and of this data if need be */
+        if ((ret = virFDStreamWriteFrame(fdst)) < 0)
+            goto cleanup;
+
+        if (!fdst->frameLeft) {
+            unsigned long long hole = fdst->holeLeft;
+
+            ret = 0;
+            if (nbytes == 0)
+                goto cleanup;
+
+            if (hole) {
+                fdst->holeLeft = 0;
+                if ((ret = virFDStreamStartFrame(fdst, VIR_FILE_FRAME_HOLE,
+                                                 hole)) < 0)
+                    goto cleanup;
+            }
+
+            if ((ret = virFDStreamStartFrame(fdst, VIR_FILE_FRAME_DATA,
+                                             nbytes)) < 0)
+                goto cleanup;
+        }
+
+        if (fdst->frameLeft < nbytes)
+            nbytes = fdst->frameLeft;
+    }
+
 retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -391,10 +554,14 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->framed)
+            fdst->frameLeft -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
@@ -429,6 +596,21 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->framed) {
+        if ((ret = virFDStreamReadFrame(fdst)) <= 0)
+            goto cleanup;
+
+        if (fdst->frameLeft < nbytes)
+            nbytes = fdst->frameLeft;
+
+        /* A reader which does not skip holes gets zeros */
+        if (fdst->frame.type == VIR_FILE_FRAME_HOLE) {
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            goto done;
+        }
+    }
+
 retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -441,10 +623,164 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
+        goto cleanup;
+    }
+
+    if (fdst->framed && ret == 0 && nbytes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("I/O helper stopped in the middle of data"));
+        ret = -1;
+        goto cleanup;
+    }
+
+done:
+    if (fdst->framed)
+        fdst->frameLeft -= ret;
+    if (fdst->length)
         fdst->offset += ret;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int
+virFDStreamInData(virStreamPtr st,
+                  int *inData,
+                  long long *length)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    unsigned long long len;
+    int ret = -1;
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        /* No hole is known of, so it is all data as far as we can tell */
+        *inData = 1;
+        *length = 0;
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (fdst->framed) {
+        switch (virFDStreamReadFrame(fdst)) {
+        case -2:
+            /* Not known yet, reading will tell when it is */
+            *inData = 1;
+            *length = 0;
+            ret = 0;
+            goto cleanup;
+        case -1:
+            goto cleanup;
+        case 0:
+            *inData = 0;
+            len = 0;
+            break;
+        default:
+            *inData = fdst->frame.type == VIR_FILE_FRAME_DATA;
+            len = fdst->frameLeft;
+        }
+    } else if (virFileInData(fdst->fd, inData, &len) < 0) {
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        (fdst->length - fdst->offset) < len)
+        len = fdst->length - fdst->offset;
+    if (len == 0)
+        *inData = 0;
+
+    if (len > LLONG_MAX)
+        len = LLONG_MAX;
+    *length = len;
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+/*
+ * Moves the stream on by @length bytes. Reading, the bytes are
+ * skipped over, writing, they are made to read back as zeros.
+ */
+static int
+virFDStreamSendHole(virStreamPtr st,
+                    long long length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream does not support holes"));
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        (fdst->length - fdst->offset) < length) {
+        virReportSystemError(ENOSPC, "%s",
+                             _("hole does not fit in stream"));
+        goto cleanup;
+    }
+
+    if (fdst->framed) {
+        if (fdst->writable) {
+            /* Sent along with the next data, or when closing */
+            if (fdst->frameLeft) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("hole in the middle of stream data"));
+                goto cleanup;
+            }
+            fdst->holeLeft += length;
+        } else {
+            if (!fdst->frameLeft ||
+                fdst->frame.type != VIR_FILE_FRAME_HOLE ||
+                fdst->frameLeft < length) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("stream is not in a hole that long"));
+                goto cleanup;
+            }
+            fdst->frameLeft -= length;
+        }
+    } else if (fdst->writable) {
+        if (virFileMakeHole(fdst->fd, length) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to make hole in stream"));
+            goto cleanup;
+        }
+    } else if (lseek(fdst->fd, length, SEEK_CUR) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek past hole in stream"));
+        goto cleanup;
     }
 
+    if (fdst->length)
+        fdst->offset += length;
+
+    ret = 0;
+
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
@@ -453,6 +789,8 @@ retry:
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamSendHole = virFDStreamSendHole,
+    .streamInData = virFDStreamInData,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamAddCallback = virFDStreamAddCallback,
@@ -464,12 +802,14 @@ static int virFDStreamOpenInternal(virStreamPtr st,
                                    int fd,
                                    virCommandPtr cmd,
                                    int errfd,
-                                   unsigned long long length)
+                                   unsigned long long length,
+                                   bool sparse,
+                                   bool writable)
 {
     struct virFDStreamData *fdst;
 
-    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu",
-              st, fd, cmd, errfd, length);
+    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu sparse=%d",
+              st, fd, cmd, errfd, length, sparse);
 
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         virSetNonBlock(fd) < 0)
@@ -484,6 +824,10 @@ static int virFDStreamOpenInternal(virStreamPtr st,
     fdst->cmd = cmd;
     fdst->errfd = errfd;
     fdst->length = length;
+    fdst->sparse = sparse;
+    fdst->writable = writable;
+    fdst->framed = sparse && cmd;
+    fdst->frameDone = sizeof(fdst->frame);
     if (virMutexInit(&fdst->lock) < 0) {
         VIR_FREE(fdst);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -501,7 +845,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 int virFDStreamOpen(virStreamPtr st,
                     int fd)
 {
-    return virFDStreamOpenInternal(st, fd, NULL, -1, 0);
+    return virFDStreamOpenInternal(st, fd, NULL, -1, 0, false, false);
 }
 
 
@@ -546,7 +890,7 @@ int virFDStreamConnectUNIX(virStreamPtr st,
         goto error;
     } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
 
-    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0) < 0)
+    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0, false, false) < 0)
         goto error;
     return 0;
 
@@ -571,7 +915,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long offset,
                             unsigned long long length,
                             int oflags,
-                            int mode)
+                            int mode,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
@@ -579,8 +924,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     virCommandPtr cmd = NULL;
     int errfd = -1;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o sparse=%d",
+              st, path, oflags, offset, length, mode, sparse);
 
     if (oflags & O_CREAT)
         fd = open(path, oflags, mode);
@@ -608,6 +953,11 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         goto error;
     }
 
+    /* Holes are found and made in plain files, and block devices
+     * get zeros written where holes are to be made */
+    if (!S_ISREG(sb.st_mode) && !S_ISBLK(sb.st_mode))
+        sparse = false;
+
     /* Thanks to the POSIX i/o model, we can't reliably get
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
@@ -637,6 +987,9 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         virCommandAddArgFormat(cmd, "%llu", length);
         virCommandTransferFD(cmd, fd);
         virCommandAddArgFormat(cmd, "%d", fd);
+        /* Holes cross the fifo as frames */
+        if (sparse)
+            virCommandAddArg(cmd, "1");
 
         if (oflags == O_RDONLY) {
             childfd = fds[1];
@@ -655,7 +1008,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         VIR_FORCE_CLOSE(childfd);
     }
 
-    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
+    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length, sparse,
+                                (oflags & O_ACCMODE) != O_RDONLY) < 0)
         goto error;
 
     return 0;
@@ -684,7 +1038,29 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0);
+                                       oflags, 0, false);
+}
+
+/*
+ * Like virFDStreamOpenFile, but if @path is a plain file the
+ * stream can tell where its holes are and make new ones, see
+ * virStreamInData and virStreamSendHole.
+ */
+int virFDStreamOpenSparseFile(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags)
+{
+    if (oflags & O_CREAT) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Attempt to create %s without specifying mode"),
+                       path);
+        return -1;
+    }
+    return virFDStreamOpenFileInternal(st, path,
+                                       offset, length,
+                                       oflags, 0, true);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -696,7 +1072,7 @@ int virFDStreamCreateFile(virStreamPtr st,
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags | O_CREAT, mode);
+                                       oflags | O_CREAT, mode, false);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -59,6 +59,7 @@
 #include "command.h"
 #include "virrandom.h"
 #include "viruri.h"
+#include "virtypedparam.h"
 #include "threads.h"
 
 #ifdef WITH_TEST
@@ -4290,6 +4291,217 @@ error:
     return -1;
 }
 
+/**
+ * virDomainListGetState:
+ * @doms: array of domain objects, all from the same connection
+ * @ndoms: number of domains in @doms
+ * @states: array of @ndoms elements, filled with the state of each
+ * domain (one of virDomainState)
+ * @reasons: array of @ndoms elements, filled with the reason which
+ * led to each state (one of virDomain*Reason); it is allowed to be NULL
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Extract the state of several domains at once, as virDomainGetState
+ * would for each of them. Remote drivers send all the requests before
+ * waiting for the first answer, which is much quicker than one call
+ * per domain on a connection with any latency.
+ *
+ * A domain whose state cannot be determined, eg because it was
+ * undefined in the meantime, gets a state and reason of -1 and does
+ * not make the whole call fail.
+ *
+ * Returns the number of domains whose state was retrieved, or -1
+ * in case of failure.
+ */
+int
+virDomainListGetState(virDomainPtr *doms,
+                      unsigned int ndoms,
+                      int *states,
+                      int *reasons,
+                      unsigned int flags)
+{
+    virConnectPtr conn;
+    unsigned int i;
+    int ret;
+
+    VIR_DEBUG("doms=%p, ndoms=%u, states=%p, reasons=%p, flags=%x",
+              doms, ndoms, states, reasons, flags);
+
+    virResetLastError();
+
+    if (!doms || ndoms == 0 || !VIR_IS_CONNECTED_DOMAIN(doms[0])) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    conn = doms[0]->conn;
+    virCheckNonNullArgGoto(states, error);
+
+    for (i = 1 ; i < ndoms ; i++) {
+        if (!VIR_IS_DOMAIN(doms[i]) || doms[i]->conn != conn) {
+            virReportInvalidArg(doms,
+                                _("domains in %s must all belong to "
+                                  "the same connection"),
+                                __FUNCTION__);
+            goto error;
+        }
+    }
+
+    if (conn->driver->domainListGetState) {
+        ret = conn->driver->domainListGetState(conn, doms, ndoms,
+                                               states, reasons, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    if (conn->driver->domainGetState) {
+        ret = 0;
+        for (i = 0 ; i < ndoms ; i++) {
+            if (conn->driver->domainGetState(doms[i], &states[i],
+                                             reasons ? &reasons[i] : NULL,
+                                             flags) < 0) {
+                states[i] = -1;
+                if (reasons)
+                    reasons[i] = -1;
+                continue;
+            }
+            ret++;
+        }
+        if (ret == 0)
+            goto error;
+        virResetLastError();
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainGetInfoAsync:
+ * @domain: a domain object
+ * @info: pointer to a virDomainInfo structure allocated by the user
+ * @cb: callback to call once @info is filled in
+ * @opaque: opaque data to pass to @cb
+ * @freecb: optional function to free @opaque after @cb was called
+ *
+ * Extract information about a domain, as virDomainGetInfo does, but
+ * without waiting for it. @info must stay around until @cb is called
+ * from the event loop, which requires an event loop implementation
+ * to be registered and run. A single thread can thus have requests
+ * in flight to many domains and hosts at once.
+ *
+ * Returns 0 if the request was made, in which case @cb is called
+ * exactly once, and -1 in case of failure, in which case it is not.
+ */
+int
+virDomainGetInfoAsync(virDomainPtr domain,
+                      virDomainInfoPtr info,
+                      virConnectAsyncCallback cb,
+                      void *opaque,
+                      virFreeCallback freecb)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "info=%p, cb=%p, opaque=%p, freecb=%p",
+                     info, cb, opaque, freecb);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(info, error);
+    virCheckNonNullArgGoto(cb, error);
+
+    memset(info, 0, sizeof(virDomainInfo));
+
+    conn = domain->conn;
+
+    if (conn->driver->domainGetInfoAsync) {
+        int ret;
+        ret = conn->driver->domainGetInfoAsync(domain, info,
+                                               cb, opaque, freecb);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
+/**
+ * virDomainGetStateAsync:
+ * @domain: a domain object
+ * @state: returned state of the domain (one of virDomainState)
+ * @reason: returned reason which led to @state (one of virDomain*Reason
+ * corresponding to the current state); it is allowed to be NULL
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ * @cb: callback to call once @state is filled in
+ * @opaque: opaque data to pass to @cb
+ * @freecb: optional function to free @opaque after @cb was called
+ *
+ * Extract domain state, as virDomainGetState does, but without
+ * waiting for it. @state and @reason must stay around until @cb is
+ * called from the event loop, which requires an event loop
+ * implementation to be registered and run.
+ *
+ * Returns 0 if the request was made, in which case @cb is called
+ * exactly once, and -1 in case of failure, in which case it is not.
+ */
+int
+virDomainGetStateAsync(virDomainPtr domain,
+                       int *state,
+                       int *reason,
+                       unsigned int flags,
+                       virConnectAsyncCallback cb,
+                       void *opaque,
+                       virFreeCallback freecb)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "state=%p, reason=%p, flags=%x, cb=%p, "
+                     "opaque=%p, freecb=%p",
+                     state, reason, flags, cb, opaque, freecb);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(state, error);
+    virCheckNonNullArgGoto(cb, error);
+
+    conn = domain->conn;
+
+    if (conn->driver->domainGetStateAsync) {
+        int ret;
+        ret = conn->driver->domainGetStateAsync(domain, state, reason, flags,
+                                                cb, opaque, freecb);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
 /**
  * virDomainGetControlInfo:
  * @domain: a domain object
@@ -4394,6 +4606,73 @@ error:
     return NULL;
 }
 
+/**
+ * virDomainGetXMLDescAsync:
+ * @domain: a domain object
+ * @flags: an OR'ed set of virDomainXMLFlags
+ * @xml: returned XML description of the domain, to be freed by the
+ * caller once @cb reported success
+ * @cb: callback to call once @xml is filled in
+ * @opaque: opaque data to pass to @cb
+ * @freecb: optional function to free @opaque after @cb was called
+ *
+ * Provide an XML description of the domain, as virDomainGetXMLDesc
+ * does, but without waiting for it. @xml must stay around until @cb
+ * is called from the event loop, which requires an event loop
+ * implementation to be registered and run.
+ *
+ * Returns 0 if the request was made, in which case @cb is called
+ * exactly once, and -1 in case of failure, in which case it is not.
+ */
+int
+virDomainGetXMLDescAsync(virDomainPtr domain,
+                         unsigned int flags,
+                         char **xml,
+                         virConnectAsyncCallback cb,
+                         void *opaque,
+                         virFreeCallback freecb)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "flags=%x, xml=%p, cb=%p, opaque=%p, freecb=%p",
+                     flags, xml, cb, opaque, freecb);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(xml, error);
+    virCheckNonNullArgGoto(cb, error);
+
+    *xml = NULL;
+
+    conn = domain->conn;
+
+    if ((conn->flags & VIR_CONNECT_RO) && (flags & VIR_DOMAIN_XML_SECURE)) {
+        virLibConnError(VIR_ERR_OPERATION_DENIED, "%s",
+                        _("virDomainGetXMLDescAsync with secure flag"));
+        goto error;
+    }
+
+    if (conn->driver->domainGetXMLDescAsync) {
+        int ret;
+        ret = conn->driver->domainGetXMLDescAsync(domain, flags, xml,
+                                                  cb, opaque, freecb);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
 /**
  * virConnectDomainXMLFromNative:
  * @conn: a connection object
@@ -6473,6 +6752,57 @@ error:
     return -1;
 }
 
+/**
+ * virNodeGetInfoAsync:
+ * @conn: pointer to the hypervisor connection
+ * @info: pointer to a virNodeInfo structure allocated by the user
+ * @cb: callback to call once @info is filled in
+ * @opaque: opaque data to pass to @cb
+ * @freecb: optional function to free @opaque after @cb was called
+ *
+ * Extract hardware information about the node, as virNodeGetInfo
+ * does, but without waiting for it. @info must stay around until
+ * @cb is called from the event loop, which requires an event loop
+ * implementation to be registered and run.
+ *
+ * Returns 0 if the request was made, in which case @cb is called
+ * exactly once, and -1 in case of failure, in which case it is not.
+ */
+int
+virNodeGetInfoAsync(virConnectPtr conn,
+                    virNodeInfoPtr info,
+                    virConnectAsyncCallback cb,
+                    void *opaque,
+                    virFreeCallback freecb)
+{
+    VIR_DEBUG("conn=%p, info=%p, cb=%p, opaque=%p, freecb=%p",
+              conn, info, cb, opaque, freecb);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(info, error);
+    virCheckNonNullArgGoto(cb, error);
+
+    if (conn->driver->nodeGetInfoAsync) {
+        int ret;
+        ret = conn->driver->nodeGetInfoAsync(conn, info, cb, opaque, freecb);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
 /**
  * virConnectGetCapabilities:
  * @conn: pointer to the hypervisor connection
@@ -8333,6 +8663,309 @@ error:
     return -1;
 }
 
+/**
+ * virConnectGetAllDomainStats:
+ * @conn: pointer to the hypervisor connection
+ * @stats: bitwise-OR of virDomainStatsTypes, or 0 for all of them
+ * @retStats: filled with an array of statistics records
+ * @flags: bitwise-OR of virConnectListAllDomainsFlags, to select
+ * the domains as virConnectListAllDomains would
+ *
+ * Collect statistics of all domains in one call, rather than asking
+ * for the info, CPU, block, interface and memory statistics of each
+ * domain separately. Each record holds a domain and its statistics
+ * as typed parameters, named after the group they belong to:
+ *
+ * VIR_DOMAIN_STATS_STATE: "state.state" and "state.reason" as int,
+ * as returned by virDomainGetState().
+ *
+ * VIR_DOMAIN_STATS_CPU_TOTAL: "cpu.time", "cpu.user" and "cpu.system"
+ * as unsigned long long, in nanoseconds.
+ *
+ * VIR_DOMAIN_STATS_BALLOON: "balloon.current" and "balloon.maximum"
+ * as unsigned long long, in kibibytes, then whatever of "balloon.swap_in",
+ * "balloon.swap_out", "balloon.major_fault", "balloon.minor_fault",
+ * "balloon.unused", "balloon.available", "balloon.actual" and
+ * "balloon.rss" the guest reports, as unsigned long long with the
+ * meaning and units of the matching virDomainMemoryStatTags. Where
+ * the host accounts for the memory of the domain, "balloon.cgroup.usage",
+ * "balloon.cgroup.cache", "balloon.cgroup.rss", "balloon.cgroup.mapped_file",
+ * "balloon.cgroup.swap" and "balloon.cgroup.unevictable" in bytes and
+ * "balloon.cgroup.pgfault" and "balloon.cgroup.pgmajfault" as counts,
+ * all as unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_VCPU: "vcpu.current" and "vcpu.maximum" as unsigned
+ * int, then "vcpu.<num>.state" as int (one of virVcpuState) and
+ * "vcpu.<num>.time" as unsigned long long, in nanoseconds.
+ *
+ * VIR_DOMAIN_STATS_INTERFACE: "net.count" as unsigned int, then
+ * "net.<num>.name" as string and "net.<num>.rx.bytes", "rx.pkts",
+ * "rx.errs", "rx.drop", "tx.bytes", "tx.pkts", "tx.errs" and "tx.drop"
+ * as unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_BLOCK: "block.count" as unsigned int, then
+ * "block.<num>.name" as string and "block.<num>.rd.reqs", "rd.bytes",
+ * "wr.reqs", "wr.bytes" and "errors" as unsigned long long. When the
+ * hypervisor cannot be asked, only "rd.bytes" and "wr.bytes" may be
+ * given, for the disks backed by host block devices.
+ *
+ * Statistics which are not available, eg the runtime ones of an
+ * inactive domain, are left out of the record, as are the groups
+ * which the driver does not know about.
+ *
+ * Returns the number of records stored in @retStats, or -1 in case
+ * of error. The array is terminated by a NULL element and must be
+ * freed with virDomainStatsRecordListFree().
+ */
+int
+virConnectGetAllDomainStats(virConnectPtr conn,
+                            unsigned int stats,
+                            virDomainStatsRecordPtr **retStats,
+                            unsigned int flags)
+{
+    int ret;
+
+    VIR_DEBUG("conn=%p, stats=%x, retStats=%p, flags=%x",
+              conn, stats, retStats, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(retStats, error);
+    *retStats = NULL;
+
+    if (conn->driver->connectGetAllDomainStats) {
+        ret = conn->driver->connectGetAllDomainStats(conn, NULL, 0, stats,
+                                                     retStats, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainListGetStats:
+ * @doms: NULL terminated array of domains, all from the same connection
+ * @stats: bitwise-OR of virDomainStatsTypes, or 0 for all of them
+ * @retStats: filled with an array of statistics records
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Collect statistics of the domains in @doms, as
+ * virConnectGetAllDomainStats() does for all domains. Domains which
+ * disappeared in the meantime are left out of the result.
+ *
+ * Returns the number of records stored in @retStats, or -1 in case
+ * of error. The array is terminated by a NULL element and must be
+ * freed with virDomainStatsRecordListFree().
+ */
+int
+virDomainListGetStats(virDomainPtr *doms,
+                      unsigned int stats,
+                      virDomainStatsRecordPtr **retStats,
+                      unsigned int flags)
+{
+    virConnectPtr conn;
+    unsigned int ndoms;
+    int ret;
+
+    VIR_DEBUG("doms=%p, stats=%x, retStats=%p, flags=%x",
+              doms, stats, retStats, flags);
+
+    virResetLastError();
+
+    if (!doms || !doms[0] || !VIR_IS_CONNECTED_DOMAIN(doms[0])) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    conn = doms[0]->conn;
+    virCheckNonNullArgGoto(retStats, error);
+    *retStats = NULL;
+
+    for (ndoms = 1 ; doms[ndoms] ; ndoms++) {
+        if (!VIR_IS_DOMAIN(doms[ndoms]) || doms[ndoms]->conn != conn) {
+            virReportInvalidArg(doms,
+                                _("domains in %s must all belong to "
+                                  "the same connection"),
+                                __FUNCTION__);
+            goto error;
+        }
+    }
+
+    if (conn->driver->connectGetAllDomainStats) {
+        ret = conn->driver->connectGetAllDomainStats(conn, doms, ndoms, stats,
+                                                     retStats, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainStatsRecordListFree:
+ * @stats: NULL terminated array of records, may be NULL
+ *
+ * Free the records returned by virConnectGetAllDomainStats() or
+ * virDomainListGetStats(), along with their domains and parameters.
+ */
+void
+virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats)
+{
+    virDomainStatsRecordPtr *next;
+
+    if (!stats)
+        return;
+
+    for (next = stats ; *next ; next++) {
+        virTypedParameterArrayClear((*next)->params, (*next)->nparams);
+        VIR_FREE((*next)->params);
+        if ((*next)->dom)
+            virDomainFree((*next)->dom);
+        VIR_FREE(*next);
+    }
+
+    VIR_FREE(stats);
+}
+
+/**
+ * virNodeGetStatsHistory:
+ * @conn: pointer to the hypervisor connection
+ * @nsamples: maximum number of samples to return
+ * @retSamples: filled with an array of samples, oldest first
+ * @flags: bitwise-OR of virStatsHistoryFlags
+ *
+ * Get the last @nsamples samples of the host statistics which the
+ * driver records at a regular interval, if it was configured to do
+ * so, saving the callers from polling and computing rates themselves.
+ * Each sample is a record with a NULL domain, holding "timestamp",
+ * the time it was taken at in milliseconds since the Epoch, then the
+ * fields of virNodeGetCPUStats() for all CPUs as "cpu.<field>" and
+ * those of virNodeGetMemoryStats() for all cells as "mem.<field>",
+ * all as unsigned long long.
+ *
+ * With VIR_STATS_HISTORY_RATES, each sample instead holds the per
+ * second rates of the cumulative counters, the CPU times here,
+ * between the previous sample and itself; the other fields keep
+ * their values.
+ *
+ * Returns the number of samples stored in @retSamples, which may be
+ * less than @nsamples if fewer were recorded, or -1 in case of error.
+ * The array is terminated by a NULL element and must be freed with
+ * virDomainStatsRecordListFree().
+ */
+int
+virNodeGetStatsHistory(virConnectPtr conn,
+                       unsigned int nsamples,
+                       virDomainStatsRecordPtr **retSamples,
+                       unsigned int flags)
+{
+    int ret;
+
+    VIR_DEBUG("conn=%p, nsamples=%u, retSamples=%p, flags=%x",
+              conn, nsamples, retSamples, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(retSamples, error);
+    *retSamples = NULL;
+
+    if (conn->driver->connectGetStatsHistory) {
+        ret = conn->driver->connectGetStatsHistory(conn, NULL, nsamples,
+                                                   retSamples, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainGetStatsHistory:
+ * @dom: pointer to the domain object
+ * @nsamples: maximum number of samples to return
+ * @retSamples: filled with an array of samples, oldest first
+ * @flags: bitwise-OR of virStatsHistoryFlags
+ *
+ * Get the last @nsamples samples of the statistics of @dom which the
+ * driver records at a regular interval while the domain runs, as
+ * virNodeGetStatsHistory() does for the host. Each sample is a
+ * record holding "timestamp", as unsigned long long milliseconds
+ * since the Epoch, and the statistics virDomainListGetStats()
+ * returns for the domain.
+ *
+ * With VIR_STATS_HISTORY_RATES, the cumulative counters, that is the
+ * CPU times and the byte, packet, request, error and drop counts,
+ * are replaced by their per second rates between the previous sample
+ * and this one.
+ *
+ * Returns the number of samples stored in @retSamples, or -1 in case
+ * of error. The array is terminated by a NULL element and must be
+ * freed with virDomainStatsRecordListFree().
+ */
+int
+virDomainGetStatsHistory(virDomainPtr dom,
+                         unsigned int nsamples,
+                         virDomainStatsRecordPtr **retSamples,
+                         unsigned int flags)
+{
+    virConnectPtr conn;
+    int ret;
+
+    VIR_DOMAIN_DEBUG(dom, "nsamples=%u, retSamples=%p, flags=%x",
+                     nsamples, retSamples, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(dom)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    conn = dom->conn;
+    virCheckNonNullArgGoto(retSamples, error);
+    *retSamples = NULL;
+
+    if (conn->driver->connectGetStatsHistory) {
+        ret = conn->driver->connectGetStatsHistory(conn, dom, nsamples,
+                                                   retSamples, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
 /**
  * virDomainCreate:
  * @domain: pointer to a defined domain
@@ -13557,12 +14190,20 @@ error:
  * @stream: stream to use as output
  * @offset: position in @vol to start reading from
  * @length: limit on amount of data to download
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolDownloadFlags
  *
  * Download the content of the volume as a stream. If @length
  * is zero, then the remaining contents of the volume after
  * @offset will be downloaded.
  *
+ * If @flags contains VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM,
+ * runs of zeros the volume does not store are sent as holes
+ * rather than as data. The caller then has to read the stream
+ * with virStreamRecvFlags and VIR_STREAM_RECV_STOP_AT_HOLE, and
+ * fetch each hole with virStreamRecvHole, or else receives the
+ * zeros as usual. Holes are only found in volumes which are
+ * plain files.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -13626,7 +14267,7 @@ error:
  * @stream: stream to use as input
  * @offset: position to start writing to
  * @length: limit on amount of data to upload
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolUploadFlags
  *
  * Upload new content to the volume from a stream. This call
  * will fail if @offset + @length exceeds the size of the
@@ -13634,6 +14275,11 @@ error:
  * will be raised if an attempt is made to upload greater
  * than @length bytes of data.
  *
+ * If @flags contains VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM,
+ * runs of zeros may be sent with virStreamSendHole instead of
+ * as data, and are recreated as holes in the volume. This is
+ * only possible for volumes which are plain files.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -15859,6 +16505,227 @@ error:
 }
 
 
+/**
+ * virStreamRecvFlags:
+ * @stream: pointer to the stream object
+ * @data: buffer to read into from stream
+ * @nbytes: size of @data buffer
+ * @flags: bitwise-OR of virStreamRecvFlagsValues
+ *
+ * Reads a series of bytes from the stream, like virStreamRecv.
+ *
+ * A stream opened as a sparse stream, for instance by passing
+ * VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM to virStorageVolDownload,
+ * may carry holes in place of runs of zeros. With no @flags, a
+ * hole is read as the zeros it stands for. With
+ * VIR_STREAM_RECV_STOP_AT_HOLE, reading stops short of a hole
+ * instead, and once no data is left before it, -3 is returned
+ * to tell the caller to fetch the hole with virStreamRecvHole.
+ *
+ * Returns the number of bytes read, 0 at the end of the stream,
+ * -1 upon error, -2 if the stream is non-blocking and there is
+ * no data pending, or -3 if a hole has been reached and
+ * VIR_STREAM_RECV_STOP_AT_HOLE was given.
+ */
+int virStreamRecvFlags(virStreamPtr stream,
+                       char *data,
+                       size_t nbytes,
+                       unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, data=%p, nbytes=%zi, flags=%x",
+              stream, data, nbytes, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(data, error);
+
+    if (stream->driver &&
+        stream->driver->streamRecvFlags) {
+        int ret;
+        ret = (stream->driver->streamRecvFlags)(stream, data, nbytes, flags);
+        if (ret == -2 || ret == -3)
+            return ret;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    /* Without holes there is nothing for the flags to change */
+    if (stream->driver &&
+        stream->driver->streamRecv) {
+        int ret;
+        ret = (stream->driver->streamRecv)(stream, data, nbytes);
+        if (ret == -2)
+            return -2;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamSendHole:
+ * @stream: pointer to the stream object
+ * @length: number of bytes the hole stands for
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Sends a hole of @length bytes, a run of zeros which the
+ * receiving end recreates without the zeros having to be sent.
+ * This is only possible on streams opened as sparse streams,
+ * for instance by passing VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM
+ * to virStorageVolUpload.
+ *
+ * Returns 0 on success, -1 upon error
+ */
+int virStreamSendHole(virStreamPtr stream,
+                      long long length,
+                      unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%lld, flags=%x",
+              stream, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (length < 0) {
+        virReportInvalidArg(length,
+                            _("length in %s must not be negative"),
+                            __FUNCTION__);
+        goto error;
+    }
+
+    if (stream->driver &&
+        stream->driver->streamSendHole) {
+        int ret;
+        ret = (stream->driver->streamSendHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamRecvHole:
+ * @stream: pointer to the stream object
+ * @length: filled with the number of bytes the hole stands for
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Fetches the hole that made virStreamRecvFlags return -3, and
+ * moves the stream past it. If there is no hole at the current
+ * position of the stream, @length is set to 0.
+ *
+ * Returns 0 on success, -1 upon error
+ */
+int virStreamRecvHole(virStreamPtr stream,
+                      long long *length,
+                      unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%p, flags=%x",
+              stream, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(length, error);
+
+    if (stream->driver &&
+        stream->driver->streamRecvHole) {
+        int ret;
+        ret = (stream->driver->streamRecvHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamInData:
+ * @stream: pointer to the stream object
+ * @inData: set to 1 if the stream is in data, 0 if in a hole
+ * @length: set to the number of bytes until the data or hole ends
+ *
+ * Tells whether the next bytes to be read from the stream are
+ * data or a hole, and how many there are. A @length of 0 means
+ * the end of the stream if *@inData is 0, and that it is not
+ * known how much data follows otherwise. The hole is skipped
+ * with virStreamSendHole.
+ *
+ * This is only meant for use by the daemon, and thus not part
+ * of the public API.
+ *
+ * Returns 0 on success, -1 upon error
+ */
+int virStreamInData(virStreamPtr stream,
+                    int *inData,
+                    long long *length)
+{
+    VIR_DEBUG("stream=%p, inData=%p, length=%p", stream, inData, length);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(inData, error);
+    virCheckNonNullArgGoto(length, error);
+
+    if (stream->driver &&
+        stream->driver->streamInData) {
+        int ret;
+        ret = (stream->driver->streamInData)(stream, inData, length);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
 /**
  * virStreamSendAll:
  * @stream: pointer to the stream object
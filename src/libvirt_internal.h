@@ -110,6 +110,20 @@ enum {
      * Support for offline migration.
      */
     VIR_DRV_FEATURE_MIGRATION_OFFLINE = 12,
+
+    /*
+     * Remote party accepts compressed messages. Asking for it tells
+     * the remote party that we accept them as well, so it starts
+     * compressing the messages it sends.
+     */
+    VIR_DRV_FEATURE_PROGRAM_COMPRESSION = 13,
+
+    /*
+     * Remote party splits replies too large for a single message
+     * into fragments. Asking for it tells the remote party that we
+     * put them back together, so it starts sending such replies.
+     */
+    VIR_DRV_FEATURE_PROGRAM_FRAGMENTS = 14,
 };
 
 
@@ -221,4 +235,8 @@ int virDomainMigrateConfirm3(virDomainPtr domain,
                              unsigned long flags,
                              int restart); /* Restart the src VM */
 
+int virStreamInData(virStreamPtr stream,
+                    int *inData,
+                    long long *length);
+
 #endif
@@ -123,6 +123,7 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
     driver->keepAliveInterval = 5;
     driver->keepAliveCount = 5;
     driver->seccompSandbox = -1;
+    driver->statsHistorySize = 60;
 
     /* Just check the file is readable before opening it, otherwise
      * libvirt emits an error.
@@ -374,6 +375,8 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
     GET_VALUE_LONG("keepalive_interval", driver->keepAliveInterval);
     GET_VALUE_LONG("keepalive_count", driver->keepAliveCount);
     GET_VALUE_LONG("seccomp_sandbox", driver->seccompSandbox);
+    GET_VALUE_LONG("stats_sample_interval", driver->statsSampleInterval);
+    GET_VALUE_LONG("stats_history_size", driver->statsHistorySize);
 
     ret = 0;
 
@@ -44,6 +44,7 @@
 # include "threadpool.h"
 # include "locking/lock_manager.h"
 # include "qemu_capabilities.h"
+# include "virstatshistory.h"
 
 # define QEMUD_CPUMASK_LEN CPU_SETSIZE
 
@@ -163,6 +164,17 @@ struct _virQEMUDriver {
     int keepAliveInterval;
     unsigned int keepAliveCount;
     int seccompSandbox;
+
+    /* Background sampling of the host and domain statistics, every
+     * statsSampleInterval seconds when it is not 0 */
+    int statsSampleInterval;
+    unsigned int statsHistorySize;
+    virStatsHistoryPtr nodeStatsHistory;
+    virThread statsThread;
+    bool statsThreadActive;
+    bool statsThreadQuit;
+    virMutex statsLock;
+    virCond statsCond;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
@@ -148,6 +148,7 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
 
     job->active = QEMU_JOB_NONE;
     job->owner = 0;
+    job->uncounted = false;
 }
 
 static void
@@ -238,6 +239,9 @@ static void qemuDomainObjPrivateFree(void *data)
     virDomainChrSourceDefFree(priv->monConfig);
     qemuDomainObjFreeJob(priv);
     VIR_FREE(priv->vcpupids);
+    virCgroupStatsReaderFree(priv->cgroupStats);
+    qemuVcpuStatsFree(priv->vcpuStats);
+    virStatsHistoryFree(priv->statsHistory);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
 
@@ -885,6 +889,57 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                          asyncJob);
 }
 
+/*
+ * obj must be locked before calling, driver must NOT be locked
+ *
+ * Like qemuDomainObjBeginJob, except that it fails at once if the job
+ * cannot be started right away, rather than waiting for the current
+ * one. Such a job does not count in jobs_queued, so that it never
+ * makes other callers hit the max_queued limit. Meant for gathering
+ * statistics, which can rather skip a busy domain.
+ *
+ * Upon successful return, the object will have its ref count increased,
+ * successful calls must be followed by EndJob eventually
+ */
+int qemuDomainObjBeginJobNowait(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                enum qemuDomainJob job)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    if (job <= QEMU_JOB_NONE || job >= QEMU_JOB_ASYNC) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Attempt to start invalid job"));
+        return -1;
+    }
+
+    if (!qemuDomainJobAllowed(priv, job)) {
+        VIR_DEBUG("Not starting job %s for domain %s;"
+                  " current job is (%s, %s)",
+                  qemuDomainJobTypeToString(job),
+                  obj->def->name,
+                  qemuDomainJobTypeToString(priv->job.active),
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+        virReportError(VIR_ERR_OPERATION_TIMEOUT,
+                       "%s", _("cannot acquire state change lock"));
+        return -1;
+    }
+
+    virObjectRef(obj);
+
+    VIR_DEBUG("Starting job: %s (async=%s)",
+              qemuDomainJobTypeToString(job),
+              qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+    priv->job.active = job;
+    priv->job.owner = virThreadSelfID();
+    priv->job.uncounted = true;
+
+    if (qemuDomainTrackJob(job))
+        qemuDomainObjSaveJob(driver, obj);
+
+    return 0;
+}
+
 /*
  * obj and driver must be locked before calling.
  *
@@ -930,7 +985,8 @@ bool qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
     qemuDomainObjPrivatePtr priv = obj->privateData;
     enum qemuDomainJob job = priv->job.active;
 
-    priv->jobs_queued--;
+    if (!priv->job.uncounted)
+        priv->jobs_queued--;
 
     VIR_DEBUG("Stopping job: %s (async=%s)",
               qemuDomainJobTypeToString(job),
@@ -31,6 +31,7 @@
 # include "qemu_agent.h"
 # include "qemu_conf.h"
 # include "qemu_capabilities.h"
+# include "qemu_vcpustats.h"
 # include "virchrdev.h"
 
 # define QEMU_EXPECTED_VIRT_TYPES      \
@@ -102,6 +103,7 @@ struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     enum qemuDomainJob active;          /* Currently running job */
     int owner;                          /* Thread which set current job */
+    bool uncounted;                     /* Job not counted in jobs_queued */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     enum qemuDomainAsyncJob asyncJob;   /* Currently active async job */
@@ -142,6 +144,13 @@ struct _qemuDomainObjPrivate {
     int nvcpupids;
     int *vcpupids;
 
+    /* Keeps the cgroup statistics files open, see qemuDomainGetCgroupStats */
+    virCgroupStatsReaderPtr cgroupStats;
+    /* Keeps the vCPU accounting files open, see qemu_vcpustats.c */
+    qemuVcpuStatsPtr vcpuStats;
+    /* Samples taken by the stats sampler thread, see qemu_driver.c */
+    virStatsHistoryPtr statsHistory;
+
     qemuDomainPCIAddressSetPtr pciaddrs;
     int persistentAddrs;
 
@@ -190,6 +199,10 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                virDomainObjPtr obj,
                                enum qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginJobNowait(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                enum qemuDomainJob job)
+    ATTRIBUTE_RETURN_CHECK;
 int qemuDomainObjBeginJobWithDriver(virQEMUDriverPtr driver,
                                     virDomainObjPtr obj,
                                     enum qemuDomainJob job)
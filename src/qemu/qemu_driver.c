@@ -138,6 +138,9 @@ static void processWatchdogEvent(void *data, void *opaque);
 
 static int qemuShutdown(void);
 
+static int qemuStatsSamplerStart(virQEMUDriverPtr driver);
+static void qemuStatsSamplerStop(virQEMUDriverPtr driver);
+
 static int qemuDomainObjStart(virConnectPtr conn,
                               virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
@@ -917,6 +920,10 @@ qemuStartup(bool privileged,
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (qemu_driver->statsSampleInterval > 0 &&
+        qemuStatsSamplerStart(qemu_driver) < 0)
+        goto error;
+
     qemuDriverUnlock(qemu_driver);
 
     qemuAutostartDomains(qemu_driver);
@@ -1059,6 +1066,9 @@ qemuShutdown(void) {
     if (!qemu_driver)
         return -1;
 
+    /* The sampler takes the driver lock */
+    qemuStatsSamplerStop(qemu_driver);
+
     qemuDriverLock(qemu_driver);
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     pciDeviceListFree(qemu_driver->activePciHostdevs);
@@ -1325,6 +1335,20 @@ cleanup:
 }
 
 
+/* The vCPU accounting of a running domain, created on first use.
+ * The domain must be locked. */
+static qemuVcpuStatsPtr
+qemuDomainGetVcpuStats(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (!priv->vcpuStats)
+        priv->vcpuStats = qemuVcpuStatsNew();
+
+    return priv->vcpuStats;
+}
+
+
 static int
 qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
                    pid_t pid, int tid)
@@ -4574,6 +4598,9 @@ qemuDomainGetVcpus(virDomainPtr dom,
     int i, v, maxcpu, hostcpus;
     int ret = -1;
     qemuDomainObjPrivatePtr priv;
+    qemuVcpuStatsPtr vcpuStats;
+    unsigned long long *cpuTime = NULL;
+    int *lastCpu = NULL;
 
     qemuDriverLock(driver);
     vm = virDomainFindByUUID(&driver->domains, dom->uuid);
@@ -4610,19 +4637,28 @@ qemuDomainGetVcpus(virDomainPtr dom,
     if (maxinfo >= 1) {
         if (info != NULL) {
             memset(info, 0, sizeof(*info) * maxinfo);
+
+            /* Read the times of all the vCPUs at once */
+            if (priv->vcpupids != NULL) {
+                if (VIR_ALLOC_N(cpuTime, priv->nvcpupids) < 0 ||
+                    VIR_ALLOC_N(lastCpu, priv->nvcpupids) < 0) {
+                    virReportOOMError();
+                    goto cleanup;
+                }
+                if (!(vcpuStats = qemuDomainGetVcpuStats(vm)) ||
+                    qemuVcpuStatsGetTimes(vcpuStats, vm->pid,
+                                          priv->vcpupids, priv->nvcpupids,
+                                          cpuTime, lastCpu) < 0)
+                    goto cleanup;
+            }
+
             for (i = 0 ; i < maxinfo ; i++) {
                 info[i].number = i;
                 info[i].state = VIR_VCPU_RUNNING;
 
-                if (priv->vcpupids != NULL &&
-                    qemuGetProcessInfo(&(info[i].cpuTime),
-                                       &(info[i].cpu),
-                                       NULL,
-                                       vm->pid,
-                                       priv->vcpupids[i]) < 0) {
-                    virReportSystemError(errno, "%s",
-                                         _("cannot get vCPU placement & pCPU time"));
-                    goto cleanup;
+                if (priv->vcpupids != NULL) {
+                    info[i].cpuTime = cpuTime[i];
+                    info[i].cpu = lastCpu[i];
                 }
             }
         }
@@ -4657,6 +4693,8 @@ qemuDomainGetVcpus(virDomainPtr dom,
     ret = maxinfo;
 
 cleanup:
+    VIR_FREE(cpuTime);
+    VIR_FREE(lastCpu);
     if (vm)
         virDomainObjUnlock(vm);
     return ret;
@@ -14398,66 +14436,6 @@ qemuDomainGetTotalcpuStats(virCgroupPtr group,
     return nparams;
 }
 
-/* This function gets the sums of cpu time consumed by all vcpus.
- * For example, if there are 4 physical cpus, and 2 vcpus in a domain,
- * then for each vcpu, the cpuacct.usage_percpu looks like this:
- *   t0 t1 t2 t3
- * and we have 2 groups of such data:
- *   v\p   0   1   2   3
- *   0   t00 t01 t02 t03
- *   1   t10 t11 t12 t13
- * for each pcpu, the sum is cpu time consumed by all vcpus.
- *   s0 = t00 + t10
- *   s1 = t01 + t11
- *   s2 = t02 + t12
- *   s3 = t03 + t13
- */
-static int
-getSumVcpuPercpuStats(virCgroupPtr group,
-                      unsigned int nvcpu,
-                      unsigned long long *sum_cpu_time,
-                      unsigned int num)
-{
-    int ret = -1;
-    int i;
-    char *buf = NULL;
-    virCgroupPtr group_vcpu = NULL;
-
-    for (i = 0; i < nvcpu; i++) {
-        char *pos;
-        unsigned long long tmp;
-        int j;
-
-        if (virCgroupForVcpu(group, i, &group_vcpu, 0) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("error accessing cgroup cpuacct for vcpu"));
-            goto cleanup;
-        }
-
-        if (virCgroupGetCpuacctPercpuUsage(group_vcpu, &buf) < 0)
-            goto cleanup;
-
-        pos = buf;
-        for (j = 0; j < num; j++) {
-            if (virStrToLong_ull(pos, &pos, 10, &tmp) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("cpuacct parse error"));
-                goto cleanup;
-            }
-            sum_cpu_time[j] += tmp;
-        }
-
-        virCgroupFree(&group_vcpu);
-        VIR_FREE(buf);
-    }
-
-    ret = 0;
-cleanup:
-    virCgroupFree(&group_vcpu);
-    VIR_FREE(buf);
-    return ret;
-}
-
 static int
 qemuDomainGetPercpuStats(virDomainObjPtr vm,
                          virCgroupPtr group,
@@ -14474,6 +14452,7 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
     unsigned long long *sum_cpu_pos;
     unsigned int n = 0;
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuVcpuStatsPtr vcpuStats;
     virTypedParameterPtr ent;
     int param_idx;
     unsigned long long cpu_time;
@@ -14540,7 +14519,11 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
         virReportOOMError();
         goto cleanup;
     }
-    if (getSumVcpuPercpuStats(group, priv->nvcpupids, sum_cpu_time, n) < 0)
+    /* The sums of the cpu time consumed by all vcpus on each pcpu,
+     * from the cpuacct cgroups of the vcpus */
+    if (!(vcpuStats = qemuDomainGetVcpuStats(vm)) ||
+        qemuVcpuStatsGetPercpuSum(vcpuStats, group, priv->nvcpupids,
+                                  sum_cpu_time, n) < 0)
         goto cleanup;
 
     sum_cpu_pos = sum_cpu_time;
@@ -14803,6 +14786,1100 @@ qemuListAllDomains(virConnectPtr conn,
     return ret;
 }
 
+
+/* Append an empty parameter to @record, which has room for
+ * @maxparams of them */
+static virTypedParameterPtr
+qemuDomainStatsNewParam(virDomainStatsRecordPtr record,
+                        size_t *maxparams)
+{
+    if (VIR_RESIZE_N(record->params, *maxparams, record->nparams, 1) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    return &record->params[record->nparams++];
+}
+
+static int
+qemuDomainStatsAddInt(virDomainStatsRecordPtr record,
+                      size_t *maxparams,
+                      const char *field,
+                      int value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = qemuDomainStatsNewParam(record, maxparams)))
+        return -1;
+
+    return virTypedParameterAssign(param, field, VIR_TYPED_PARAM_INT, value);
+}
+
+static int
+qemuDomainStatsAddUInt(virDomainStatsRecordPtr record,
+                       size_t *maxparams,
+                       const char *field,
+                       unsigned int value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = qemuDomainStatsNewParam(record, maxparams)))
+        return -1;
+
+    return virTypedParameterAssign(param, field, VIR_TYPED_PARAM_UINT, value);
+}
+
+static int
+qemuDomainStatsAddULLong(virDomainStatsRecordPtr record,
+                         size_t *maxparams,
+                         const char *field,
+                         unsigned long long value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = qemuDomainStatsNewParam(record, maxparams)))
+        return -1;
+
+    return virTypedParameterAssign(param, field, VIR_TYPED_PARAM_ULLONG, value);
+}
+
+/* The name of device @idx of @group, eg "block.0.name" */
+static int
+qemuDomainStatsAddName(virDomainStatsRecordPtr record,
+                       size_t *maxparams,
+                       const char *group,
+                       size_t idx,
+                       const char *name)
+{
+    virTypedParameterPtr param;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    char *value;
+
+    snprintf(field, sizeof(field), "%s.%zu.name", group, idx);
+
+    if (!(value = strdup(name))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (!(param = qemuDomainStatsNewParam(record, maxparams)) ||
+        virTypedParameterAssign(param, field,
+                                VIR_TYPED_PARAM_STRING, value) < 0) {
+        VIR_FREE(value);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* A counter of device @idx of @group, left out if negative, which
+ * is how the hypervisor tells it does not maintain it */
+static int
+qemuDomainStatsAddCounter(virDomainStatsRecordPtr record,
+                          size_t *maxparams,
+                          const char *group,
+                          size_t idx,
+                          const char *name,
+                          long long value)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    if (value < 0)
+        return 0;
+
+    snprintf(field, sizeof(field), "%s.%zu.%s", group, idx, name);
+
+    return qemuDomainStatsAddULLong(record, maxparams, field, value);
+}
+
+typedef int
+(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          virDomainStatsRecordPtr record,
+                          size_t *maxparams,
+                          bool haveJob);
+
+static int
+qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr vm,
+                        virDomainStatsRecordPtr record,
+                        size_t *maxparams,
+                        bool haveJob ATTRIBUTE_UNUSED)
+{
+    int state;
+    int reason;
+
+    state = virDomainObjGetState(vm, &reason);
+
+    if (qemuDomainStatsAddInt(record, maxparams, "state.state", state) < 0 ||
+        qemuDomainStatsAddInt(record, maxparams, "state.reason", reason) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Read the cgroup statistics of a running domain through the control
+ * files kept open in its private data, so that polling a domain does
+ * not open and close them every time. The domain must be locked. */
+static int
+qemuDomainGetCgroupStats(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         unsigned int flags,
+                         virCgroupStatsPtr stats)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr group = NULL;
+    int rc;
+
+    if (!priv->cgroupStats) {
+        if ((rc = virCgroupForDomain(driver->cgroup, vm->def->name,
+                                     &group, 0)) < 0)
+            return rc;
+        rc = virCgroupStatsReaderNew(group, &priv->cgroupStats);
+        virCgroupFree(&group);
+        if (rc < 0)
+            return rc;
+    }
+
+    return virCgroupStatsReaderRead(priv->cgroupStats, flags, stats);
+}
+
+static int
+qemuDomainGetStatsCpu(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
+                      virDomainStatsRecordPtr record,
+                      size_t *maxparams,
+                      bool haveJob ATTRIBUTE_UNUSED)
+{
+    virCgroupStats stats;
+    unsigned long long cpu_time;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+
+    if (!virDomainObjIsActive(vm))
+        return 0;
+
+    /* The cgroup also accounts for the threads qemu has finished
+     * with, fall back to the process if it is not available */
+    if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUACCT) &&
+        qemuDomainGetCgroupStats(driver, vm, VIR_CGROUP_STATS_CPUACCT,
+                                 &stats) == 0) {
+        if (qemuDomainStatsAddULLong(record, maxparams,
+                                     "cpu.time", stats.cpuUsage) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams,
+                                     "cpu.user", stats.cpuUser) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams,
+                                     "cpu.system", stats.cpuSystem) < 0)
+            goto cleanup;
+    } else if (qemuGetProcessInfo(&cpu_time, NULL, NULL, vm->pid, 0) == 0) {
+        if (qemuDomainStatsAddULLong(record, maxparams,
+                                     "cpu.time", cpu_time) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupStatsClear(&stats);
+    return ret;
+}
+
+/* Field names of the virDomainMemoryStatTags, after "balloon." */
+VIR_ENUM_DECL(qemuDomainMemoryStat)
+VIR_ENUM_IMPL(qemuDomainMemoryStat, VIR_DOMAIN_MEMORY_STAT_NR,
+              "swap_in",
+              "swap_out",
+              "major_fault",
+              "minor_fault",
+              "unused",
+              "available",
+              "actual",
+              "rss")
+
+static int
+qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          virDomainStatsRecordPtr record,
+                          size_t *maxparams,
+                          bool haveJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long cur_balloon = vm->def->mem.cur_balloon;
+    unsigned long long balloon;
+    virDomainMemoryStatStruct memstats[VIR_DOMAIN_MEMORY_STAT_NR];
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    virCgroupStats stats;
+    int nmemstats = 0;
+    int i;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+
+    /* Same as qemuDomainGetInfo, except that the monitor is only
+     * used if the job could be acquired */
+    if (!virDomainObjIsActive(vm)) {
+        /* Nothing to ask */
+    } else if (vm->def->memballoon &&
+               vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE) {
+        cur_balloon = vm->def->mem.max_balloon;
+    } else if (haveJob) {
+        /* With the balloon event, cur_balloon is already up to date */
+        bool askBalloon = !qemuCapsGet(priv->caps, QEMU_CAPS_BALLOON_EVENT);
+        int err = 0;
+
+        qemuDomainObjEnterMonitor(driver, vm);
+        if (askBalloon)
+            err = qemuMonitorGetBalloonInfo(priv->mon, &balloon);
+        nmemstats = qemuMonitorGetMemoryStats(priv->mon, memstats,
+                                              VIR_DOMAIN_MEMORY_STAT_NR);
+        qemuDomainObjExitMonitor(driver, vm);
+
+        if (err < 0 || nmemstats < 0)
+            virResetLastError();
+
+        if (askBalloon && err == 0)
+            cur_balloon = vm->def->mem.max_balloon;
+        else if (askBalloon && err > 0)
+            cur_balloon = balloon;
+    }
+
+    if (qemuDomainStatsAddULLong(record, maxparams, "balloon.current",
+                                 cur_balloon) < 0 ||
+        qemuDomainStatsAddULLong(record, maxparams, "balloon.maximum",
+                                 vm->def->mem.max_balloon) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < nmemstats ; i++) {
+        const char *tag = qemuDomainMemoryStatTypeToString(memstats[i].tag);
+
+        if (!tag)
+            continue;
+
+        snprintf(field, sizeof(field), "balloon.%s", tag);
+        if (qemuDomainStatsAddULLong(record, maxparams, field,
+                                     memstats[i].val) < 0)
+            goto cleanup;
+    }
+
+    /* What the host sees of the memory of the domain, which unlike
+     * the guest statistics needs neither the monitor nor the agent */
+    if (virDomainObjIsActive(vm) &&
+        qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_MEMORY) &&
+        qemuDomainGetCgroupStats(driver, vm, VIR_CGROUP_STATS_MEMORY,
+                                 &stats) == 0) {
+        if (qemuDomainStatsAddULLong(record, maxparams, "balloon.cgroup.usage",
+                                     stats.memUsage) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams, "balloon.cgroup.cache",
+                                     stats.memCache) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams, "balloon.cgroup.rss",
+                                     stats.memRss) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams,
+                                     "balloon.cgroup.mapped_file",
+                                     stats.memMappedFile) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams, "balloon.cgroup.swap",
+                                     stats.memSwap) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams,
+                                     "balloon.cgroup.pgfault",
+                                     stats.memPgfault) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams,
+                                     "balloon.cgroup.pgmajfault",
+                                     stats.memPgmajfault) < 0 ||
+            qemuDomainStatsAddULLong(record, maxparams,
+                                     "balloon.cgroup.unevictable",
+                                     stats.memUnevictable) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupStatsClear(&stats);
+    return ret;
+}
+
+static int
+qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                       virDomainObjPtr vm,
+                       virDomainStatsRecordPtr record,
+                       size_t *maxparams,
+                       bool haveJob ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    qemuVcpuStatsPtr vcpuStats;
+    unsigned long long *cpuTime = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (qemuDomainStatsAddUInt(record, maxparams, "vcpu.current",
+                               vm->def->vcpus) < 0 ||
+        qemuDomainStatsAddUInt(record, maxparams, "vcpu.maximum",
+                               vm->def->maxvcpus) < 0)
+        return -1;
+
+    if (!virDomainObjIsActive(vm) || !priv->vcpupids)
+        return 0;
+
+    if (VIR_ALLOC_N(cpuTime, priv->nvcpupids) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    /* The times are left out if they cannot be read */
+    if (!(vcpuStats = qemuDomainGetVcpuStats(vm)) ||
+        qemuVcpuStatsGetTimes(vcpuStats, vm->pid,
+                              priv->vcpupids, priv->nvcpupids,
+                              cpuTime, NULL) < 0) {
+        virResetLastError();
+        VIR_FREE(cpuTime);
+    }
+
+    for (i = 0 ; i < priv->nvcpupids ; i++) {
+        snprintf(field, sizeof(field), "vcpu.%zu.state", i);
+        if (qemuDomainStatsAddInt(record, maxparams, field,
+                                  VIR_VCPU_RUNNING) < 0)
+            goto cleanup;
+
+        if (cpuTime &&
+            qemuDomainStatsAddCounter(record, maxparams, "vcpu", i,
+                                      "time", cpuTime[i]) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(cpuTime);
+    return ret;
+}
+
+static int
+qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr vm,
+                            virDomainStatsRecordPtr record,
+                            size_t *maxparams,
+                            bool haveJob ATTRIBUTE_UNUSED)
+{
+    size_t i;
+
+    if (!virDomainObjIsActive(vm))
+        return 0;
+
+    if (qemuDomainStatsAddUInt(record, maxparams, "net.count",
+                               vm->def->nnets) < 0)
+        return -1;
+
+    for (i = 0 ; i < vm->def->nnets ; i++) {
+        virDomainNetDefPtr net = vm->def->nets[i];
+#ifdef __linux__
+        struct _virDomainInterfaceStats stats;
+#endif
+
+        if (!net->ifname)
+            continue;
+
+        if (qemuDomainStatsAddName(record, maxparams, "net", i,
+                                   net->ifname) < 0)
+            return -1;
+
+#ifdef __linux__
+        if (linuxDomainInterfaceStats(net->ifname, &stats) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        if (qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "rx.bytes", stats.rx_bytes) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "rx.pkts", stats.rx_packets) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "rx.errs", stats.rx_errs) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "rx.drop", stats.rx_drop) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "tx.bytes", stats.tx_bytes) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "tx.pkts", stats.tx_packets) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "tx.errs", stats.tx_errs) < 0 ||
+            qemuDomainStatsAddCounter(record, maxparams, "net", i,
+                                      "tx.drop", stats.tx_drop) < 0)
+            return -1;
+#endif
+    }
+
+    return 0;
+}
+
+/* The counters of the host block device backing @disk, if any */
+static virCgroupBlkioStatsPtr
+qemuDomainDiskBlkioStats(virDomainDiskDefPtr disk,
+                         virCgroupStatsPtr stats)
+{
+    struct stat sb;
+    size_t i;
+
+    if (!stats->nblkio ||
+        disk->type != VIR_DOMAIN_DISK_TYPE_BLOCK || !disk->src ||
+        stat(disk->src, &sb) < 0 || !S_ISBLK(sb.st_mode))
+        return NULL;
+
+    for (i = 0 ; i < stats->nblkio ; i++) {
+        if (stats->blkio[i].major == major(sb.st_rdev) &&
+            stats->blkio[i].minor == minor(sb.st_rdev))
+            return &stats->blkio[i];
+    }
+
+    return NULL;
+}
+
+static int
+qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm,
+                        virDomainStatsRecordPtr record,
+                        size_t *maxparams,
+                        bool haveJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr blockstats = NULL;
+    virCgroupStats stats;
+    size_t i;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+
+    if (!virDomainObjIsActive(vm))
+        return 0;
+
+    if (qemuDomainStatsAddUInt(record, maxparams, "block.count",
+                               vm->def->ndisks) < 0)
+        return -1;
+
+    /* A single query covers all the disks, which the job keeps
+     * from changing meanwhile */
+    if (haveJob) {
+        qemuDomainObjEnterMonitor(driver, vm);
+        blockstats = qemuMonitorGetAllBlockStatsInfo(priv->mon);
+        qemuDomainObjExitMonitor(driver, vm);
+
+        if (!blockstats)
+            virResetLastError();
+    }
+
+    /* Without the monitor, the bytes transferred to and from the disks
+     * backed by host block devices are still known to their cgroup */
+    if (!blockstats &&
+        qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_BLKIO))
+        ignore_value(qemuDomainGetCgroupStats(driver, vm,
+                                              VIR_CGROUP_STATS_BLKIO,
+                                              &stats));
+
+    for (i = 0 ; i < vm->def->ndisks ; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+        qemuBlockStatsPtr bstats;
+        virCgroupBlkioStatsPtr blkio;
+
+        if (qemuDomainStatsAddName(record, maxparams, "block", i,
+                                   disk->dst) < 0)
+            goto cleanup;
+
+        if (blockstats && disk->info.alias &&
+            (bstats = virHashLookup(blockstats, disk->info.alias))) {
+            if (qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "rd.reqs", bstats->rd_req) < 0 ||
+                qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "rd.bytes", bstats->rd_bytes) < 0 ||
+                qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "wr.reqs", bstats->wr_req) < 0 ||
+                qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "wr.bytes", bstats->wr_bytes) < 0 ||
+                qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "errors", bstats->errs) < 0)
+                goto cleanup;
+        } else if ((blkio = qemuDomainDiskBlkioStats(disk, &stats))) {
+            if (qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "rd.bytes", blkio->read) < 0 ||
+                qemuDomainStatsAddCounter(record, maxparams, "block", i,
+                                          "wr.bytes", blkio->write) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupStatsClear(&stats);
+    virHashFree(blockstats);
+    return ret;
+}
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+};
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK },
+    { NULL, 0 }
+};
+
+/* Whether any of @stats needs to talk to the monitor of @vm */
+static bool
+qemuDomainGetStatsNeedMonitor(virDomainObjPtr vm,
+                              unsigned int stats)
+{
+    if (!virDomainObjIsActive(vm))
+        return false;
+
+    if ((stats & VIR_DOMAIN_STATS_BLOCK) && vm->def->ndisks)
+        return true;
+
+    if ((stats & VIR_DOMAIN_STATS_BALLOON) &&
+        !(vm->def->memballoon &&
+          vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE))
+        return true;
+
+    return false;
+}
+
+static void
+qemuDomainStatsRecordFree(virDomainStatsRecordPtr record)
+{
+    if (!record)
+        return;
+
+    virTypedParameterArrayClear(record->params, record->nparams);
+    VIR_FREE(record->params);
+    if (record->dom)
+        virDomainFree(record->dom);
+    VIR_FREE(record);
+}
+
+/*
+ * Collect @stats of @vm, which must be locked and is unlocked on
+ * return. A single query job covers all the stats which need the
+ * monitor. It is only taken if no other job is active, so that one
+ * busy domain does not hold up the stats of all the others; those
+ * stats are then left out rather than failing the whole call, or
+ * with @skipBusy no record is collected at all and *@record is set
+ * to NULL. The domain of the record is only set if @conn is not NULL.
+ */
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virQEMUDriverPtr driver,
+                   virDomainObjPtr vm,
+                   unsigned int stats,
+                   bool skipBusy,
+                   virDomainStatsRecordPtr *record)
+{
+    virDomainStatsRecordPtr tmp = NULL;
+    size_t maxparams = 0;
+    bool haveJob = false;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (conn) {
+        if (!(tmp->dom = virGetDomain(conn, vm->def->name, vm->def->uuid)))
+            goto cleanup;
+        tmp->dom->id = vm->def->id;
+    }
+
+    if (qemuDomainGetStatsNeedMonitor(vm, stats)) {
+        if (qemuDomainObjBeginJobNowait(driver, vm, QEMU_JOB_QUERY) < 0) {
+            virResetLastError();
+            if (skipBusy) {
+                *record = NULL;
+                ret = 0;
+                goto cleanup;
+            }
+        } else {
+            haveJob = true;
+        }
+    }
+
+    for (i = 0 ; qemuDomainGetStatsWorkers[i].func ; i++) {
+        if (!(stats & qemuDomainGetStatsWorkers[i].stats))
+            continue;
+
+        if (qemuDomainGetStatsWorkers[i].func(driver, vm, tmp,
+                                              &maxparams, haveJob) < 0)
+            goto endjob;
+    }
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+endjob:
+    if (haveJob && qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    qemuDomainStatsRecordFree(tmp);
+    return ret;
+}
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainPtr *domlist = NULL;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    virDomainObjPtr vm;
+    int ndomlist = 0;
+    size_t nstats = 0;
+    size_t i;
+    int ret = -1;
+
+    if (doms)
+        virCheckFlags(0, -1);
+    else
+        virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
+
+    if (!stats) {
+        for (i = 0 ; qemuDomainGetStatsWorkers[i].func ; i++)
+            stats |= qemuDomainGetStatsWorkers[i].stats;
+    }
+
+    if (!doms) {
+        qemuDriverLock(driver);
+        ndomlist = virDomainList(conn, driver->domains.objs,
+                                 &domlist, flags);
+        qemuDriverUnlock(driver);
+        if (ndomlist < 0)
+            goto cleanup;
+
+        doms = domlist;
+        ndoms = ndomlist;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, ndoms + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ndoms ; i++) {
+        qemuDriverLock(driver);
+        vm = virDomainFindByUUID(&driver->domains, doms[i]->uuid);
+        qemuDriverUnlock(driver);
+
+        /* Undefined in the meantime */
+        if (!vm)
+            continue;
+
+        if (qemuDomainGetStats(conn, driver, vm, stats, false,
+                               &tmpstats[nstats]) < 0)
+            goto cleanup;
+        nstats++;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    if (domlist) {
+        for (i = 0 ; i < ndomlist ; i++)
+            virDomainFree(domlist[i]);
+        VIR_FREE(domlist);
+    }
+    return ret;
+}
+
+/*
+ * When stats_sample_interval is set in qemu.conf, a thread samples
+ * the host and all the running domains every so many seconds into
+ * rings of the last stats_history_size samples, so that clients
+ * can get the history of the statistics, or their rates, without
+ * polling themselves.
+ */
+
+/* The host statistics, as "cpu.<field>" and "mem.<field>" */
+static int
+qemuStatsSampleNode(virQEMUDriverPtr driver)
+{
+    virNodeCPUStatsPtr cpu = NULL;
+    virNodeMemoryStatsPtr mem = NULL;
+    virTypedParameterPtr params = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned long long now;
+    unsigned long long monotonic;
+    int ncpu = 0;
+    int nmem = 0;
+    int nparams = 0;
+    int i;
+    int ret = -1;
+
+    if (nodeGetCPUStats(NULL, VIR_NODE_CPU_STATS_ALL_CPUS,
+                        NULL, &ncpu, 0) < 0 ||
+        nodeGetMemoryStats(NULL, VIR_NODE_MEMORY_STATS_ALL_CELLS,
+                           NULL, &nmem, 0) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(cpu, ncpu) < 0 ||
+        VIR_ALLOC_N(mem, nmem) < 0 ||
+        VIR_ALLOC_N(params, ncpu + nmem) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virTimeMillisNow(&now) < 0 ||
+        virTimeMonotonicMillisNow(&monotonic) < 0 ||
+        nodeGetCPUStats(NULL, VIR_NODE_CPU_STATS_ALL_CPUS,
+                        cpu, &ncpu, 0) < 0 ||
+        nodeGetMemoryStats(NULL, VIR_NODE_MEMORY_STATS_ALL_CELLS,
+                           mem, &nmem, 0) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ncpu ; i++) {
+        snprintf(field, sizeof(field), "cpu.%s", cpu[i].field);
+        if (virTypedParameterAssign(&params[nparams], field,
+                                    VIR_TYPED_PARAM_ULLONG,
+                                    cpu[i].value) < 0)
+            goto cleanup;
+        nparams++;
+    }
+
+    for (i = 0 ; i < nmem ; i++) {
+        snprintf(field, sizeof(field), "mem.%s", mem[i].field);
+        if (virTypedParameterAssign(&params[nparams], field,
+                                    VIR_TYPED_PARAM_ULLONG,
+                                    mem[i].value) < 0)
+            goto cleanup;
+        nparams++;
+    }
+
+    virStatsHistoryAdd(driver->nodeStatsHistory, now, monotonic,
+                       params, nparams);
+    params = NULL;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(cpu);
+    VIR_FREE(mem);
+    VIR_FREE(params);
+    return ret;
+}
+
+static void
+qemuStatsSampleReportError(const char *what)
+{
+    virErrorPtr err = virGetLastError();
+
+    VIR_WARN("Unable to sample the statistics of %s: %s",
+             what, err ? err->message : _("unknown error"));
+    virResetLastError();
+}
+
+/* Sample all the stats of @vm, which must be referenced by the
+ * caller but not locked. A domain busy with another job is skipped
+ * until the next round, rather than waited for or sampled without
+ * the stats of its monitor */
+static void
+qemuStatsSampleDomain(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv;
+    virDomainStatsRecordPtr record = NULL;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    unsigned int stats = 0;
+    unsigned long long now;
+    unsigned long long monotonic;
+    size_t i;
+    int id;
+
+    for (i = 0 ; qemuDomainGetStatsWorkers[i].func ; i++)
+        stats |= qemuDomainGetStatsWorkers[i].stats;
+
+    virDomainObjLock(vm);
+
+    if (!virDomainObjIsActive(vm)) {
+        virDomainObjUnlock(vm);
+        return;
+    }
+    id = vm->def->id;
+    virUUIDFormat(vm->def->uuid, uuidstr);
+
+    if (virTimeMillisNow(&now) < 0 ||
+        virTimeMonotonicMillisNow(&monotonic) < 0) {
+        virDomainObjUnlock(vm);
+        goto error;
+    }
+
+    /* Unlocks the domain */
+    if (qemuDomainGetStats(NULL, driver, vm, stats, true, &record) < 0)
+        goto error;
+
+    if (!record) {
+        VIR_DEBUG("Skipping busy domain %s", uuidstr);
+        return;
+    }
+
+    virDomainObjLock(vm);
+    priv = vm->privateData;
+
+    /* Unless it was stopped, or even started again, in the meantime */
+    if (vm->def->id == id) {
+        if (!priv->statsHistory &&
+            !(priv->statsHistory =
+              virStatsHistoryNew(driver->statsHistorySize))) {
+            virDomainObjUnlock(vm);
+            goto error;
+        }
+
+        virStatsHistoryAdd(priv->statsHistory, now, monotonic,
+                           record->params, record->nparams);
+        record->params = NULL;
+        record->nparams = 0;
+    }
+
+    virDomainObjUnlock(vm);
+    qemuDomainStatsRecordFree(record);
+    return;
+
+error:
+    qemuStatsSampleReportError(uuidstr);
+    qemuDomainStatsRecordFree(record);
+}
+
+struct qemuStatsSampleData {
+    virDomainObjPtr *vms;
+    size_t nvms;
+    bool oom;
+};
+
+static void
+qemuStatsCollectDomain(void *payload,
+                       const void *name ATTRIBUTE_UNUSED,
+                       void *opaque)
+{
+    virDomainObjPtr vm = payload;
+    struct qemuStatsSampleData *data = opaque;
+
+    virDomainObjLock(vm);
+    if (virDomainObjIsActive(vm) && !data->oom) {
+        if (VIR_EXPAND_N(data->vms, data->nvms, 1) < 0)
+            data->oom = true;
+        else
+            data->vms[data->nvms - 1] = virObjectRef(vm);
+    }
+    virDomainObjUnlock(vm);
+}
+
+static void
+qemuStatsSamplerThread(void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    struct qemuStatsSampleData data;
+    unsigned long long next;
+    size_t i;
+
+    virMutexLock(&driver->statsLock);
+    while (!driver->statsThreadQuit) {
+        virMutexUnlock(&driver->statsLock);
+
+        if (virTimeMillisNow(&next) < 0)
+            next = 0;
+        next += driver->statsSampleInterval * 1000ull;
+
+        if (qemuStatsSampleNode(driver) < 0)
+            qemuStatsSampleReportError("the host");
+
+        memset(&data, 0, sizeof(data));
+        qemuDriverLock(driver);
+        virHashForEach(driver->domains.objs, qemuStatsCollectDomain, &data);
+        qemuDriverUnlock(driver);
+        if (data.oom)
+            VIR_WARN("Unable to sample the statistics of all the domains");
+
+        for (i = 0 ; i < data.nvms ; i++) {
+            qemuStatsSampleDomain(driver, data.vms[i]);
+            virObjectUnref(data.vms[i]);
+        }
+        VIR_FREE(data.vms);
+
+        virMutexLock(&driver->statsLock);
+        while (!driver->statsThreadQuit) {
+            if (virCondWaitUntil(&driver->statsCond,
+                                 &driver->statsLock, next) < 0)
+                break;
+        }
+    }
+    virMutexUnlock(&driver->statsLock);
+}
+
+static int
+qemuStatsSamplerStart(virQEMUDriverPtr driver)
+{
+    if (!(driver->nodeStatsHistory =
+          virStatsHistoryNew(driver->statsHistorySize)))
+        return -1;
+
+    if (virMutexInit(&driver->statsLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&driver->statsCond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virMutexDestroy(&driver->statsLock);
+        goto error;
+    }
+
+    driver->statsThreadQuit = false;
+    if (virThreadCreate(&driver->statsThread, true,
+                        qemuStatsSamplerThread, driver) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create statistics sampler thread"));
+        ignore_value(virCondDestroy(&driver->statsCond));
+        virMutexDestroy(&driver->statsLock);
+        goto error;
+    }
+    driver->statsThreadActive = true;
+
+    return 0;
+
+error:
+    virStatsHistoryFree(driver->nodeStatsHistory);
+    driver->nodeStatsHistory = NULL;
+    return -1;
+}
+
+static void
+qemuStatsSamplerStop(virQEMUDriverPtr driver)
+{
+    if (!driver->statsThreadActive)
+        return;
+
+    virMutexLock(&driver->statsLock);
+    driver->statsThreadQuit = true;
+    virCondSignal(&driver->statsCond);
+    virMutexUnlock(&driver->statsLock);
+
+    virThreadJoin(&driver->statsThread);
+    driver->statsThreadActive = false;
+
+    ignore_value(virCondDestroy(&driver->statsCond));
+    virMutexDestroy(&driver->statsLock);
+    virStatsHistoryFree(driver->nodeStatsHistory);
+    driver->nodeStatsHistory = NULL;
+}
+
+static int
+qemuConnectGetStatsHistory(virConnectPtr conn,
+                           virDomainPtr dom,
+                           unsigned int nsamples,
+                           virDomainStatsRecordPtr **retSamples,
+                           unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainObjPtr vm = NULL;
+    qemuDomainObjPrivatePtr priv;
+    virStatsHistoryPtr history;
+    virStatsHistorySamplePtr samples = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsRecordPtr record;
+    bool rates = (flags & VIR_STATS_HISTORY_RATES) != 0;
+    size_t nret = 0;
+    size_t i;
+    int ret = -1;
+
+    virCheckFlags(VIR_STATS_HISTORY_RATES, -1);
+
+    if (!driver->statsThreadActive) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("statistics sampling is disabled, "
+                         "see stats_sample_interval in qemu.conf"));
+        return -1;
+    }
+
+    history = driver->nodeStatsHistory;
+
+    if (dom) {
+        qemuDriverLock(driver);
+        vm = virDomainFindByUUID(&driver->domains, dom->uuid);
+        qemuDriverUnlock(driver);
+
+        if (!vm) {
+            char uuidstr[VIR_UUID_STRING_BUFLEN];
+            virUUIDFormat(dom->uuid, uuidstr);
+            virReportError(VIR_ERR_NO_DOMAIN,
+                           _("no domain with matching uuid '%s'"), uuidstr);
+            goto cleanup;
+        }
+
+        priv = vm->privateData;
+        history = priv->statsHistory;
+    }
+
+    /* A domain which was not sampled yet has no history */
+    if (history &&
+        virStatsHistoryGet(history, nsamples, rates, &samples, &nret) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(records, nret + 1) < 0)
+        goto no_memory;
+
+    for (i = 0 ; i < nret ; i++) {
+        if (VIR_ALLOC(record) < 0)
+            goto no_memory;
+        records[i] = record;
+
+        if (VIR_ALLOC_N(record->params, samples[i].nparams + 1) < 0)
+            goto no_memory;
+
+        if (virTypedParameterAssign(&record->params[0], "timestamp",
+                                    VIR_TYPED_PARAM_ULLONG,
+                                    samples[i].timestamp) < 0)
+            goto cleanup;
+
+        /* The strings move over to the record */
+        memcpy(record->params + 1, samples[i].params,
+               sizeof(*record->params) * samples[i].nparams);
+        record->nparams = samples[i].nparams + 1;
+        samples[i].nparams = 0;
+
+        if (dom)
+            record->dom = virObjectRef(dom);
+    }
+
+    *retSamples = records;
+    records = NULL;
+    ret = nret;
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    virStatsHistorySampleListFree(samples, nret);
+    virDomainStatsRecordListFree(records);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
 static char *
 qemuDomainAgentCommand(virDomainPtr domain,
                        const char *cmd,
@@ -15121,6 +16198,8 @@ static virDriver qemuDriver = {
     .nodeGetCPUMap = nodeGetCPUMap, /* 1.0.0 */
     .domainFSTrim = qemuDomainFSTrim, /* 1.0.1 */
     .domainOpenChannel = qemuDomainOpenChannel, /* 1.0.1 */
+    .connectGetAllDomainStats = qemuConnectGetAllDomainStats, /* 1.0.1 */
+    .connectGetStatsHistory = qemuConnectGetStatsHistory, /* 1.0.1 */
 };
 
 
@@ -1485,6 +1485,41 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
     return ret;
 }
 
+/*
+ * Get the statistics of all block devices with a single command,
+ * rather than one per device. Returns a table of qemuBlockStats
+ * keyed by device name, or NULL on error.
+ */
+virHashTablePtr
+qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon)
+{
+    int ret;
+    virHashTablePtr table;
+
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return NULL;
+    }
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return NULL;
+
+    if (mon->json)
+        ret = qemuMonitorJSONGetAllBlockStatsInfo(mon, table);
+    else
+        ret = qemuMonitorTextGetAllBlockStatsInfo(mon, table);
+
+    if (ret < 0) {
+        virHashFree(table);
+        return NULL;
+    }
+
+    return table;
+}
+
 /* Return 0 and update @nparams with the number of block stats
  * QEMU supports if success. Return -1 if failure.
  */
@@ -278,6 +278,20 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                          int *nparams);
 
+/* Statistics of a block device, each of them -1 if qemu does not
+ * maintain it */
+typedef struct _qemuBlockStats qemuBlockStats;
+typedef qemuBlockStats *qemuBlockStatsPtr;
+struct _qemuBlockStats {
+    long long rd_req;
+    long long rd_bytes;
+    long long wr_req;
+    long long wr_bytes;
+    long long errs;
+};
+
+virHashTablePtr qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon);
+
 int qemuMonitorGetBlockExtent(qemuMonitorPtr mon,
                               const char *dev_name,
                               unsigned long long *extent);
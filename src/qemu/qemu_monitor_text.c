@@ -993,6 +993,103 @@ int qemuMonitorTextGetBlockStatsInfo(qemuMonitorPtr mon,
     return ret;
 }
 
+int qemuMonitorTextGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
+{
+    char *info = NULL;
+    int ret = -1;
+    char *dummy;
+    char *p, *eol, *sep;
+
+    if (qemuMonitorHMPCommand(mon, "info blockstats", &info) < 0)
+        goto cleanup;
+
+    /* If the command isn't supported then qemu prints the supported
+     * info commands, so the output starts "info ".  Since this is
+     * unlikely to be the name of a block device, we can use this
+     * to detect if qemu supports the command.
+     */
+    if (strstr(info, "\ninfo ")) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s",
+                       _("'info blockstats' not supported by this qemu"));
+        goto cleanup;
+    }
+
+    /* The output format for both qemu & KVM is:
+     *   blockdevice: rd_bytes=% wr_bytes=% rd_operations=% wr_operations=%
+     *   (repeated for each block device)
+     * where '%' is a 64 bit number.
+     */
+    p = info;
+
+    while (*p) {
+        qemuBlockStatsPtr bstats;
+
+        if (!(eol = strchr(p, '\n')))
+            eol = p + strlen(p);
+        else
+            *eol++ = '\0';
+
+        /* Keyed by the guest side name, as qemuMonitorTextGetBlockStatsInfo
+         * looks devices up */
+        if (STRPREFIX(p, QEMU_DRIVE_HOST_PREFIX))
+            p += strlen(QEMU_DRIVE_HOST_PREFIX);
+
+        if (!(sep = strstr(p, ": "))) {
+            p = eol;
+            continue;
+        }
+        *sep = '\0';
+
+        if (VIR_ALLOC(bstats) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        bstats->rd_req = bstats->rd_bytes = -1;
+        bstats->wr_req = bstats->wr_bytes = bstats->errs = -1;
+
+        if (virHashAddEntry(table, p, bstats) < 0) {
+            VIR_FREE(bstats);
+            goto cleanup;
+        }
+
+        p = sep + 2;               /* Skip to first label. */
+
+        while (p && *p) {
+            if (STRPREFIX(p, "rd_bytes=")) {
+                p += strlen("rd_bytes=");
+                if (virStrToLong_ll(p, &dummy, 10, &bstats->rd_bytes) == -1)
+                    VIR_DEBUG("error reading rd_bytes: %s", p);
+            } else if (STRPREFIX(p, "wr_bytes=")) {
+                p += strlen("wr_bytes=");
+                if (virStrToLong_ll(p, &dummy, 10, &bstats->wr_bytes) == -1)
+                    VIR_DEBUG("error reading wr_bytes: %s", p);
+            } else if (STRPREFIX(p, "rd_operations=")) {
+                p += strlen("rd_operations=");
+                if (virStrToLong_ll(p, &dummy, 10, &bstats->rd_req) == -1)
+                    VIR_DEBUG("error reading rd_req: %s", p);
+            } else if (STRPREFIX(p, "wr_operations=")) {
+                p += strlen("wr_operations=");
+                if (virStrToLong_ll(p, &dummy, 10, &bstats->wr_req) == -1)
+                    VIR_DEBUG("error reading wr_req: %s", p);
+            }
+
+            /* Skip to next label. */
+            if ((p = strchr(p, ' ')))
+                p++;
+        }
+
+        p = eol;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(info);
+    return ret;
+}
+
 int qemuMonitorTextGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                              int *nparams)
 {
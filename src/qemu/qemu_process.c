@@ -4145,6 +4145,15 @@ void qemuProcessStop(virQEMUDriverPtr driver,
         networkReleaseActualDevice(net);
     }
 
+    /* Close the control files of the cgroups before removing them */
+    virCgroupStatsReaderFree(priv->cgroupStats);
+    priv->cgroupStats = NULL;
+    qemuVcpuStatsFree(priv->vcpuStats);
+    priv->vcpuStats = NULL;
+    /* The counters of the next run start again from zero */
+    virStatsHistoryFree(priv->statsHistory);
+    priv->statsHistory = NULL;
+
 retry:
     if ((ret = qemuRemoveCgroup(driver, vm, 0)) < 0) {
         if (ret == -EBUSY && (retries++ < 5)) {
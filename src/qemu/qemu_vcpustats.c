@@ -0,0 +1,507 @@
+/*
+ * qemu_vcpustats.c: QEMU vCPU time accounting
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "qemu_vcpustats.h"
+#include "logging.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "util.h"
+#include "threads.h"
+#include "viratomic.h"
+#include "virfile.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+/*
+ * The times of all the vCPUs of a domain are read at once, from the
+ * /proc stat files of the vCPU threads and the cpuacct cgroups of
+ * the vCPUs, which are kept open between calls so that a domain
+ * with many vCPUs does not cost an open and close of each of them
+ * every time it is polled.
+ *
+ * The vCPU threads change when vCPUs are hot plugged, so the thread
+ * a file was opened for is checked against the current one on each
+ * read. An object must only be used with the domain locked.
+ *
+ * The files kept open by all the domains are capped to a quarter of
+ * the descriptors the process may have. Past that, or once opening a
+ * file failed with EMFILE, the files of a domain are opened for each
+ * read and closed again.
+ */
+
+typedef struct _qemuVcpuStatsThread qemuVcpuStatsThread;
+struct _qemuVcpuStatsThread {
+    int tid;
+    int fd;
+};
+
+struct _qemuVcpuStats {
+    pid_t pid;
+    bool noKeep; /* ran out of descriptors, keep no file open */
+
+    qemuVcpuStatsThread *threads;
+    size_t nthreads;
+
+    virCgroupStatsReaderPtr *readers;
+    size_t nreaders;
+};
+
+
+/* Number of files kept open by all the objects, and its cap */
+static int qemuVcpuStatsOpen = 0;
+static int qemuVcpuStatsMaxOpen = 0;
+
+static int
+qemuVcpuStatsOnceInit(void)
+{
+    struct rlimit rlim;
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        qemuVcpuStatsMaxOpen = 256;
+    else if (rlim.rlim_cur == RLIM_INFINITY || rlim.rlim_cur / 4 > INT_MAX)
+        qemuVcpuStatsMaxOpen = INT_MAX;
+    else
+        qemuVcpuStatsMaxOpen = rlim.rlim_cur / 4;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuVcpuStats)
+
+
+/* Whether one more file may be kept open, counting it if so */
+static bool
+qemuVcpuStatsKeepFile(qemuVcpuStatsPtr stats)
+{
+    if (stats->noKeep)
+        return false;
+
+    if (virAtomicIntInc(&qemuVcpuStatsOpen) > qemuVcpuStatsMaxOpen) {
+        ignore_value(virAtomicIntDecAndTest(&qemuVcpuStatsOpen));
+        return false;
+    }
+
+    return true;
+}
+
+
+static void
+qemuVcpuStatsCloseFile(int *fd)
+{
+    if (*fd < 0)
+        return;
+
+    VIR_FORCE_CLOSE(*fd);
+    ignore_value(virAtomicIntDecAndTest(&qemuVcpuStatsOpen));
+}
+
+
+static void
+qemuVcpuStatsFreeReader(virCgroupStatsReaderPtr *reader)
+{
+    if (!*reader)
+        return;
+
+    virCgroupStatsReaderFree(*reader);
+    *reader = NULL;
+    ignore_value(virAtomicIntDecAndTest(&qemuVcpuStatsOpen));
+}
+
+
+qemuVcpuStatsPtr
+qemuVcpuStatsNew(void)
+{
+    qemuVcpuStatsPtr stats;
+
+    if (qemuVcpuStatsInitialize() < 0)
+        return NULL;
+
+    if (VIR_ALLOC(stats) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    return stats;
+}
+
+
+static void
+qemuVcpuStatsCloseThreads(qemuVcpuStatsPtr stats)
+{
+    size_t i;
+
+    for (i = 0 ; i < stats->nthreads ; i++)
+        qemuVcpuStatsCloseFile(&stats->threads[i].fd);
+    VIR_FREE(stats->threads);
+    stats->nthreads = 0;
+}
+
+
+/* Free the readers past the first @nreaders, of vCPUs which were
+ * unplugged */
+static void
+qemuVcpuStatsTrimReaders(qemuVcpuStatsPtr stats,
+                         size_t nreaders)
+{
+    size_t i;
+
+    if (nreaders >= stats->nreaders)
+        return;
+
+    for (i = nreaders ; i < stats->nreaders ; i++)
+        qemuVcpuStatsFreeReader(&stats->readers[i]);
+
+    if (nreaders == 0)
+        VIR_FREE(stats->readers);
+    else
+        ignore_value(VIR_REALLOC_N(stats->readers, nreaders));
+    stats->nreaders = nreaders;
+}
+
+
+/* Stop keeping files open once the process ran out of descriptors */
+static void
+qemuVcpuStatsStopKeeping(qemuVcpuStatsPtr stats)
+{
+    size_t i;
+
+    VIR_WARN("Out of file descriptors, no longer keeping the vCPU "
+             "statistics files of process %d open", (int) stats->pid);
+
+    stats->noKeep = true;
+    for (i = 0 ; i < stats->nthreads ; i++)
+        qemuVcpuStatsCloseFile(&stats->threads[i].fd);
+    for (i = 0 ; i < stats->nreaders ; i++)
+        qemuVcpuStatsFreeReader(&stats->readers[i]);
+}
+
+
+void
+qemuVcpuStatsFree(qemuVcpuStatsPtr stats)
+{
+    if (!stats)
+        return;
+
+    qemuVcpuStatsCloseThreads(stats);
+    qemuVcpuStatsTrimReaders(stats, 0);
+    VIR_FREE(stats);
+}
+
+
+/* Make the array of threads match the vCPU threads of the domain,
+ * keeping the files of the threads which are still the same */
+static int
+qemuVcpuStatsSyncThreads(qemuVcpuStatsPtr stats,
+                         pid_t pid,
+                         const int *vcpupids,
+                         size_t nvcpupids)
+{
+    size_t i;
+
+    if (stats->pid != pid)
+        qemuVcpuStatsCloseThreads(stats);
+    stats->pid = pid;
+
+    for (i = nvcpupids ; i < stats->nthreads ; i++)
+        qemuVcpuStatsCloseFile(&stats->threads[i].fd);
+
+    if (nvcpupids != stats->nthreads) {
+        if (VIR_REALLOC_N(stats->threads, nvcpupids) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        for (i = stats->nthreads ; i < nvcpupids ; i++) {
+            stats->threads[i].tid = 0;
+            stats->threads[i].fd = -1;
+        }
+        stats->nthreads = nvcpupids;
+    }
+
+    for (i = 0 ; i < nvcpupids ; i++) {
+        if (stats->threads[i].tid != vcpupids[i]) {
+            qemuVcpuStatsCloseFile(&stats->threads[i].fd);
+            stats->threads[i].tid = vcpupids[i];
+        }
+    }
+
+    return 0;
+}
+
+
+/* Read the stat file of a thread, opening it if needed. Returns 0
+ * with an empty buffer if the thread is gone. */
+static int
+qemuVcpuStatsReadThread(qemuVcpuStatsPtr stats,
+                        qemuVcpuStatsThread *thread,
+                        char *buf,
+                        size_t buflen)
+{
+    char *path = NULL;
+    ssize_t got;
+    bool reopened = false;
+    int fd;
+
+    *buf = '\0';
+
+retry:
+    if (thread->fd < 0) {
+        /* In general, we cannot assume pid_t fits in int; but /proc
+         * parsing is specific to Linux where int works fine.  */
+        if (virAsprintf(&path, "/proc/%d/task/%d/stat",
+                        (int) stats->pid, thread->tid) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 && errno == EMFILE && !stats->noKeep) {
+            qemuVcpuStatsStopKeeping(stats);
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        VIR_FREE(path);
+        /* VM probably shut down, so fake 0 */
+        if (fd < 0)
+            return 0;
+
+        if (!qemuVcpuStatsKeepFile(stats)) {
+            got = pread(fd, buf, buflen - 1, 0);
+            VIR_FORCE_CLOSE(fd);
+            if (got > 0)
+                buf[got] = '\0';
+            return 0;
+        }
+        thread->fd = fd;
+        reopened = true;
+    }
+
+    if ((got = pread(thread->fd, buf, buflen - 1, 0)) < 0) {
+        qemuVcpuStatsCloseFile(&thread->fd);
+        if (!reopened)
+            goto retry;
+        return 0;
+    }
+    buf[got] = '\0';
+
+    return 0;
+}
+
+
+/**
+ * qemuVcpuStatsGetTimes:
+ * @stats: the accounting of the domain
+ * @pid: the pid of the domain
+ * @vcpupids: the thread ids of the vCPUs
+ * @nvcpupids: number of vCPUs
+ * @cpuTime: filled with the cpu time of each vCPU, in nanoseconds
+ * @lastCpu: filled with the physical CPU each vCPU last ran on
+ *
+ * Either of @cpuTime and @lastCpu may be NULL. The values of the
+ * threads which are gone are 0.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuVcpuStatsGetTimes(qemuVcpuStatsPtr stats,
+                      pid_t pid,
+                      const int *vcpupids,
+                      size_t nvcpupids,
+                      unsigned long long *cpuTime,
+                      int *lastCpu)
+{
+    char buf[1024];
+    char *pos;
+    unsigned long long usertime, systime;
+    long ticks_per_sec;
+    int cpu;
+    size_t i;
+
+    if ((ticks_per_sec = sysconf(_SC_CLK_TCK)) <= 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot get the clock ticks per second"));
+        return -1;
+    }
+
+    if (qemuVcpuStatsSyncThreads(stats, pid, vcpupids, nvcpupids) < 0)
+        return -1;
+
+    for (i = 0 ; i < nvcpupids ; i++) {
+        if (cpuTime)
+            cpuTime[i] = 0;
+        if (lastCpu)
+            lastCpu[i] = 0;
+
+        if (qemuVcpuStatsReadThread(stats, &stats->threads[i],
+                                    buf, sizeof(buf)) < 0)
+            return -1;
+        if (!*buf)
+            continue;
+
+        /* See 'man proc' for information about what all these fields
+         * are. The command name may contain spaces, so start after
+         * it, with the state field */
+        if (!(pos = strrchr(buf, ')')) ||
+            sscanf(pos + 1,
+                   /* state -> stime */
+                   " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+                   /* cutime -> endcode */
+                   " %*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u %*u"
+                   /* startstack -> processor */
+                   " %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+                   &usertime, &systime, &cpu) != 3) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot parse status data of vCPU thread %d"),
+                           vcpupids[i]);
+            return -1;
+        }
+
+        if (cpuTime)
+            cpuTime[i] = 1000ull * 1000ull * 1000ull * (usertime + systime) /
+                (unsigned long long)ticks_per_sec;
+        if (lastCpu)
+            lastCpu[i] = cpu;
+    }
+
+    return 0;
+}
+
+
+/* Read the usage_percpu of vCPU @vcpu from its cgroup, keeping the
+ * file open if allowed. Returns 0 on success, -errno on failure. */
+static int
+qemuVcpuStatsReadVcpu(qemuVcpuStatsPtr stats,
+                      virCgroupPtr group,
+                      size_t vcpu,
+                      virCgroupStatsPtr vcpustats)
+{
+    virCgroupStatsReaderPtr reader = stats->readers[vcpu];
+    virCgroupPtr group_vcpu = NULL;
+    int rc;
+
+    if (!reader) {
+        if ((rc = virCgroupForVcpu(group, vcpu, &group_vcpu, 0)) < 0)
+            return rc;
+        rc = virCgroupStatsReaderNew(group_vcpu, &reader);
+        virCgroupFree(&group_vcpu);
+        if (rc < 0)
+            return rc;
+    }
+
+    rc = virCgroupStatsReaderRead(reader, VIR_CGROUP_STATS_CPUACCT_PERCPU,
+                                  vcpustats);
+
+    if (reader == stats->readers[vcpu]) {
+        /* Look the cgroup up again next time, in case the vCPU was
+         * unplugged and plugged back */
+        if (rc < 0)
+            qemuVcpuStatsFreeReader(&stats->readers[vcpu]);
+    } else if (rc == 0 && qemuVcpuStatsKeepFile(stats)) {
+        stats->readers[vcpu] = reader;
+    } else {
+        virCgroupStatsReaderFree(reader);
+    }
+
+    return rc;
+}
+
+
+/**
+ * qemuVcpuStatsGetPercpuSum:
+ * @stats: the accounting of the domain
+ * @group: the cgroup of the domain
+ * @nvcpus: number of vCPUs
+ * @sum: filled with the time spent by all the vCPUs on each physical CPU
+ * @ncpus: number of physical CPUs in @sum
+ *
+ * The times are read from the cpuacct cgroups of the vCPUs. For
+ * example, if there are 4 physical cpus, and 2 vcpus in a domain,
+ * then for each vcpu, the cpuacct.usage_percpu looks like this:
+ *   t0 t1 t2 t3
+ * and we have 2 groups of such data:
+ *   v\p   0   1   2   3
+ *   0   t00 t01 t02 t03
+ *   1   t10 t11 t12 t13
+ * for each pcpu, the sum is cpu time consumed by all vcpus.
+ *   s0 = t00 + t10
+ *   s1 = t01 + t11
+ *   s2 = t02 + t12
+ *   s3 = t03 + t13
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuVcpuStatsGetPercpuSum(qemuVcpuStatsPtr stats,
+                          virCgroupPtr group,
+                          size_t nvcpus,
+                          unsigned long long *sum,
+                          size_t ncpus)
+{
+    virCgroupStats vcpu;
+    size_t i, j;
+    int rc;
+
+    memset(&vcpu, 0, sizeof(vcpu));
+    memset(sum, 0, sizeof(*sum) * ncpus);
+
+    qemuVcpuStatsTrimReaders(stats, nvcpus);
+
+    if (nvcpus > stats->nreaders) {
+        if (VIR_REALLOC_N(stats->readers, nvcpus) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        memset(stats->readers + stats->nreaders, 0,
+               sizeof(*stats->readers) * (nvcpus - stats->nreaders));
+        stats->nreaders = nvcpus;
+    }
+
+    for (i = 0 ; i < nvcpus ; i++) {
+        rc = qemuVcpuStatsReadVcpu(stats, group, i, &vcpu);
+        if (rc == -EMFILE && !stats->noKeep) {
+            qemuVcpuStatsStopKeeping(stats);
+            rc = qemuVcpuStatsReadVcpu(stats, group, i, &vcpu);
+        }
+        if (rc < 0) {
+            virReportSystemError(-rc, "%s",
+                                 _("unable to get cpu account of vcpu"));
+            return -1;
+        }
+
+        if (vcpu.npercpuUsage < ncpus) {
+            virCgroupStatsClear(&vcpu);
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cpuacct parse error"));
+            return -1;
+        }
+
+        for (j = 0 ; j < ncpus ; j++)
+            sum[j] += vcpu.percpuUsage[j];
+
+        virCgroupStatsClear(&vcpu);
+    }
+
+    return 0;
+}
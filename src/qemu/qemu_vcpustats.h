@@ -0,0 +1,49 @@
+/*
+ * qemu_vcpustats.h: QEMU vCPU time accounting
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QEMU_VCPUSTATS_H__
+# define __QEMU_VCPUSTATS_H__
+
+# include <sys/types.h>
+
+# include "internal.h"
+# include "util.h"
+# include "cgroup.h"
+
+typedef struct _qemuVcpuStats qemuVcpuStats;
+typedef qemuVcpuStats *qemuVcpuStatsPtr;
+
+qemuVcpuStatsPtr qemuVcpuStatsNew(void);
+void qemuVcpuStatsFree(qemuVcpuStatsPtr stats);
+
+int qemuVcpuStatsGetTimes(qemuVcpuStatsPtr stats,
+                          pid_t pid,
+                          const int *vcpupids,
+                          size_t nvcpupids,
+                          unsigned long long *cpuTime,
+                          int *lastCpu);
+
+int qemuVcpuStatsGetPercpuSum(qemuVcpuStatsPtr stats,
+                              virCgroupPtr group,
+                              size_t nvcpus,
+                              unsigned long long *sum,
+                              size_t ncpus);
+
+#endif /* __QEMU_VCPUSTATS_H__ */
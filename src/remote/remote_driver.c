@@ -50,6 +50,9 @@
 
 #define VIR_FROM_THIS VIR_FROM_REMOTE
 
+/* Calls smaller than this are not worth compressing */
+#define REMOTE_COMPRESS_THRESHOLD 4096
+
 #if SIZEOF_LONG < 8
 # define HYPER_TO_TYPE(_type, _to, _from)                                     \
     do {                                                                      \
@@ -114,6 +117,47 @@ static int callWithFD(virConnectPtr conn, struct private_data *priv,
                       unsigned int flags, int fd, int proc_nr,
                       xdrproc_t args_filter, char *args,
                       xdrproc_t ret_filter, char *ret);
+static int callBatch(virConnectPtr conn, struct private_data *priv,
+                     virNetClientProgramBatchCallPtr calls,
+                     size_t ncalls);
+
+/* State of an asynchronous call, kept until its reply arrived */
+typedef struct _remoteAsyncCall remoteAsyncCall;
+typedef remoteAsyncCall *remoteAsyncCallPtr;
+typedef void (*remoteAsyncFinishFunc)(remoteAsyncCallPtr call);
+
+struct _remoteAsyncCall {
+    virConnectPtr conn;
+
+    xdrproc_t ret_filter;
+    union {
+        remote_node_get_info_ret node_info;
+        remote_domain_get_info_ret info;
+        remote_domain_get_state_ret state;
+        remote_domain_get_xml_desc_ret xml_desc;
+    } ret;
+
+    /* Copies @ret to where the caller wants the result */
+    remoteAsyncFinishFunc finish;
+    union {
+        virNodeInfoPtr node_info;
+        virDomainInfoPtr info;
+        struct {
+            int *state;
+            int *reason;
+        } state;
+        char **xml;
+    } result;
+
+    virConnectAsyncCallback cb;
+    void *opaque;
+    virFreeCallback freecb;
+};
+
+static int callAsync(virConnectPtr conn, struct private_data *priv,
+                     int proc_nr,
+                     xdrproc_t args_filter, char *args,
+                     xdrproc_t ret_filter, remoteAsyncCallPtr call);
 static int remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                               virConnectAuthPtr auth, const char *authtype);
 #if HAVE_SASL
@@ -477,6 +521,9 @@ doRemoteOpen(virConnectPtr conn,
     char *name = NULL, *command = NULL, *sockname = NULL, *netcat = NULL;
     char *port = NULL, *authtype = NULL, *username = NULL;
     bool sanity = true, verify = true, tty ATTRIBUTE_UNUSED = true;
+    bool compress = true;
+    bool noShm = true;
+    bool noIOThread = true;
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
@@ -532,6 +579,9 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_sanity", sanity);
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
+            EXTRACT_URI_ARG_BOOL("no_compress", compress);
+            EXTRACT_URI_ARG_BOOL("shm", noShm);
+            EXTRACT_URI_ARG_BOOL("io_thread", noIOThread);
 
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
@@ -791,6 +841,75 @@ doRemoteOpen(virConnectPtr conn,
         }
     }
 
+    /* Compression only pays off over the network, where it is worth
+     * trading some CPU time for fewer bytes on the wire */
+    if (compress &&
+        (transport == trans_tls || transport == trans_tcp) &&
+        virNetMessageCompressionAvailable()) {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_PROGRAM_COMPRESSION };
+        remote_supports_feature_ret ret = { 0 };
+        int rc;
+
+        rc = call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                  (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                  (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret);
+
+        if (rc != -1 && ret.supported) {
+            virNetClientSetCompression(priv->client,
+                                       REMOTE_COMPRESS_THRESHOLD);
+        } else {
+            VIR_INFO("Not compressing messages since the server does not"
+                     " allow it");
+        }
+    }
+
+    /* Without this, listing many objects fails once the reply
+     * outgrows a single message */
+    {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_PROGRAM_FRAGMENTS };
+        remote_supports_feature_ret ret = { 0 };
+
+        if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                 (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                 (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1 ||
+            !ret.supported)
+            VIR_INFO("Server does not support fragmented replies");
+    }
+
+    /* Nothing else is in flight yet, so both ends can switch to the
+     * shared memory right after the reply to this call */
+    if (!noShm && transport == trans_unix) {
+        if (!virNetShmSessionAvailable()) {
+            VIR_INFO("Shared memory transport is not supported");
+        } else {
+            virNetShmSessionPtr shm;
+            remote_connect_start_shm_args args = { 0 };
+
+            if (!(shm = virNetShmSessionNewClient()) ||
+                callWithFD(conn, priv, 0, virNetShmSessionGetFD(shm),
+                           REMOTE_PROC_CONNECT_START_SHM,
+                           (xdrproc_t) xdr_remote_connect_start_shm_args,
+                           (char *) &args,
+                           (xdrproc_t) xdr_void, (char *) NULL) == -1) {
+                VIR_INFO("Not using shared memory since the server does"
+                         " not allow it");
+            } else if (virNetClientSetShmSession(priv->client, shm) < 0) {
+                /* The server has switched already */
+                virObjectUnref(shm);
+                goto failed;
+            }
+            virObjectUnref(shm);
+        }
+    }
+
+    /* Calls made from now on by several threads at once are all in
+     * flight together, instead of the threads taking turns */
+    if (!noIOThread &&
+        virNetClientStartIOThread(priv->client) < 0)
+        goto failed;
+
     /* Finally we can call the remote side's open function. */
     {
         remote_open_args args = { &name, flags };
@@ -1588,6 +1707,208 @@ cleanup:
     return rv;
 }
 
+static int
+remoteConnectGetAllDomainStats(virConnectPtr conn,
+                               virDomainPtr *doms,
+                               unsigned int ndoms,
+                               unsigned int stats,
+                               virDomainStatsRecordPtr **retStats,
+                               unsigned int flags)
+{
+    int rv = -1;
+    size_t i;
+    remote_connect_get_all_domain_stats_args args;
+    remote_connect_get_all_domain_stats_ret ret;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    virDomainStatsRecordPtr elem;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
+
+    if (ndoms > REMOTE_DOMAIN_STATS_RECORDS_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many domains '%u' for limit '%d'"),
+                       ndoms, REMOTE_DOMAIN_STATS_RECORDS_MAX);
+        goto done;
+    }
+
+    if (ndoms) {
+        if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0) {
+            virReportOOMError();
+            goto done;
+        }
+        args.doms.doms_len = ndoms;
+
+        for (i = 0 ; i < ndoms ; i++)
+            make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    }
+    args.stats = stats;
+    args.flags = flags;
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.retStats.retStats_len > REMOTE_DOMAIN_STATS_RECORDS_MAX) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("returned number of records exceeds limit"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, ret.retStats.retStats_len + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ret.retStats.retStats_len ; i++) {
+        remote_domain_stats_record *rec = ret.retStats.retStats_val + i;
+
+        if (VIR_ALLOC(elem) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        tmpstats[i] = elem;
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+            goto cleanup;
+
+        if (VIR_ALLOC_N(elem->params, rec->params.params_len) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        elem->nparams = rec->params.params_len;
+
+        if (remoteDeserializeTypedParameters(rec->params.params_val,
+                                             rec->params.params_len,
+                                             REMOTE_DOMAIN_STATS_PARAMETERS_MAX,
+                                             elem->params,
+                                             &elem->nparams) < 0) {
+            /* Nothing left to clear in the parameters */
+            elem->nparams = 0;
+            goto cleanup;
+        }
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    rv = ret.retStats.retStats_len;
+
+cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret);
+
+done:
+    /* The domain names are borrowed from @doms */
+    VIR_FREE(args.doms.doms_val);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteConnectGetStatsHistory(virConnectPtr conn,
+                             virDomainPtr dom,
+                             unsigned int nsamples,
+                             virDomainStatsRecordPtr **retSamples,
+                             unsigned int flags)
+{
+    int rv = -1;
+    size_t i;
+    remote_connect_get_stats_history_args args;
+    remote_connect_get_stats_history_ret ret;
+    remote_nonnull_domain rdom;
+    virDomainStatsRecordPtr *tmpsamples = NULL;
+    virDomainStatsRecordPtr elem;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
+
+    if (nsamples > REMOTE_STATS_HISTORY_SAMPLES_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many samples '%u' for limit '%d'"),
+                       nsamples, REMOTE_STATS_HISTORY_SAMPLES_MAX);
+        goto done;
+    }
+
+    /* The domain name is borrowed from @dom */
+    if (dom) {
+        make_nonnull_domain(&rdom, dom);
+        args.dom.dom_val = &rdom;
+        args.dom.dom_len = 1;
+    }
+    args.nsamples = nsamples;
+    args.flags = flags;
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_STATS_HISTORY,
+             (xdrproc_t) xdr_remote_connect_get_stats_history_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_get_stats_history_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.samples.samples_len > nsamples) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("returned number of samples exceeds limit"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmpsamples, ret.samples.samples_len + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ret.samples.samples_len ; i++) {
+        remote_stats_history_sample *sample = ret.samples.samples_val + i;
+
+        if (VIR_ALLOC(elem) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        tmpsamples[i] = elem;
+
+        if (dom)
+            elem->dom = virObjectRef(dom);
+
+        if (VIR_ALLOC_N(elem->params, sample->params.params_len) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        elem->nparams = sample->params.params_len;
+
+        if (remoteDeserializeTypedParameters(sample->params.params_val,
+                                             sample->params.params_len,
+                                             REMOTE_DOMAIN_STATS_PARAMETERS_MAX,
+                                             elem->params,
+                                             &elem->nparams) < 0) {
+            /* Nothing left to clear in the parameters */
+            elem->nparams = 0;
+            goto cleanup;
+        }
+    }
+
+    *retSamples = tmpsamples;
+    tmpsamples = NULL;
+    rv = ret.samples.samples_len;
+
+cleanup:
+    virDomainStatsRecordListFree(tmpsamples);
+    xdr_free((xdrproc_t) xdr_remote_connect_get_stats_history_ret,
+             (char *) &ret);
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int
 remoteDeserializeDomainDiskErrors(remote_domain_disk_error *ret_errors_val,
                                   u_int ret_errors_len,
@@ -2191,6 +2512,280 @@ done:
     return rv;
 }
 
+static int
+remoteDomainListGetState(virConnectPtr conn,
+                         virDomainPtr *doms,
+                         unsigned int ndoms,
+                         int *states,
+                         int *reasons,
+                         unsigned int flags)
+{
+    int rv = -1;
+    remote_domain_get_state_args *args = NULL;
+    remote_domain_get_state_ret *ret = NULL;
+    virNetClientProgramBatchCallPtr calls = NULL;
+    struct private_data *priv = conn->privateData;
+    size_t i;
+
+    remoteDriverLock(priv);
+
+    if (VIR_ALLOC_N(args, ndoms) < 0 ||
+        VIR_ALLOC_N(ret, ndoms) < 0 ||
+        VIR_ALLOC_N(calls, ndoms) < 0) {
+        virReportOOMError();
+        goto done;
+    }
+
+    for (i = 0 ; i < ndoms ; i++) {
+        make_nonnull_domain(&args[i].dom, doms[i]);
+        args[i].flags = flags;
+
+        calls[i].proc = REMOTE_PROC_DOMAIN_GET_STATE;
+        calls[i].args_filter = (xdrproc_t) xdr_remote_domain_get_state_args;
+        calls[i].args = &args[i];
+        calls[i].ret_filter = (xdrproc_t) xdr_remote_domain_get_state_ret;
+        calls[i].ret = &ret[i];
+    }
+
+    if (callBatch(conn, priv, calls, ndoms) < 0)
+        goto done;
+
+    rv = 0;
+    for (i = 0 ; i < ndoms ; i++) {
+        if (calls[i].result < 0) {
+            states[i] = -1;
+            if (reasons)
+                reasons[i] = -1;
+            continue;
+        }
+        states[i] = ret[i].state;
+        if (reasons)
+            reasons[i] = ret[i].reason;
+        rv++;
+    }
+
+    /* Only report an error if no domain could be queried at all */
+    if (rv == 0)
+        rv = -1;
+    else
+        virResetLastError();
+
+done:
+    VIR_FREE(calls);
+    VIR_FREE(ret);
+    VIR_FREE(args);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static remoteAsyncCallPtr
+remoteAsyncCallNew(remoteAsyncFinishFunc finish,
+                   virConnectAsyncCallback cb,
+                   void *opaque,
+                   virFreeCallback freecb)
+{
+    remoteAsyncCallPtr call;
+
+    if (VIR_ALLOC(call) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    call->finish = finish;
+    call->cb = cb;
+    call->opaque = opaque;
+    call->freecb = freecb;
+    return call;
+}
+
+static void
+remoteNodeGetInfoFinish(remoteAsyncCallPtr call)
+{
+    virNodeInfoPtr info = call->result.node_info;
+    remote_node_get_info_ret *ret = &call->ret.node_info;
+
+    memcpy(info->model, ret->model, sizeof(info->model));
+    info->memory = ret->memory;
+    info->cpus = ret->cpus;
+    info->mhz = ret->mhz;
+    info->nodes = ret->nodes;
+    info->sockets = ret->sockets;
+    info->cores = ret->cores;
+    info->threads = ret->threads;
+}
+
+static int
+remoteNodeGetInfoAsync(virConnectPtr conn,
+                       virNodeInfoPtr info,
+                       virConnectAsyncCallback cb,
+                       void *opaque,
+                       virFreeCallback freecb)
+{
+    int rv = -1;
+    remoteAsyncCallPtr call;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (!(call = remoteAsyncCallNew(remoteNodeGetInfoFinish,
+                                    cb, opaque, freecb)))
+        goto done;
+    call->result.node_info = info;
+
+    if (callAsync(conn, priv, REMOTE_PROC_NODE_GET_INFO,
+                  (xdrproc_t) xdr_void, (char *) NULL,
+                  (xdrproc_t) xdr_remote_node_get_info_ret, call) < 0) {
+        VIR_FREE(call);
+        goto done;
+    }
+
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static void
+remoteDomainGetInfoFinish(remoteAsyncCallPtr call)
+{
+    virDomainInfoPtr info = call->result.info;
+    remote_domain_get_info_ret *ret = &call->ret.info;
+
+    info->state = ret->state;
+    info->maxMem = ret->maxMem;
+    info->memory = ret->memory;
+    info->nrVirtCpu = ret->nrVirtCpu;
+    info->cpuTime = ret->cpuTime;
+}
+
+static int
+remoteDomainGetInfoAsync(virDomainPtr dom,
+                         virDomainInfoPtr info,
+                         virConnectAsyncCallback cb,
+                         void *opaque,
+                         virFreeCallback freecb)
+{
+    int rv = -1;
+    remote_domain_get_info_args args;
+    remoteAsyncCallPtr call;
+    struct private_data *priv = dom->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (!(call = remoteAsyncCallNew(remoteDomainGetInfoFinish,
+                                    cb, opaque, freecb)))
+        goto done;
+    call->result.info = info;
+
+    make_nonnull_domain(&args.dom, dom);
+
+    if (callAsync(dom->conn, priv, REMOTE_PROC_DOMAIN_GET_INFO,
+                  (xdrproc_t) xdr_remote_domain_get_info_args, (char *) &args,
+                  (xdrproc_t) xdr_remote_domain_get_info_ret, call) < 0) {
+        VIR_FREE(call);
+        goto done;
+    }
+
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static void
+remoteDomainGetStateFinish(remoteAsyncCallPtr call)
+{
+    *call->result.state.state = call->ret.state.state;
+    if (call->result.state.reason)
+        *call->result.state.reason = call->ret.state.reason;
+}
+
+static int
+remoteDomainGetStateAsync(virDomainPtr dom,
+                          int *state,
+                          int *reason,
+                          unsigned int flags,
+                          virConnectAsyncCallback cb,
+                          void *opaque,
+                          virFreeCallback freecb)
+{
+    int rv = -1;
+    remote_domain_get_state_args args;
+    remoteAsyncCallPtr call;
+    struct private_data *priv = dom->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (!(call = remoteAsyncCallNew(remoteDomainGetStateFinish,
+                                    cb, opaque, freecb)))
+        goto done;
+    call->result.state.state = state;
+    call->result.state.reason = reason;
+
+    make_nonnull_domain(&args.dom, dom);
+    args.flags = flags;
+
+    if (callAsync(dom->conn, priv, REMOTE_PROC_DOMAIN_GET_STATE,
+                  (xdrproc_t) xdr_remote_domain_get_state_args, (char *) &args,
+                  (xdrproc_t) xdr_remote_domain_get_state_ret, call) < 0) {
+        VIR_FREE(call);
+        goto done;
+    }
+
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static void
+remoteDomainGetXMLDescFinish(remoteAsyncCallPtr call)
+{
+    /* Steal the string rather than copying it */
+    *call->result.xml = call->ret.xml_desc.xml;
+    call->ret.xml_desc.xml = NULL;
+}
+
+static int
+remoteDomainGetXMLDescAsync(virDomainPtr dom,
+                            unsigned int flags,
+                            char **xml,
+                            virConnectAsyncCallback cb,
+                            void *opaque,
+                            virFreeCallback freecb)
+{
+    int rv = -1;
+    remote_domain_get_xml_desc_args args;
+    remoteAsyncCallPtr call;
+    struct private_data *priv = dom->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (!(call = remoteAsyncCallNew(remoteDomainGetXMLDescFinish,
+                                    cb, opaque, freecb)))
+        goto done;
+    call->result.xml = xml;
+
+    make_nonnull_domain(&args.dom, dom);
+    args.flags = flags;
+
+    if (callAsync(dom->conn, priv, REMOTE_PROC_DOMAIN_GET_XML_DESC,
+                  (xdrproc_t) xdr_remote_domain_get_xml_desc_args, (char *) &args,
+                  (xdrproc_t) xdr_remote_domain_get_xml_desc_ret, call) < 0) {
+        VIR_FREE(call);
+        goto done;
+    }
+
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int
 remoteNodeGetSecurityModel(virConnectPtr conn, virSecurityModelPtr secmodel)
 {
@@ -4691,11 +5286,12 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x", st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
@@ -4711,7 +5307,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -4721,6 +5318,61 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+    virNetClientStreamPtr privst = st->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    return virNetClientStreamRecvHole(privst, length);
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -4894,7 +5546,10 @@ cleanup:
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
     .streamSend = remoteStreamSend,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamAddCallback = remoteStreamEventAddCallback,
@@ -5180,7 +5835,8 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto done;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -5548,6 +6204,86 @@ callWithFD(virConnectPtr conn ATTRIBUTE_UNUSED,
     return rv;
 }
 
+/*
+ * Make several calls on the remote program, sending them all before
+ * waiting for any reply. Serials are assigned here.
+ */
+static int
+callBatch(virConnectPtr conn ATTRIBUTE_UNUSED,
+          struct private_data *priv,
+          virNetClientProgramBatchCallPtr calls,
+          size_t ncalls)
+{
+    int rv;
+    virNetClientPtr client = priv->client;
+    size_t i;
+
+    for (i = 0 ; i < ncalls ; i++)
+        calls[i].serial = priv->counter++;
+    priv->localUses++;
+
+    /* Unlock for the same reason as callWithFD */
+    remoteDriverUnlock(priv);
+    rv = virNetClientProgramCallBatch(priv->remoteProgram, client,
+                                      calls, ncalls);
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    return rv;
+}
+
+/*
+ * Run from the event loop once the reply to an asynchronous
+ * call was decoded, or the call failed.
+ */
+static void
+remoteAsyncCallDone(int result, void *opaque)
+{
+    remoteAsyncCallPtr call = opaque;
+
+    if (result == 0)
+        (call->finish)(call);
+    else
+        virDispatchError(call->conn);
+
+    (call->cb)(call->conn, result, call->opaque);
+    if (call->freecb)
+        (call->freecb)(call->opaque);
+
+    xdr_free(call->ret_filter, (char *) &call->ret);
+    virObjectUnref(call->conn);
+    VIR_FREE(call);
+}
+
+/*
+ * Make a call on the remote program without waiting for the reply.
+ * @call belongs to the event loop once this succeeded, and is
+ * freed after its callback was run.
+ */
+static int
+callAsync(virConnectPtr conn,
+          struct private_data *priv,
+          int proc_nr,
+          xdrproc_t args_filter, char *args,
+          xdrproc_t ret_filter, remoteAsyncCallPtr call)
+{
+    call->conn = virObjectRef(conn);
+    call->ret_filter = ret_filter;
+
+    /* Nothing is waited for, so the driver lock can be kept */
+    if (virNetClientProgramCallAsync(priv->remoteProgram, priv->client,
+                                     priv->counter++, proc_nr,
+                                     args_filter, args,
+                                     ret_filter, &call->ret,
+                                     remoteAsyncCallDone, call) < 0) {
+        virObjectUnref(conn);
+        call->conn = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
 static int
 call(virConnectPtr conn,
      struct private_data *priv,
@@ -5986,6 +6722,7 @@ static virDriver remote_driver = {
     .getSysinfo = remoteGetSysinfo, /* 0.8.8 */
     .getMaxVcpus = remoteGetMaxVcpus, /* 0.3.0 */
     .nodeGetInfo = remoteNodeGetInfo, /* 0.3.0 */
+    .nodeGetInfoAsync = remoteNodeGetInfoAsync, /* 1.0.1 */
     .getCapabilities = remoteGetCapabilities, /* 0.3.0 */
     .listDomains = remoteListDomains, /* 0.3.0 */
     .numOfDomains = remoteNumOfDomains, /* 0.3.0 */
@@ -6015,6 +6752,9 @@ static virDriver remote_driver = {
     .domainGetBlkioParameters = remoteDomainGetBlkioParameters, /* 0.9.0 */
     .domainGetInfo = remoteDomainGetInfo, /* 0.3.0 */
     .domainGetState = remoteDomainGetState, /* 0.9.2 */
+    .domainListGetState = remoteDomainListGetState, /* 1.0.1 */
+    .domainGetInfoAsync = remoteDomainGetInfoAsync, /* 1.0.1 */
+    .domainGetStateAsync = remoteDomainGetStateAsync, /* 1.0.1 */
     .domainGetControlInfo = remoteDomainGetControlInfo, /* 0.9.3 */
     .domainSave = remoteDomainSave, /* 0.3.0 */
     .domainSaveFlags = remoteDomainSaveFlags, /* 0.9.4 */
@@ -6038,6 +6778,9 @@ static virDriver remote_driver = {
     .domainGetSecurityLabelList = remoteDomainGetSecurityLabelList, /* 0.10.0 */
     .nodeGetSecurityModel = remoteNodeGetSecurityModel, /* 0.6.1 */
     .domainGetXMLDesc = remoteDomainGetXMLDesc, /* 0.3.0 */
+    .domainGetXMLDescAsync = remoteDomainGetXMLDescAsync, /* 1.0.1 */
+    .connectGetAllDomainStats = remoteConnectGetAllDomainStats, /* 1.0.1 */
+    .connectGetStatsHistory = remoteConnectGetStatsHistory, /* 1.0.1 */
     .domainXMLFromNative = remoteDomainXMLFromNative, /* 0.6.4 */
     .domainXMLToNative = remoteDomainXMLToNative, /* 0.6.4 */
     .listDefinedDomains = remoteListDefinedDomains, /* 0.3.0 */
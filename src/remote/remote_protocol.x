@@ -234,6 +234,21 @@ const REMOTE_DOMAIN_DISK_ERRORS_MAX = 256;
  */
 const REMOTE_NODE_MEMORY_PARAMETERS_MAX = 64;
 
+/*
+ * Upper limit on the domains of a bulk stats call
+ */
+const REMOTE_DOMAIN_STATS_RECORDS_MAX = 16384;
+
+/*
+ * Upper limit on the stats of one domain
+ */
+const REMOTE_DOMAIN_STATS_PARAMETERS_MAX = 4096;
+
+/*
+ * Upper limit on the samples of a stats history call
+ */
+const REMOTE_STATS_HISTORY_SAMPLES_MAX = 1024;
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -2702,6 +2717,42 @@ struct remote_domain_open_channel_args {
     unsigned int flags;
 };
 
+/* The shared memory is passed along as a file descriptor */
+struct remote_connect_start_shm_args {
+    unsigned int flags;
+};
+
+struct remote_domain_stats_record {
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_DOMAIN_STATS_PARAMETERS_MAX>;
+};
+
+/* An empty list of domains asks for all of them */
+struct remote_connect_get_all_domain_stats_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_STATS_RECORDS_MAX>;
+    unsigned int stats;
+    unsigned int flags;
+};
+
+struct remote_connect_get_all_domain_stats_ret {
+    remote_domain_stats_record retStats<REMOTE_DOMAIN_STATS_RECORDS_MAX>;
+};
+
+struct remote_stats_history_sample {
+    remote_typed_param params<REMOTE_DOMAIN_STATS_PARAMETERS_MAX>;
+};
+
+/* An empty domain asks for the samples of the host */
+struct remote_connect_get_stats_history_args {
+    remote_nonnull_domain dom<1>;
+    unsigned int nsamples;
+    unsigned int flags;
+};
+
+struct remote_connect_get_stats_history_ret {
+    remote_stats_history_sample samples<REMOTE_STATS_HISTORY_SAMPLES_MAX>;
+};
+
 /*----- Protocol. -----*/
 
 /* Define the program number, protocol version and procedure numbers here. */
@@ -2724,7 +2775,9 @@ enum remote_procedure {
      * create a stream.  The direction is defined from the src/remote point
      * of view.  A readstream transfers data from daemon to src/remote.  The
      * <offset> specifies at which offset the stream parameter is inserted
-     * in the function parameter list. */
+     * in the function parameter list.  It may be followed by a
+     * sparseflag@<flag>, naming the flag in the arguments which makes
+     * the stream a sparse one, able to carry holes. */
     REMOTE_PROC_OPEN = 1, /* skipgen skipgen priority:high */
     REMOTE_PROC_CLOSE = 2, /* skipgen skipgen priority:high */
     REMOTE_PROC_GET_TYPE = 3, /* autogen skipgen priority:high */
@@ -2952,8 +3005,8 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_SET_BLKIO_PARAMETERS = 205, /* autogen autogen */
     REMOTE_PROC_DOMAIN_GET_BLKIO_PARAMETERS = 206, /* skipgen skipgen */
     REMOTE_PROC_DOMAIN_MIGRATE_SET_MAX_SPEED = 207, /* autogen autogen */
-    REMOTE_PROC_STORAGE_VOL_UPLOAD = 208, /* autogen autogen | writestream@1 */
-    REMOTE_PROC_STORAGE_VOL_DOWNLOAD = 209, /* autogen autogen | readstream@1 */
+    REMOTE_PROC_STORAGE_VOL_UPLOAD = 208, /* autogen autogen | writestream@1 sparseflag@VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM */
+    REMOTE_PROC_STORAGE_VOL_DOWNLOAD = 209, /* autogen autogen | readstream@1 sparseflag@VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM */
     REMOTE_PROC_DOMAIN_INJECT_NMI = 210, /* autogen autogen */
 
     REMOTE_PROC_DOMAIN_SCREENSHOT = 211, /* autogen autogen | readstream@1 */
@@ -3049,7 +3102,10 @@ enum remote_procedure {
     REMOTE_PROC_NODE_GET_CPU_MAP = 293, /* skipgen skipgen */
     REMOTE_PROC_DOMAIN_FSTRIM = 294, /* autogen autogen */
     REMOTE_PROC_DOMAIN_SEND_PROCESS_SIGNAL = 295, /* autogen autogen */
-    REMOTE_PROC_DOMAIN_OPEN_CHANNEL = 296 /* autogen autogen | readstream@2 */
+    REMOTE_PROC_DOMAIN_OPEN_CHANNEL = 296, /* autogen autogen | readstream@2 */
+    REMOTE_PROC_CONNECT_START_SHM = 297, /* skipgen skipgen */
+    REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS = 298, /* skipgen skipgen */
+    REMOTE_PROC_CONNECT_GET_STATS_HISTORY = 299 /* skipgen skipgen */
 
     /*
      * Notice how the entries are grouped in sets of 10 ?
@@ -3070,5 +3126,7 @@ enum remote_procedure {
      * create a stream.  The direction is defined from the src/remote point
      * of view.  A readstream transfers data from daemon to src/remote.  The
      * <offset> specifies at which offset the stream parameter is inserted
-     * in the function parameter list. */
+     * in the function parameter list.  It may be followed by a
+     * sparseflag@<flag>, naming the flag in the arguments which makes
+     * the stream a sparse one, able to carry holes. */
 };
@@ -210,14 +210,16 @@ while (<PROTOCOL>) {
             }
 
             if (defined $genflags and $genflags ne "") {
-                if ($genflags =~ m/^\|\s*(read|write)stream@(\d+)\s*$/) {
+                if ($genflags =~ m/^\|\s*(read|write)stream@(\d+)(\s+sparseflag@(\S+))?\s*$/) {
                     $calls{$name}->{streamflag} = $1;
                     $calls{$name}->{streamoffset} = int($2);
+                    $calls{$name}->{sparseflag} = defined $4 ? $4 : "none";
                 } else {
                     die "invalid generator flags for ${procprefix}_PROC_${name}"
                 }
             } else {
                 $calls{$name}->{streamflag} = "none";
+                $calls{$name}->{sparseflag} = "none";
             }
 
             # for now, we distinguish only two levels of prioroty:
@@ -861,7 +863,11 @@ elsif ($opt_b) {
             print "    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)))\n";
             print "        goto cleanup;\n";
             print "\n";
-            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header)))\n";
+            my $allowSkip = "false";
+            if ($call->{sparseflag} ne "none") {
+                $allowSkip = "args->flags & $call->{sparseflag}";
+            }
+            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header, $allowSkip)))\n";
             print "        goto cleanup;\n";
             print "\n";
         }
@@ -999,7 +1005,7 @@ elsif ($opt_b) {
 
     print "virNetServerProgramProc ${structprefix}Procs[] = {\n";
     for ($id = 0 ; $id <= $#calls ; $id++) {
-        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority);
+        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority, $procname);
 
         if (defined $calls[$id] && !$calls[$id]->{msg}) {
             $comment = "/* Method $calls[$id]->{ProcName} => $id */";
@@ -1010,6 +1016,7 @@ elsif ($opt_b) {
             $retlen = $rettype ne "void" ? "sizeof($rettype)" : "0";
             $argfilter = $argtype ne "void" ? "xdr_$argtype" : "xdr_void";
             $retfilter = $rettype ne "void" ? "xdr_$rettype" : "xdr_void";
+            $procname = "\"$calls[$id]->{ProcName}\"";
         } else {
             if ($calls[$id]->{msg}) {
                 $comment = "/* Async event $calls[$id]->{ProcName} => $id */";
@@ -1020,11 +1027,12 @@ elsif ($opt_b) {
             $arglen = $retlen = 0;
             $argfilter = "xdr_void";
             $retfilter = "xdr_void";
+            $procname = "NULL";
         }
 
     $priority = defined $calls[$id]->{priority} ? $calls[$id]->{priority} : 0;
 
-        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority\n},\n";
+        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority,\n   $procname\n},\n";
     }
     print "};\n";
     print "size_t ${structprefix}NProcs = ARRAY_CARDINALITY(${structprefix}Procs);\n";
@@ -1451,7 +1459,11 @@ elsif ($opt_k) {
 
         if ($call->{streamflag} ne "none") {
             print "\n";
-            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter)))\n";
+            my $allowSkip = "false";
+            if ($call->{sparseflag} ne "none") {
+                $allowSkip = "flags & $call->{sparseflag}";
+            }
+            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter, $allowSkip)))\n";
             print "        goto done;\n";
             print "\n";
             print "    if (virNetClientAddStream(priv->client, netst) < 0) {\n";
@@ -28,12 +28,33 @@
 #include "logging.h"
 #include "util.h"
 #include "virterror_internal.h"
+#include "virtime.h"
 #include "virnetsocket.h"
 #include "virkeepaliveprotocol.h"
 #include "virkeepalive.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Number of one second slots in a timer wheel */
+#define VIR_KEEPALIVE_WHEEL_SLOTS 64
+
+struct _virKeepAliveWheel {
+    virObject object;
+
+    virMutex lock;
+
+    /* Only registered while the wheel has members */
+    int timer;
+    size_t nmembers;
+    /* Deadlines up to this one were dealt with */
+    time_t lastRun;
+    /* Set while the timer callback deals with due keepalives */
+    bool running;
+    /* Keepalives whose deadline is a multiple of the number
+     * of slots away from the slot index */
+    virKeepAlivePtr slots[VIR_KEEPALIVE_WHEEL_SLOTS];
+};
+
 struct _virKeepAlive {
     virObject object;
 
@@ -46,6 +67,17 @@ struct _virKeepAlive {
     time_t intervalStart;
     int timer;
 
+    /* Shared wheel driving this keepalive instead of a timer of its
+     * own, if any. The fields below are protected by the lock of
+     * the wheel. */
+    virKeepAliveWheelPtr wheel;
+    bool inWheel;
+    time_t wheelDeadline;
+    int wheelSlot; /* -1 while being dealt with */
+    virKeepAlivePtr wheelPrev;
+    virKeepAlivePtr wheelNext;
+    virKeepAlivePtr wheelDue;
+
     virKeepAliveSendFunc sendCB;
     virKeepAliveDeadFunc deadCB;
     virKeepAliveFreeFunc freeCB;
@@ -54,7 +86,9 @@ struct _virKeepAlive {
 
 
 static virClassPtr virKeepAliveClass;
+static virClassPtr virKeepAliveWheelClass;
 static void virKeepAliveDispose(void *obj);
+static void virKeepAliveWheelDispose(void *obj);
 
 static int virKeepAliveOnceInit(void)
 {
@@ -63,6 +97,11 @@ static int virKeepAliveOnceInit(void)
                                           virKeepAliveDispose)))
         return -1;
 
+    if (!(virKeepAliveWheelClass = virClassNew("virKeepAliveWheel",
+                                               sizeof(virKeepAliveWheel),
+                                               virKeepAliveWheelDispose)))
+        return -1;
+
     return 0;
 }
 
@@ -81,6 +120,23 @@ virKeepAliveUnlock(virKeepAlivePtr ka)
 }
 
 
+/*
+ * Seconds of a clock which setting the system time does not affect,
+ * so that stepping it back does not hold pings off until it caught
+ * up again, nor stepping it forward make all of them due at once.
+ */
+static time_t
+virKeepAliveNow(void)
+{
+    unsigned long long now = 0;
+
+    /* Which can only fail if the clock does not exist at all */
+    ignore_value(virTimeMonotonicMillisNowRaw(&now));
+
+    return now / 1000;
+}
+
+
 static virNetMessagePtr
 virKeepAliveMessage(virKeepAlivePtr ka, int proc)
 {
@@ -131,14 +187,15 @@ static bool
 virKeepAliveTimerInternal(virKeepAlivePtr ka,
                           virNetMessagePtr *msg)
 {
-    time_t now = time(NULL);
+    time_t now = virKeepAliveNow();
 
     if (ka->interval <= 0 || ka->intervalStart == 0)
         return false;
 
     if (now - ka->intervalStart < ka->interval) {
         int timeout = ka->interval - (now - ka->intervalStart);
-        virEventUpdateTimeout(ka->timer, timeout * 1000);
+        if (ka->timer >= 0)
+            virEventUpdateTimeout(ka->timer, timeout * 1000);
         return false;
     }
 
@@ -159,7 +216,8 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
         ka->countToDeath--;
         ka->intervalStart = now;
         *msg = virKeepAliveMessage(ka, KEEPALIVE_PROC_PING);
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
+        if (ka->timer >= 0)
+            virEventUpdateTimeout(ka->timer, ka->interval * 1000);
         return false;
     }
 }
@@ -199,9 +257,270 @@ cleanup:
 }
 
 
+static void
+virKeepAliveWheelLock(virKeepAliveWheelPtr wheel)
+{
+    virMutexLock(&wheel->lock);
+}
+
+static void
+virKeepAliveWheelUnlock(virKeepAliveWheelPtr wheel)
+{
+    virMutexUnlock(&wheel->lock);
+}
+
+
+/* Arm the timer for the first slot holding any keepalive */
+static void
+virKeepAliveWheelSchedule(virKeepAliveWheelPtr wheel)
+{
+    time_t now = virKeepAliveNow();
+    time_t t;
+
+    for (t = wheel->lastRun + 1 ;
+         t <= wheel->lastRun + VIR_KEEPALIVE_WHEEL_SLOTS ; t++) {
+        if (wheel->slots[t % VIR_KEEPALIVE_WHEEL_SLOTS]) {
+            virEventUpdateTimeout(wheel->timer,
+                                  t > now ? (t - now) * 1000 : 0);
+            return;
+        }
+    }
+
+    virEventUpdateTimeout(wheel->timer, -1);
+}
+
+
+static void
+virKeepAliveWheelInsert(virKeepAliveWheelPtr wheel,
+                        virKeepAlivePtr ka,
+                        time_t deadline)
+{
+    int slot;
+
+    /* Overdue keepalives are dealt with on the next tick */
+    if (deadline <= wheel->lastRun)
+        deadline = wheel->lastRun + 1;
+
+    slot = deadline % VIR_KEEPALIVE_WHEEL_SLOTS;
+    ka->wheelDeadline = deadline;
+    ka->wheelSlot = slot;
+    ka->wheelPrev = NULL;
+    ka->wheelNext = wheel->slots[slot];
+    if (ka->wheelNext)
+        ka->wheelNext->wheelPrev = ka;
+    wheel->slots[slot] = ka;
+
+    /* The timer callback does it once it is done */
+    if (!wheel->running)
+        virKeepAliveWheelSchedule(wheel);
+}
+
+
+static void
+virKeepAliveWheelUnlink(virKeepAliveWheelPtr wheel,
+                        virKeepAlivePtr ka)
+{
+    if (ka->wheelSlot < 0)
+        return;
+
+    if (ka->wheelPrev)
+        ka->wheelPrev->wheelNext = ka->wheelNext;
+    else
+        wheel->slots[ka->wheelSlot] = ka->wheelNext;
+    if (ka->wheelNext)
+        ka->wheelNext->wheelPrev = ka->wheelPrev;
+
+    ka->wheelPrev = ka->wheelNext = NULL;
+    ka->wheelSlot = -1;
+}
+
+
+/*
+ * Deal with all keepalives whose deadline passed. A keepalive which
+ * received anything since it was put in the wheel has its interval
+ * restarted, so it is simply moved to a later slot rather than sent
+ * a ping. Callbacks are run without the wheel lock held.
+ */
+static void
+virKeepAliveWheelTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+{
+    virKeepAliveWheelPtr wheel = opaque;
+    virKeepAlivePtr due = NULL;
+    time_t now = virKeepAliveNow();
+    time_t t;
+
+    virKeepAliveWheelLock(wheel);
+
+    /* The timer may fire late, in which case all slots need a look */
+    if (now - wheel->lastRun > VIR_KEEPALIVE_WHEEL_SLOTS)
+        wheel->lastRun = now - VIR_KEEPALIVE_WHEEL_SLOTS;
+
+    for (t = wheel->lastRun + 1 ; t <= now ; t++) {
+        virKeepAlivePtr ka = wheel->slots[t % VIR_KEEPALIVE_WHEEL_SLOTS];
+
+        while (ka) {
+            virKeepAlivePtr next = ka->wheelNext;
+
+            if (ka->wheelDeadline <= now) {
+                virKeepAliveWheelUnlink(wheel, ka);
+                virObjectRef(ka);
+                ka->wheelDue = due;
+                due = ka;
+            }
+            ka = next;
+        }
+    }
+    wheel->lastRun = now;
+    wheel->running = true;
+
+    virKeepAliveWheelUnlock(wheel);
+
+    while (due) {
+        virKeepAlivePtr ka = due;
+        virNetMessagePtr msg = NULL;
+        void *client;
+        bool dead;
+        time_t deadline;
+
+        due = ka->wheelDue;
+        ka->wheelDue = NULL;
+
+        virKeepAliveLock(ka);
+        client = ka->client;
+        dead = virKeepAliveTimerInternal(ka, &msg);
+        deadline = ka->intervalStart + ka->interval;
+        virKeepAliveUnlock(ka);
+
+        if (dead) {
+            ka->deadCB(client);
+        } else if (msg && ka->sendCB(client, msg) < 0) {
+            VIR_WARN("Failed to send keepalive request to client %p", client);
+            virNetMessageFree(msg);
+        }
+
+        /* Unless it was stopped meanwhile */
+        virKeepAliveWheelLock(wheel);
+        if (ka->inWheel && ka->wheelSlot < 0)
+            virKeepAliveWheelInsert(wheel, ka, deadline);
+        virKeepAliveWheelUnlock(wheel);
+
+        virObjectUnref(ka);
+    }
+
+    virKeepAliveWheelLock(wheel);
+    wheel->running = false;
+    if (wheel->timer >= 0)
+        virKeepAliveWheelSchedule(wheel);
+    virKeepAliveWheelUnlock(wheel);
+}
+
+
+/*
+ * Create a wheel, which drives many keepalives from a single timer
+ * instead of one timer each. Deadlines are rounded to the second,
+ * which matches the resolution of keepalive intervals.
+ */
+virKeepAliveWheelPtr
+virKeepAliveWheelNew(void)
+{
+    virKeepAliveWheelPtr wheel;
+
+    if (virKeepAliveInitialize() < 0)
+        return NULL;
+
+    if (!(wheel = virObjectNew(virKeepAliveWheelClass)))
+        return NULL;
+
+    if (virMutexInit(&wheel->lock) < 0) {
+        VIR_FREE(wheel);
+        return NULL;
+    }
+
+    wheel->timer = -1;
+    wheel->lastRun = virKeepAliveNow();
+
+    return wheel;
+}
+
+
+void
+virKeepAliveWheelDispose(void *obj)
+{
+    virKeepAliveWheelPtr wheel = obj;
+
+    virMutexDestroy(&wheel->lock);
+}
+
+
+static int
+virKeepAliveWheelAdd(virKeepAliveWheelPtr wheel,
+                     virKeepAlivePtr ka,
+                     time_t deadline)
+{
+    int ret = -1;
+
+    virKeepAliveWheelLock(wheel);
+
+    if (ka->inWheel) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* The timer holds a reference to the wheel */
+    if (wheel->timer < 0) {
+        virObjectRef(wheel);
+        if ((wheel->timer = virEventAddTimeout(-1, virKeepAliveWheelTimer,
+                                               wheel,
+                                               virObjectFreeCallback)) < 0) {
+            virObjectUnref(wheel);
+            goto cleanup;
+        }
+        wheel->lastRun = virKeepAliveNow();
+    }
+
+    /* The wheel has another reference to this object */
+    virObjectRef(ka);
+    ka->inWheel = true;
+    wheel->nmembers++;
+    virKeepAliveWheelInsert(wheel, ka, deadline);
+    ret = 0;
+
+cleanup:
+    virKeepAliveWheelUnlock(wheel);
+    return ret;
+}
+
+
+static void
+virKeepAliveWheelRemove(virKeepAliveWheelPtr wheel,
+                        virKeepAlivePtr ka)
+{
+    bool unref = false;
+
+    virKeepAliveWheelLock(wheel);
+
+    if (ka->inWheel) {
+        virKeepAliveWheelUnlink(wheel, ka);
+        ka->inWheel = false;
+        unref = true;
+
+        if (--wheel->nmembers == 0) {
+            virEventRemoveTimeout(wheel->timer);
+            wheel->timer = -1;
+        }
+    }
+
+    virKeepAliveWheelUnlock(wheel);
+
+    if (unref)
+        virObjectUnref(ka);
+}
+
+
 virKeepAlivePtr
 virKeepAliveNew(int interval,
                 unsigned int count,
+                virKeepAliveWheelPtr wheel,
                 void *client,
                 virKeepAliveSendFunc sendCB,
                 virKeepAliveDeadFunc deadCB,
@@ -226,10 +545,13 @@ virKeepAliveNew(int interval,
     ka->count = count;
     ka->countToDeath = count;
     ka->timer = -1;
+    ka->wheelSlot = -1;
     ka->client = client;
     ka->sendCB = sendCB;
     ka->deadCB = deadCB;
     ka->freeCB = freeCB;
+    if (wheel)
+        ka->wheel = virObjectRef(wheel);
 
     PROBE(RPC_KEEPALIVE_NEW,
           "ka=%p client=%p",
@@ -245,6 +567,7 @@ virKeepAliveDispose(void *obj)
     virKeepAlivePtr ka = obj;
 
     virMutexDestroy(&ka->lock);
+    virObjectUnref(ka->wheel);
     ka->freeCB(ka->client);
 }
 
@@ -288,13 +611,19 @@ virKeepAliveStart(virKeepAlivePtr ka,
           "ka=%p client=%p interval=%d count=%u",
           ka, ka->client, interval, count);
 
-    now = time(NULL);
+    now = virKeepAliveNow();
     delay = now - ka->lastPacketReceived;
     if (delay > ka->interval)
         timeout = 0;
     else
         timeout = ka->interval - delay;
     ka->intervalStart = now - (ka->interval - timeout);
+
+    if (ka->wheel) {
+        ret = virKeepAliveWheelAdd(ka->wheel, ka, now + timeout);
+        goto cleanup;
+    }
+
     ka->timer = virEventAddTimeout(timeout * 1000, virKeepAliveTimer,
                                    ka, virObjectFreeCallback);
     if (ka->timer < 0)
@@ -324,6 +653,9 @@ virKeepAliveStop(virKeepAlivePtr ka)
         ka->timer = -1;
     }
 
+    if (ka->wheel)
+        virKeepAliveWheelRemove(ka->wheel, ka);
+
     virKeepAliveUnlock(ka);
 }
 
@@ -341,7 +673,7 @@ virKeepAliveTimeout(virKeepAlivePtr ka)
     if (ka->interval <= 0 || ka->intervalStart == 0) {
         timeout = -1;
     } else {
-        timeout = ka->interval - (time(NULL) - ka->intervalStart);
+        timeout = ka->interval - (virKeepAliveNow() - ka->intervalStart);
         if (timeout < 0)
             timeout = 0;
     }
@@ -390,7 +722,7 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
     virKeepAliveLock(ka);
 
     ka->countToDeath = ka->count;
-    ka->lastPacketReceived = ka->intervalStart = time(NULL);
+    ka->lastPacketReceived = ka->intervalStart = virKeepAliveNow();
 
     if (msg->header.prog == KEEPALIVE_PROGRAM &&
         msg->header.vers == KEEPALIVE_PROTOCOL_VERSION &&
@@ -33,15 +33,20 @@ typedef void (*virKeepAliveFreeFunc)(void *client);
 typedef struct _virKeepAlive virKeepAlive;
 typedef virKeepAlive *virKeepAlivePtr;
 
+typedef struct _virKeepAliveWheel virKeepAliveWheel;
+typedef virKeepAliveWheel *virKeepAliveWheelPtr;
+
+virKeepAliveWheelPtr virKeepAliveWheelNew(void);
 
 virKeepAlivePtr virKeepAliveNew(int interval,
                                 unsigned int count,
+                                virKeepAliveWheelPtr wheel,
                                 void *client,
                                 virKeepAliveSendFunc sendCB,
                                 virKeepAliveDeadFunc deadCB,
                                 virKeepAliveFreeFunc freeCB)
-                                ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4)
-                                ATTRIBUTE_NONNULL(5) ATTRIBUTE_NONNULL(6);
+                                ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5)
+                                ATTRIBUTE_NONNULL(6) ATTRIBUTE_NONNULL(7);
 
 int virKeepAliveStart(virKeepAlivePtr ka,
                       int interval,
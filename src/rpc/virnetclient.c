@@ -36,6 +36,7 @@
 #include "logging.h"
 #include "util.h"
 #include "virterror_internal.h"
+#include "event.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -55,6 +56,13 @@ struct _virNetClientCall {
     bool expectReply;
     bool nonBlock;
     bool haveThread;
+    bool batched; /* freed by the thread sending the batch */
+
+    /* For asynchronous calls, which no thread waits for */
+    virNetClientPtr client;
+    virNetClientReplyFunc replyFunc;
+    void *replyOpaque;
+    int result;
 
     virCond cond;
 
@@ -78,6 +86,8 @@ struct _virNetClient {
 
     /* For incoming message packets */
     virNetMessage msg;
+    /* The fragmented reply being put together, if any */
+    virNetMessagePtr fragments;
 
 #if HAVE_SASL
     virNetSASLSessionPtr sasl;
@@ -91,11 +101,21 @@ struct _virNetClient {
      * List of calls currently waiting for dispatch
      * The calls should all have threads waiting for
      * them, except possibly the first call in the list
-     * which might be a partially sent non-blocking call.
+     * which might be a partially sent non-blocking call,
+     * the calls of a batch, which are all waited for
+     * by the thread sending the batch, and asynchronous
+     * calls.
      */
     virNetClientCallPtr waitDispatch;
     /* True if a thread holds the buck */
     bool haveTheBuck;
+    /* True while a dedicated thread holds the buck for good */
+    bool ioThread;
+
+    /* Asynchronous calls which are finished, and whose
+     * callbacks the event loop is yet to run */
+    virNetClientCallPtr asyncDone;
+    int asyncTimer;
 
     size_t nstreams;
     virNetClientStreamPtr *streams;
@@ -104,6 +124,10 @@ struct _virNetClient {
     bool wantClose;
     int closeReason;
 
+    /* Calls larger than this are compressed, 0 if the
+     * server did not agree to compression */
+    size_t compressThreshold;
+
     virNetClientCloseFunc closeCb;
     void *closeOpaque;
     virFreeCallback closeFf;
@@ -131,6 +155,9 @@ static int virNetClientQueueNonBlocking(virNetClientPtr client,
                                         virNetMessagePtr msg);
 static void virNetClientCloseInternal(virNetClientPtr client,
                                       int reason);
+static void virNetClientIOUpdateCallback(virNetClientPtr client,
+                                         bool enableCallback);
+static void virNetClientIOThread(void *opaque);
 
 
 static void virNetClientLock(virNetClientPtr client)
@@ -287,6 +314,19 @@ virNetClientKeepAliveStop(virNetClientPtr client)
     virNetClientUnlock(client);
 }
 
+/*
+ * Compress calls larger than @threshold bytes from now on. Only
+ * to be used once the server agreed to compression.
+ */
+void
+virNetClientSetCompression(virNetClientPtr client,
+                           size_t threshold)
+{
+    virNetClientLock(client);
+    client->compressThreshold = threshold;
+    virNetClientUnlock(client);
+}
+
 static void
 virNetClientKeepAliveDeadCB(void *opaque)
 {
@@ -332,6 +372,7 @@ static virNetClientPtr virNetClientNew(virNetSocketPtr sock,
     client->wakeupReadFD = wakeupFD[0];
     client->wakeupSendFD = wakeupFD[1];
     wakeupFD[0] = wakeupFD[1] = -1;
+    client->asyncTimer = -1;
 
     if (hostname &&
         !(client->hostname = strdup(hostname)))
@@ -563,7 +604,7 @@ int virNetClientRegisterKeepAlive(virNetClientPtr client)
 
     /* Keepalive protocol consists of async messages so it can only be used
      * if the client supports them */
-    if (!(ka = virKeepAliveNew(-1, 0, client,
+    if (!(ka = virKeepAliveNew(-1, 0, NULL, client,
                                virNetClientKeepAliveSendCB,
                                virNetClientKeepAliveDeadCB,
                                virObjectFreeCallback)))
@@ -633,6 +674,7 @@ void virNetClientDispose(void *obj)
 #endif
 
     virNetMessageClear(&client->msg);
+    virNetMessageFree(client->fragments);
 
     virNetClientUnlock(client);
     virMutexDestroy(&client->lock);
@@ -673,6 +715,10 @@ virNetClientCloseLocked(virNetClientPtr client)
     client->keepalive = NULL;
     client->wantClose = false;
 
+    /* Let the timer fail the asynchronous calls left, and go away */
+    if (client->asyncTimer != -1)
+        virEventUpdateTimeout(client->asyncTimer, 0);
+
     if (ka || client->closeCb) {
         virNetClientCloseFunc closeCb = client->closeCb;
         void *closeOpaque = client->closeOpaque;
@@ -733,6 +779,62 @@ void virNetClientClose(virNetClientPtr client)
 }
 
 
+/*
+ * Hand all the I/O on the client to a thread of its own. Threads
+ * making calls then only queue them and sleep until the I/O thread
+ * got their reply, rather than taking turns at polling the socket,
+ * so that many threads sharing a client can have their calls in
+ * flight at the same time. The thread lives until the client is
+ * closed, and must not be started while calls are in progress.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetClientStartIOThread(virNetClientPtr client)
+{
+    virThread thread;
+    int ret = -1;
+
+    virNetClientLock(client);
+
+    if (client->ioThread) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    if (client->haveTheBuck) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("cannot start I/O thread while calls are in progress"));
+        goto cleanup;
+    }
+
+    virObjectRef(client);
+    if (virThreadCreate(&thread, false, virNetClientIOThread, client) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create I/O thread"));
+        virObjectUnref(client);
+        goto cleanup;
+    }
+
+    client->ioThread = true;
+    client->haveTheBuck = true;
+
+    /* The event loop has nothing left to do for us */
+    virNetClientIOUpdateCallback(client, false);
+
+    ret = 0;
+
+cleanup:
+    virNetClientUnlock(client);
+    return ret;
+}
+
+
 #if HAVE_SASL
 void virNetClientSetSASLSession(virNetClientPtr client,
                                 virNetSASLSessionPtr sasl)
@@ -745,6 +847,20 @@ void virNetClientSetSASLSession(virNetClientPtr client,
 #endif
 
 
+/* Must only be called once the reply to the call setting up the
+ * shared memory was received, and before any other call is sent */
+int virNetClientSetShmSession(virNetClientPtr client,
+                              virNetShmSessionPtr shm)
+{
+    int ret;
+
+    virNetClientLock(client);
+    ret = virNetSocketSetShmSession(client->sock, shm);
+    virNetClientUnlock(client);
+    return ret;
+}
+
+
 int virNetClientSetTLSSession(virNetClientPtr client,
                               virNetTLSContextPtr tls)
 {
@@ -765,8 +881,11 @@ int virNetClientSetTLSSession(virNetClientPtr client,
 
     virNetClientLock(client);
 
+    /* The address tells apart servers sharing a name, so that a
+     * session is only resumed with the one it was made with */
     if (!(client->tls = virNetTLSSessionNew(tls,
-                                            client->hostname)))
+                                            client->hostname,
+                                            virNetSocketRemoteAddrString(client->sock))))
         goto error;
 
     virNetSocketSetTLSSession(client->sock, client->tls);
@@ -987,12 +1106,13 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0) {
-        virReportOOMError();
-        return -1;
-    }
+    /* Hand the reply buffer over rather than copying it */
+    virNetMessageFreeBuffer(thecall->msg);
+    thecall->msg->buffer = client->msg.buffer;
+    thecall->msg->bufferAlloc = client->msg.bufferAlloc;
+    client->msg.buffer = NULL;
+    client->msg.bufferAlloc = 0;
 
-    memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
     memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
     thecall->msg->bufferLength = client->msg.bufferLength;
     thecall->msg->bufferOffset = client->msg.bufferOffset;
@@ -1062,7 +1182,8 @@ static int virNetClientCallDispatchStream(virNetClientPtr client)
     /* Status is either
      *   - REMOTE_OK - no payload for streams
      *   - REMOTE_ERROR - followed by a remote_error struct
-     *   - REMOTE_CONTINUE - followed by a raw data packet
+     *   - REMOTE_CONTINUE - followed by a raw data packet,
+     *     or by a virNetStreamHole for a hole
      */
     switch (client->msg.header.status) {
     case VIR_NET_CONTINUE: {
@@ -1126,6 +1247,15 @@ virNetClientCallDispatch(virNetClientPtr client)
           client->msg.header.prog, client->msg.header.vers, client->msg.header.proc,
           client->msg.header.type, client->msg.header.status, client->msg.header.serial);
 
+    /* Nothing comes in between the fragments of a reply */
+    if (client->fragments ||
+        (client->msg.header.type & VIR_NET_MESSAGE_FRAGMENT)) {
+        int rv = virNetMessageAddFragment(&client->fragments, &client->msg);
+        if (rv <= 0)
+            return rv;
+        return virNetClientCallDispatchReply(client);
+    }
+
     if (virKeepAliveCheckMessage(client->keepalive, &client->msg, &response)) {
         if (response &&
             virNetClientQueueNonBlocking(client, response) < 0) {
@@ -1144,6 +1274,7 @@ virNetClientCallDispatch(virNetClientPtr client)
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Sparse stream protocol */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1184,7 +1315,7 @@ virNetClientIOWriteMessage(virNetClientPtr client,
         }
         thecall->msg->donefds = 0;
         thecall->msg->bufferOffset = thecall->msg->bufferLength = 0;
-        VIR_FREE(thecall->msg->buffer);
+        virNetMessageFreeBuffer(thecall->msg);
         if (thecall->expectReply)
             thecall->mode = VIR_NET_CLIENT_MODE_WAIT_RX;
         else
@@ -1233,10 +1364,9 @@ virNetClientIOReadMessage(virNetClientPtr client)
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
         client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0) {
-            virReportOOMError();
+        if (virNetMessageAllocBuffer(&client->msg,
+                                     client->msg.bufferLength) < 0)
             return -ENOMEM;
-        }
     }
 
     wantData = client->msg.bufferLength - client->msg.bufferOffset;
@@ -1314,7 +1444,7 @@ virNetClientIOHandleInput(virNetClientPtr client)
 
                 ret = virNetClientCallDispatch(client);
                 client->msg.bufferOffset = client->msg.bufferLength = 0;
-                VIR_FREE(client->msg.buffer);
+                virNetMessageFreeBuffer(&client->msg);
                 /*
                  * We've completed one call, but we don't want to
                  * spin around the loop forever if there are many
@@ -1341,6 +1471,75 @@ virNetClientIOHandleInput(virNetClientPtr client)
 }
 
 
+static bool virNetClientAsyncPending(virNetClientCallPtr call,
+                                     void *opaque ATTRIBUTE_UNUSED)
+{
+    return call->replyFunc != NULL;
+}
+
+
+/*
+ * Run the callbacks of the asynchronous calls which are finished,
+ * without the client lock held. Once the client is closed, all of
+ * them are failed, and the timer goes away.
+ */
+static void virNetClientAsyncTimer(int timer ATTRIBUTE_UNUSED,
+                                   void *opaque)
+{
+    virNetClientPtr client = opaque;
+    virNetClientCallPtr calls;
+
+    virNetClientLock(client);
+    calls = client->asyncDone;
+    client->asyncDone = NULL;
+    /* Calls may still be queued if a thread is yet to fail them */
+    if (client->sock ||
+        virNetClientCallMatchPredicate(client->waitDispatch,
+                                       virNetClientAsyncPending,
+                                       NULL)) {
+        virEventUpdateTimeout(client->asyncTimer, -1);
+    } else {
+        virEventRemoveTimeout(client->asyncTimer);
+        client->asyncTimer = -1;
+    }
+    virObjectRef(client);
+    virNetClientUnlock(client);
+
+    while (calls) {
+        virNetClientCallPtr call = calls;
+        calls = call->next;
+
+        VIR_DEBUG("Dispatching asynchronous call %p result=%d",
+                  call, call->result);
+        virResetLastError();
+        if (call->result < 0)
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+        (call->replyFunc)(client, call->msg, call->result, call->replyOpaque);
+
+        ignore_value(virCondDestroy(&call->cond));
+        VIR_FREE(call);
+    }
+
+    virObjectUnref(client);
+}
+
+
+/*
+ * Hand an asynchronous call which is finished over to the event
+ * loop, for it to run the callback.
+ */
+static void virNetClientAsyncDone(virNetClientCallPtr call,
+                                  int result)
+{
+    virNetClientPtr client = call->client;
+
+    call->result = result;
+    virNetClientCallQueue(&client->asyncDone, call);
+    virEventUpdateTimeout(client->asyncTimer, 0);
+}
+
+
 static bool virNetClientIOEventLoopPollEvents(virNetClientCallPtr call,
                                               void *opaque)
 {
@@ -1379,6 +1578,11 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
     if (call->haveThread) {
         VIR_DEBUG("Waking up sleep %p", call);
         virCondSignal(&call->cond);
+    } else if (call->batched) {
+        VIR_DEBUG("Removing completed batched call %p", call);
+    } else if (call->replyFunc) {
+        VIR_DEBUG("Completing asynchronous call %p", call);
+        virNetClientAsyncDone(call, 0);
     } else {
         VIR_DEBUG("Removing completed call %p", call);
         if (call->expectReply)
@@ -1410,6 +1614,12 @@ virNetClientIOEventLoopRemoveAll(virNetClientCallPtr call,
         return false;
 
     VIR_DEBUG("Removing call %p", call);
+    if (call->batched)
+        return true;
+    if (call->replyFunc) {
+        virNetClientAsyncDone(call, -1);
+        return true;
+    }
     ignore_value(virCondDestroy(&call->cond));
     VIR_FREE(call->msg);
     VIR_FREE(call);
@@ -1446,144 +1656,174 @@ virNetClientIOEventLoopPassTheBuck(virNetClientPtr client,
 
 
 /*
- * Process all calls pending dispatch/receive until we
- * get a reply to our own call. Then quit and pass the buck
- * to someone else.
+ * Wait for the socket to be ready, or for another thread to wake
+ * us up, then send and receive whatever it allows. Completed calls
+ * other than @thiscall are removed from the dispatch list, and
+ * their threads woken up.
  *
- * Returns 1 if the call was queued and will be completed later (only
- * for nonBlock==true), 0 if the call was completed and -1 on error.
+ * Returns the events seen on the socket, or -1 on error
  */
-static int virNetClientIOEventLoop(virNetClientPtr client,
-                                   virNetClientCallPtr thiscall)
+static int virNetClientIOEventLoopStep(virNetClientPtr client,
+                                       virNetClientCallPtr thiscall,
+                                       bool nonBlock)
 {
     struct pollfd fds[2];
+    char ignore;
+    sigset_t oldmask, blockedsigs;
+    int timeout = -1;
+    int events;
     int ret;
+    virNetMessagePtr msg = NULL;
 
     fds[0].fd = virNetSocketGetFD(client->sock);
     fds[1].fd = client->wakeupReadFD;
 
-    for (;;) {
-        char ignore;
-        sigset_t oldmask, blockedsigs;
-        int timeout = -1;
-        virNetMessagePtr msg = NULL;
-
-        /* If we have existing SASL decoded data we don't want to sleep in
-         * the poll(), just check if any other FDs are also ready.
-         * If the connection is going to be closed, we don't want to sleep in
-         * poll() either.
-         */
-        if (virNetSocketHasCachedData(client->sock) || client->wantClose)
-            timeout = 0;
+    /* If we have existing SASL decoded data we don't want to sleep in
+     * the poll(), just check if any other FDs are also ready.
+     * If the connection is going to be closed, we don't want to sleep in
+     * poll() either.
+     */
+    if (virNetSocketHasCachedData(client->sock) || client->wantClose)
+        timeout = 0;
 
-        /* If we are non-blocking, then we don't want to sleep in poll() */
-        if (thiscall->nonBlock)
-            timeout = 0;
+    /* If we are non-blocking, then we don't want to sleep in poll() */
+    if (nonBlock)
+        timeout = 0;
 
-        /* Limit timeout so that we can send keepalive request in time */
-        if (timeout == -1)
-            timeout = virKeepAliveTimeout(client->keepalive);
+    /* Limit timeout so that we can send keepalive request in time */
+    if (timeout == -1)
+        timeout = virKeepAliveTimeout(client->keepalive);
 
-        fds[0].events = fds[0].revents = 0;
-        fds[1].events = fds[1].revents = 0;
+    fds[0].events = fds[0].revents = 0;
+    fds[1].events = fds[1].revents = 0;
 
-        fds[1].events = POLLIN;
+    fds[1].events = POLLIN;
 
-        /* Calculate poll events for calls */
-        virNetClientCallMatchPredicate(client->waitDispatch,
-                                       virNetClientIOEventLoopPollEvents,
-                                       &fds[0]);
+    /* Calculate poll events for calls */
+    virNetClientCallMatchPredicate(client->waitDispatch,
+                                   virNetClientIOEventLoopPollEvents,
+                                   &fds[0]);
 
-        /* We have to be prepared to receive stream data
-         * regardless of whether any of the calls waiting
-         * for dispatch are for streams.
-         */
-        if (client->nstreams)
-            fds[0].events |= POLLIN;
+    /* We have to be prepared to receive stream data
+     * regardless of whether any of the calls waiting
+     * for dispatch are for streams. The I/O thread
+     * also takes care of events and keepalives.
+     */
+    if (client->nstreams || client->ioThread)
+        fds[0].events |= POLLIN;
 
-        /* Release lock while poll'ing so other threads
-         * can stuff themselves on the queue */
-        virNetClientUnlock(client);
+    /* With shared memory, the socket only carries wakeups */
+    events = fds[0].events;
+    fds[0].events = virNetSocketGetPollEvents(client->sock, events);
 
-        /* Block SIGWINCH from interrupting poll in curses programs,
-         * then restore the original signal mask again immediately
-         * after the call (RHBZ#567931).  Same for SIGCHLD and SIGPIPE
-         * at the suggestion of Paolo Bonzini and Daniel Berrange.
-         */
-        sigemptyset(&blockedsigs);
+    /* Release lock while poll'ing so other threads
+     * can stuff themselves on the queue */
+    virNetClientUnlock(client);
+
+    /* Block SIGWINCH from interrupting poll in curses programs,
+     * then restore the original signal mask again immediately
+     * after the call (RHBZ#567931).  Same for SIGCHLD and SIGPIPE
+     * at the suggestion of Paolo Bonzini and Daniel Berrange.
+     */
+    sigemptyset(&blockedsigs);
 #ifdef SIGWINCH
-        sigaddset(&blockedsigs, SIGWINCH);
+    sigaddset(&blockedsigs, SIGWINCH);
 #endif
 #ifdef SIGCHLD
-        sigaddset(&blockedsigs, SIGCHLD);
+    sigaddset(&blockedsigs, SIGCHLD);
 #endif
-        sigaddset(&blockedsigs, SIGPIPE);
-        ignore_value(pthread_sigmask(SIG_BLOCK, &blockedsigs, &oldmask));
+    sigaddset(&blockedsigs, SIGPIPE);
+    ignore_value(pthread_sigmask(SIG_BLOCK, &blockedsigs, &oldmask));
 
-    repoll:
-        ret = poll(fds, ARRAY_CARDINALITY(fds), timeout);
-        if (ret < 0 && (errno == EAGAIN || errno == EINTR))
-            goto repoll;
+repoll:
+    ret = poll(fds, ARRAY_CARDINALITY(fds), timeout);
+    if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+        goto repoll;
 
-        ignore_value(pthread_sigmask(SIG_SETMASK, &oldmask, NULL));
+    ignore_value(pthread_sigmask(SIG_SETMASK, &oldmask, NULL));
 
-        virNetClientLock(client);
+    virNetClientLock(client);
 
-        if (ret < 0) {
-            virReportSystemError(errno,
-                                 "%s", _("poll on socket failed"));
-            goto error;
-        }
+    if (ret < 0) {
+        virReportSystemError(errno,
+                             "%s", _("poll on socket failed"));
+        return -1;
+    }
 
-        if (virKeepAliveTrigger(client->keepalive, &msg)) {
-            virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_KEEPALIVE);
-        } else if (msg && virNetClientQueueNonBlocking(client, msg) < 0) {
-            VIR_WARN("Could not queue keepalive request");
-            virNetMessageFree(msg);
-        }
+    fds[0].revents = virNetSocketGetPollRevents(client->sock, events,
+                                                fds[0].revents);
 
-        /* If we have existing SASL decoded data, pretend
-         * the socket became readable so we consume it
-         */
-        if (virNetSocketHasCachedData(client->sock)) {
-            fds[0].revents |= POLLIN;
-        }
+    if (virKeepAliveTrigger(client->keepalive, &msg)) {
+        virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_KEEPALIVE);
+    } else if (msg && virNetClientQueueNonBlocking(client, msg) < 0) {
+        VIR_WARN("Could not queue keepalive request");
+        virNetMessageFree(msg);
+    }
 
-        /* If wantClose flag is set, pretend there was an error on the socket
-         */
-        if (client->wantClose)
-            fds[0].revents = POLLERR;
-
-        if (fds[1].revents) {
-            VIR_DEBUG("Woken up from poll by other thread");
-            if (saferead(client->wakeupReadFD, &ignore, sizeof(ignore)) != sizeof(ignore)) {
-                virReportSystemError(errno, "%s",
-                                     _("read on wakeup fd failed"));
-                virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
-                goto error;
-            }
+    /* If we have existing SASL decoded data, pretend
+     * the socket became readable so we consume it
+     */
+    if (virNetSocketHasCachedData(client->sock)) {
+        fds[0].revents |= POLLIN;
+    }
+
+    /* If wantClose flag is set, pretend there was an error on the socket
+     */
+    if (client->wantClose)
+        fds[0].revents = POLLERR;
+
+    if (fds[1].revents) {
+        VIR_DEBUG("Woken up from poll by other thread");
+        if (saferead(client->wakeupReadFD, &ignore, sizeof(ignore)) != sizeof(ignore)) {
+            virReportSystemError(errno, "%s",
+                                 _("read on wakeup fd failed"));
+            virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
+            return -1;
         }
+    }
 
-        if (fds[0].revents & POLLOUT) {
-            if (virNetClientIOHandleOutput(client) < 0) {
-                virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
-                goto error;
-            }
+    if (fds[0].revents & POLLOUT) {
+        if (virNetClientIOHandleOutput(client) < 0) {
+            virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
+            return -1;
         }
+    }
 
-        if (fds[0].revents & POLLIN) {
-            if (virNetClientIOHandleInput(client) < 0) {
-                virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
-                goto error;
-            }
+    if (fds[0].revents & POLLIN) {
+        if (virNetClientIOHandleInput(client) < 0) {
+            virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
+            return -1;
         }
+    }
 
-        /* Iterate through waiting calls and if any are
-         * complete, remove them from the dispatch list.
-         */
-        virNetClientCallRemovePredicate(&client->waitDispatch,
-                                        virNetClientIOEventLoopRemoveDone,
-                                        thiscall);
+    /* Iterate through waiting calls and if any are
+     * complete, remove them from the dispatch list.
+     */
+    virNetClientCallRemovePredicate(&client->waitDispatch,
+                                    virNetClientIOEventLoopRemoveDone,
+                                    thiscall);
+
+    return fds[0].revents;
+}
+
+
+/*
+ * Process all calls pending dispatch/receive until we
+ * get a reply to our own call. Then quit and pass the buck
+ * to someone else.
+ *
+ * Returns 1 if the call was queued and will be completed later (only
+ * for nonBlock==true), 0 if the call was completed and -1 on error.
+ */
+static int virNetClientIOEventLoop(virNetClientPtr client,
+                                   virNetClientCallPtr thiscall)
+{
+    for (;;) {
+        int revents = virNetClientIOEventLoopStep(client, thiscall,
+                                                  thiscall->nonBlock);
+
+        if (revents < 0)
+            goto error;
 
         /* Now see if *we* are done */
         if (thiscall->mode == VIR_NET_CLIENT_MODE_COMPLETE) {
@@ -1599,7 +1839,7 @@ static int virNetClientIOEventLoop(virNetClientPtr client,
             return 1;
         }
 
-        if (fds[0].revents & (POLLHUP | POLLERR)) {
+        if (revents & (POLLHUP | POLLERR)) {
             virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_EOF);
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("received hangup / error event on socket"));
@@ -1614,6 +1854,106 @@ error:
 }
 
 
+static bool
+virNetClientIOThreadRemoveAll(virNetClientCallPtr call,
+                              void *opaque)
+{
+    if (call->haveThread) {
+        VIR_DEBUG("Waking up sleep %p", call);
+        virCondSignal(&call->cond);
+        return true;
+    }
+
+    return virNetClientIOEventLoopRemoveAll(call, opaque);
+}
+
+
+/*
+ * Body of the I/O thread, which holds the buck until the client
+ * is closed, and then wakes up all the threads still waiting for
+ * a reply, for them to fail.
+ */
+static void virNetClientIOThread(void *opaque)
+{
+    virNetClientPtr client = opaque;
+
+    virNetClientLock(client);
+
+    VIR_DEBUG("I/O thread started for client %p", client);
+
+    while (client->sock) {
+        int revents = virNetClientIOEventLoopStep(client, NULL, false);
+
+        if (revents < 0 || (revents & (POLLHUP | POLLERR))) {
+            if (!client->wantClose)
+                virNetClientMarkClose(client,
+                                      revents < 0 ?
+                                      VIR_CONNECT_CLOSE_REASON_ERROR :
+                                      VIR_CONNECT_CLOSE_REASON_EOF);
+            break;
+        }
+    }
+
+    VIR_DEBUG("I/O thread exiting for client %p", client);
+
+    client->ioThread = false;
+    client->haveTheBuck = false;
+    virNetClientCloseLocked(client);
+    virNetClientCallRemovePredicate(&client->waitDispatch,
+                                    virNetClientIOThreadRemoveAll,
+                                    NULL);
+
+    virNetClientUnlock(client);
+    virObjectUnref(client);
+}
+
+
+/*
+ * Leave @thiscall to the I/O thread, which sends it and hands the
+ * reply over by serial, and sleep until it is complete. No thread
+ * but the I/O thread ever touches the socket, so the callers need
+ * not take turns at it.
+ */
+static int virNetClientIOWaitThread(virNetClientPtr client,
+                                    virNetClientCallPtr thiscall)
+{
+    char ignore = 1;
+
+    /* Get the new call into the events the thread polls for */
+    if (thiscall->mode == VIR_NET_CLIENT_MODE_WAIT_TX &&
+        safewrite(client->wakeupSendFD, &ignore, sizeof(ignore)) != sizeof(ignore)) {
+        virNetClientCallRemove(&client->waitDispatch, thiscall);
+        virReportSystemError(errno, "%s",
+                             _("failed to wake up I/O thread"));
+        return -1;
+    }
+
+    if (thiscall->nonBlock) {
+        virNetClientIODetachNonBlocking(thiscall);
+        return 1;
+    }
+
+    while (thiscall->mode != VIR_NET_CLIENT_MODE_COMPLETE) {
+        /* The thread is gone, or on its way out */
+        if (!client->ioThread) {
+            virNetClientCallRemove(&client->waitDispatch, thiscall);
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+            return -1;
+        }
+
+        if (virCondWait(&thiscall->cond, &client->lock) < 0) {
+            virNetClientCallRemove(&client->waitDispatch, thiscall);
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("failed to wait on condition"));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static bool
 virNetClientIOUpdateEvents(virNetClientCallPtr call,
                            void *opaque)
@@ -1698,7 +2038,15 @@ static void virNetClientIOUpdateCallback(virNetClientPtr client,
  *   - waitDispatch == NULL,
  *   - waitDispatch != NULL, waitDispatch.nonBlock == true
  *
- * NB(7) Don't Panic!
+ * NB(7) Calls of a batch are all queued up front, and only one
+ * of them has a thread at any time, the others being completed
+ * by whichever thread holds the buck. See virNetClientSendBatch.
+ *
+ * NB(8) Once virNetClientStartIOThread was called, the buck stays
+ * with the I/O thread, and the callers only queue their calls and
+ * sleep until the thread completed them.
+ *
+ * NB(9) Don't Panic!
  *
  * Returns 1 if the call was queued and will be completed later (only
  * for nonBlock==true), 0 if the call was completed and -1 on error.
@@ -1717,8 +2065,15 @@ static int virNetClientIO(virNetClientPtr client,
               thiscall->msg->bufferLength,
               client->waitDispatch);
 
-    /* Stick ourselves on the end of the wait queue */
-    virNetClientCallQueue(&client->waitDispatch, thiscall);
+    /* Stick ourselves on the end of the wait queue, unless we
+     * are part of a batch which was queued as a whole */
+    if (!thiscall->batched)
+        virNetClientCallQueue(&client->waitDispatch, thiscall);
+
+    if (client->ioThread) {
+        rv = virNetClientIOWaitThread(client, thiscall);
+        goto cleanup;
+    }
 
     /* Check to see if another thread is dispatching */
     if (client->haveTheBuck) {
@@ -1855,8 +2210,14 @@ void virNetClientIncomingEvent(virNetSocketPtr sock,
     virNetClientIOUpdateCallback(client, true);
 
 done:
-    if (client->wantClose)
+    if (client->wantClose) {
         virNetClientCloseLocked(client);
+        /* With no thread around, nobody else fails the calls left */
+        if (!client->haveTheBuck)
+            virNetClientCallRemovePredicate(&client->waitDispatch,
+                                            virNetClientIOEventLoopRemoveAll,
+                                            NULL);
+    }
     virNetClientUnlock(client);
 }
 
@@ -1960,6 +2321,9 @@ static int virNetClientSendInternal(virNetClientPtr client,
         return -1;
     }
 
+    if (virNetMessageCompress(msg, client->compressThreshold) < 0)
+        return -1;
+
     if (!(call = virNetClientCallNew(msg, expectReply, nonBlock))) {
         virReportOOMError();
         return -1;
@@ -2002,6 +2366,213 @@ int virNetClientSendWithReply(virNetClientPtr client,
 }
 
 
+/*
+ * @msgs: messages allocated on heap or stack
+ * @nmsgs: number of messages
+ *
+ * Send several messages, and wait for all their replies. All the
+ * messages are queued before waiting for any reply, so that the
+ * whole batch goes out in as few writes as possible and costs one
+ * round trip rather than one per message. Replies are matched to
+ * their calls by serial number, as for any other call, so each
+ * message must have its own serial.
+ *
+ * The caller is responsible for free'ing @msgs if they were
+ * allocated on the heap
+ *
+ * Returns 0 once all replies were received, -1 on failure
+ */
+int virNetClientSendWithReplyBatch(virNetClientPtr client,
+                                   virNetMessagePtr *msgs,
+                                   size_t nmsgs)
+{
+    virNetClientCallPtr *calls = NULL;
+    bool started = false;
+    bool lost = false;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(calls, nmsgs) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virNetClientLock(client);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < nmsgs ; i++) {
+        PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+              "client=%p len=%zu prog=%u vers=%u proc=%u"
+              " type=%u status=%u serial=%u",
+              client, msgs[i]->bufferLength,
+              msgs[i]->header.prog, msgs[i]->header.vers,
+              msgs[i]->header.proc, msgs[i]->header.type,
+              msgs[i]->header.status, msgs[i]->header.serial);
+
+        if (virNetMessageCompress(msgs[i], client->compressThreshold) < 0 ||
+            !(calls[i] = virNetClientCallNew(msgs[i], true, false)))
+            goto cleanup;
+        calls[i]->batched = true;
+    }
+
+    for (i = 0 ; i < nmsgs ; i++)
+        virNetClientCallQueue(&client->waitDispatch, calls[i]);
+    started = true;
+
+    /* Wait for each call in turn. Whoever holds the buck meanwhile
+     * completes any of them, so most are done by the time we get
+     * to them. */
+    for (i = 0 ; i < nmsgs ; i++) {
+        if (calls[i]->mode == VIR_NET_CLIENT_MODE_COMPLETE)
+            continue;
+
+        /* Calls left behind by a close are no longer queued */
+        if (!client->sock || client->wantClose) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+            goto cleanup;
+        }
+
+        calls[i]->haveThread = true;
+        if (virNetClientIO(client, calls[i]) < 0)
+            goto cleanup;
+        calls[i]->haveThread = false;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < nmsgs && calls[i] ; i++) {
+        /* Dropping a call which is already on the wire leaves its
+         * reply without a taker, so the stream is lost anyway */
+        if (started &&
+            calls[i]->mode != VIR_NET_CLIENT_MODE_COMPLETE &&
+            (calls[i]->mode != VIR_NET_CLIENT_MODE_WAIT_TX ||
+             calls[i]->msg->bufferOffset != 0))
+            lost = true;
+        virNetClientCallRemove(&client->waitDispatch, calls[i]);
+        ignore_value(virCondDestroy(&calls[i]->cond));
+        VIR_FREE(calls[i]);
+    }
+    VIR_FREE(calls);
+
+    if (lost && client->sock && !client->wantClose) {
+        virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
+        if (client->haveTheBuck) {
+            char ignore = 1;
+            size_t len = sizeof(ignore);
+
+            if (safewrite(client->wakeupSendFD, &ignore, len) != len)
+                VIR_ERROR(_("failed to wake up polling thread"));
+        } else {
+            virNetClientIOEventLoopPassTheBuck(client, NULL);
+        }
+    }
+    virNetClientUnlock(client);
+    return ret;
+}
+
+
+/*
+ * @msg: a message allocated on the heap
+ * @func: called from the event loop once the call is finished
+ * @opaque: data for @func
+ *
+ * Send a message asynchronously, and return without waiting for the
+ * reply. The event loop calls @func when the reply arrived, which it
+ * stores in @msg, or with a @result of -1 if the client was closed
+ * first. Ownership of @msg passes to @func, which must free it. This
+ * lets a single thread have many calls in flight.
+ *
+ * The client needs to be registered with the event loop.
+ *
+ * Returns 0 if the call was queued, -1 on failure, in which case the
+ * caller keeps @msg and @func is not called
+ */
+int virNetClientSendWithReplyAsync(virNetClientPtr client,
+                                   virNetMessagePtr msg,
+                                   virNetClientReplyFunc func,
+                                   void *opaque)
+{
+    virNetClientCallPtr call = NULL;
+    int ret = -1;
+
+    PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+          "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+          client, msg->bufferLength,
+          msg->header.prog, msg->header.vers, msg->header.proc,
+          msg->header.type, msg->header.status, msg->header.serial);
+
+    virNetClientLock(client);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    if (!client->asyncIO) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to make asynchronous calls without async IO support"));
+        goto cleanup;
+    }
+
+    if (client->asyncTimer == -1) {
+        virObjectRef(client);
+        if ((client->asyncTimer =
+             virEventAddTimeout(-1,
+                                virNetClientAsyncTimer,
+                                client,
+                                virObjectFreeCallback)) < 0) {
+            virObjectUnref(client);
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to register asynchronous call timer"));
+            goto cleanup;
+        }
+    }
+
+    if (virNetMessageCompress(msg, client->compressThreshold) < 0 ||
+        !(call = virNetClientCallNew(msg, true, false)))
+        goto cleanup;
+
+    call->client = client;
+    call->replyFunc = func;
+    call->replyOpaque = opaque;
+    virNetClientCallQueue(&client->waitDispatch, call);
+
+    /* Whoever holds the buck sends the call along with its own,
+     * otherwise the event loop does once the socket is writable */
+    if (client->haveTheBuck) {
+        char ignore = 1;
+
+        if (safewrite(client->wakeupSendFD, &ignore, sizeof(ignore)) != sizeof(ignore)) {
+            virNetClientCallRemove(&client->waitDispatch, call);
+            virReportSystemError(errno, "%s",
+                                 _("failed to wake up polling thread"));
+            goto cleanup;
+        }
+    } else {
+        virNetClientIOUpdateCallback(client, true);
+    }
+
+    call = NULL;
+    ret = 0;
+
+cleanup:
+    if (call) {
+        ignore_value(virCondDestroy(&call->cond));
+        VIR_FREE(call);
+    }
+    virNetClientUnlock(client);
+    return ret;
+}
+
+
 /*
  * @msg: a message allocated on heap or stack
  *
@@ -2074,5 +2645,10 @@ int virNetClientSendWithReplyStream(virNetClientPtr client,
     virNetClientUnlock(client);
     if (ret < 0)
         return -1;
+
+    /* An error reply may have been dispatched by another thread,
+     * which raised it in its own context rather than ours */
+    if (virNetClientStreamRaiseError(st))
+        return -1;
     return 0;
 }
@@ -25,6 +25,7 @@
 
 # include "virnettlscontext.h"
 # include "virnetmessage.h"
+# include "virnetshmsession.h"
 # ifdef HAVE_SASL
 #  include "virnetsaslcontext.h"
 # endif
@@ -92,6 +93,20 @@ void virNetClientRemoveStream(virNetClientPtr client,
 int virNetClientSendWithReply(virNetClientPtr client,
                               virNetMessagePtr msg);
 
+int virNetClientSendWithReplyBatch(virNetClientPtr client,
+                                   virNetMessagePtr *msgs,
+                                   size_t nmsgs);
+
+typedef void (*virNetClientReplyFunc)(virNetClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int result,
+                                      void *opaque);
+
+int virNetClientSendWithReplyAsync(virNetClientPtr client,
+                                   virNetMessagePtr msg,
+                                   virNetClientReplyFunc func,
+                                   void *opaque);
+
 int virNetClientSendNoReply(virNetClientPtr client,
                             virNetMessagePtr msg);
 
@@ -107,6 +122,9 @@ void virNetClientSetSASLSession(virNetClientPtr client,
                                 virNetSASLSessionPtr sasl);
 # endif
 
+int virNetClientSetShmSession(virNetClientPtr client,
+                              virNetShmSessionPtr shm);
+
 int virNetClientSetTLSSession(virNetClientPtr client,
                               virNetTLSContextPtr tls);
 
@@ -120,6 +138,8 @@ int virNetClientGetTLSKeySize(virNetClientPtr client);
 
 void virNetClientClose(virNetClientPtr client);
 
+int virNetClientStartIOThread(virNetClientPtr client);
+
 bool virNetClientKeepAliveIsSupported(virNetClientPtr client);
 int virNetClientKeepAliveStart(virNetClientPtr client,
                                int interval,
@@ -127,4 +147,7 @@ int virNetClientKeepAliveStart(virNetClientPtr client,
 
 void virNetClientKeepAliveStop(virNetClientPtr client);
 
+void virNetClientSetCompression(virNetClientPtr client,
+                                size_t threshold);
+
 #endif /* __VIR_NET_CLIENT_H__ */
@@ -267,6 +267,37 @@ cleanup:
 }
 
 
+static int virNetClientProgramCheckReply(virNetMessagePtr msg,
+                                         unsigned serial,
+                                         int proc)
+{
+    /* None of these 3 should ever happen here, because
+     * virNetClientSend should have validated the reply,
+     * but it doesn't hurt to check again.
+     */
+    if (msg->header.type != VIR_NET_REPLY &&
+        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message type %d"), msg->header.type);
+        return -1;
+    }
+    if (msg->header.proc != proc) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message proc %d != %d"),
+                       msg->header.proc, proc);
+        return -1;
+    }
+    if (msg->header.serial != serial) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message serial %d != %d"),
+                       msg->header.serial, serial);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int virNetClientProgramCall(virNetClientProgramPtr prog,
                             virNetClientPtr client,
                             unsigned serial,
@@ -286,6 +317,14 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (ninfds)
         *ninfds = 0;
 
+    /* Checked up front, since failing to send them
+     * would leave the connection unusable */
+    if (noutfds && !virNetClientHasPassFD(client)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Passing file descriptors is not supported on this connection"));
+        return -1;
+    }
+
     if (!(msg = virNetMessageNew(false)))
         return -1;
 
@@ -330,28 +369,8 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (virNetClientSendWithReply(client, msg) < 0)
         goto error;
 
-    /* None of these 3 should ever happen here, because
-     * virNetClientSend should have validated the reply,
-     * but it doesn't hurt to check again.
-     */
-    if (msg->header.type != VIR_NET_REPLY &&
-        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message type %d"), msg->header.type);
-        goto error;
-    }
-    if (msg->header.proc != proc) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message proc %d != %d"),
-                       msg->header.proc, proc);
+    if (virNetClientProgramCheckReply(msg, serial, proc) < 0)
         goto error;
-    }
-    if (msg->header.serial != serial) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message serial %d != %d"),
-                       msg->header.serial, serial);
-        goto error;
-    }
 
     switch (msg->header.status) {
     case VIR_NET_OK:
@@ -405,3 +424,213 @@ error:
     }
     return -1;
 }
+
+
+/*
+ * Make several calls without any file descriptors, sending them all
+ * before waiting for the first reply. The outcome of each call is
+ * stored in its @result, so that a call failing, eg because the
+ * object it refers to has gone away meanwhile, does not spoil the
+ * rest of the batch; the error of the last failed call is left set.
+ *
+ * Returns 0 if the batch was exchanged with the server, -1 if not,
+ * in which case none of the calls has a result.
+ */
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 virNetClientProgramBatchCallPtr calls,
+                                 size_t ncalls)
+{
+    virNetMessagePtr *msgs = NULL;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0 ; i < ncalls ; i++)
+        calls[i].result = -1;
+
+    if (VIR_ALLOC_N(msgs, ncalls) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0 ; i < ncalls ; i++) {
+        if (!(msgs[i] = virNetMessageNew(false)))
+            goto cleanup;
+
+        msgs[i]->header.prog = prog->program;
+        msgs[i]->header.vers = prog->version;
+        msgs[i]->header.status = VIR_NET_OK;
+        msgs[i]->header.type = VIR_NET_CALL;
+        msgs[i]->header.serial = calls[i].serial;
+        msgs[i]->header.proc = calls[i].proc;
+
+        if (virNetMessageEncodeHeader(msgs[i]) < 0)
+            goto cleanup;
+
+        if (virNetMessageEncodePayload(msgs[i], calls[i].args_filter,
+                                       calls[i].args) < 0)
+            goto cleanup;
+    }
+
+    if (virNetClientSendWithReplyBatch(client, msgs, ncalls) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ncalls ; i++) {
+        virNetMessagePtr msg = msgs[i];
+
+        if (virNetClientProgramCheckReply(msg, calls[i].serial,
+                                          calls[i].proc) < 0)
+            continue;
+
+        switch (msg->header.status) {
+        case VIR_NET_OK:
+            if (virNetMessageDecodePayload(msg, calls[i].ret_filter,
+                                           calls[i].ret) < 0)
+                continue;
+            calls[i].result = 0;
+            break;
+
+        case VIR_NET_ERROR:
+            virNetClientProgramDispatchError(prog, msg);
+            break;
+
+        default:
+            virReportError(VIR_ERR_RPC,
+                           _("Unexpected message status %d"),
+                           msg->header.status);
+            break;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < ncalls ; i++)
+        virNetMessageFree(msgs[i]);
+    VIR_FREE(msgs);
+    return ret;
+}
+
+
+typedef struct _virNetClientProgramAsyncCall virNetClientProgramAsyncCall;
+typedef virNetClientProgramAsyncCall *virNetClientProgramAsyncCallPtr;
+
+struct _virNetClientProgramAsyncCall {
+    virNetClientProgramPtr prog;
+    unsigned serial;
+    int proc;
+    xdrproc_t ret_filter;
+    void *ret;
+
+    virNetClientProgramCallFunc func;
+    void *opaque;
+};
+
+
+static void
+virNetClientProgramAsyncReply(virNetClientPtr client ATTRIBUTE_UNUSED,
+                              virNetMessagePtr msg,
+                              int result,
+                              void *opaque)
+{
+    virNetClientProgramAsyncCallPtr call = opaque;
+    int ret = -1;
+
+    if (result < 0)
+        goto cleanup;
+
+    if (virNetClientProgramCheckReply(msg, call->serial, call->proc) < 0)
+        goto cleanup;
+
+    switch (msg->header.status) {
+    case VIR_NET_OK:
+        if (virNetMessageDecodePayload(msg, call->ret_filter, call->ret) < 0)
+            goto cleanup;
+        ret = 0;
+        break;
+
+    case VIR_NET_ERROR:
+        virNetClientProgramDispatchError(call->prog, msg);
+        break;
+
+    default:
+        virReportError(VIR_ERR_RPC,
+                       _("Unexpected message status %d"), msg->header.status);
+        break;
+    }
+
+cleanup:
+    (call->func)(ret, call->opaque);
+
+    virNetMessageFree(msg);
+    virObjectUnref(call->prog);
+    VIR_FREE(call);
+}
+
+
+/*
+ * Make a call without any file descriptors, and return as soon as
+ * it is queued. @func is called from the event loop once the reply
+ * was decoded into @ret, with a @result of 0, or with -1 and the
+ * error set if the call failed. @args may be freed on return, but
+ * @ret must stay around until @func is called.
+ *
+ * Returns 0 if the call was queued, -1 on error, in which case
+ * @func is not called
+ */
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, void *ret,
+                                 virNetClientProgramCallFunc func,
+                                 void *opaque)
+{
+    virNetClientProgramAsyncCallPtr call = NULL;
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.status = VIR_NET_OK;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = serial;
+    msg->header.proc = proc;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto error;
+
+    if (virNetMessageEncodePayload(msg, args_filter, args) < 0)
+        goto error;
+
+    if (VIR_ALLOC(call) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    call->prog = virObjectRef(prog);
+    call->serial = serial;
+    call->proc = proc;
+    call->ret_filter = ret_filter;
+    call->ret = ret;
+    call->func = func;
+    call->opaque = opaque;
+
+    if (virNetClientSendWithReplyAsync(client, msg,
+                                       virNetClientProgramAsyncReply,
+                                       call) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    if (call) {
+        virObjectUnref(call->prog);
+        VIR_FREE(call);
+    }
+    virNetMessageFree(msg);
+    return -1;
+}
@@ -81,6 +81,37 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
                             xdrproc_t args_filter, void *args,
                             xdrproc_t ret_filter, void *ret);
 
+typedef struct _virNetClientProgramBatchCall virNetClientProgramBatchCall;
+typedef virNetClientProgramBatchCall *virNetClientProgramBatchCallPtr;
+
+struct _virNetClientProgramBatchCall {
+    unsigned serial;
+    int proc;
+    xdrproc_t args_filter;
+    void *args;
+    xdrproc_t ret_filter;
+    void *ret;
+
+    int result; /* 0 if @ret was filled in, -1 on error */
+};
+
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 virNetClientProgramBatchCallPtr calls,
+                                 size_t ncalls);
+
+typedef void (*virNetClientProgramCallFunc)(int result,
+                                            void *opaque);
+
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, void *ret,
+                                 virNetClientProgramCallFunc func,
+                                 void *opaque);
+
 
 
 #endif /* __VIR_NET_CLIENT_PROGRAM_H__ */
@@ -32,6 +32,13 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* A hole found @offset bytes into the incoming data */
+typedef struct _virNetClientStreamHole virNetClientStreamHole;
+struct _virNetClientStreamHole {
+    size_t offset;
+    long long length;
+};
+
 struct _virNetClientStream {
     virObject object;
 
@@ -40,6 +47,8 @@ struct _virNetClientStream {
     virNetClientProgramPtr prog;
     int proc;
     unsigned serial;
+    /* Whether holes may be sent and received */
+    bool allowSkip;
 
     virError err;
 
@@ -55,6 +64,9 @@ struct _virNetClientStream {
     size_t incomingLength;
     bool incomingEOF;
 
+    virNetClientStreamHole *holes;
+    size_t nholes;
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -88,7 +100,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incomingOffset || st->nholes || st->incomingEOF) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -111,7 +123,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incomingOffset || st->nholes || st->incomingEOF))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -138,7 +150,8 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
 virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
                                             int proc,
-                                            unsigned serial)
+                                            unsigned serial,
+                                            bool allowSkip)
 {
     virNetClientStreamPtr st;
 
@@ -151,6 +164,7 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
     st->prog = prog;
     st->proc = proc;
     st->serial = serial;
+    st->allowSkip = allowSkip;
 
     if (virMutexInit(&st->lock) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -170,6 +184,7 @@ void virNetClientStreamDispose(void *obj)
 
     virResetError(&st->err);
     VIR_FREE(st->incoming);
+    VIR_FREE(st->holes);
     virMutexDestroy(&st->lock);
     virObjectUnref(st->prog);
 }
@@ -270,6 +285,50 @@ cleanup:
 }
 
 
+static int
+virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                            virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    virNetClientStreamHole hole;
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        return -1;
+    }
+
+    memset(&data, 0, sizeof(data));
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    /* An empty hole would read back as the end of the stream */
+    if (data.length <= 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("Invalid stream hole length %lld"),
+                       (long long)data.length);
+        return -1;
+    }
+
+    /* Holes with no data between them add up */
+    if (st->nholes &&
+        st->holes[st->nholes - 1].offset == st->incomingOffset) {
+        st->holes[st->nholes - 1].length += data.length;
+        return 0;
+    }
+
+    hole.offset = st->incomingOffset;
+    hole.length = data.length;
+    if (VIR_APPEND_ELEMENT(st->holes, st->nholes, hole) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg)
 {
@@ -277,6 +336,16 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     size_t need;
 
     virMutexLock(&st->lock);
+
+    if (msg->header.type == VIR_NET_STREAM_HOLE) {
+        if (virNetClientStreamQueueHole(st, msg) < 0)
+            goto cleanup;
+        VIR_DEBUG("Stream incoming hole at offset %zu", st->incomingOffset);
+        virNetClientStreamEventTimerUpdate(st);
+        ret = 0;
+        goto cleanup;
+    }
+
     need = msg->bufferLength - msg->bufferOffset;
     if (need) {
         size_t avail = st->incomingLength - st->incomingOffset;
@@ -364,17 +433,109 @@ error:
     return -1;
 }
 
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg = NULL;
+    virNetStreamHole data;
+    int ret = -1;
+
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    virMutexLock(&st->lock);
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Holes are not supported with this stream"));
+        virMutexUnlock(&st->lock);
+        goto cleanup;
+    }
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virMutexUnlock(&st->lock);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    /* Like data packets, holes are fire&forget */
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length)
+{
+    int ret = -1;
+
+    virMutexLock(&st->lock);
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Holes are not supported with this stream"));
+        goto cleanup;
+    }
+
+    *length = 0;
+    if (st->nholes && st->holes[0].offset == 0) {
+        *length = st->holes[0].length;
+        VIR_DELETE_ELEMENT(st->holes, 0, st->nholes);
+    }
+
+    VIR_DEBUG("st=%p length=%lld", st, *length);
+    virNetClientStreamEventTimerUpdate(st);
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&st->lock);
+    return ret;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    size_t avail;
+    size_t i;
+
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     virMutexLock(&st->lock);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incomingOffset && !st->nholes && !st->incomingEOF) {
         virNetMessagePtr msg;
         int ret;
 
@@ -407,8 +568,12 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
     }
 
     VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
-        int want = st->incomingOffset;
+
+    /* Only the data up to the next hole can be handed out */
+    avail = st->nholes ? st->holes[0].offset : st->incomingOffset;
+
+    if (avail) {
+        int want = avail;
         if (want > nbytes)
             want = nbytes;
         memcpy(data, st->incoming, want);
@@ -419,7 +584,24 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             VIR_FREE(st->incoming);
             st->incomingOffset = st->incomingLength = 0;
         }
+        for (i = 0 ; i < st->nholes ; i++)
+            st->holes[i].offset -= want;
         rv = want;
+    } else if (st->nholes) {
+        if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+            VIR_DEBUG("Hole of %lld bytes reached", st->holes[0].length);
+            rv = -3;
+            goto cleanup;
+        }
+
+        /* The caller does not care for holes, so hand out zeros */
+        if (st->holes[0].length < nbytes)
+            nbytes = st->holes[0].length;
+        memset(data, 0, nbytes);
+        st->holes[0].length -= nbytes;
+        if (st->holes[0].length == 0)
+            VIR_DELETE_ELEMENT(st->holes, 0, st->nholes);
+        rv = nbytes;
     } else {
         rv = 0;
     }
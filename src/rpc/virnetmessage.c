@@ -22,16 +22,200 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include "virnetmessage.h"
 #include "memory.h"
 #include "virterror_internal.h"
 #include "logging.h"
+#include "threads.h"
 #include "virfile.h"
 #include "util.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+#define VIR_NET_MESSAGE_BUFFER_MAX (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)
+#define VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX \
+    (VIR_NET_MESSAGE_FRAGMENTED_MAX + VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX)
+
+/*
+ * Message buffers come in a few size classes, and the buffers of
+ * freed messages are kept around for reuse, up to a limit per class.
+ * Most messages are small, so encoding starts out with a buffer of
+ * the smallest class, and only moves on to the next class when XDR
+ * runs out of room, rather than every message paying for a buffer
+ * of the maximum size. Only the payload of fragmented replies may
+ * go beyond the largest class, and such buffers are never pooled.
+ */
+typedef struct _virNetMessageBufferClass virNetMessageBufferClass;
+typedef virNetMessageBufferClass *virNetMessageBufferClassPtr;
+
+struct _virNetMessageBufferClass {
+    size_t size;
+    size_t nfreeMax;
+
+    /* Free buffers, linked through their first bytes */
+    size_t nfree;
+    char *free;
+};
+
+static virMutex virNetMessageBufferLock;
+static virNetMessageBufferClass virNetMessageBufferClasses[] = {
+    { 4096, 256, 0, NULL },
+    { 65536, 32, 0, NULL },
+    { VIR_NET_MESSAGE_BUFFER_MAX, 4, 0, NULL },
+};
+
+static int virNetMessageOnceInit(void)
+{
+    if (virMutexInit(&virNetMessageBufferLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessage)
+
+
+/* Returns a buffer of the smallest class holding @len bytes,
+ * storing its actual size in @alloc */
+static char *virNetMessageBufferGet(size_t len, size_t *alloc)
+{
+    virNetMessageBufferClassPtr cls = NULL;
+    char *buf = NULL;
+    size_t i;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(virNetMessageBufferClasses) ; i++) {
+        if (len <= virNetMessageBufferClasses[i].size) {
+            cls = &virNetMessageBufferClasses[i];
+            break;
+        }
+    }
+
+    if (!cls) {
+        if (len > VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("message buffer of %zu bytes too large, want %d"),
+                           len, VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX);
+            return NULL;
+        }
+
+        /* No class size matches, so it is freed rather than pooled */
+        if (VIR_ALLOC_N(buf, len) < 0) {
+            virReportOOMError();
+            return NULL;
+        }
+        *alloc = len;
+        return buf;
+    }
+
+    if (virNetMessageInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virNetMessageBufferLock);
+    if (cls->free) {
+        buf = cls->free;
+        memcpy(&cls->free, buf, sizeof(cls->free));
+        cls->nfree--;
+    }
+    virMutexUnlock(&virNetMessageBufferLock);
+
+    if (!buf && VIR_ALLOC_N(buf, cls->size) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    *alloc = cls->size;
+    return buf;
+}
+
+
+/* Returns @buf to the pool, or frees it if it was not pooled
+ * (@alloc is 0) or the pool has enough of its class already */
+static void virNetMessageBufferPut(char *buf, size_t alloc)
+{
+    size_t i;
+
+    if (!buf)
+        return;
+
+    for (i = 0 ; alloc && i < ARRAY_CARDINALITY(virNetMessageBufferClasses) ; i++) {
+        virNetMessageBufferClassPtr cls = &virNetMessageBufferClasses[i];
+
+        if (cls->size != alloc)
+            continue;
+
+        virMutexLock(&virNetMessageBufferLock);
+        if (cls->nfree < cls->nfreeMax) {
+            memcpy(buf, &cls->free, sizeof(cls->free));
+            cls->free = buf;
+            cls->nfree++;
+            buf = NULL;
+        }
+        virMutexUnlock(&virNetMessageBufferLock);
+        break;
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/* Makes the buffer of @msg hold at least @len bytes, keeping its
+ * first @keep bytes. Does not touch bufferLength */
+static int virNetMessageGrowBuffer(virNetMessagePtr msg,
+                                   size_t len,
+                                   size_t keep)
+{
+    char *buf;
+    size_t alloc;
+
+    if (msg->buffer && msg->bufferAlloc >= len)
+        return 0;
+
+    if (!(buf = virNetMessageBufferGet(len, &alloc)))
+        return -1;
+
+    if (msg->buffer && keep)
+        memcpy(buf, msg->buffer, keep);
+    virNetMessageBufferPut(msg->buffer, msg->bufferAlloc);
+
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    return 0;
+}
+
+
+/* Moves the message being encoded to a buffer of the next size
+ * class, or one twice as large past the classes. Returns 1 if it
+ * was grown, 0 if it is as large as it gets already, -1 on error */
+static int virNetMessageGrowEncodeBuffer(virNetMessagePtr msg)
+{
+    size_t max = VIR_NET_MESSAGE_BUFFER_MAX;
+    size_t len = msg->bufferAlloc + 1;
+
+    if (msg->allowFragments)
+        max = VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX;
+
+    if (msg->bufferAlloc >= max)
+        return 0;
+
+    if (msg->bufferAlloc >= VIR_NET_MESSAGE_BUFFER_MAX)
+        len = MIN(msg->bufferAlloc * 2, max);
+
+    if (virNetMessageGrowBuffer(msg, len, msg->bufferOffset) < 0)
+        return -1;
+
+    VIR_DEBUG("Grew message buffer to %zu", msg->bufferAlloc);
+    msg->bufferLength = msg->bufferAlloc;
+    return 1;
+}
+
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -58,7 +242,7 @@ void virNetMessageClear(virNetMessagePtr msg)
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
-    VIR_FREE(msg->buffer);
+    virNetMessageFreeBuffer(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
 }
@@ -77,11 +261,44 @@ void virNetMessageFree(virNetMessagePtr msg)
 
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
-    VIR_FREE(msg->buffer);
+    virNetMessageFreeBuffer(msg);
     VIR_FREE(msg->fds);
     VIR_FREE(msg);
 }
 
+
+/**
+ * virNetMessageAllocBuffer:
+ * @msg: the message
+ * @len: number of bytes needed
+ *
+ * Makes sure @msg has a buffer of at least @len bytes, taking
+ * one from the pool of free buffers if possible. The previous
+ * contents of the buffer are lost. Buffers allocated otherwise
+ * are simply freed along with the message, rather than pooled.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageAllocBuffer(virNetMessagePtr msg, size_t len)
+{
+    return virNetMessageGrowBuffer(msg, len, 0);
+}
+
+
+/**
+ * virNetMessageFreeBuffer:
+ * @msg: the message
+ *
+ * Gives the buffer of @msg back to the pool of free buffers.
+ * The buffer length and offset are left untouched.
+ */
+void virNetMessageFreeBuffer(virNetMessagePtr msg)
+{
+    virNetMessageBufferPut(msg->buffer, msg->bufferAlloc);
+    msg->buffer = NULL;
+    msg->bufferAlloc = 0;
+}
+
 void virNetMessageQueuePush(virNetMessagePtr *queue, virNetMessagePtr msg)
 {
     virNetMessagePtr tmp = *queue;
@@ -141,12 +358,12 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     }
 
     /* Extend our declared buffer length and carry
-       on reading the header + payload */
-    msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+       on reading the header + payload. Small messages
+       fit in the buffer the length was read into */
+    if (virNetMessageGrowBuffer(msg, msg->bufferLength + len,
+                                msg->bufferLength) < 0)
         goto cleanup;
-    }
+    msg->bufferLength += len;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
               msg->bufferLength, len);
@@ -159,6 +376,71 @@ cleanup:
 }
 
 
+#if HAVE_ZLIB
+/* Replaces the compressed data following the header of @msg,
+ * which starts at bufferOffset, by the original data */
+static int virNetMessageDecompress(virNetMessagePtr msg)
+{
+    XDR xdr;
+    unsigned int len;
+    uLongf destLen;
+    char *buf = NULL;
+    size_t alloc;
+    int ret = -1;
+
+    xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                  msg->bufferLength - msg->bufferOffset, XDR_DECODE);
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to decode compressed data length"));
+        goto cleanup;
+    }
+
+    if (len > VIR_NET_MESSAGE_BUFFER_MAX - msg->bufferOffset) {
+        virReportError(VIR_ERR_RPC,
+                       _("compressed packet expands to %u bytes, want %zu"),
+                       len, VIR_NET_MESSAGE_BUFFER_MAX - msg->bufferOffset);
+        goto cleanup;
+    }
+
+    if (!(buf = virNetMessageBufferGet(msg->bufferOffset + len, &alloc)))
+        goto cleanup;
+    memcpy(buf, msg->buffer, msg->bufferOffset);
+
+    destLen = len;
+    if (uncompress((Bytef *)buf + msg->bufferOffset, &destLen,
+                   (Bytef *)msg->buffer + msg->bufferOffset + xdr_getpos(&xdr),
+                   msg->bufferLength - msg->bufferOffset - xdr_getpos(&xdr)) != Z_OK ||
+        destLen != len) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to decompress message"));
+        goto cleanup;
+    }
+
+    virNetMessageBufferPut(msg->buffer, msg->bufferAlloc);
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    msg->bufferLength = msg->bufferOffset + len;
+    buf = NULL;
+
+    ret = 0;
+
+cleanup:
+    virNetMessageBufferPut(buf, alloc);
+    xdr_destroy(&xdr);
+    return ret;
+}
+#else
+static int virNetMessageDecompress(virNetMessagePtr msg ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_RPC, "%s",
+                   _("received a compressed message, but compression "
+                     "is not supported"));
+    return -1;
+}
+#endif
+
+
 /*
  * @msg: the complete incoming message, whose header to decode
  *
@@ -190,6 +472,12 @@ int virNetMessageDecodeHeader(virNetMessagePtr msg)
 
     msg->bufferOffset += xdr_getpos(&xdr);
 
+    if (msg->header.type & VIR_NET_MESSAGE_COMPRESSED) {
+        msg->header.type &= ~VIR_NET_MESSAGE_COMPRESSED;
+        if (virNetMessageDecompress(msg) < 0)
+            goto cleanup;
+    }
+
     ret = 0;
 
 cleanup:
@@ -205,7 +493,9 @@ cleanup:
  * message offset ready to encode the payload. Leaves space
  * for the length field later. Upon return bufferLength will
  * refer to the total available space for message, while
- * bufferOffset will refer to current space used by header
+ * bufferOffset will refer to current space used by header.
+ * The buffer starts out small, and is grown as needed when
+ * the payload is encoded
  *
  * returns 0 if successfully encoded, -1 upon fatal error
  */
@@ -215,11 +505,9 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageGrowBuffer(msg, virNetMessageBufferClasses[0].size, 0) < 0)
         return ret;
-    }
+    msg->bufferLength = msg->bufferAlloc;
     msg->bufferOffset = 0;
 
     /* Format the header. */
@@ -338,16 +626,26 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 {
     XDR xdr;
     unsigned int msglen;
+    int rv;
 
     /* Serialise payload of the message. This assumes that
      * virNetMessageEncodeHeader has already been run, so
-     * just appends to that data */
-    xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
-                  msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
-
-    if (!(*filter)(&xdr, data)) {
-        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
-        goto error;
+     * just appends to that data. If the payload does not
+     * fit, start over with the next larger buffer */
+    for (;;) {
+        xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                      msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
+
+        if ((*filter)(&xdr, data))
+            break;
+        xdr_destroy(&xdr);
+
+        if ((rv = virNetMessageGrowEncodeBuffer(msg)) < 0)
+            return -1;
+        if (rv == 0) {
+            virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
+            return -1;
+        }
     }
 
     /* Get the length stored in buffer. */
@@ -402,40 +700,66 @@ error:
 }
 
 
-int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
-                                  const char *data,
-                                  size_t len)
+/**
+ * virNetMessageReservePayloadRaw:
+ * @msg: the message, with its header encoded
+ * @len: number of bytes of raw data to make room for
+ *
+ * Makes room for @len bytes of raw data after the header, so that
+ * the data can be read straight into the message rather than being
+ * copied in by virNetMessageEncodePayloadRaw. Once the data is in
+ * place, virNetMessageCommitPayloadRaw must be called with the
+ * number of bytes actually stored, which may be less than @len.
+ *
+ * Returns a pointer to the room, or NULL on error
+ */
+char *virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                     size_t len)
 {
-    XDR xdr;
-    unsigned int msglen;
+    if ((msg->bufferLength - msg->bufferOffset) < len) {
+        if ((VIR_NET_MESSAGE_BUFFER_MAX - msg->bufferOffset) < len) {
+            virReportError(VIR_ERR_RPC,
+                           _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
+                           len, (VIR_NET_MESSAGE_BUFFER_MAX - msg->bufferOffset));
+            return NULL;
+        }
+
+        if (virNetMessageGrowBuffer(msg, msg->bufferOffset + len,
+                                    msg->bufferOffset) < 0)
+            return NULL;
+        msg->bufferLength = msg->bufferAlloc;
+    }
 
+    return msg->buffer + msg->bufferOffset;
+}
+
+
+int virNetMessageCommitPayloadRaw(virNetMessagePtr msg,
+                                  size_t len)
+{
     if ((msg->bufferLength - msg->bufferOffset) < len) {
-        virReportError(VIR_ERR_RPC,
-                    _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
-                    len, (msg->bufferLength - msg->bufferOffset));
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Raw payload of %zu bytes exceeds the room reserved"),
+                       len);
         return -1;
     }
 
-    memcpy(msg->buffer + msg->bufferOffset, data, len);
     msg->bufferOffset += len;
+    return virNetMessageEncodePayloadEmpty(msg);
+}
 
-    /* Re-encode the length word. */
-    VIR_DEBUG("Encode length as %zu", msg->bufferOffset);
-    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
-    msglen = msg->bufferOffset;
-    if (!xdr_u_int(&xdr, &msglen)) {
-        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
-        goto error;
-    }
-    xdr_destroy(&xdr);
 
-    msg->bufferLength = msg->bufferOffset;
-    msg->bufferOffset = 0;
-    return 0;
+int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+{
+    char *buf;
 
-error:
-    xdr_destroy(&xdr);
-    return -1;
+    if (!(buf = virNetMessageReservePayloadRaw(msg, len)))
+        return -1;
+
+    memcpy(buf, data, len);
+    return virNetMessageCommitPayloadRaw(msg, len);
 }
 
 
@@ -525,3 +849,272 @@ int virNetMessageDupFD(virNetMessagePtr msg,
     }
     return fd;
 }
+
+
+/**
+ * virNetMessageFragment:
+ * @msg: a fully encoded reply, not sent yet
+ * @fragments: filled in with the messages to send ahead of @msg
+ *
+ * Splits a reply whose payload grew beyond VIR_NET_MESSAGE_MAX, as
+ * allowed by allowFragments, into fragments. All but the last part
+ * of the payload is moved into new messages, returned in @fragments
+ * linked through their next field, leaving only the last part in
+ * @msg. @fragments is set to NULL if @msg fits in a single message.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageFragment(virNetMessagePtr msg,
+                          virNetMessagePtr *fragments)
+{
+    const size_t start = VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX;
+    const size_t chunk = VIR_NET_MESSAGE_MAX - VIR_NET_MESSAGE_HEADER_MAX;
+    virNetMessagePtr list = NULL;
+    virNetMessagePtr frag;
+    size_t offset;
+    size_t len;
+    size_t alloc;
+    char *buf;
+
+    *fragments = NULL;
+
+    if (msg->bufferLength <= VIR_NET_MESSAGE_BUFFER_MAX)
+        return 0;
+
+    if (msg->header.type != VIR_NET_REPLY ||
+        msg->bufferOffset != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to fragment message of type %d"),
+                       msg->header.type);
+        return -1;
+    }
+
+    for (offset = start ;
+         msg->bufferLength - offset > chunk ;
+         offset += chunk) {
+        if (!(frag = virNetMessageNew(false)))
+            goto error;
+        virNetMessageQueuePush(&list, frag);
+
+        frag->header = msg->header;
+        frag->header.type |= VIR_NET_MESSAGE_FRAGMENT;
+
+        if (virNetMessageEncodeHeader(frag) < 0 ||
+            virNetMessageEncodePayloadRaw(frag, msg->buffer + offset,
+                                          chunk) < 0)
+            goto error;
+    }
+
+    /* The last part no longer needs the large buffer */
+    len = msg->bufferLength - offset;
+    if (!(buf = virNetMessageBufferGet(start + len, &alloc)))
+        goto error;
+    memcpy(buf, msg->buffer, start);
+    memcpy(buf + start, msg->buffer + offset, len);
+
+    virNetMessageBufferPut(msg->buffer, msg->bufferAlloc);
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    msg->bufferLength = msg->bufferOffset = start + len;
+    if (virNetMessageEncodePayloadEmpty(msg) < 0)
+        goto error;
+
+    VIR_DEBUG("Split reply serial=%u into fragments, %zu bytes left",
+              msg->header.serial, msg->bufferLength);
+
+    *fragments = list;
+    return 0;
+
+error:
+    while ((frag = virNetMessageQueueServe(&list)))
+        virNetMessageFree(frag);
+    return -1;
+}
+
+
+/**
+ * virNetMessageAddFragment:
+ * @fragments: the reply put together so far, NULL at first
+ * @msg: a message just received, with its header decoded
+ *
+ * Appends the payload of @msg, which has VIR_NET_MESSAGE_FRAGMENT
+ * set in its type or follows a message which had, to the reply in
+ * @fragments, allocating it for the first fragment. Once the last
+ * fragment is added, the complete reply is moved into @msg and
+ * @fragments is freed, as if the reply had come in one piece.
+ *
+ * Returns 1 if @msg holds the complete reply, 0 if more fragments
+ * are expected, -1 on error
+ */
+int virNetMessageAddFragment(virNetMessagePtr *fragments,
+                             virNetMessagePtr msg)
+{
+    virNetMessagePtr whole = *fragments;
+    bool more = !!(msg->header.type & VIR_NET_MESSAGE_FRAGMENT);
+    size_t len = msg->bufferLength - msg->bufferOffset;
+    size_t want;
+
+    msg->header.type &= ~VIR_NET_MESSAGE_FRAGMENT;
+
+    if (msg->header.type != VIR_NET_REPLY ||
+        (whole &&
+         (whole->header.prog != msg->header.prog ||
+          whole->header.vers != msg->header.vers ||
+          whole->header.proc != msg->header.proc ||
+          whole->header.serial != msg->header.serial))) {
+        virReportError(VIR_ERR_RPC,
+                       _("unexpected fragment prog %d vers %d proc %d type %d serial %d"),
+                       msg->header.prog, msg->header.vers, msg->header.proc,
+                       msg->header.type, msg->header.serial);
+        return -1;
+    }
+
+    if (!whole) {
+        if (!(whole = virNetMessageNew(false)))
+            return -1;
+        *fragments = whole;
+
+        whole->header = msg->header;
+        if (virNetMessageAllocBuffer(whole, msg->bufferLength) < 0)
+            return -1;
+        memcpy(whole->buffer, msg->buffer, msg->bufferOffset);
+        whole->bufferOffset = whole->bufferLength = msg->bufferOffset;
+    }
+
+    want = whole->bufferLength + len;
+    if (want > VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("fragmented reply of %zu bytes too large, want %d"),
+                       want, VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX);
+        return -1;
+    }
+
+    /* Double the buffer as needed, to avoid copying it for
+     * every fragment */
+    if (want > whole->bufferAlloc &&
+        virNetMessageGrowBuffer(whole,
+                                MAX(want,
+                                    MIN(whole->bufferAlloc * 2,
+                                        VIR_NET_MESSAGE_FRAGMENTED_BUFFER_MAX)),
+                                whole->bufferLength) < 0)
+        return -1;
+
+    memcpy(whole->buffer + whole->bufferLength,
+           msg->buffer + msg->bufferOffset, len);
+    whole->bufferLength = want;
+
+    if (more)
+        return 0;
+
+    VIR_DEBUG("Put together fragmented reply serial=%u of %zu bytes",
+              whole->header.serial, whole->bufferLength);
+
+    virNetMessageFreeBuffer(msg);
+    msg->buffer = whole->buffer;
+    msg->bufferAlloc = whole->bufferAlloc;
+    msg->bufferLength = whole->bufferLength;
+    msg->bufferOffset = whole->bufferOffset;
+    whole->buffer = NULL;
+    whole->bufferAlloc = 0;
+
+    virNetMessageFree(whole);
+    *fragments = NULL;
+    return 1;
+}
+
+
+bool virNetMessageCompressionAvailable(void)
+{
+#if HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+#if HAVE_ZLIB
+/**
+ * virNetMessageCompress:
+ * @msg: a fully encoded message, not sent yet
+ * @threshold: size in bytes up to which messages are left alone
+ *
+ * Compresses everything after the header of @msg, if the message
+ * is larger than @threshold and compression actually saves space.
+ * Stream packets are never compressed, as their data often is
+ * already. Only use this once the peer has asked for compression.
+ *
+ * Returns 0 on success, whether @msg was compressed or not, and
+ * -1 on error
+ */
+int virNetMessageCompress(virNetMessagePtr msg,
+                          size_t threshold)
+{
+    const size_t start = VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX;
+    virNetMessageHeader header = msg->header;
+    XDR xdr;
+    unsigned int len;
+    unsigned int rawLen;
+    uLongf destLen;
+    char *buf = NULL;
+    size_t alloc;
+    int ret = -1;
+
+    if (threshold == 0 ||
+        msg->bufferLength <= threshold ||
+        msg->bufferLength <= start ||
+        msg->bufferOffset != 0 ||
+        header.type == VIR_NET_STREAM ||
+        header.type == VIR_NET_STREAM_HOLE)
+        return 0;
+
+    rawLen = msg->bufferLength - start;
+
+    /* Anything not shorter than the original is useless */
+    if (!(buf = virNetMessageBufferGet(msg->bufferLength, &alloc)))
+        return -1;
+    destLen = rawLen - VIR_NET_MESSAGE_LEN_MAX;
+
+    if (compress2((Bytef *)buf + start + VIR_NET_MESSAGE_LEN_MAX, &destLen,
+                  (Bytef *)msg->buffer + start, rawLen,
+                  Z_BEST_SPEED) != Z_OK) {
+        VIR_DEBUG("Message of %zu bytes does not compress", msg->bufferLength);
+        virNetMessageBufferPut(buf, alloc);
+        return 0;
+    }
+
+    len = start + VIR_NET_MESSAGE_LEN_MAX + destLen;
+    header.type |= VIR_NET_MESSAGE_COMPRESSED;
+
+    xdrmem_create(&xdr, buf, start + VIR_NET_MESSAGE_LEN_MAX, XDR_ENCODE);
+    if (!xdr_u_int(&xdr, &len) ||
+        !xdr_virNetMessageHeader(&xdr, &header) ||
+        !xdr_u_int(&xdr, &rawLen)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to encode compressed message header"));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Compressed message from %zu to %u bytes",
+              msg->bufferLength, len);
+
+    virNetMessageBufferPut(msg->buffer, msg->bufferAlloc);
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    msg->bufferLength = len;
+    buf = NULL;
+
+    ret = 0;
+
+cleanup:
+    virNetMessageBufferPut(buf, alloc);
+    xdr_destroy(&xdr);
+    return ret;
+}
+#else
+int virNetMessageCompress(virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                          size_t threshold ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+#endif
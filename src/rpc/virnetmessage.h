@@ -22,6 +22,7 @@
 # define __VIR_NET_MESSAGE_H__
 
 # include "virnetprotocol.h"
+# include "threadpool.h"
 
 typedef struct virNetMessageHeader *virNetMessageHeaderPtr;
 typedef struct virNetMessageError *virNetMessageErrorPtr;
@@ -34,9 +35,15 @@ typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 struct _virNetMessage {
     bool tracked;
 
-    char *buffer; /* Typically VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX */
+    char *buffer; /* Up to VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX,
+                   * unless allowFragments is set */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferAlloc; /* Size of a pooled buffer, 0 if not pooled */
+
+    /* The payload may grow up to VIR_NET_MESSAGE_FRAGMENTED_MAX,
+     * to be sent in fragments by virNetMessageFragment */
+    bool allowFragments;
 
     virNetMessageHeader header;
 
@@ -47,6 +54,13 @@ struct _virNetMessage {
     int *fds;
     size_t donefds;
 
+    /* Used by the server while the message waits for a worker
+     * thread, so that dispatching it needs no further allocation */
+    virThreadPoolJob job;
+    struct _virNetServerClient *jobClient;
+    struct _virNetServerProgram *jobProg;
+    unsigned int jobPriority;
+
     virNetMessagePtr next;
 };
 
@@ -57,6 +71,11 @@ void virNetMessageClear(virNetMessagePtr);
 
 void virNetMessageFree(virNetMessagePtr msg);
 
+int virNetMessageAllocBuffer(virNetMessagePtr msg, size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+void virNetMessageFreeBuffer(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1);
+
 virNetMessagePtr virNetMessageQueueServe(virNetMessagePtr *queue)
     ATTRIBUTE_NONNULL(1);
 void virNetMessageQueuePush(virNetMessagePtr *queue,
@@ -86,6 +105,12 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+char *virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                     size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageCommitPayloadRaw(virNetMessagePtr msg,
+                                  size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
@@ -95,4 +120,16 @@ void virNetMessageSaveError(virNetMessageErrorPtr rerr)
 int virNetMessageDupFD(virNetMessagePtr msg,
                        size_t slot);
 
+int virNetMessageFragment(virNetMessagePtr msg,
+                          virNetMessagePtr *fragments)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageAddFragment(virNetMessagePtr *fragments,
+                             virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
+bool virNetMessageCompressionAvailable(void);
+int virNetMessageCompress(virNetMessagePtr msg,
+                          size_t threshold)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 #endif /* __VIR_NET_MESSAGE_H__ */
@@ -92,6 +92,9 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_STREAM
  *      * serial matches that from the corresponding VIR_NET_CALL
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
  * and the 'status' field varies according to:
  *
  *  - type == VIR_NET_CALL
@@ -109,6 +112,9 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * VIR_NET_OK if stream is complete
  *     * VIR_NET_ERROR if stream had an error
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * VIR_NET_CONTINUE always
+ *
  * Payload varies according to type and status:
  *
  *  - type == VIR_NET_CALL
@@ -132,6 +138,10 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_OK
  *          <empty>
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * status == VIR_NET_CONTINUE
+ *          virNetStreamHole  length of the hole in the stream data
+ *
  *  - type == VIR_NET_CALL_WITH_FDS
  *          int8 - number of FDs
  *          XXX_args  for procedure
@@ -143,6 +153,21 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_ERROR
  *          remote_error    Error information
  *
+ * Once a peer has asked for compression, the type of any message
+ * but a stream packet may have VIR_NET_MESSAGE_COMPRESSED or'd in.
+ * Everything following the header is then replaced by
+ *
+ *          int4 - length of the original data
+ *          byte[]       zlib stream of the original data
+ *
+ * Once a client has asked for fragments, a reply whose payload does
+ * not fit in VIR_NET_MESSAGE_MAX may be split over several messages
+ * with the same header. All but the last have VIR_NET_MESSAGE_FRAGMENT
+ * or'd into their type, and the payloads of all of them put together
+ * make up the payload of the reply, up to VIR_NET_MESSAGE_FRAGMENTED_MAX.
+ * The fragments of a reply are sent back to back, with no other
+ * message in between.
+ *
  */
 enum virNetMessageType {
     /* client -> server. args from a method call */
@@ -156,9 +181,18 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* either direction. hole in the data of a sparse stream */
+    VIR_NET_STREAM_HOLE = 6
 };
 
+/* Flags in the message type, see above */
+const VIR_NET_MESSAGE_COMPRESSED = 65536;
+const VIR_NET_MESSAGE_FRAGMENT = 131072;
+
+/* Size of a fragmented reply, once put together */
+const VIR_NET_MESSAGE_FRAGMENTED_MAX = 67108864;
+
 enum virNetMessageStatus {
     /* Status is always VIR_NET_OK for calls.
      * For replies, indicates no error.
@@ -236,3 +270,11 @@ struct virNetMessageError {
     int int2;
     virNetMessageNetwork net; /* unused */
 };
+
+/* A run of zeros in the data of a sparse stream, sent in place of
+ * the zeros themselves. Only streams opened with a flag asking for
+ * a sparse stream may carry these. No flags are defined yet. */
+struct virNetStreamHole {
+    hyper length;
+    unsigned int flags;
+};
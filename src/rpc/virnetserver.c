@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 
 #include "virnetserver.h"
 #include "logging.h"
@@ -36,7 +37,11 @@
 #include "util.h"
 #include "virfile.h"
 #include "event.h"
+#include "event_epoll.h"
+#include "viratomic.h"
 #include "virnetservermdns.h"
+#include "virnetserverfairqueue.h"
+#include "virtime.h"
 #include "virdbus.h"
 
 #ifndef SA_SIGINFO
@@ -55,13 +60,24 @@ struct _virNetServerSignal {
     void *opaque;
 };
 
-typedef struct _virNetServerJob virNetServerJob;
-typedef virNetServerJob *virNetServerJobPtr;
+typedef struct _virNetServerClientWeight virNetServerClientWeight;
+typedef virNetServerClientWeight *virNetServerClientWeightPtr;
 
-struct _virNetServerJob {
-    virNetServerClientPtr client;
-    virNetMessagePtr msg;
-    virNetServerProgramPtr prog;
+struct _virNetServerClientWeight {
+    char *pattern;
+    unsigned int weight;
+};
+
+typedef struct _virNetServerEventLoop virNetServerEventLoop;
+typedef virNetServerEventLoop *virNetServerEventLoopPtr;
+
+/* A secondary event loop, run by a dedicated thread, which
+ * watches the sockets of a subset of the clients */
+struct _virNetServerEventLoop {
+    virEventEpollLoopPtr loop;
+    virThread thread;
+    bool running;
+    int quit;
 };
 
 struct _virNetServer {
@@ -71,6 +87,22 @@ struct _virNetServer {
 
     virThreadPoolPtr workers;
 
+    /* Guards the programs, the client weights and the hand over
+     * of calls to the workers. Messages are dispatched with their
+     * client locked, from any event loop, so this is taken after
+     * a client lock and no other lock may be taken while it is
+     * held, unlike @lock which is held while clients are closed */
+    virMutex dispatchLock;
+
+    /* Calls waiting for a worker, scheduled fairly between
+     * clients according to the weight of their identity */
+    virNetServerFairQueuePtr calls;
+    size_t nclientWeights;
+    virNetServerClientWeightPtr clientWeights;
+
+    /* Offered to clients which ask for compression */
+    size_t compressThreshold;
+
     bool privileged;
 
     size_t nsignals;
@@ -93,9 +125,17 @@ struct _virNetServer {
     size_t nclients_max;
     virNetServerClientPtr *clients;
 
+    /* If non-empty, client sockets are spread over these
+     * loops instead of being watched by the main loop */
+    size_t neventLoops;
+    virNetServerEventLoopPtr *eventLoops;
+    size_t nextEventLoop;
+
     int keepaliveInterval;
     unsigned int keepaliveCount;
     bool keepaliveRequired;
+    /* Drives the keepalives of all clients from a single timer */
+    virKeepAliveWheelPtr keepaliveWheel;
 
     unsigned int quit :1;
 
@@ -183,28 +223,82 @@ cleanup:
     return ret;
 }
 
+/* Weight of a client in the fair queue, from its identity */
+static unsigned int virNetServerGetClientWeight(virNetServerPtr srv,
+                                                const char *identity)
+{
+    size_t i;
+
+    if (identity) {
+        for (i = 0 ; i < srv->nclientWeights ; i++) {
+            if (fnmatch(srv->clientWeights[i].pattern, identity, 0) == 0)
+                return srv->clientWeights[i].weight;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Hand queued calls over to the worker pool, as long as fewer calls
+ * than it has workers are running. Called whenever a call is queued
+ * or done, with the dispatch lock held. A call which could not be
+ * handed over is put back, to be retried the next time round.
+ */
+static void virNetServerDispatchCalls(virNetServerPtr srv)
+{
+    size_t limit = virThreadPoolGetMaxWorkers(srv->workers);
+    virNetMessagePtr msg;
+
+    while ((msg = virNetServerFairQueuePop(srv->calls, limit))) {
+        if (virThreadPoolSendEmbeddedJob(srv->workers, 0,
+                                         &msg->job, msg) < 0) {
+            VIR_WARN("Unable to dispatch call from client %p",
+                     msg->jobClient);
+            virNetServerFairQueueUndo(srv->calls,
+                                      virNetServerClientGetFlow(msg->jobClient),
+                                      msg);
+            break;
+        }
+    }
+}
+
 static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
-    virNetServerJobPtr job = jobOpaque;
+    virNetMessagePtr msg = jobOpaque;
+    /* Processing the message may clear it */
+    virNetServerClientPtr client = msg->jobClient;
+    virNetServerProgramPtr prog = msg->jobProg;
+    unsigned int priority = msg->jobPriority;
 
     VIR_DEBUG("server=%p client=%p message=%p prog=%p",
-              srv, job->client, job->msg, job->prog);
+              srv, client, msg, prog);
+
+    msg->jobClient = NULL;
+    msg->jobProg = NULL;
 
-    if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg) < 0)
+    if (virNetServerProcessMsg(srv, client, prog, msg) < 0)
         goto error;
 
-    virObjectUnref(job->prog);
-    virObjectUnref(job->client);
-    VIR_FREE(job);
-    return;
+    virObjectUnref(prog);
+    virObjectUnref(client);
+    goto done;
 
 error:
-    virObjectUnref(job->prog);
-    virNetMessageFree(job->msg);
-    virNetServerClientClose(job->client);
-    virObjectUnref(job->client);
-    VIR_FREE(job);
+    virObjectUnref(prog);
+    virNetMessageFree(msg);
+    virNetServerClientClose(client);
+    virObjectUnref(client);
+
+done:
+    /* Priority calls bypass the fair queue */
+    if (!priority) {
+        virMutexLock(&srv->dispatchLock);
+        virNetServerFairQueueDone(srv->calls);
+        virNetServerDispatchCalls(srv);
+        virMutexUnlock(&srv->dispatchLock);
+    }
 }
 
 static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
@@ -220,44 +314,56 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
     VIR_DEBUG("server=%p client=%p message=%p",
               srv, client, msg);
 
-    virNetServerLock(srv);
+    virMutexLock(&srv->dispatchLock);
     for (i = 0 ; i < srv->nprograms ; i++) {
         if (virNetServerProgramMatches(srv->programs[i], msg)) {
-            prog = srv->programs[i];
+            prog = virObjectRef(srv->programs[i]);
             break;
         }
     }
 
     if (srv->workers) {
-        virNetServerJobPtr job;
-
-        if (VIR_ALLOC(job) < 0) {
-            virReportOOMError();
-            goto cleanup;
-        }
-
-        job->client = client;
-        job->msg = msg;
+        msg->jobClient = client;
 
         if (prog) {
-            virObjectRef(prog);
-            job->prog = prog;
+            msg->jobProg = prog;
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
+        msg->jobPriority = priority;
+
+        /* Count the time spent in the fair queue as waiting too */
+        memset(&msg->job, 0, sizeof(msg->job));
+        if (virTimeMonotonicMicrosNowRaw(&msg->job.queued) < 0)
+            msg->job.queued = 0;
+
+        if (priority) {
+            ret = virThreadPoolSendEmbeddedJob(srv->workers, priority,
+                                               &msg->job, msg);
+            if (ret < 0) {
+                msg->jobClient = NULL;
+                msg->jobProg = NULL;
+                virObjectUnref(prog);
+            }
+        } else {
+            virNetServerFairQueueFlowPtr flow;
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+            /* The client is locked while its calls are dispatched */
+            flow = virNetServerClientGetFlow(client);
+            if (!flow->weight)
+                flow->weight = virNetServerGetClientWeight(srv, flow->identity);
 
-        if (ret < 0) {
-            VIR_FREE(job);
-            virObjectUnref(prog);
+            virNetServerFairQueuePush(srv->calls, flow, msg);
+            virNetServerDispatchCalls(srv);
+            ret = 0;
         }
+        virMutexUnlock(&srv->dispatchLock);
     } else {
+        /* Processing may call back into the server */
+        virMutexUnlock(&srv->dispatchLock);
         ret = virNetServerProcessMsg(srv, client, prog, msg);
+        virObjectUnref(prog);
     }
 
-cleanup:
-    virNetServerUnlock(srv);
-
     return ret;
 }
 
@@ -274,6 +380,14 @@ static int virNetServerAddClient(virNetServerPtr srv,
         goto error;
     }
 
+    if (srv->neventLoops) {
+        virNetServerEventLoopPtr el;
+
+        el = srv->eventLoops[srv->nextEventLoop++ % srv->neventLoops];
+        if (virNetServerClientSetEventLoop(client, el->loop) < 0)
+            goto error;
+    }
+
     if (virNetServerClientInit(client) < 0)
         goto error;
 
@@ -288,8 +402,10 @@ static int virNetServerAddClient(virNetServerPtr srv,
                                     virNetServerDispatchNewMessage,
                                     srv);
 
-    virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
+    virNetServerClientInitKeepAlive(client, srv->keepaliveWheel,
+                                    srv->keepaliveInterval,
                                     srv->keepaliveCount);
+    virNetServerClientInitCompression(client, srv->compressThreshold);
 
     virNetServerUnlock(srv);
     return 0;
@@ -378,10 +494,11 @@ virNetServerPtr virNetServerNew(size_t min_workers,
         return NULL;
 
     if (max_workers &&
-        !(srv->workers = virThreadPoolNew(min_workers, max_workers,
-                                          priority_workers,
-                                          virNetServerHandleJob,
-                                          srv)))
+        (!(srv->workers = virThreadPoolNew(min_workers, max_workers,
+                                           priority_workers,
+                                           virNetServerHandleJob,
+                                           srv)) ||
+         !(srv->calls = virNetServerFairQueueNew())))
         goto error;
 
     srv->nclients_max = max_clients;
@@ -409,7 +526,8 @@ virNetServerPtr virNetServerNew(size_t min_workers,
             goto error;
     }
 
-    if (virMutexInit(&srv->lock) < 0) {
+    if (virMutexInit(&srv->lock) < 0 ||
+        virMutexInit(&srv->dispatchLock) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("cannot initialize mutex"));
         goto error;
@@ -418,6 +536,9 @@ virNetServerPtr virNetServerNew(size_t min_workers,
     if (virEventRegisterDefaultImpl() < 0)
         goto error;
 
+    if (!(srv->keepaliveWheel = virKeepAliveWheelNew()))
+        goto error;
+
     memset(&sig_action, 0, sizeof(sig_action));
     sig_action.sa_handler = SIG_IGN;
     sigaction(SIGPIPE, &sig_action, NULL);
@@ -1019,19 +1140,19 @@ error:
 int virNetServerAddProgram(virNetServerPtr srv,
                            virNetServerProgramPtr prog)
 {
-    virNetServerLock(srv);
+    virMutexLock(&srv->dispatchLock);
 
     if (VIR_EXPAND_N(srv->programs, srv->nprograms, 1) < 0)
         goto no_memory;
 
     srv->programs[srv->nprograms-1] = virObjectRef(prog);
 
-    virNetServerUnlock(srv);
+    virMutexUnlock(&srv->dispatchLock);
     return 0;
 
 no_memory:
     virReportOOMError();
-    virNetServerUnlock(srv);
+    virMutexUnlock(&srv->dispatchLock);
     return -1;
 }
 
@@ -1043,6 +1164,294 @@ int virNetServerSetTLSContext(virNetServerPtr srv,
 }
 
 
+static void virNetServerEventLoopRun(void *opaque)
+{
+    virNetServerEventLoopPtr el = opaque;
+
+    while (!virAtomicIntGet(&el->quit)) {
+        if (virEventEpollLoopRunOnce(el->loop) < 0) {
+            VIR_ERROR(_("Client event loop iteration failed, exiting"));
+            break;
+        }
+    }
+}
+
+
+static void virNetServerEventLoopFree(virNetServerEventLoopPtr el)
+{
+    if (!el)
+        return;
+
+    if (el->running) {
+        virAtomicIntSet(&el->quit, 1);
+        virEventEpollLoopInterrupt(el->loop);
+        virThreadJoin(&el->thread);
+    }
+    virEventEpollLoopFree(el->loop);
+    VIR_FREE(el);
+}
+
+
+/**
+ * virNetServerSetEventLoops:
+ * @srv: the server
+ * @nloops: number of event loop threads
+ *
+ * Spread the sockets of clients connected from now on over
+ * @nloops event loops, each run by its own thread, rather than
+ * watching them all from the main loop. This lets I/O on many
+ * busy connections proceed in parallel. The main loop keeps
+ * handling timers, signals and listening sockets.
+ *
+ * Passing 0 keeps all clients on the main loop. The extra
+ * loops require epoll, if that is not available a warning
+ * is logged and the main loop is used.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerSetEventLoops(virNetServerPtr srv,
+                              size_t nloops)
+{
+    size_t i;
+    int ret = -1;
+
+    virNetServerLock(srv);
+
+    if (srv->neventLoops) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Client event loops are already configured"));
+        goto cleanup;
+    }
+
+    if (nloops == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!virEventEpollAvailable()) {
+        VIR_WARN("Client event loops require epoll, "
+                 "using the main event loop for all clients");
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(srv->eventLoops, nloops) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < nloops ; i++) {
+        virNetServerEventLoopPtr el;
+
+        if (VIR_ALLOC(el) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        srv->eventLoops[i] = el;
+
+        if (!(el->loop = virEventEpollLoopNew()))
+            goto error;
+
+        if (virThreadCreate(&el->thread, true,
+                            virNetServerEventLoopRun, el) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create client event loop thread"));
+            goto error;
+        }
+        el->running = true;
+    }
+    srv->neventLoops = nloops;
+
+    VIR_DEBUG("Started %zu client event loops", nloops);
+    ret = 0;
+
+cleanup:
+    virNetServerUnlock(srv);
+    return ret;
+
+error:
+    for (i = 0 ; i < nloops ; i++)
+        virNetServerEventLoopFree(srv->eventLoops[i]);
+    VIR_FREE(srv->eventLoops);
+    goto cleanup;
+}
+
+
+/**
+ * virNetServerSetWorkerLimits:
+ * @srv: the server
+ * @min_workers: new minimum number of worker threads
+ * @max_workers: new maximum number of worker threads
+ *
+ * Resize the pool of threads processing client calls, without
+ * disturbing calls in progress. A server created without any
+ * workers processes calls in the event loop, and can't be given
+ * workers later on.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerSetWorkerLimits(virNetServerPtr srv,
+                                size_t min_workers,
+                                size_t max_workers)
+{
+    int ret = -1;
+
+    virNetServerLock(srv);
+
+    if (!srv->workers) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Server has no worker threads"));
+        goto cleanup;
+    }
+
+    if (virThreadPoolSetParameters(srv->workers,
+                                   min_workers, max_workers) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Worker limits set to min=%zu max=%zu",
+              min_workers, max_workers);
+
+    /* More calls may be running now */
+    virMutexLock(&srv->dispatchLock);
+    virNetServerDispatchCalls(srv);
+    virMutexUnlock(&srv->dispatchLock);
+    ret = 0;
+
+cleanup:
+    virNetServerUnlock(srv);
+    return ret;
+}
+
+
+/**
+ * virNetServerGetWorkerStats:
+ * @srv: the server
+ * @stats: filled with the worker pool statistics
+ *
+ * Returns 0 on success, -1 if the server has no worker threads
+ */
+int virNetServerGetWorkerStats(virNetServerPtr srv,
+                               virThreadPoolStatsPtr stats)
+{
+    int ret = -1;
+
+    virNetServerLock(srv);
+    if (srv->workers) {
+        virThreadPoolGetStats(srv->workers, stats);
+        stats->jobQueueDepth += virNetServerFairQueueGetDepth(srv->calls);
+        ret = 0;
+    }
+    virNetServerUnlock(srv);
+
+    return ret;
+}
+
+
+/**
+ * virNetServerGetTLSResumeStats:
+ * @srv: the server
+ * @resumed: set to the number of TLS handshakes resuming a session
+ * @full: set to the number of full TLS handshakes
+ *
+ * Returns 0 on success, -1 if the server has no TLS service
+ */
+int virNetServerGetTLSResumeStats(virNetServerPtr srv,
+                                  unsigned long long *resumed,
+                                  unsigned long long *full)
+{
+    int ret = -1;
+    size_t i;
+
+    *resumed = *full = 0;
+
+    virNetServerLock(srv);
+    for (i = 0 ; i < srv->nservices ; i++) {
+        virNetTLSContextPtr tls =
+            virNetServerServiceGetTLSContext(srv->services[i]);
+        unsigned long long r, f;
+
+        if (!tls)
+            continue;
+
+        virNetTLSContextGetResumeStats(tls, &r, &f);
+        *resumed += r;
+        *full += f;
+        ret = 0;
+    }
+    virNetServerUnlock(srv);
+
+    return ret;
+}
+
+
+/**
+ * virNetServerAddClientWeight:
+ * @srv: the server
+ * @pattern: shell wildcard matched against client identities
+ * @weight: share of the worker threads given to matching clients
+ *
+ * When clients compete for the worker threads, each client gets a
+ * share of them in proportion to its weight. The weight of a client
+ * is that of the first pattern matching its identity, or 1 if none
+ * does. Only clients which authenticate after the call are affected.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerAddClientWeight(virNetServerPtr srv,
+                                const char *pattern,
+                                unsigned int weight)
+{
+    int ret = -1;
+    char *tmp;
+
+    if (weight == 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Weight of clients matching '%s' must be positive"),
+                       pattern);
+        return -1;
+    }
+
+    if (!(tmp = strdup(pattern))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virMutexLock(&srv->dispatchLock);
+
+    if (VIR_EXPAND_N(srv->clientWeights, srv->nclientWeights, 1) < 0) {
+        virReportOOMError();
+        VIR_FREE(tmp);
+        goto cleanup;
+    }
+
+    srv->clientWeights[srv->nclientWeights - 1].pattern = tmp;
+    srv->clientWeights[srv->nclientWeights - 1].weight = weight;
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&srv->dispatchLock);
+    return ret;
+}
+
+
+/**
+ * virNetServerSetCompressThreshold:
+ * @srv: the server
+ * @threshold: size in bytes above which messages are compressed
+ *
+ * Lets clients which connect after the call ask for messages
+ * larger than @threshold to be compressed. A threshold of 0
+ * refuses compression to clients.
+ */
+void virNetServerSetCompressThreshold(virNetServerPtr srv,
+                                      size_t threshold)
+{
+    virNetServerLock(srv);
+    srv->compressThreshold = threshold;
+    virNetServerUnlock(srv);
+}
+
+
 static void virNetServerAutoShutdownTimer(int timerid ATTRIBUTE_UNUSED,
                                           void *opaque) {
     virNetServerPtr srv = opaque;
@@ -1176,6 +1585,22 @@ void virNetServerDispose(void *obj)
 
     virThreadPoolFree(srv->workers);
 
+    /* Calls still queued will never run */
+    if (srv->calls) {
+        virNetMessagePtr msg;
+
+        while ((msg = virNetServerFairQueuePop(srv->calls, SIZE_MAX))) {
+            virObjectUnref(msg->jobProg);
+            virObjectUnref(msg->jobClient);
+            virNetMessageFree(msg);
+        }
+        virNetServerFairQueueFree(srv->calls);
+    }
+
+    for (i = 0 ; i < srv->nclientWeights ; i++)
+        VIR_FREE(srv->clientWeights[i].pattern);
+    VIR_FREE(srv->clientWeights);
+
     for (i = 0 ; i < srv->nsignals ; i++) {
         sigaction(srv->signals[i]->signum, &srv->signals[i]->oldaction, NULL);
         VIR_FREE(srv->signals[i]);
@@ -1200,9 +1625,18 @@ void virNetServerDispose(void *obj)
     }
     VIR_FREE(srv->clients);
 
+    virObjectUnref(srv->keepaliveWheel);
+
+    /* All client sockets have been unregistered by now, so
+     * stopping the loops releases their last references */
+    for (i = 0 ; i < srv->neventLoops ; i++)
+        virNetServerEventLoopFree(srv->eventLoops[i]);
+    VIR_FREE(srv->eventLoops);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 
+    virMutexDestroy(&srv->dispatchLock);
     virMutexDestroy(&srv->lock);
 }
 
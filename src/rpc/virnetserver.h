@@ -32,6 +32,7 @@
 # include "virnetserverservice.h"
 # include "virobject.h"
 # include "json.h"
+# include "threadpool.h"
 
 virNetServerPtr virNetServerNew(size_t min_workers,
                                 size_t max_workers,
@@ -82,6 +83,25 @@ int virNetServerAddProgram(virNetServerPtr srv,
 int virNetServerSetTLSContext(virNetServerPtr srv,
                               virNetTLSContextPtr tls);
 
+int virNetServerSetEventLoops(virNetServerPtr srv,
+                              size_t nloops);
+
+int virNetServerSetWorkerLimits(virNetServerPtr srv,
+                                size_t min_workers,
+                                size_t max_workers);
+int virNetServerGetWorkerStats(virNetServerPtr srv,
+                               virThreadPoolStatsPtr stats);
+int virNetServerGetTLSResumeStats(virNetServerPtr srv,
+                                  unsigned long long *resumed,
+                                  unsigned long long *full);
+
+int virNetServerAddClientWeight(virNetServerPtr srv,
+                                const char *pattern,
+                                unsigned int weight);
+
+void virNetServerSetCompressThreshold(virNetServerPtr srv,
+                                      size_t threshold);
+
 void virNetServerUpdateServices(virNetServerPtr srv,
                                 bool enabled);
 
@@ -73,6 +73,8 @@ struct _virNetServerClient
 #endif
     int sockTimer; /* Timer to be fired upon cached data,
                     * so we jump out from poll() immediately */
+    virEventEpollLoopPtr eventLoop; /* Secondary loop watching sock,
+                                     * NULL for the main loop */
 
     /* Count of messages in the 'tx' queue,
      * and the server worker pool queue
@@ -96,12 +98,28 @@ struct _virNetServerClient
     virNetServerClientDispatchFunc dispatchFunc;
     void *dispatchOpaque;
 
+    /* Calls waiting for a worker thread */
+    virNetServerFairQueueFlow flow;
+
     void *privateData;
     virFreeCallback privateDataFreeFunc;
     virNetServerClientPrivPreExecRestart privateDataPreExecRestart;
     virNetServerClientCloseFunc privateDataCloseFunc;
 
     virKeepAlivePtr keepalive;
+
+    /* Messages larger than this are compressed, once the
+     * client asked for it */
+    size_t compressThreshold;
+    bool compress;
+
+    /* Set once the client asked for fragmented replies */
+    bool fragments;
+
+    /* Shared memory to move the socket data onto, once
+     * shmReply, the reply to the call setting it up, is sent */
+    virNetShmSessionPtr shm;
+    virNetMessagePtr shmReply;
 };
 
 
@@ -310,8 +328,7 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
      * (NB. The '\1' byte is sent in an encrypted record).
      */
     confirm->bufferLength = 1;
-    if (VIR_ALLOC_N(confirm->buffer, confirm->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageAllocBuffer(confirm, confirm->bufferLength) < 0) {
         virNetMessageFree(confirm);
         return -1;
     }
@@ -330,8 +347,9 @@ static void virNetServerClientSockTimerFunc(int timer,
     virNetServerClientLock(client);
     virEventUpdateTimeout(timer, -1);
     /* Although client->rx != NULL when this timer is enabled, it might have
-     * changed since the client was unlocked in the meantime. */
-    if (client->rx)
+     * changed since the client was unlocked in the meantime. The timer is
+     * also fired to get a client which wants to close reaped. */
+    if (client->rx && !client->wantClose)
         virNetServerClientDispatchRead(client);
     virNetServerClientUnlock(client);
 }
@@ -372,10 +390,8 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
     if (!(client->rx = virNetMessageNew(true)))
         goto error;
     client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageAllocBuffer(client->rx, client->rx->bufferLength) < 0)
         goto error;
-    }
     client->nrequests = 1;
 
     PROBE(RPC_SERVER_CLIENT_NEW,
@@ -653,6 +669,9 @@ int virNetServerClientSetIdentity(virNetServerClientPtr client,
         virReportOOMError();
         goto error;
     }
+    /* Have the weight looked up again on the next call */
+    client->flow.identity = client->identity;
+    client->flow.weight = 0;
     ret = 0;
 
 error:
@@ -660,6 +679,20 @@ error:
     return ret;
 }
 
+/**
+ * virNetServerClientGetFlow:
+ * @client: the client
+ *
+ * Returns the fair queue flow for calls of @client. It may only
+ * be used by the dispatch function, which is called with the
+ * client locked.
+ */
+virNetServerFairQueueFlowPtr
+virNetServerClientGetFlow(virNetServerClientPtr client)
+{
+    return &client->flow;
+}
+
 const char *virNetServerClientGetIdentity(virNetServerClientPtr client)
 {
     const char *identity;
@@ -689,6 +722,26 @@ void virNetServerClientSetCloseHook(virNetServerClientPtr client,
 }
 
 
+/*
+ * Watch the client socket from @loop rather than the main
+ * event loop. Must be called before virNetServerClientInit
+ */
+int virNetServerClientSetEventLoop(virNetServerClientPtr client,
+                                   virEventEpollLoopPtr loop)
+{
+    int ret = -1;
+
+    virNetServerClientLock(client);
+    if (client->sock &&
+        virNetSocketSetEventLoop(client->sock, loop) == 0) {
+        client->eventLoop = loop;
+        ret = 0;
+    }
+    virNetServerClientUnlock(client);
+    return ret;
+}
+
+
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque)
@@ -728,6 +781,7 @@ void virNetServerClientDispose(void *obj)
 #if HAVE_SASL
     virObjectUnref(client->sasl);
 #endif
+    virObjectUnref(client->shm);
     if (client->sockTimer > 0)
         virEventRemoveTimeout(client->sockTimer);
     virObjectUnref(client->tls);
@@ -855,7 +909,7 @@ int virNetServerClientInit(virNetServerClientPtr client)
         int ret;
 
         if (!(client->tls = virNetTLSSessionNew(client->tlsCtxt,
-                                                NULL)))
+                                                NULL, NULL)))
             goto error;
 
         virNetSocketSetTLSSession(client->sock,
@@ -1055,9 +1109,8 @@ readmore:
                 client->wantClose = true;
             } else {
                 client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    virReportOOMError();
+                if (virNetMessageAllocBuffer(client->rx,
+                                             client->rx->bufferLength) < 0) {
                     client->wantClose = true;
                 } else {
                     client->nrequests++;
@@ -1069,8 +1122,17 @@ readmore:
 }
 
 
+/* Most queued messages sent with a single write */
+#define VIR_NET_SERVER_CLIENT_TX_BATCH 16
+
 /*
- * Send client->tx using no encoding
+ * Send client->tx using no encoding, along with as many of the
+ * messages queued behind it as possible. A batch ends with a
+ * message passing FDs, since they must be sent right after the
+ * data of their message, and with a message completing the SASL
+ * negotiation or the switch to shared memory, since the following
+ * ones must go another way. The data sent is accounted to the
+ * messages it came from.
  *
  * Returns:
  *   -1 on error or EOF
@@ -1079,7 +1141,11 @@ readmore:
  */
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
+    struct iovec iov[VIR_NET_SERVER_CLIENT_TX_BATCH];
+    size_t niov = 0;
+    virNetMessagePtr msg;
     ssize_t ret;
+    size_t done;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
         virReportError(VIR_ERR_RPC,
@@ -1092,13 +1158,37 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
     if (client->tx->bufferLength == client->tx->bufferOffset)
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    msg = client->tx;
+    do {
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        niov++;
+
+        if (msg->nfds)
+            break;
+#if HAVE_SASL
+        if (client->sasl)
+            break;
+#endif
+        if (msg == client->shmReply)
+            break;
+        msg = msg->next;
+    } while (msg && msg->bufferOffset < msg->bufferLength &&
+             niov < ARRAY_CARDINALITY(iov));
+
+    ret = virNetSocketWritev(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    for (msg = client->tx, done = ret ; done > 0 ; msg = msg->next) {
+        size_t len = msg->bufferLength - msg->bufferOffset;
+
+        if (len > done)
+            len = done;
+        msg->bufferOffset += len;
+        done -= len;
+    }
+
     return ret;
 }
 
@@ -1148,6 +1238,18 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
             }
 #endif
 
+            /* The client switches to the shared memory as soon as
+             * it gets this reply, so everything after it goes there */
+            if (client->shmReply == client->tx) {
+                client->shmReply = NULL;
+                if (virNetSocketSetShmSession(client->sock, client->shm) < 0) {
+                    client->wantClose = true;
+                    return;
+                }
+                virObjectUnref(client->shm);
+                client->shm = NULL;
+            }
+
             /* Get finished msg from head of tx queue */
             msg = virNetMessageQueueServe(&client->tx);
 
@@ -1159,8 +1261,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
                     msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-                        virReportOOMError();
+                    if (virNetMessageAllocBuffer(msg, msg->bufferLength) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
@@ -1237,6 +1338,11 @@ virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
                   VIR_EVENT_HANDLE_HANGUP))
         client->wantClose = true;
 
+    /* Closed clients are reaped by the main loop, which has no
+     * reason to wake up if the socket is watched elsewhere */
+    if (client->wantClose && client->eventLoop)
+        virEventUpdateTimeout(client->sockTimer, 0);
+
     virNetServerClientUnlock(client);
 }
 
@@ -1266,15 +1372,63 @@ virNetServerClientSendMessageLocked(virNetServerClientPtr client,
     return ret;
 }
 
+/*
+ * A reply too large for one message goes out as fragments followed
+ * by @msg. Either all of them are queued, or none: the client could
+ * not make sense of a reply with some of its fragments missing, so
+ * it is closed if any of them cannot be prepared.
+ */
 int virNetServerClientSendMessage(virNetServerClientPtr client,
                                   virNetMessagePtr msg)
 {
-    int ret;
+    int ret = -1;
+    size_t threshold = 0;
+    virNetMessagePtr fragments = NULL;
+    virNetMessagePtr frag;
+
+    virNetServerClientLock(client);
+    if (client->compress)
+        threshold = client->compressThreshold;
+    virNetServerClientUnlock(client);
+
+    if (virNetMessageFragment(msg, &fragments) < 0)
+        goto abort;
+
+    /* This may take a while, so don't hold up the client meanwhile */
+    if (threshold) {
+        for (frag = fragments ; frag ; frag = frag->next) {
+            if (virNetMessageCompress(frag, threshold) < 0)
+                goto abort;
+        }
+        if (virNetMessageCompress(msg, threshold) < 0)
+            goto abort;
+    }
+
+    virNetServerClientLock(client);
+    /* Nothing else can get queued or close the client while it is
+     * locked, so if the first part can be queued, all of them can.
+     * The fragments go out back to back, ahead of the last part */
+    if (client->sock && !client->wantClose) {
+        while ((frag = virNetMessageQueueServe(&fragments)))
+            ignore_value(virNetServerClientSendMessageLocked(client, frag));
+        ret = virNetServerClientSendMessageLocked(client, msg);
+    }
+    virNetServerClientUnlock(client);
 
+    goto cleanup;
+
+abort:
+    VIR_DEBUG("Dropping reply to client=%p proc=%d serial=%u",
+              client, msg->header.proc, msg->header.serial);
     virNetServerClientLock(client);
-    ret = virNetServerClientSendMessageLocked(client, msg);
+    client->wantClose = true;
+    if (client->eventLoop)
+        virEventUpdateTimeout(client->sockTimer, 0);
     virNetServerClientUnlock(client);
 
+cleanup:
+    while ((frag = virNetMessageQueueServe(&fragments)))
+        virNetMessageFree(frag);
     return ret;
 }
 
@@ -1306,6 +1460,7 @@ virNetServerClientKeepAliveSendCB(void *opaque,
 
 int
 virNetServerClientInitKeepAlive(virNetServerClientPtr client,
+                                virKeepAliveWheelPtr wheel,
                                 int interval,
                                 unsigned int count)
 {
@@ -1314,7 +1469,7 @@ virNetServerClientInitKeepAlive(virNetServerClientPtr client,
 
     virNetServerClientLock(client);
 
-    if (!(ka = virKeepAliveNew(interval, count, client,
+    if (!(ka = virKeepAliveNew(interval, count, wheel, client,
                                virNetServerClientKeepAliveSendCB,
                                virNetServerClientKeepAliveDeadCB,
                                virObjectFreeCallback)))
@@ -1343,3 +1498,92 @@ virNetServerClientStartKeepAlive(virNetServerClientPtr client)
     virNetServerClientUnlock(client);
     return ret;
 }
+
+void
+virNetServerClientInitCompression(virNetServerClientPtr client,
+                                  size_t threshold)
+{
+    virNetServerClientLock(client);
+    client->compressThreshold = threshold;
+    virNetServerClientUnlock(client);
+}
+
+/*
+ * Called when the client asks for compression, which tells us it
+ * can decode compressed messages. Returns true if messages sent to
+ * the client will be compressed from now on.
+ */
+bool
+virNetServerClientStartCompression(virNetServerClientPtr client)
+{
+    bool ret;
+    virNetServerClientLock(client);
+    if (client->compressThreshold &&
+        virNetMessageCompressionAvailable())
+        client->compress = true;
+    ret = client->compress;
+    virNetServerClientUnlock(client);
+    return ret;
+}
+
+/*
+ * Called when the client asks for fragmented replies, which tells
+ * us it can put them back together. Replies too large for a single
+ * message are split into fragments from now on.
+ */
+void
+virNetServerClientStartFragments(virNetServerClientPtr client)
+{
+    virNetServerClientLock(client);
+    client->fragments = true;
+    virNetServerClientUnlock(client);
+}
+
+bool
+virNetServerClientGetFragments(virNetServerClientPtr client)
+{
+    bool ret;
+    virNetServerClientLock(client);
+    ret = client->fragments;
+    virNetServerClientUnlock(client);
+    return ret;
+}
+
+
+/*
+ * Called from the dispatcher of the call setting up @shm, with @reply
+ * the message its reply will be sent in. The socket data moves onto
+ * the shared memory once the reply is sent, since until the client
+ * gets it, it keeps using the socket. The socket then only carries
+ * wakeups, which rules out anything needing its data, such as TLS or
+ * passing file descriptors.
+ */
+int
+virNetServerClientSetShmSession(virNetServerClientPtr client,
+                                virNetMessagePtr reply,
+                                virNetShmSessionPtr shm)
+{
+    int ret = -1;
+
+    virNetServerClientLock(client);
+
+    if (client->tls ||
+#if HAVE_SASL
+        client->sasl ||
+#endif
+        client->shm ||
+        !client->sock ||
+        !virNetSocketHasPassFD(client->sock)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Shared memory can only be used on plain local sockets"));
+        goto cleanup;
+    }
+
+    client->shm = virObjectRef(shm);
+    client->shmReply = reply;
+    ret = 0;
+
+cleanup:
+    virNetServerClientUnlock(client);
+    return ret;
+}
@@ -26,6 +26,8 @@
 
 # include "virnetsocket.h"
 # include "virnetmessage.h"
+# include "virnetserverfairqueue.h"
+# include "virkeepalive.h"
 # include "virobject.h"
 # include "json.h"
 
@@ -91,6 +93,8 @@ bool virNetServerClientIsSecure(virNetServerClientPtr client);
 int virNetServerClientSetIdentity(virNetServerClientPtr client,
                                   const char *identity);
 const char *virNetServerClientGetIdentity(virNetServerClientPtr client);
+virNetServerFairQueueFlowPtr
+virNetServerClientGetFlow(virNetServerClientPtr client);
 
 int virNetServerClientGetUNIXIdentity(virNetServerClientPtr client,
                                       uid_t *uid, gid_t *gid, pid_t *pid);
@@ -102,6 +106,9 @@ typedef void (*virNetServerClientCloseFunc)(virNetServerClientPtr client);
 void virNetServerClientSetCloseHook(virNetServerClientPtr client,
                                     virNetServerClientCloseFunc cf);
 
+int virNetServerClientSetEventLoop(virNetServerClientPtr client,
+                                   virEventEpollLoopPtr loop);
+
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque);
@@ -115,12 +122,24 @@ bool virNetServerClientWantClose(virNetServerClientPtr client);
 int virNetServerClientInit(virNetServerClientPtr client);
 
 int virNetServerClientInitKeepAlive(virNetServerClientPtr client,
+                                    virKeepAliveWheelPtr wheel,
                                     int interval,
                                     unsigned int count);
 bool virNetServerClientCheckKeepAlive(virNetServerClientPtr client,
                                       virNetMessagePtr msg);
 int virNetServerClientStartKeepAlive(virNetServerClientPtr client);
 
+void virNetServerClientInitCompression(virNetServerClientPtr client,
+                                       size_t threshold);
+bool virNetServerClientStartCompression(virNetServerClientPtr client);
+
+void virNetServerClientStartFragments(virNetServerClientPtr client);
+bool virNetServerClientGetFragments(virNetServerClientPtr client);
+
+int virNetServerClientSetShmSession(virNetServerClientPtr client,
+                                    virNetMessagePtr reply,
+                                    virNetShmSessionPtr shm);
+
 const char *virNetServerClientLocalAddrString(virNetServerClientPtr client);
 const char *virNetServerClientRemoteAddrString(virNetServerClientPtr client);
 
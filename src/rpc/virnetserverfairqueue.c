@@ -0,0 +1,238 @@
+/*
+ * virnetserverfairqueue.c: per client fair queuing of RPC calls
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "virnetserverfairqueue.h"
+#include "memory.h"
+#include "threads.h"
+#include "virterror_internal.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/*
+ * Calls are queued per flow, and flows which have calls queued are
+ * kept in a ring. The flow at the head of the ring may hand out as
+ * many calls as its weight allows before it is moved to the tail,
+ * so that each client gets a share of the workers in proportion to
+ * its weight, however many calls it sends. This is deficit round
+ * robin with every call costing the same. A flow leaves the ring
+ * when it runs out of calls, forfeiting the rest of its turn.
+ *
+ * The number of calls handed out and not yet done is capped, so
+ * that calls wait here rather than in the FIFO of the worker pool,
+ * where the order could no longer be changed.
+ */
+struct _virNetServerFairQueue {
+    virMutex lock;
+
+    virNetServerFairQueueFlowPtr head;
+    virNetServerFairQueueFlowPtr tail;
+
+    size_t nqueued;
+    size_t inflight;
+};
+
+
+virNetServerFairQueuePtr virNetServerFairQueueNew(void)
+{
+    virNetServerFairQueuePtr queue;
+
+    if (VIR_ALLOC(queue) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&queue->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+
+/* The queue must have been drained by the caller, since only it
+ * knows how to release the calls */
+void virNetServerFairQueueFree(virNetServerFairQueuePtr queue)
+{
+    if (!queue)
+        return;
+
+    virMutexDestroy(&queue->lock);
+    VIR_FREE(queue);
+}
+
+
+void virNetServerFairQueuePush(virNetServerFairQueuePtr queue,
+                               virNetServerFairQueueFlowPtr flow,
+                               virNetMessagePtr msg)
+{
+    virMutexLock(&queue->lock);
+
+    msg->next = NULL;
+    if (flow->tail)
+        flow->tail->next = msg;
+    else
+        flow->head = msg;
+    flow->tail = msg;
+
+    /* A new weight applies from the next turn on */
+    flow->quantum = flow->weight ? flow->weight : 1;
+
+    if (!flow->active) {
+        flow->active = true;
+        flow->deficit = 0;
+        flow->next = NULL;
+        if (queue->tail)
+            queue->tail->next = flow;
+        else
+            queue->head = flow;
+        queue->tail = flow;
+    }
+
+    queue->nqueued++;
+
+    virMutexUnlock(&queue->lock);
+}
+
+
+/*
+ * Take the next call to run, unless @limit calls are already
+ * running or nothing is queued. The caller must report the end
+ * of every call returned with virNetServerFairQueueDone.
+ */
+virNetMessagePtr virNetServerFairQueuePop(virNetServerFairQueuePtr queue,
+                                          size_t limit)
+{
+    virNetServerFairQueueFlowPtr flow;
+    virNetMessagePtr msg = NULL;
+
+    virMutexLock(&queue->lock);
+
+    if (!(flow = queue->head) ||
+        queue->inflight >= limit)
+        goto cleanup;
+
+    if (flow->deficit == 0)
+        flow->deficit = flow->quantum;
+
+    msg = flow->head;
+    flow->head = msg->next;
+    if (!flow->head)
+        flow->tail = NULL;
+    msg->next = NULL;
+    flow->deficit--;
+
+    if (!flow->head || flow->deficit == 0) {
+        queue->head = flow->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        flow->next = NULL;
+
+        if (flow->head) {
+            /* Turn is over, go to the back of the ring */
+            if (queue->tail)
+                queue->tail->next = flow;
+            else
+                queue->head = flow;
+            queue->tail = flow;
+        } else {
+            flow->active = false;
+            flow->deficit = 0;
+        }
+    }
+
+    queue->nqueued--;
+    queue->inflight++;
+
+cleanup:
+    virMutexUnlock(&queue->lock);
+    return msg;
+}
+
+
+/*
+ * Put back a call returned by virNetServerFairQueuePop which could
+ * not be run after all, so that it is the next one handed out.
+ */
+void virNetServerFairQueueUndo(virNetServerFairQueuePtr queue,
+                               virNetServerFairQueueFlowPtr flow,
+                               virNetMessagePtr msg)
+{
+    virMutexLock(&queue->lock);
+
+    msg->next = flow->head;
+    flow->head = msg;
+    if (!flow->tail)
+        flow->tail = msg;
+
+    if (flow->active) {
+        /* Still in the ring, but not necessarily at the head */
+        if (queue->head != flow) {
+            virNetServerFairQueueFlowPtr prev = queue->head;
+
+            while (prev->next != flow)
+                prev = prev->next;
+            prev->next = flow->next;
+            if (queue->tail == flow)
+                queue->tail = prev;
+            flow->next = queue->head;
+            queue->head = flow;
+        }
+    } else {
+        flow->active = true;
+        flow->next = queue->head;
+        queue->head = flow;
+        if (!queue->tail)
+            queue->tail = flow;
+    }
+    flow->deficit++;
+
+    queue->nqueued++;
+    if (queue->inflight > 0)
+        queue->inflight--;
+
+    virMutexUnlock(&queue->lock);
+}
+
+
+void virNetServerFairQueueDone(virNetServerFairQueuePtr queue)
+{
+    virMutexLock(&queue->lock);
+    if (queue->inflight > 0)
+        queue->inflight--;
+    virMutexUnlock(&queue->lock);
+}
+
+
+size_t virNetServerFairQueueGetDepth(virNetServerFairQueuePtr queue)
+{
+    size_t depth;
+
+    virMutexLock(&queue->lock);
+    depth = queue->nqueued;
+    virMutexUnlock(&queue->lock);
+
+    return depth;
+}
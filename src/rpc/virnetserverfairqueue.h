@@ -0,0 +1,70 @@
+/*
+ * virnetserverfairqueue.h: per client fair queuing of RPC calls
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_NET_SERVER_FAIR_QUEUE_H__
+# define __VIR_NET_SERVER_FAIR_QUEUE_H__
+
+# include "virnetmessage.h"
+
+typedef struct _virNetServerFairQueue virNetServerFairQueue;
+typedef virNetServerFairQueue *virNetServerFairQueuePtr;
+
+typedef struct _virNetServerFairQueueFlow virNetServerFairQueueFlow;
+typedef virNetServerFairQueueFlow *virNetServerFairQueueFlowPtr;
+
+/*
+ * The calls of one client, embedded in the client so that queueing
+ * needs no allocation. The identity and weight are maintained by
+ * the owner of the flow, with a weight of 0 meaning it has to be
+ * looked up again. The remaining fields are private to the queue.
+ */
+struct _virNetServerFairQueueFlow {
+    const char *identity;
+    unsigned int weight;
+
+    virNetMessagePtr head;
+    virNetMessagePtr tail;
+    virNetServerFairQueueFlowPtr next;
+    bool active;
+    unsigned int quantum;
+    unsigned int deficit;
+};
+
+virNetServerFairQueuePtr virNetServerFairQueueNew(void);
+void virNetServerFairQueueFree(virNetServerFairQueuePtr queue);
+
+void virNetServerFairQueuePush(virNetServerFairQueuePtr queue,
+                               virNetServerFairQueueFlowPtr flow,
+                               virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+virNetMessagePtr virNetServerFairQueuePop(virNetServerFairQueuePtr queue,
+                                          size_t limit)
+    ATTRIBUTE_NONNULL(1);
+void virNetServerFairQueueUndo(virNetServerFairQueuePtr queue,
+                               virNetServerFairQueueFlowPtr flow,
+                               virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+void virNetServerFairQueueDone(virNetServerFairQueuePtr queue)
+    ATTRIBUTE_NONNULL(1);
+size_t virNetServerFairQueueGetDepth(virNetServerFairQueuePtr queue)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_NET_SERVER_FAIR_QUEUE_H__ */
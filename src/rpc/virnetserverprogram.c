@@ -31,6 +31,7 @@
 #include "logging.h"
 #include "virfile.h"
 #include "threads.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -41,6 +42,10 @@ struct _virNetServerProgram {
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* One entry per procedure, NULL unless stats are enabled */
+    virMutex statsLock;
+    virNetServerProgramProcStatsPtr stats;
 };
 
 
@@ -73,6 +78,13 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (!(prog = virObjectNew(virNetServerProgramClass)))
         return NULL;
 
+    if (virMutexInit(&prog->statsLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(prog);
+        return NULL;
+    }
+
     prog->program = program;
     prog->version = version;
     prog->procs = procs;
@@ -96,6 +108,30 @@ int virNetServerProgramGetVersion(virNetServerProgramPtr prog)
 }
 
 
+/*
+ * Start counting the calls of each procedure. This has to be done
+ * before the program is added to a server, and can not be undone.
+ */
+int virNetServerProgramEnableStats(virNetServerProgramPtr prog)
+{
+    if (prog->stats)
+        return 0;
+
+    if (VIR_ALLOC_N(prog->stats, prog->nprocs) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+size_t virNetServerProgramGetNProcs(virNetServerProgramPtr prog)
+{
+    return prog->nprocs;
+}
+
+
 int virNetServerProgramMatches(virNetServerProgramPtr prog,
                                virNetMessagePtr msg)
 {
@@ -136,6 +172,76 @@ virNetServerProgramGetPriority(virNetServerProgramPtr prog,
     return proc->priority;
 }
 
+
+/*
+ * @procedure: the procedure to get the counters of
+ * @name: filled with the name of the procedure, if non-NULL
+ * @stats: filled with the counters
+ *
+ * Returns 0 on success, 1 if the program has no such procedure,
+ * or -1 if stats are not enabled
+ */
+int
+virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                int procedure,
+                                const char **name,
+                                virNetServerProgramProcStatsPtr stats)
+{
+    virNetServerProgramProcPtr proc;
+
+    if (!prog->stats) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("RPC statistics are not enabled"));
+        return -1;
+    }
+
+    if (!(proc = virNetServerProgramGetProc(prog, procedure)))
+        return 1;
+
+    virMutexLock(&prog->statsLock);
+    *stats = prog->stats[procedure];
+    virMutexUnlock(&prog->statsLock);
+
+    if (name)
+        *name = proc->name;
+
+    return 0;
+}
+
+
+/*
+ * @start: the time the worker picked up the call
+ * @bytesIn: the length of the call
+ * @bytesOut: the length of the reply, 0 if it is an error
+ */
+static void
+virNetServerProgramRecordCall(virNetServerProgramPtr prog,
+                              virNetMessagePtr msg,
+                              unsigned long long start,
+                              size_t bytesIn,
+                              size_t bytesOut)
+{
+    virNetServerProgramProcStatsPtr stats = &prog->stats[msg->header.proc];
+    unsigned long long queued = msg->job.queued;
+    unsigned long long end;
+
+    /* Calls dispatched from the event loop were never queued */
+    if (queued == 0 || queued > start)
+        queued = start;
+    if (virTimeMonotonicMicrosNowRaw(&end) < 0 || end < start)
+        end = start;
+
+    virMutexLock(&prog->statsLock);
+    stats->calls++;
+    if (!bytesOut)
+        stats->errors++;
+    stats->bytesIn += bytesIn;
+    stats->bytesOut += bytesOut;
+    stats->waitTime[virThreadPoolHistogramBucket(start - queued)]++;
+    stats->runTime[virThreadPoolHistogramBucket(end - start)]++;
+    virMutexUnlock(&prog->statsLock);
+}
+
 static int
 virNetServerProgramSendError(unsigned program,
                              unsigned version,
@@ -204,7 +310,9 @@ virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
                                         msg,
                                         rerr,
                                         req->proc,
-                                        req->type == VIR_NET_STREAM ? VIR_NET_STREAM : VIR_NET_REPLY,
+                                        (req->type == VIR_NET_STREAM ||
+                                         req->type == VIR_NET_STREAM_HOLE) ?
+                                        VIR_NET_STREAM : VIR_NET_REPLY,
                                         req->serial);
 }
 
@@ -305,6 +413,7 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
         break;
 
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -371,12 +480,18 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     char *arg = NULL;
     char *ret = NULL;
     int rv = -1;
-    virNetServerProgramProcPtr dispatcher;
+    virNetServerProgramProcPtr dispatcher = NULL;
     virNetMessageError rerr;
     size_t i;
+    unsigned long long start = 0;
+    size_t bytesIn = msg->bufferLength;
 
     memset(&rerr, 0, sizeof(rerr));
 
+    if (prog->stats &&
+        virTimeMonotonicMicrosNowRaw(&start) < 0)
+        start = 0;
+
     if (msg->header.status != VIR_NET_OK) {
         virReportError(VIR_ERR_RPC,
                        _("Unexpected message status %u"),
@@ -457,6 +572,10 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     /*msg->header.serial = msg->header.serial;*/
     msg->header.status = VIR_NET_OK;
 
+    /* Replies too large for one message are only possible if
+     * the client can put them back together */
+    msg->allowFragments = !msg->nfds && virNetServerClientGetFragments(client);
+
     if (virNetMessageEncodeHeader(msg) < 0) {
         xdr_free(dispatcher->ret_filter, ret);
         goto error;
@@ -477,10 +596,17 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     VIR_FREE(arg);
     VIR_FREE(ret);
 
+    if (prog->stats)
+        virNetServerProgramRecordCall(prog, msg, start,
+                                      bytesIn, msg->bufferLength);
+
     /* Put reply on end of tx queue to send out  */
     return virNetServerClientSendMessage(client, msg);
 
 error:
+    if (prog->stats && dispatcher)
+        virNetServerProgramRecordCall(prog, msg, start, bytesIn, 0);
+
     /* Bad stuff (de-)serializing message, but we have an
      * RPC error message we can send back to the client */
     rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
@@ -492,32 +618,46 @@ error:
 }
 
 
-int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
-                                      virNetServerClientPtr client,
+static int
+virNetServerProgramEncodeStreamHeader(virNetServerProgramPtr prog,
                                       virNetMessagePtr msg,
                                       int procedure,
                                       int serial,
-                                      const char *data,
-                                      size_t len)
+                                      virNetMessageType type,
+                                      virNetMessageStatus status)
 {
-    VIR_DEBUG("client=%p msg=%p data=%p len=%zu", client, msg, data, len);
-
     /* Return header. We're reusing same message object, so
      * only need to tweak type/status fields */
     msg->header.prog = prog->program;
     msg->header.vers = prog->version;
     msg->header.proc = procedure;
-    msg->header.type = VIR_NET_STREAM;
+    msg->header.type = type;
     msg->header.serial = serial;
+    msg->header.status = status;
+
+    return virNetMessageEncodeHeader(msg);
+}
+
+
+int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      const char *data,
+                                      size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p data=%p len=%zu", client, msg, data, len);
+
     /*
      * NB
      *   data != NULL + len > 0    => REMOTE_CONTINUE   (Sending back data)
      *   data != NULL + len == 0   => REMOTE_CONTINUE   (Sending read EOF)
      *   data == NULL              => REMOTE_OK         (Sending finish handshake confirmation)
      */
-    msg->header.status = data ? VIR_NET_CONTINUE : VIR_NET_OK;
-
-    if (virNetMessageEncodeHeader(msg) < 0)
+    if (virNetServerProgramEncodeStreamHeader(prog, msg, procedure, serial,
+                                              VIR_NET_STREAM,
+                                              data ? VIR_NET_CONTINUE : VIR_NET_OK) < 0)
         return -1;
 
     if (data && len) {
@@ -534,6 +674,98 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+/**
+ * virNetServerProgramReserveStreamData:
+ * @prog: the program the stream belongs to
+ * @msg: the message to send the data in
+ * @procedure: the procedure of the stream
+ * @serial: the serial of the stream
+ * @len: the most data that will be sent
+ *
+ * Prepares @msg to carry up to @len bytes of stream data, returning
+ * where the data must be put. This lets the caller read the data
+ * straight into the message, rather than into a buffer of its own
+ * from which virNetServerProgramSendStreamData would copy it. The
+ * message is sent with virNetServerProgramSendReservedStreamData.
+ *
+ * Returns a pointer to the room for the data, or NULL on error
+ */
+char *virNetServerProgramReserveStreamData(virNetServerProgramPtr prog,
+                                           virNetMessagePtr msg,
+                                           int procedure,
+                                           int serial,
+                                           size_t len)
+{
+    VIR_DEBUG("msg=%p len=%zu", msg, len);
+
+    /* Get a buffer large enough for everything up front, so that
+     * the header need not be moved once it is encoded */
+    if (virNetMessageAllocBuffer(msg, VIR_NET_MESSAGE_HEADER_XDR_LEN +
+                                 VIR_NET_MESSAGE_HEADER_MAX + len) < 0)
+        return NULL;
+
+    if (virNetServerProgramEncodeStreamHeader(prog, msg, procedure, serial,
+                                              VIR_NET_STREAM,
+                                              VIR_NET_CONTINUE) < 0)
+        return NULL;
+
+    return virNetMessageReservePayloadRaw(msg, len);
+}
+
+
+/*
+ * Sends the @len bytes of stream data placed in the room returned
+ * by virNetServerProgramReserveStreamData. A @len of 0 sends the
+ * read EOF.
+ */
+int virNetServerProgramSendReservedStreamData(virNetServerClientPtr client,
+                                              virNetMessagePtr msg,
+                                              size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p len=%zu", client, msg, len);
+
+    if (virNetMessageCommitPayloadRaw(msg, len) < 0)
+        return -1;
+    VIR_DEBUG("Total %zu", msg->bufferLength);
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      long long length,
+                                      unsigned int flags)
+{
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p msg=%p length=%lld", client, msg, length);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (virNetServerProgramEncodeStreamHeader(prog, msg, procedure, serial,
+                                              VIR_NET_STREAM_HOLE,
+                                              VIR_NET_CONTINUE) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+void virNetServerProgramDispose(void *obj)
 {
+    virNetServerProgramPtr prog = obj;
+
+    VIR_FREE(prog->stats);
+    virMutexDestroy(&prog->statsLock);
 }
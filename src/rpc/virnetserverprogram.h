@@ -27,6 +27,7 @@
 # include "virnetmessage.h"
 # include "virnetserverclient.h"
 # include "virobject.h"
+# include "threadpool.h"
 
 typedef struct _virNetServer virNetServer;
 typedef virNetServer *virNetServerPtr;
@@ -40,6 +41,9 @@ typedef virNetServerProgram *virNetServerProgramPtr;
 typedef struct _virNetServerProgramProc virNetServerProgramProc;
 typedef virNetServerProgramProc *virNetServerProgramProcPtr;
 
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+
 typedef int (*virNetServerProgramDispatchFunc)(virNetServerPtr server,
                                                virNetServerClientPtr client,
                                                virNetMessagePtr msg,
@@ -55,6 +59,19 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    const char *name;
+};
+
+/* The wait time of a call runs from its arrival until a worker
+ * picks it up, the run time covers decoding, executing and encoding
+ * it. Both histograms use the buckets of virThreadPoolStats */
+struct _virNetServerProgramProcStats {
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+    unsigned long long waitTime[VIR_THREADPOOL_HISTOGRAM_BUCKETS];
+    unsigned long long runTime[VIR_THREADPOOL_HISTOGRAM_BUCKETS];
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -65,6 +82,15 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
 int virNetServerProgramGetID(virNetServerProgramPtr prog);
 int virNetServerProgramGetVersion(virNetServerProgramPtr prog);
 
+int virNetServerProgramEnableStats(virNetServerProgramPtr prog);
+
+size_t virNetServerProgramGetNProcs(virNetServerProgramPtr prog);
+
+int virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                    int procedure,
+                                    const char **name,
+                                    virNetServerProgramProcStatsPtr stats);
+
 unsigned int virNetServerProgramGetPriority(virNetServerProgramPtr prog,
                                             int procedure);
 
@@ -101,4 +127,21 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+char *virNetServerProgramReserveStreamData(virNetServerProgramPtr prog,
+                                           virNetMessagePtr msg,
+                                           int procedure,
+                                           int serial,
+                                           size_t len);
+int virNetServerProgramSendReservedStreamData(virNetServerClientPtr client,
+                                              virNetMessagePtr msg,
+                                              size_t len);
+
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      long long length,
+                                      unsigned int flags);
+
 #endif /* __VIR_NET_SERVER_PROGRAM_H__ */
@@ -0,0 +1,455 @@
+/*
+ * virnetshmsession.c: shared memory transport for local clients
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "virnetshmsession.h"
+#include "virobject.h"
+#include "viratomic.h"
+#include "threads.h"
+#include "virfile.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "logging.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/* The rings are only safe to share with another process when the
+ * atomic operations are real CPU instructions, and the memory can
+ * be sealed so that the peer cannot pull it away from under us */
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS) && \
+    defined(VIR_ATOMIC_OPS_GCC)
+# define WITH_SHM 1
+#endif
+
+#define VIR_NET_SHM_MAGIC 0x6c767368
+#define VIR_NET_SHM_VERSION 1
+
+/* Must be a power of two, so that indexes can be masked */
+#define VIR_NET_SHM_RING_SIZE (1024 * 1024)
+#define VIR_NET_SHM_RING_SIZE_MIN 4096
+#define VIR_NET_SHM_RING_SIZE_MAX (64 * 1024 * 1024)
+
+/* Offset of the ring data, leaving the header a page of its own */
+#define VIR_NET_SHM_DATA_OFFSET 4096
+
+/*
+ * A single producer, single consumer byte ring. The head and tail
+ * count the bytes written and read since the start, wrapping around,
+ * so that head - tail is the amount of data queued. Only the producer
+ * moves the head and only the consumer the tail.
+ *
+ * A side which finds the ring empty, or full, sets its waiting flag
+ * before looking again, and the other side sends a byte over the
+ * socket when it finds the flag set after moving its index. One of
+ * them always sees what the other did, so no wakeup is lost.
+ */
+typedef struct _virNetShmRing virNetShmRing;
+typedef virNetShmRing *virNetShmRingPtr;
+struct _virNetShmRing {
+    int head;
+    int tail;
+    int readerWaiting;
+    int writerWaiting;
+};
+
+/* Ring 0 carries the data sent by the client, ring 1 the replies */
+typedef struct _virNetShmHeader virNetShmHeader;
+typedef virNetShmHeader *virNetShmHeaderPtr;
+struct _virNetShmHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int ringSize;
+    unsigned int padding;
+    virNetShmRing rings[2];
+};
+
+verify(sizeof(virNetShmHeader) <= VIR_NET_SHM_DATA_OFFSET);
+
+struct _virNetShmSession {
+    virObject object;
+
+    int fd;
+    char *map;
+    size_t mapLen;
+
+    /* Copied out of the header, since the peer may change it */
+    unsigned int ringSize;
+
+    virNetShmRingPtr rx;
+    char *rxData;
+    virNetShmRingPtr tx;
+    char *txData;
+};
+
+
+bool virNetShmSessionAvailable(void)
+{
+#ifdef WITH_SHM
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+#ifdef WITH_SHM
+static virClassPtr virNetShmSessionClass;
+static void virNetShmSessionDispose(void *obj);
+
+static int virNetShmSessionOnceInit(void)
+{
+    if (!(virNetShmSessionClass = virClassNew("virNetShmSession",
+                                              sizeof(virNetShmSession),
+                                              virNetShmSessionDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetShmSession)
+
+
+static virNetShmSessionPtr virNetShmSessionNew(int fd,
+                                               size_t mapLen,
+                                               bool client)
+{
+    virNetShmSessionPtr sess;
+    virNetShmHeaderPtr hdr;
+    void *map;
+
+    if (virNetShmSessionInitialize() < 0)
+        return NULL;
+
+    if ((map = mmap(NULL, mapLen, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to map shared memory"));
+        return NULL;
+    }
+
+    if (!(sess = virObjectNew(virNetShmSessionClass))) {
+        munmap(map, mapLen);
+        return NULL;
+    }
+
+    sess->fd = -1;
+    sess->map = map;
+    sess->mapLen = mapLen;
+    hdr = map;
+
+    if (client) {
+        hdr->magic = VIR_NET_SHM_MAGIC;
+        hdr->version = VIR_NET_SHM_VERSION;
+        hdr->ringSize = VIR_NET_SHM_RING_SIZE;
+    } else if (hdr->magic != VIR_NET_SHM_MAGIC ||
+               hdr->version != VIR_NET_SHM_VERSION ||
+               hdr->ringSize != (mapLen - VIR_NET_SHM_DATA_OFFSET) / 2) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unsupported shared memory layout"));
+        virObjectUnref(sess);
+        return NULL;
+    }
+    sess->ringSize = (mapLen - VIR_NET_SHM_DATA_OFFSET) / 2;
+
+    sess->rx = &hdr->rings[client ? 1 : 0];
+    sess->rxData = sess->map + VIR_NET_SHM_DATA_OFFSET +
+        (client ? sess->ringSize : 0);
+    sess->tx = &hdr->rings[client ? 0 : 1];
+    sess->txData = sess->map + VIR_NET_SHM_DATA_OFFSET +
+        (client ? 0 : sess->ringSize);
+
+    return sess;
+}
+
+
+/*
+ * Create the shared memory on the client side, to be passed to the
+ * server with virNetSocketSendFD. The memory is sealed against
+ * resizing, so that the server can safely map it.
+ */
+virNetShmSessionPtr virNetShmSessionNewClient(void)
+{
+    virNetShmSessionPtr sess;
+    size_t mapLen = VIR_NET_SHM_DATA_OFFSET + 2 * VIR_NET_SHM_RING_SIZE;
+    int fd;
+
+    if ((fd = memfd_create("libvirt-rpc",
+                           MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create shared memory"));
+        return NULL;
+    }
+
+    if (ftruncate(fd, mapLen) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to size shared memory"));
+        goto error;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seal shared memory"));
+        goto error;
+    }
+
+    if (!(sess = virNetShmSessionNew(fd, mapLen, true)))
+        goto error;
+    sess->fd = fd;
+
+    return sess;
+
+error:
+    VIR_FORCE_CLOSE(fd);
+    return NULL;
+}
+
+
+/*
+ * Map the shared memory received from a client. The client is not
+ * trusted, so the memory must not be able to shrink, which would
+ * fault any access past its new end.
+ */
+virNetShmSessionPtr virNetShmSessionNewServer(int fd)
+{
+    struct stat sb;
+    size_t ringSize;
+    int seals;
+
+    if ((seals = fcntl(fd, F_GET_SEALS)) < 0 ||
+        !(seals & F_SEAL_SHRINK)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared memory is not sealed against shrinking"));
+        return NULL;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to stat shared memory"));
+        return NULL;
+    }
+
+    ringSize = sb.st_size > VIR_NET_SHM_DATA_OFFSET ?
+        (sb.st_size - VIR_NET_SHM_DATA_OFFSET) / 2 : 0;
+    if (ringSize < VIR_NET_SHM_RING_SIZE_MIN ||
+        ringSize > VIR_NET_SHM_RING_SIZE_MAX ||
+        (ringSize & (ringSize - 1)) ||
+        sb.st_size != VIR_NET_SHM_DATA_OFFSET + 2 * ringSize) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unsupported shared memory size %lld"),
+                       (long long)sb.st_size);
+        return NULL;
+    }
+
+    return virNetShmSessionNew(fd, sb.st_size, false);
+}
+
+
+static void virNetShmSessionDispose(void *obj)
+{
+    virNetShmSessionPtr sess = obj;
+
+    if (sess->map)
+        munmap(sess->map, sess->mapLen);
+    VIR_FORCE_CLOSE(sess->fd);
+}
+#else /* ! WITH_SHM */
+virNetShmSessionPtr virNetShmSessionNewClient(void)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Shared memory transport is not supported"));
+    return NULL;
+}
+
+
+virNetShmSessionPtr virNetShmSessionNewServer(int fd ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Shared memory transport is not supported"));
+    return NULL;
+}
+#endif /* ! WITH_SHM */
+
+
+
+/* The memory to send to the server, only set on the client side */
+int virNetShmSessionGetFD(virNetShmSessionPtr sess)
+{
+    return sess->fd;
+}
+
+
+/* Amount of data in @ring, or -1 if the peer broke its indexes */
+static ssize_t virNetShmSessionRingUsed(virNetShmSessionPtr sess,
+                                        virNetShmRingPtr ring)
+{
+    unsigned int used = (unsigned int)virAtomicIntGet(&ring->head) -
+        (unsigned int)virAtomicIntGet(&ring->tail);
+
+    if (used > sess->ringSize) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared memory ring is corrupted"));
+        return -1;
+    }
+
+    return used;
+}
+
+
+/*
+ * Copy up to @len bytes out of the receive ring. If the ring is empty,
+ * the reader is marked as waiting for a wakeup, and 0 is returned, as
+ * a socket read would on EAGAIN. @wakeup is set to true if the peer
+ * has to be woken up because it was waiting for room.
+ *
+ * Returns the number of bytes read, 0 if none, -1 on error
+ */
+ssize_t virNetShmSessionRead(virNetShmSessionPtr sess,
+                             char *buf,
+                             size_t len,
+                             bool *wakeup)
+{
+    ssize_t used;
+    unsigned int tail;
+    size_t offset;
+    size_t n;
+
+    if ((used = virNetShmSessionRingUsed(sess, sess->rx)) < 0)
+        return -1;
+
+    if (used == 0) {
+        virAtomicIntSet(&sess->rx->readerWaiting, 1);
+        if ((used = virNetShmSessionRingUsed(sess, sess->rx)) <= 0)
+            return used;
+    }
+
+    if (len > (size_t)used)
+        len = used;
+
+    tail = virAtomicIntGet(&sess->rx->tail);
+    offset = tail & (sess->ringSize - 1);
+    n = MIN(len, sess->ringSize - offset);
+    memcpy(buf, sess->rxData + offset, n);
+    memcpy(buf + n, sess->rxData, len - n);
+
+    /* Only hand the room back once the data is copied out */
+    virAtomicIntAdd(&sess->rx->tail, len);
+
+    if (virAtomicIntAnd(&sess->rx->writerWaiting, 0))
+        *wakeup = true;
+
+    return len;
+}
+
+
+/*
+ * Copy up to @len bytes into the send ring. If the ring is full, the
+ * writer is marked as waiting for a wakeup, and 0 is returned, as a
+ * socket write would on EAGAIN. @wakeup is set to true if the peer
+ * has to be woken up because it was waiting for data.
+ *
+ * Returns the number of bytes written, 0 if none, -1 on error
+ */
+ssize_t virNetShmSessionWrite(virNetShmSessionPtr sess,
+                              const char *buf,
+                              size_t len,
+                              bool *wakeup)
+{
+    ssize_t used;
+    unsigned int head;
+    size_t offset;
+    size_t n;
+
+    if ((used = virNetShmSessionRingUsed(sess, sess->tx)) < 0)
+        return -1;
+
+    if (used == sess->ringSize) {
+        virAtomicIntSet(&sess->tx->writerWaiting, 1);
+        if ((used = virNetShmSessionRingUsed(sess, sess->tx)) < 0)
+            return -1;
+        if (used == sess->ringSize)
+            return 0;
+    }
+
+    if (len > (size_t)(sess->ringSize - used))
+        len = sess->ringSize - used;
+
+    head = virAtomicIntGet(&sess->tx->head);
+    offset = head & (sess->ringSize - 1);
+    n = MIN(len, sess->ringSize - offset);
+    memcpy(sess->txData + offset, buf, n);
+    memcpy(sess->txData, buf + n, len - n);
+
+    /* Only publish the data once it is copied in */
+    virAtomicIntAdd(&sess->tx->head, len);
+
+    if (virAtomicIntAnd(&sess->tx->readerWaiting, 0))
+        *wakeup = true;
+
+    return len;
+}
+
+
+/*
+ * Whether the receive ring has data. If it has none and @arm is
+ * true, the reader is marked as waiting, so that the peer sends a
+ * wakeup once it adds some. A corrupted ring counts as readable, so
+ * that the error is reported by the next read.
+ */
+bool virNetShmSessionCanRead(virNetShmSessionPtr sess,
+                             bool arm)
+{
+    if (virNetShmSessionRingUsed(sess, sess->rx) != 0)
+        return true;
+
+    if (!arm)
+        return false;
+
+    virAtomicIntSet(&sess->rx->readerWaiting, 1);
+    return virNetShmSessionRingUsed(sess, sess->rx) != 0;
+}
+
+
+/*
+ * Whether the send ring has room, marking the writer as waiting for
+ * a wakeup if it has none and @arm is true
+ */
+bool virNetShmSessionCanWrite(virNetShmSessionPtr sess,
+                              bool arm)
+{
+    if (virNetShmSessionRingUsed(sess, sess->tx) != sess->ringSize)
+        return true;
+
+    if (!arm)
+        return false;
+
+    virAtomicIntSet(&sess->tx->writerWaiting, 1);
+    return virNetShmSessionRingUsed(sess, sess->tx) != sess->ringSize;
+}
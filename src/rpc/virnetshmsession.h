@@ -0,0 +1,56 @@
+/*
+ * virnetshmsession.h: shared memory transport for local clients
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_NET_SHM_SESSION_H__
+# define __VIR_NET_SHM_SESSION_H__
+
+# include "internal.h"
+
+typedef struct _virNetShmSession virNetShmSession;
+typedef virNetShmSession *virNetShmSessionPtr;
+
+bool virNetShmSessionAvailable(void);
+
+virNetShmSessionPtr virNetShmSessionNewClient(void);
+virNetShmSessionPtr virNetShmSessionNewServer(int fd);
+
+int virNetShmSessionGetFD(virNetShmSessionPtr sess)
+    ATTRIBUTE_NONNULL(1);
+
+ssize_t virNetShmSessionRead(virNetShmSessionPtr sess,
+                             char *buf,
+                             size_t len,
+                             bool *wakeup)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+ssize_t virNetShmSessionWrite(virNetShmSessionPtr sess,
+                              const char *buf,
+                              size_t len,
+                              bool *wakeup)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+
+bool virNetShmSessionCanRead(virNetShmSessionPtr sess,
+                             bool arm)
+    ATTRIBUTE_NONNULL(1);
+bool virNetShmSessionCanWrite(virNetShmSessionPtr sess,
+                              bool arm)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_NET_SHM_SESSION_H__ */
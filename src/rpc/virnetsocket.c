@@ -25,6 +25,7 @@
 
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
@@ -43,6 +44,8 @@
 #include "logging.h"
 #include "virfile.h"
 #include "event.h"
+#include "event_epoll.h"
+#include "event_poll.h"
 #include "threads.h"
 #include "virprocess.h"
 
@@ -54,6 +57,10 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Most data gathered into a single TLS record by virNetSocketWritev,
+ * which is the largest record payload TLS allows */
+#define VIR_NET_SOCKET_TLS_BATCH_MAX 16384
+
 
 struct _virNetSocket {
     virObject object;
@@ -67,9 +74,11 @@ struct _virNetSocket {
     bool client;
 
     /* Event callback fields */
+    virEventEpollLoopPtr eventLoop;
     virNetSocketIOFunc func;
     void *opaque;
     virFreeCallback ff;
+    int events;
 
     virSocketAddr localAddr;
     virSocketAddr remoteAddr;
@@ -77,6 +86,7 @@ struct _virNetSocket {
     char *remoteAddrStr;
 
     virNetTLSSessionPtr tlsSession;
+    char *tlsBatch;
 #if HAVE_SASL
     virNetSASLSessionPtr saslSession;
 
@@ -91,6 +101,10 @@ struct _virNetSocket {
 #if HAVE_LIBSSH2
     virNetSSHSessionPtr sshSession;
 #endif
+
+    /* With shared memory, the socket only carries wakeups */
+    virNetShmSessionPtr shmSession;
+    bool shmEOF;
 };
 
 
@@ -950,6 +964,11 @@ virJSONValuePtr virNetSocketPreExecRestart(virNetSocketPtr sock)
                        _("Unable to save socket state when TLS session is active"));
         goto error;
     }
+    if (sock->shmSession) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save socket state when shared memory is in use"));
+        goto error;
+    }
 
     if (!(object = virJSONValueNewObject()))
         goto error;
@@ -1019,6 +1038,7 @@ void virNetSocketDispose(void *obj)
 #if HAVE_LIBSSH2
     virObjectUnref(sock->sshSession);
 #endif
+    virObjectUnref(sock->shmSession);
 
     VIR_FORCE_CLOSE(sock->fd);
     VIR_FORCE_CLOSE(sock->errfd);
@@ -1027,6 +1047,7 @@ void virNetSocketDispose(void *obj)
 
     VIR_FREE(sock->localAddrStr);
     VIR_FREE(sock->remoteAddrStr);
+    VIR_FREE(sock->tlsBatch);
 
     virMutexDestroy(&sock->lock);
 }
@@ -1074,7 +1095,10 @@ bool virNetSocketHasPassFD(virNetSocketPtr sock)
 {
     bool hasPassFD = false;
     virMutexLock(&sock->lock);
-    if (sock->localAddr.data.sa.sa_family == AF_UNIX)
+    /* The file descriptors would not arrive in step with the
+     * data once that goes through shared memory */
+    if (sock->localAddr.data.sa.sa_family == AF_UNIX &&
+        !sock->shmSession)
         hasPassFD = true;
     virMutexUnlock(&sock->lock);
     return hasPassFD;
@@ -1195,6 +1219,190 @@ void virNetSocketSetSASLSession(virNetSocketPtr sock,
 #endif
 
 
+/* Let the peer know that the shared memory changed */
+static void virNetSocketShmWakeup(virNetSocketPtr sock)
+{
+    char token = 0;
+
+    /* If the socket buffer is full, the peer has wakeups
+     * pending already, so there is no need to wait */
+    if (send(sock->fd, &token, 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+        errno != EAGAIN && errno != EINTR)
+        VIR_DEBUG("Unable to wake up peer of socket %p: %d", sock, errno);
+}
+
+
+/* Consume the wakeups received, noting when the peer went away */
+static void virNetSocketShmDrain(virNetSocketPtr sock)
+{
+    char tokens[64];
+    ssize_t got;
+
+    for (;;) {
+        got = recv(sock->fd, tokens, sizeof(tokens), MSG_DONTWAIT);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && errno == EAGAIN)
+            break;
+        if (got <= 0) {
+            sock->shmEOF = true;
+            break;
+        }
+    }
+}
+
+
+/*
+ * The events to watch on the socket, for the owner of the watch to
+ * get @events from the shared memory. Waiting for data or room means
+ * waiting for a wakeup to arrive. When the shared memory is ready
+ * already, watching for the socket to be writable, which it nearly
+ * always is, gets the owner called right away.
+ */
+static int virNetSocketShmWatchEvents(virNetSocketPtr sock,
+                                      int events)
+{
+    int ret = events & ~(VIR_EVENT_HANDLE_READABLE |
+                         VIR_EVENT_HANDLE_WRITABLE);
+    bool ready = false;
+
+    if (events & VIR_EVENT_HANDLE_READABLE) {
+        if (sock->shmEOF ||
+            virNetShmSessionCanRead(sock->shmSession, true))
+            ready = true;
+        else
+            ret |= VIR_EVENT_HANDLE_READABLE;
+    }
+
+    if (events & VIR_EVENT_HANDLE_WRITABLE) {
+        if (virNetShmSessionCanWrite(sock->shmSession, true))
+            ready = true;
+        else
+            ret |= VIR_EVENT_HANDLE_READABLE;
+    }
+
+    if (ready)
+        ret |= VIR_EVENT_HANDLE_WRITABLE;
+
+    return ret;
+}
+
+
+/* Turn the @revents seen on the socket into the @events the owner of
+ * the watch wanted from the shared memory */
+static int virNetSocketShmReadyEvents(virNetSocketPtr sock,
+                                      int events,
+                                      int revents)
+{
+    int ret = revents & ~(VIR_EVENT_HANDLE_READABLE |
+                          VIR_EVENT_HANDLE_WRITABLE);
+
+    if (revents & VIR_EVENT_HANDLE_READABLE)
+        virNetSocketShmDrain(sock);
+
+    if ((events & VIR_EVENT_HANDLE_READABLE) &&
+        (sock->shmEOF ||
+         virNetShmSessionCanRead(sock->shmSession, false)))
+        ret |= VIR_EVENT_HANDLE_READABLE;
+
+    if ((events & VIR_EVENT_HANDLE_WRITABLE) &&
+        virNetShmSessionCanWrite(sock->shmSession, false))
+        ret |= VIR_EVENT_HANDLE_WRITABLE;
+
+    return ret;
+}
+
+
+static void virNetSocketUpdateWatch(virNetSocketPtr sock)
+{
+    int events = sock->events;
+
+    if (sock->watch <= 0)
+        return;
+
+    if (sock->shmSession)
+        events = virNetSocketShmWatchEvents(sock, events);
+
+    if (sock->eventLoop)
+        virEventEpollLoopUpdateHandle(sock->eventLoop, sock->watch, events);
+    else
+        virEventUpdateHandle(sock->watch, events);
+}
+
+
+/*
+ * Move all further data onto the shared memory of @sess. Both ends
+ * must switch at the same point of the stream, with nothing sent
+ * but not yet received in between.
+ */
+int virNetSocketSetShmSession(virNetSocketPtr sock,
+                              virNetShmSessionPtr sess)
+{
+    int ret = -1;
+
+    virMutexLock(&sock->lock);
+
+    if (sock->localAddr.data.sa.sa_family != AF_UNIX ||
+        sock->tlsSession ||
+#if HAVE_SASL
+        sock->saslSession ||
+#endif
+#if HAVE_LIBSSH2
+        sock->sshSession ||
+#endif
+        sock->shmSession) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Shared memory can only be used on plain local sockets"));
+        goto cleanup;
+    }
+
+    sock->shmSession = virObjectRef(sess);
+    virNetSocketUpdateWatch(sock);
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&sock->lock);
+    return ret;
+}
+
+
+/*
+ * For a caller driving the socket with poll() itself, the events to
+ * poll for on the socket, so as to get the POLLIN and POLLOUT @events
+ * wanted. Without shared memory, this is @events itself.
+ */
+int virNetSocketGetPollEvents(virNetSocketPtr sock,
+                              int events)
+{
+    virMutexLock(&sock->lock);
+    if (sock->shmSession)
+        events = virEventPollToNativeEvents(
+            virNetSocketShmWatchEvents(sock,
+                                       virEventPollFromNativeEvents(events)));
+    virMutexUnlock(&sock->lock);
+    return events;
+}
+
+
+/*
+ * Turn the @revents poll() returned for the socket into those of the
+ * @events wanted which can now be acted on
+ */
+int virNetSocketGetPollRevents(virNetSocketPtr sock,
+                               int events,
+                               int revents)
+{
+    virMutexLock(&sock->lock);
+    if (sock->shmSession)
+        revents = virEventPollToNativeEvents(
+            virNetSocketShmReadyEvents(sock,
+                                       virEventPollFromNativeEvents(events),
+                                       virEventPollFromNativeEvents(revents)));
+    virMutexUnlock(&sock->lock);
+    return revents;
+}
+
+
 bool virNetSocketHasCachedData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
 {
     bool hasCached = false;
@@ -1209,6 +1417,10 @@ bool virNetSocketHasCachedData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
     if (sock->saslDecoded)
         hasCached = true;
 #endif
+
+    if (sock->shmSession &&
+        virNetShmSessionCanRead(sock->shmSession, false))
+        hasCached = true;
     virMutexUnlock(&sock->lock);
     return hasCached;
 }
@@ -1435,10 +1647,68 @@ static ssize_t virNetSocketWriteSASL(virNetSocketPtr sock, const char *buf, size
 }
 #endif
 
+
+static ssize_t virNetSocketReadShm(virNetSocketPtr sock, char *buf, size_t len)
+{
+    bool wakeup = false;
+    ssize_t ret;
+
+    ret = virNetShmSessionRead(sock->shmSession, buf, len, &wakeup);
+    if (wakeup)
+        virNetSocketShmWakeup(sock);
+
+    if (ret == 0 && sock->shmEOF) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while reading data"));
+        return -1;
+    }
+
+    return ret;
+}
+
+
+static ssize_t virNetSocketWritevShm(virNetSocketPtr sock,
+                                     const struct iovec *iov,
+                                     size_t niov)
+{
+    bool wakeup = false;
+    ssize_t ret = 0;
+    size_t i;
+
+    if (sock->shmEOF) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        return -1;
+    }
+
+    for (i = 0 ; i < niov ; i++) {
+        ssize_t done = virNetShmSessionWrite(sock->shmSession,
+                                             iov[i].iov_base,
+                                             iov[i].iov_len,
+                                             &wakeup);
+        if (done < 0) {
+            ret = -1;
+            break;
+        }
+        ret += done;
+        if ((size_t)done < iov[i].iov_len)
+            break;
+    }
+
+    if (wakeup)
+        virNetSocketShmWakeup(sock);
+
+    return ret;
+}
+
+
 ssize_t virNetSocketRead(virNetSocketPtr sock, char *buf, size_t len)
 {
     ssize_t ret;
     virMutexLock(&sock->lock);
+    if (sock->shmSession)
+        ret = virNetSocketReadShm(sock, buf, len);
+    else
 #if HAVE_SASL
     if (sock->saslSession)
         ret = virNetSocketReadSASL(sock, buf, len);
@@ -1454,6 +1724,10 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
     ssize_t ret;
 
     virMutexLock(&sock->lock);
+    if (sock->shmSession) {
+        struct iovec iov = { (char *)buf, len };
+        ret = virNetSocketWritevShm(sock, &iov, 1);
+    } else
 #if HAVE_SASL
     if (sock->saslSession)
         ret = virNetSocketWriteSASL(sock, buf, len);
@@ -1465,6 +1739,143 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 }
 
 
+/* Gathers as much of @iov as fits into one TLS record, so that
+ * many small messages do not each cost a record of their own */
+static ssize_t virNetSocketWritevTLS(virNetSocketPtr sock,
+                                     const struct iovec *iov,
+                                     size_t niov)
+{
+    size_t len = 0;
+    size_t i;
+
+    if (niov == 1 || iov[0].iov_len >= VIR_NET_SOCKET_TLS_BATCH_MAX)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+
+    if (!sock->tlsBatch &&
+        VIR_ALLOC_N(sock->tlsBatch, VIR_NET_SOCKET_TLS_BATCH_MAX) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    /* gnutls wants the same data passed again after EAGAIN. The
+     * batch always starts with the unsent data, and the caller only
+     * appends to its queue, so a retry repeats the same bytes */
+    for (i = 0 ; i < niov && len < VIR_NET_SOCKET_TLS_BATCH_MAX ; i++) {
+        size_t n = iov[i].iov_len;
+
+        if (n > VIR_NET_SOCKET_TLS_BATCH_MAX - len)
+            n = VIR_NET_SOCKET_TLS_BATCH_MAX - len;
+        memcpy(sock->tlsBatch + len, iov[i].iov_base, n);
+        len += n;
+    }
+
+    return virNetSocketWriteWire(sock, sock->tlsBatch, len);
+}
+
+
+#ifndef HAVE_WRITEV
+/* Sends the buffers one at a time, stopping after the first one
+ * which could not be sent entirely */
+static ssize_t virNetSocketWritevFallback(int fd,
+                                          const struct iovec *iov,
+                                          size_t niov)
+{
+    ssize_t done = 0;
+    size_t i;
+
+    for (i = 0 ; i < niov ; i++) {
+        ssize_t ret = write(fd, iov[i].iov_base, iov[i].iov_len);
+
+        if (ret < 0)
+            return done ? done : -1;
+        done += ret;
+        if (ret < iov[i].iov_len)
+            break;
+    }
+
+    return done;
+}
+#endif
+
+
+static ssize_t virNetSocketWritevWire(virNetSocketPtr sock,
+                                      const struct iovec *iov,
+                                      size_t niov)
+{
+    ssize_t ret;
+
+    if (sock->tlsSession &&
+        virNetTLSSessionGetHandshakeStatus(sock->tlsSession) ==
+        VIR_NET_TLS_HANDSHAKE_COMPLETE)
+        return virNetSocketWritevTLS(sock, iov, niov);
+
+rewrite:
+#ifdef HAVE_WRITEV
+    ret = writev(sock->fd, iov, niov);
+#else
+    ret = virNetSocketWritevFallback(sock->fd, iov, niov);
+#endif
+
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN)
+            return 0;
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        return -1;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        return -1;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Like virNetSocketWrite, but gathering the data to send from @niov
+ * buffers, so that several queued messages can go out with a single
+ * system call, or in a single TLS record. As with virNetSocketWrite,
+ * only part of the data may be sent, and the data of an unfinished
+ * buffer must be passed again when retrying. With SASL or SSH, only
+ * the first buffer is sent at a time, while with shared memory as
+ * many as there is room for are copied in.
+ *
+ * Returns the number of bytes sent, 0 if it would block, -1 on error
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           size_t niov)
+{
+    ssize_t ret;
+
+    if (niov == 0)
+        return 0;
+
+    virMutexLock(&sock->lock);
+    if (sock->shmSession)
+        ret = virNetSocketWritevShm(sock, iov, niov);
+    else
+#if HAVE_SASL
+    if (sock->saslSession)
+        ret = virNetSocketWriteSASL(sock, iov[0].iov_base, iov[0].iov_len);
+    else
+#endif
+#if HAVE_LIBSSH2
+    if (sock->sshSession)
+        ret = virNetSocketLibSSH2Write(sock, iov[0].iov_base, iov[0].iov_len);
+    else
+#endif
+        ret = virNetSocketWritevWire(sock, iov, niov);
+    virMutexUnlock(&sock->lock);
+    return ret;
+}
+
+
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
  */
@@ -1599,14 +2010,26 @@ static void virNetSocketEventHandle(int watch ATTRIBUTE_UNUSED,
     virNetSocketPtr sock = opaque;
     virNetSocketIOFunc func;
     void *eopaque;
+    bool shm;
 
     virMutexLock(&sock->lock);
     func = sock->func;
     eopaque = sock->opaque;
+    if ((shm = sock->shmSession != NULL))
+        events = virNetSocketShmReadyEvents(sock, sock->events, events);
     virMutexUnlock(&sock->lock);
 
-    if (func)
+    if (func && events)
         func(sock, events, eopaque);
+
+    /* The owner may have used the shared memory without changing
+     * the events it wants, so what to watch has to be worked out
+     * again */
+    if (shm) {
+        virMutexLock(&sock->lock);
+        virNetSocketUpdateWatch(sock);
+        virMutexUnlock(&sock->lock);
+    }
 }
 
 
@@ -1622,6 +2045,12 @@ static void virNetSocketEventFree(void *opaque)
     sock->func = NULL;
     sock->ff = NULL;
     sock->opaque = NULL;
+    /* The watch number means nothing to the default event
+     * loop, so make sure it is never handed to it */
+    if (sock->eventLoop) {
+        sock->eventLoop = NULL;
+        sock->watch = -1;
+    }
     virMutexUnlock(&sock->lock);
 
     if (ff)
@@ -1630,6 +2059,30 @@ static void virNetSocketEventFree(void *opaque)
     virObjectUnref(sock);
 }
 
+/*
+ * Watch the socket from @loop instead of the default event loop.
+ * Must be called before any IO callback is registered
+ */
+int virNetSocketSetEventLoop(virNetSocketPtr sock,
+                             virEventEpollLoopPtr loop)
+{
+    int ret = -1;
+
+    virMutexLock(&sock->lock);
+    if (sock->watch > 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot change event loop of a watched socket"));
+        goto cleanup;
+    }
+
+    sock->eventLoop = loop;
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&sock->lock);
+    return ret;
+}
+
 int virNetSocketAddIOCallback(virNetSocketPtr sock,
                               int events,
                               virNetSocketIOFunc func,
@@ -1645,11 +2098,24 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
         goto cleanup;
     }
 
-    if ((sock->watch = virEventAddHandle(sock->fd,
-                                         events,
-                                         virNetSocketEventHandle,
-                                         sock,
-                                         virNetSocketEventFree)) < 0) {
+    sock->events = events;
+    if (sock->shmSession)
+        events = virNetSocketShmWatchEvents(sock, events);
+
+    if (sock->eventLoop)
+        sock->watch = virEventEpollLoopAddHandle(sock->eventLoop,
+                                                 sock->fd,
+                                                 events,
+                                                 virNetSocketEventHandle,
+                                                 sock,
+                                                 virNetSocketEventFree);
+    else
+        sock->watch = virEventAddHandle(sock->fd,
+                                        events,
+                                        virNetSocketEventHandle,
+                                        sock,
+                                        virNetSocketEventFree);
+    if (sock->watch < 0) {
         VIR_DEBUG("Failed to register watch on socket %p", sock);
         goto cleanup;
     }
@@ -1676,7 +2142,8 @@ void virNetSocketUpdateIOCallback(virNetSocketPtr sock,
         return;
     }
 
-    virEventUpdateHandle(sock->watch, events);
+    sock->events = events;
+    virNetSocketUpdateWatch(sock);
 
     virMutexUnlock(&sock->lock);
 }
@@ -1691,7 +2158,10 @@ void virNetSocketRemoveIOCallback(virNetSocketPtr sock)
         return;
     }
 
-    virEventRemoveHandle(sock->watch);
+    if (sock->eventLoop)
+        virEventEpollLoopRemoveHandle(sock->eventLoop, sock->watch);
+    else
+        virEventRemoveHandle(sock->watch);
 
     virMutexUnlock(&sock->lock);
 }
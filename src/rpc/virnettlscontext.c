@@ -49,6 +49,16 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Session tickets, which let a client resume a session without the
+ * server keeping any state, appeared in gnutls 2.10 */
+#if LIBGNUTLS_VERSION_NUMBER >= 0x020a00
+# define VIR_NET_TLS_TICKETS 1
+# include <gnutls/crypto.h>
+#endif
+
+/* Number of hosts whose session a client remembers */
+#define VIR_NET_TLS_CLIENT_CACHE_SIZE 16
+
 struct _virNetTLSContext {
     virObject object;
 
@@ -60,6 +70,18 @@ struct _virNetTLSContext {
     bool isServer;
     bool requireValidCert;
     const char *const*x509dnWhitelist;
+
+#ifdef VIR_NET_TLS_TICKETS
+    /* Protects the tickets handed out by a server */
+    gnutls_datum_t ticketKey;
+    /* Digest of the certificates of a client, which a session
+     * is only resumed with if they have not changed */
+    char *credentials;
+#endif
+
+    /* Handshakes which resumed an earlier session, and full ones */
+    unsigned long long resumed;
+    unsigned long long full;
 };
 
 struct _virNetTLSSession {
@@ -71,12 +93,40 @@ struct _virNetTLSSession {
 
     bool isServer;
     char *hostname;
+#ifdef VIR_NET_TLS_TICKETS
+    /* Which sessions of the client cache this one may resume */
+    char *cacheKey;
+#endif
     gnutls_session_t session;
     virNetTLSSessionWriteFunc writeFunc;
     virNetTLSSessionReadFunc readFunc;
     void *opaque;
+
+    virNetTLSContextPtr ctxt;
+};
+
+#ifdef VIR_NET_TLS_TICKETS
+/*
+ * The remote driver creates a context for each connection, so the
+ * sessions a client may resume are kept for the process, with the
+ * least recently used one making way for a new one. A session is
+ * only resumed with the same server, reached at the same address,
+ * by a context with the same certificates as the one it was made
+ * with. The server certificate is still checked against the context
+ * of each new connection, resumed or not.
+ */
+typedef struct _virNetTLSCacheEntry virNetTLSCacheEntry;
+struct _virNetTLSCacheEntry {
+    char *key;
+    gnutls_datum_t data;
+    unsigned long long lastUsed;
 };
 
+static virMutex virNetTLSClientCacheLock;
+static virNetTLSCacheEntry virNetTLSClientCache[VIR_NET_TLS_CLIENT_CACHE_SIZE];
+static unsigned long long virNetTLSClientCacheClock;
+#endif
+
 static virClassPtr virNetTLSContextClass;
 static virClassPtr virNetTLSSessionClass;
 static void virNetTLSContextDispose(void *obj);
@@ -95,6 +145,14 @@ static int virNetTLSContextOnceInit(void)
                                               virNetTLSSessionDispose)))
         return -1;
 
+#ifdef VIR_NET_TLS_TICKETS
+    if (virMutexInit(&virNetTLSClientCacheLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+#endif
+
     return 0;
 }
 
@@ -658,6 +716,59 @@ cleanup:
 }
 
 
+#ifdef VIR_NET_TLS_TICKETS
+/* Sets ctxt->credentials to a digest of the certificate files of a
+ * client, missing ones counting as empty */
+static int virNetTLSContextDigestCredentials(virNetTLSContextPtr ctxt,
+                                             const char *cacert,
+                                             const char *cert)
+{
+    const char *files[] = { cacert, cert };
+    unsigned char digest[32];
+    gnutls_hash_hd_t hash;
+    char *buf = NULL;
+    size_t i;
+    int err;
+
+    if ((err = gnutls_hash_init(&hash, GNUTLS_DIG_SHA256)) < 0) {
+        virReportError(VIR_ERR_SYSTEM_ERROR,
+                       _("Unable to initialize digest: %s"),
+                       gnutls_strerror(err));
+        return -1;
+    }
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(files) ; i++) {
+        int len = 0;
+
+        if (files[i] && files[i][0] != '\0' && access(files[i], R_OK) == 0 &&
+            (len = virFileReadAll(files[i], (1<<20), &buf)) < 0) {
+            gnutls_hash_deinit(hash, NULL);
+            return -1;
+        }
+
+        /* The lengths keep the contents of the files apart */
+        gnutls_hash(hash, &len, sizeof(len));
+        if (len)
+            gnutls_hash(hash, buf, len);
+        VIR_FREE(buf);
+    }
+
+    gnutls_hash_deinit(hash, digest);
+
+    if (VIR_ALLOC_N(ctxt->credentials, sizeof(digest) * 2 + 1) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    for (i = 0 ; i < sizeof(digest) ; i++) {
+        ctxt->credentials[i * 2] = "0123456789abcdef"[digest[i] >> 4];
+        ctxt->credentials[i * 2 + 1] = "0123456789abcdef"[digest[i] & 0xf];
+    }
+
+    return 0;
+}
+#endif
+
+
 static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
                                                const char *cacrl,
                                                const char *cert,
@@ -732,8 +843,24 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
 
         gnutls_certificate_set_dh_params(ctxt->x509cred,
                                          ctxt->dhParams);
+
+#ifdef VIR_NET_TLS_TICKETS
+        err = gnutls_session_ticket_key_generate(&ctxt->ticketKey);
+        if (err < 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Unable to generate session ticket key: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
     }
 
+#ifdef VIR_NET_TLS_TICKETS
+    if (!isServer &&
+        virNetTLSContextDigestCredentials(ctxt, cacert, cert) < 0)
+        goto error;
+#endif
+
     ctxt->requireValidCert = requireValidCert;
     ctxt->x509dnWhitelist = x509dnWhitelist;
     ctxt->isServer = isServer;
@@ -753,6 +880,26 @@ error:
 }
 
 
+/**
+ * virNetTLSContextGetResumeStats:
+ * @ctxt: the TLS context
+ * @resumed: set to the number of handshakes which resumed a session
+ * @full: set to the number of full handshakes
+ *
+ * Counts the handshakes completed by the sessions of @ctxt, which
+ * tells how often reconnecting clients avoid a full handshake.
+ */
+void virNetTLSContextGetResumeStats(virNetTLSContextPtr ctxt,
+                                    unsigned long long *resumed,
+                                    unsigned long long *full)
+{
+    virMutexLock(&ctxt->lock);
+    *resumed = ctxt->resumed;
+    *full = ctxt->full;
+    virMutexUnlock(&ctxt->lock);
+}
+
+
 static int virNetTLSContextLocateCredentials(const char *pkipath,
                                              bool tryUserPkiPath,
                                              bool isServer,
@@ -1124,10 +1271,94 @@ void virNetTLSContextDispose(void *obj)
 
     gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+#ifdef VIR_NET_TLS_TICKETS
+    if (ctxt->ticketKey.data) {
+        memset(ctxt->ticketKey.data, 0, ctxt->ticketKey.size);
+        gnutls_free(ctxt->ticketKey.data);
+    }
+    VIR_FREE(ctxt->credentials);
+#endif
     virMutexDestroy(&ctxt->lock);
 }
 
 
+#ifdef VIR_NET_TLS_TICKETS
+/* Offer the server the session last used with the same host */
+static void virNetTLSClientCacheLookup(virNetTLSSessionPtr sess)
+{
+    size_t i;
+
+    if (!sess->cacheKey)
+        return;
+
+    virMutexLock(&virNetTLSClientCacheLock);
+    for (i = 0 ; i < VIR_NET_TLS_CLIENT_CACHE_SIZE ; i++) {
+        virNetTLSCacheEntry *entry = &virNetTLSClientCache[i];
+
+        if (!entry->key || STRNEQ(entry->key, sess->cacheKey))
+            continue;
+
+        if (gnutls_session_set_data(sess->session,
+                                    entry->data.data,
+                                    entry->data.size) < 0) {
+            VIR_DEBUG("Unable to reuse TLS session for %s", sess->hostname);
+        } else {
+            entry->lastUsed = ++virNetTLSClientCacheClock;
+        }
+        break;
+    }
+    virMutexUnlock(&virNetTLSClientCacheLock);
+}
+
+
+/* Remember the current state of an established session, which with
+ * TLS 1.3 only includes a ticket once the server sent one, some time
+ * after the handshake */
+static void virNetTLSClientCacheStore(virNetTLSSessionPtr sess)
+{
+    virNetTLSCacheEntry *entry = NULL;
+    gnutls_datum_t data;
+    char *key = NULL;
+    size_t i;
+
+    if (!sess->cacheKey || !sess->handshakeComplete)
+        return;
+
+    if (gnutls_session_get_data2(sess->session, &data) < 0)
+        return;
+
+    virMutexLock(&virNetTLSClientCacheLock);
+    for (i = 0 ; i < VIR_NET_TLS_CLIENT_CACHE_SIZE ; i++) {
+        virNetTLSCacheEntry *tmp = &virNetTLSClientCache[i];
+
+        if (tmp->key && STREQ(tmp->key, sess->cacheKey)) {
+            entry = tmp;
+            break;
+        }
+        if (!entry || tmp->lastUsed < entry->lastUsed)
+            entry = tmp;
+    }
+
+    if (!entry->key || STRNEQ(entry->key, sess->cacheKey)) {
+        if (!(key = strdup(sess->cacheKey))) {
+            /* Not worth failing the connection over */
+            gnutls_free(data.data);
+            goto cleanup;
+        }
+        VIR_FREE(entry->key);
+        entry->key = key;
+    }
+
+    gnutls_free(entry->data.data);
+    entry->data = data;
+    entry->lastUsed = ++virNetTLSClientCacheClock;
+
+cleanup:
+    virMutexUnlock(&virNetTLSClientCacheLock);
+}
+#endif
+
+
 static ssize_t
 virNetTLSSessionPush(void *opaque, const void *buf, size_t len)
 {
@@ -1156,14 +1387,20 @@ virNetTLSSessionPull(void *opaque, void *buf, size_t len)
 }
 
 
+/*
+ * @hostname: the name of the server, for a client, or NULL
+ * @peer: the address of the server, such as returned by
+ * virNetSocketRemoteAddrString, for a client, or NULL
+ */
 virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
-                                        const char *hostname)
+                                        const char *hostname,
+                                        const char *peer)
 {
     virNetTLSSessionPtr sess;
     int err;
 
-    VIR_DEBUG("ctxt=%p hostname=%s isServer=%d",
-              ctxt, NULLSTR(hostname), ctxt->isServer);
+    VIR_DEBUG("ctxt=%p hostname=%s peer=%s isServer=%d",
+              ctxt, NULLSTR(hostname), NULLSTR(peer), ctxt->isServer);
 
     if (!(sess = virObjectNew(virNetTLSSessionClass)))
         return NULL;
@@ -1181,6 +1418,15 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         goto error;
     }
 
+#ifdef VIR_NET_TLS_TICKETS
+    if (!ctxt->isServer && hostname &&
+        virAsprintf(&sess->cacheKey, "%s %s %s", ctxt->credentials,
+                    hostname, NULLSTR(peer)) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+#endif
+
     if ((err = gnutls_init(&sess->session,
                            ctxt->isServer ? GNUTLS_SERVER : GNUTLS_CLIENT)) != 0) {
         virReportError(VIR_ERR_SYSTEM_ERROR,
@@ -1216,6 +1462,25 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         gnutls_dh_set_prime_bits(sess->session, DH_BITS);
     }
 
+#ifdef VIR_NET_TLS_TICKETS
+    /* Let reconnecting clients skip the key exchange and the
+     * certificate checks, which dominate the cost of connecting */
+    if (ctxt->isServer)
+        err = gnutls_session_ticket_enable_server(sess->session,
+                                                  &ctxt->ticketKey);
+    else
+        err = gnutls_session_ticket_enable_client(sess->session);
+    if (err < 0) {
+        virReportError(VIR_ERR_SYSTEM_ERROR,
+                       _("Failed to enable TLS session tickets: %s"),
+                       gnutls_strerror(err));
+        goto error;
+    }
+
+    if (!ctxt->isServer)
+        virNetTLSClientCacheLookup(sess);
+#endif
+
     gnutls_transport_set_ptr(sess->session, sess);
     gnutls_transport_set_push_function(sess->session,
                                        virNetTLSSessionPush);
@@ -1223,6 +1488,7 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
                                        virNetTLSSessionPull);
 
     sess->isServer = ctxt->isServer;
+    sess->ctxt = virObjectRef(ctxt);
 
     PROBE(RPC_TLS_SESSION_NEW,
           "sess=%p ctxt=%p hostname=%s isServer=%d",
@@ -1315,13 +1581,20 @@ cleanup:
 int virNetTLSSessionHandshake(virNetTLSSessionPtr sess)
 {
     int ret;
+    bool resumed = false;
     VIR_DEBUG("sess=%p", sess);
     virMutexLock(&sess->lock);
     ret = gnutls_handshake(sess->session);
     VIR_DEBUG("Ret=%d", ret);
     if (ret == 0) {
         sess->handshakeComplete = true;
-        VIR_DEBUG("Handshake is complete");
+        resumed = gnutls_session_is_resumed(sess->session) != 0;
+        VIR_DEBUG("Handshake is complete, session %s",
+                  resumed ? "resumed" : "established");
+#ifdef VIR_NET_TLS_TICKETS
+        if (!sess->isServer)
+            virNetTLSClientCacheStore(sess);
+#endif
         goto cleanup;
     }
     if (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN) {
@@ -1341,6 +1614,17 @@ int virNetTLSSessionHandshake(virNetTLSSessionPtr sess)
 
 cleanup:
     virMutexUnlock(&sess->lock);
+
+    /* Taken separately, as virNetTLSContextCheckCertificate takes
+     * the locks the other way round */
+    if (ret == 0) {
+        virMutexLock(&sess->ctxt->lock);
+        if (resumed)
+            sess->ctxt->resumed++;
+        else
+            sess->ctxt->full++;
+        virMutexUnlock(&sess->ctxt->lock);
+    }
     return ret;
 }
 
@@ -1382,8 +1666,17 @@ void virNetTLSSessionDispose(void *obj)
 {
     virNetTLSSessionPtr sess = obj;
 
+#ifdef VIR_NET_TLS_TICKETS
+    if (!sess->isServer && sess->session)
+        virNetTLSClientCacheStore(sess);
+#endif
+
     VIR_FREE(sess->hostname);
+#ifdef VIR_NET_TLS_TICKETS
+    VIR_FREE(sess->cacheKey);
+#endif
     gnutls_deinit(sess->session);
+    virObjectUnref(sess->ctxt);
     virMutexDestroy(&sess->lock);
 }
 
@@ -62,6 +62,10 @@ virNetTLSContextPtr virNetTLSContextNewClient(const char *cacert,
 int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
                                      virNetTLSSessionPtr sess);
 
+void virNetTLSContextGetResumeStats(virNetTLSContextPtr ctxt,
+                                    unsigned long long *resumed,
+                                    unsigned long long *full);
+
 
 typedef ssize_t (*virNetTLSSessionWriteFunc)(const char *buf, size_t len,
                                              void *opaque);
@@ -69,7 +73,8 @@ typedef ssize_t (*virNetTLSSessionReadFunc)(char *buf, size_t len,
                                             void *opaque);
 
 virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
-                                        const char *hostname);
+                                        const char *hostname,
+                                        const char *peer);
 
 void virNetTLSSessionSetIOCallbacks(virNetTLSSessionPtr sess,
                                     virNetTLSSessionWriteFunc writeFunc,
@@ -1637,7 +1637,7 @@ storageVolumeDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1672,11 +1672,19 @@ storageVolumeDownload(virStorageVolPtr obj,
         goto out;
     }
 
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_RDONLY) < 0)
-        goto out;
+    if (flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenSparseFile(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_RDONLY) < 0)
+            goto out;
+    } else {
+        if (virFDStreamOpenFile(stream,
+                                vol->target.path,
+                                offset, length,
+                                O_RDONLY) < 0)
+            goto out;
+    }
 
     ret = 0;
 
@@ -1700,7 +1708,7 @@ storageVolumeUpload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1737,11 +1745,19 @@ storageVolumeUpload(virStorageVolPtr obj,
 
     /* Not using O_CREAT because the file is required to
      * already exist at this point */
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_WRONLY) < 0)
-        goto out;
+    if (flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenSparseFile(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_WRONLY) < 0)
+            goto out;
+    } else {
+        if (virFDStreamOpenFile(stream,
+                                vol->target.path,
+                                offset, length,
+                                O_WRONLY) < 0)
+            goto out;
+    }
 
     ret = 0;
 
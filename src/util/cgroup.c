@@ -1796,13 +1796,30 @@ int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 }
 
 #ifdef _SC_CLK_TCK
+static int virCgroupCpuacctTickScale(double *ret)
+{
+    static double scale = -1.0;
+
+    /* times reported are in system ticks (generally 100 Hz), but that
+     * rate can theoretically vary between machines.  Scale things
+     * into approximate nanoseconds.  */
+    if (scale < 0) {
+        long ticks_per_sec = sysconf(_SC_CLK_TCK);
+        if (ticks_per_sec == -1)
+            return -errno;
+        scale = 1000000000.0 / ticks_per_sec;
+    }
+    *ret = scale;
+    return 0;
+}
+
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys)
 {
     char *str;
     char *p;
     int ret;
-    static double scale = -1.0;
+    double scale;
 
     if ((ret = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                                     "cpuacct.stat", &str)) < 0)
@@ -1814,17 +1831,8 @@ int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
         ret = -EINVAL;
         goto cleanup;
     }
-    /* times reported are in system ticks (generally 100 Hz), but that
-     * rate can theoretically vary between machines.  Scale things
-     * into approximate nanoseconds.  */
-    if (scale < 0) {
-        long ticks_per_sec = sysconf(_SC_CLK_TCK);
-        if (ticks_per_sec == -1) {
-            ret = -errno;
-            goto cleanup;
-        }
-        scale = 1000000000.0 / ticks_per_sec;
-    }
+    if ((ret = virCgroupCpuacctTickScale(&scale)) < 0)
+        goto cleanup;
     *user *= scale;
     *sys *= scale;
 
@@ -1842,6 +1850,424 @@ int virCgroupGetCpuacctStat(virCgroupPtr group ATTRIBUTE_UNUSED,
 }
 #endif
 
+/*
+ * Readers of statistics which keep the control files they read open,
+ * so that polling them repeatedly costs a pread of each file rather
+ * than an open, read and close, and which parse the files holding
+ * many values in a single pass.
+ */
+enum {
+    VIR_CGROUP_STATS_FILE_CPUACCT_USAGE,
+    VIR_CGROUP_STATS_FILE_CPUACCT_PERCPU,
+    VIR_CGROUP_STATS_FILE_CPUACCT_STAT,
+    VIR_CGROUP_STATS_FILE_MEMORY_USAGE,
+    VIR_CGROUP_STATS_FILE_MEMORY_STAT,
+    VIR_CGROUP_STATS_FILE_BLKIO_BYTES,
+
+    VIR_CGROUP_STATS_FILE_LAST
+};
+
+static const struct {
+    int controller;
+    const char *key;
+    unsigned int flag;
+} virCgroupStatsFiles[VIR_CGROUP_STATS_FILE_LAST] = {
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage",
+      VIR_CGROUP_STATS_CPUACCT_USAGE },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage_percpu",
+      VIR_CGROUP_STATS_CPUACCT_PERCPU },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.stat",
+      VIR_CGROUP_STATS_CPUACCT_STAT },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.usage_in_bytes",
+      VIR_CGROUP_STATS_MEMORY_USAGE },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.stat",
+      VIR_CGROUP_STATS_MEMORY_STAT },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "blkio.throttle.io_service_bytes",
+      VIR_CGROUP_STATS_BLKIO_BYTES },
+};
+
+struct _virCgroupStatsReader {
+    char *paths[VIR_CGROUP_STATS_FILE_LAST];
+    int fds[VIR_CGROUP_STATS_FILE_LAST];
+
+    char *buf;
+    size_t bufsize;
+};
+
+/**
+ * virCgroupStatsReaderNew:
+ *
+ * @group: The group whose statistics are read
+ * @reader: Pointer to return the reader
+ *
+ * The reader does not reference @group, which may be freed. It must
+ * be freed once the group is removed, since the files it keeps open
+ * are then dead.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupStatsReaderNew(virCgroupPtr group,
+                            virCgroupStatsReaderPtr *reader)
+{
+    virCgroupStatsReaderPtr tmp;
+    int i;
+    int rc;
+
+    if (VIR_ALLOC(tmp) < 0)
+        return -ENOMEM;
+
+    for (i = 0 ; i < VIR_CGROUP_STATS_FILE_LAST ; i++)
+        tmp->fds[i] = -1;
+
+    for (i = 0 ; i < VIR_CGROUP_STATS_FILE_LAST ; i++) {
+        rc = virCgroupPathOfController(group,
+                                       virCgroupStatsFiles[i].controller,
+                                       virCgroupStatsFiles[i].key,
+                                       &tmp->paths[i]);
+        if (rc == -ENOMEM) {
+            virCgroupStatsReaderFree(tmp);
+            return rc;
+        }
+        /* Files of controllers which are not mounted keep a NULL path */
+    }
+
+    tmp->bufsize = 4096;
+    if (VIR_ALLOC_N(tmp->buf, tmp->bufsize) < 0) {
+        virCgroupStatsReaderFree(tmp);
+        return -ENOMEM;
+    }
+
+    *reader = tmp;
+    return 0;
+}
+
+/**
+ * virCgroupStatsReaderFree:
+ *
+ * @reader: The reader to free, closing the files it keeps open
+ */
+void virCgroupStatsReaderFree(virCgroupStatsReaderPtr reader)
+{
+    int i;
+
+    if (!reader)
+        return;
+
+    for (i = 0 ; i < VIR_CGROUP_STATS_FILE_LAST ; i++) {
+        VIR_FORCE_CLOSE(reader->fds[i]);
+        VIR_FREE(reader->paths[i]);
+    }
+    VIR_FREE(reader->buf);
+    VIR_FREE(reader);
+}
+
+/**
+ * virCgroupStatsClear:
+ *
+ * @stats: The statistics to clear, freeing their arrays
+ */
+void virCgroupStatsClear(virCgroupStatsPtr stats)
+{
+    if (!stats)
+        return;
+
+    VIR_FREE(stats->percpuUsage);
+    VIR_FREE(stats->blkio);
+    memset(stats, 0, sizeof(*stats));
+}
+
+/* Read the whole of a control file into reader->buf, reopening it
+ * only if it is not already open */
+static int virCgroupStatsReaderFile(virCgroupStatsReaderPtr reader,
+                                    int file)
+{
+    size_t len = 0;
+    ssize_t got;
+    int rc;
+
+    if (!reader->paths[file])
+        return -ENOENT;
+
+    if (reader->fds[file] < 0 &&
+        (reader->fds[file] = open(reader->paths[file],
+                                  O_RDONLY | O_CLOEXEC)) < 0) {
+        rc = -errno;
+        VIR_DEBUG("Failed to open %s: %m", reader->paths[file]);
+        return rc;
+    }
+
+    for (;;) {
+        if (len == reader->bufsize - 1) {
+            if (reader->bufsize >= 1024*1024)
+                return -EFBIG;
+            if (VIR_REALLOC_N(reader->buf, reader->bufsize * 2) < 0)
+                return -ENOMEM;
+            reader->bufsize *= 2;
+        }
+
+        got = pread(reader->fds[file], reader->buf + len,
+                    reader->bufsize - 1 - len, len);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            rc = -errno;
+            VIR_DEBUG("Failed to read %s: %m", reader->paths[file]);
+            /* Reopen the file next time, in case the group was
+             * removed and created again */
+            VIR_FORCE_CLOSE(reader->fds[file]);
+            return rc;
+        }
+        if (got == 0)
+            break;
+        len += got;
+    }
+
+    reader->buf[len] = '\0';
+    return 0;
+}
+
+/* Parse a list of numbers such as cpuacct.usage_percpu */
+int virCgroupStatsParsePercpu(const char *buf,
+                              virCgroupStatsPtr stats)
+{
+    char *pos = (char *)buf;
+    size_t alloc = 0;
+    unsigned long long value;
+
+    for (;;) {
+        while (*pos == ' ' || *pos == '\n')
+            pos++;
+        if (!*pos)
+            break;
+        if (virStrToLong_ull(pos, &pos, 10, &value) < 0)
+            return -EINVAL;
+        if (VIR_RESIZE_N(stats->percpuUsage, alloc,
+                         stats->npercpuUsage, 1) < 0)
+            return -ENOMEM;
+        stats->percpuUsage[stats->npercpuUsage++] = value;
+    }
+
+    return 0;
+}
+
+/* Parse the "key value" lines of cpuacct.stat and memory.stat,
+ * storing the values of the known keys */
+int virCgroupStatsParseKeys(const char *buf,
+                            const char **keys,
+                            unsigned long long **values)
+{
+    const char *line = buf;
+    char *end;
+    size_t len;
+    unsigned long long value;
+    int i;
+
+    while (*line) {
+        for (len = 0 ; line[len] && line[len] != ' ' && line[len] != '\n' ; len++)
+            ;
+        if (line[len] != ' ')
+            return -EINVAL;
+
+        if (virStrToLong_ull(line + len + 1, &end, 10, &value) < 0 ||
+            (*end && *end != '\n'))
+            return -EINVAL;
+
+        for (i = 0 ; keys[i] ; i++) {
+            if (strlen(keys[i]) == len &&
+                STREQLEN(line, keys[i], len)) {
+                *values[i] = value;
+                break;
+            }
+        }
+
+        line = *end ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+/* Parse blkio.throttle.io_service_bytes, whose lines look like
+ *   8:0 Read 1234
+ * with the lines of a device one after another, and which ends with
+ * a Total line for all of them */
+int virCgroupStatsParseBlkio(const char *buf,
+                             virCgroupStatsPtr stats)
+{
+    char *pos = (char *)buf;
+    size_t alloc = 0;
+    virCgroupBlkioStatsPtr dev;
+    unsigned long long *field;
+    unsigned long long value;
+    int major, minor;
+
+    while (*pos) {
+        if (STRPREFIX(pos, "Total ")) {
+            if (!(pos = strchr(pos, '\n')))
+                break;
+            pos++;
+            continue;
+        }
+
+        if (virStrToLong_i(pos, &pos, 10, &major) < 0 ||
+            *pos++ != ':' ||
+            virStrToLong_i(pos, &pos, 10, &minor) < 0 ||
+            *pos++ != ' ')
+            return -EINVAL;
+
+        if (!stats->nblkio ||
+            stats->blkio[stats->nblkio - 1].major != major ||
+            stats->blkio[stats->nblkio - 1].minor != minor) {
+            if (VIR_RESIZE_N(stats->blkio, alloc, stats->nblkio, 1) < 0)
+                return -ENOMEM;
+            dev = &stats->blkio[stats->nblkio++];
+            memset(dev, 0, sizeof(*dev));
+            dev->major = major;
+            dev->minor = minor;
+        }
+        dev = &stats->blkio[stats->nblkio - 1];
+
+        if (STRPREFIX(pos, "Read "))
+            field = &dev->read;
+        else if (STRPREFIX(pos, "Write "))
+            field = &dev->write;
+        else if (STRPREFIX(pos, "Sync "))
+            field = &dev->sync;
+        else if (STRPREFIX(pos, "Async "))
+            field = &dev->async;
+        else
+            field = NULL; /* Total */
+
+        if (!(pos = strchr(pos, ' ')) ||
+            virStrToLong_ull(pos + 1, &pos, 10, &value) < 0)
+            return -EINVAL;
+        if (field)
+            *field = value;
+
+        if (*pos == '\n')
+            pos++;
+        else if (*pos)
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int virCgroupStatsReadCpuacct(virCgroupStatsReaderPtr reader,
+                                     unsigned int flags,
+                                     virCgroupStatsPtr stats)
+{
+    int rc;
+
+    if (flags & VIR_CGROUP_STATS_CPUACCT_USAGE) {
+        if ((rc = virCgroupStatsReaderFile(reader,
+                                           VIR_CGROUP_STATS_FILE_CPUACCT_USAGE)) < 0)
+            return rc;
+        if (virStrToLong_ull(reader->buf, NULL, 10, &stats->cpuUsage) < 0)
+            return -EINVAL;
+    }
+
+    if ((flags & VIR_CGROUP_STATS_CPUACCT_PERCPU) &&
+        ((rc = virCgroupStatsReaderFile(reader,
+                                        VIR_CGROUP_STATS_FILE_CPUACCT_PERCPU)) < 0 ||
+         (rc = virCgroupStatsParsePercpu(reader->buf, stats)) < 0))
+        return rc;
+
+#ifdef _SC_CLK_TCK
+    if (flags & VIR_CGROUP_STATS_CPUACCT_STAT) {
+        const char *keys[] = { "user", "system", NULL };
+        unsigned long long *values[] = { &stats->cpuUser, &stats->cpuSystem };
+        double scale;
+
+        if ((rc = virCgroupStatsReaderFile(reader,
+                                           VIR_CGROUP_STATS_FILE_CPUACCT_STAT)) < 0 ||
+            (rc = virCgroupStatsParseKeys(reader->buf, keys, values)) < 0 ||
+            (rc = virCgroupCpuacctTickScale(&scale)) < 0)
+            return rc;
+        stats->cpuUser *= scale;
+        stats->cpuSystem *= scale;
+    }
+#endif
+
+    return 0;
+}
+
+static int virCgroupStatsReadMemory(virCgroupStatsReaderPtr reader,
+                                    unsigned int flags,
+                                    virCgroupStatsPtr stats)
+{
+    int rc;
+
+    if (flags & VIR_CGROUP_STATS_MEMORY_USAGE) {
+        if ((rc = virCgroupStatsReaderFile(reader,
+                                           VIR_CGROUP_STATS_FILE_MEMORY_USAGE)) < 0)
+            return rc;
+        if (virStrToLong_ull(reader->buf, NULL, 10, &stats->memUsage) < 0)
+            return -EINVAL;
+    }
+
+    if (flags & VIR_CGROUP_STATS_MEMORY_STAT) {
+        const char *keys[] = {
+            "cache", "rss", "mapped_file", "swap",
+            "pgfault", "pgmajfault", "unevictable", NULL
+        };
+        unsigned long long *values[] = {
+            &stats->memCache, &stats->memRss, &stats->memMappedFile,
+            &stats->memSwap, &stats->memPgfault, &stats->memPgmajfault,
+            &stats->memUnevictable
+        };
+
+        if ((rc = virCgroupStatsReaderFile(reader,
+                                           VIR_CGROUP_STATS_FILE_MEMORY_STAT)) < 0)
+            return rc;
+        return virCgroupStatsParseKeys(reader->buf, keys, values);
+    }
+
+    return 0;
+}
+
+/**
+ * virCgroupStatsReaderRead:
+ *
+ * @reader: The reader of the group
+ * @flags: bitwise-OR of virCgroupStatsFlags, the files to read. Only
+ *         the files which are read are kept open
+ * @stats: Filled with the statistics, to be cleared with
+ *         virCgroupStatsClear
+ *
+ * A reader may only be used by one thread at a time.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupStatsReaderRead(virCgroupStatsReaderPtr reader,
+                             unsigned int flags,
+                             virCgroupStatsPtr stats)
+{
+    int rc = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if ((flags & VIR_CGROUP_STATS_CPUACCT) &&
+        (rc = virCgroupStatsReadCpuacct(reader, flags, stats)) < 0)
+        goto error;
+
+    if ((flags & VIR_CGROUP_STATS_MEMORY) &&
+        (rc = virCgroupStatsReadMemory(reader, flags, stats)) < 0)
+        goto error;
+
+    if ((flags & VIR_CGROUP_STATS_BLKIO_BYTES) &&
+        ((rc = virCgroupStatsReaderFile(reader,
+                                        VIR_CGROUP_STATS_FILE_BLKIO_BYTES)) < 0 ||
+         (rc = virCgroupStatsParseBlkio(reader->buf, stats)) < 0))
+        goto error;
+
+    stats->flags = flags;
+    return 0;
+
+error:
+    virCgroupStatsClear(stats);
+    return rc;
+}
+
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state)
 {
     return virCgroupSetValueStr(group,
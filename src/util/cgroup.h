@@ -146,6 +146,82 @@ int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage);
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys);
 
+/* Control files read by virCgroupStatsReaderRead */
+typedef enum {
+    VIR_CGROUP_STATS_CPUACCT_USAGE  = 1 << 0, /* cpuacct.usage */
+    VIR_CGROUP_STATS_CPUACCT_PERCPU = 1 << 1, /* cpuacct.usage_percpu */
+    VIR_CGROUP_STATS_CPUACCT_STAT   = 1 << 2, /* cpuacct.stat */
+
+    VIR_CGROUP_STATS_MEMORY_USAGE   = 1 << 3, /* memory.usage_in_bytes */
+    VIR_CGROUP_STATS_MEMORY_STAT    = 1 << 4, /* memory.stat */
+    VIR_CGROUP_STATS_BLKIO_BYTES    = 1 << 5, /* blkio.throttle.io_service_bytes */
+
+    VIR_CGROUP_STATS_CPUACCT = VIR_CGROUP_STATS_CPUACCT_USAGE |
+                               VIR_CGROUP_STATS_CPUACCT_PERCPU |
+                               VIR_CGROUP_STATS_CPUACCT_STAT,
+    VIR_CGROUP_STATS_MEMORY = VIR_CGROUP_STATS_MEMORY_USAGE |
+                              VIR_CGROUP_STATS_MEMORY_STAT,
+    VIR_CGROUP_STATS_BLKIO = VIR_CGROUP_STATS_BLKIO_BYTES,
+} virCgroupStatsFlags;
+
+typedef struct _virCgroupBlkioStats virCgroupBlkioStats;
+typedef virCgroupBlkioStats *virCgroupBlkioStatsPtr;
+struct _virCgroupBlkioStats {
+    int major;
+    int minor;
+    unsigned long long read;
+    unsigned long long write;
+    unsigned long long sync;
+    unsigned long long async;
+};
+
+typedef struct _virCgroupStats virCgroupStats;
+typedef virCgroupStats *virCgroupStatsPtr;
+struct _virCgroupStats {
+    unsigned int flags; /* virCgroupStatsFlags that were read */
+
+    /* cpu times in nanoseconds */
+    unsigned long long cpuUsage;
+    unsigned long long cpuUser;
+    unsigned long long cpuSystem;
+    unsigned long long *percpuUsage;
+    size_t npercpuUsage;
+
+    /* memory in bytes and page fault counts, as in memory.stat */
+    unsigned long long memUsage;
+    unsigned long long memCache;
+    unsigned long long memRss;
+    unsigned long long memMappedFile;
+    unsigned long long memSwap;
+    unsigned long long memPgfault;
+    unsigned long long memPgmajfault;
+    unsigned long long memUnevictable;
+
+    /* bytes transferred, per device */
+    virCgroupBlkioStatsPtr blkio;
+    size_t nblkio;
+};
+
+typedef struct _virCgroupStatsReader virCgroupStatsReader;
+typedef virCgroupStatsReader *virCgroupStatsReaderPtr;
+
+int virCgroupStatsReaderNew(virCgroupPtr group,
+                            virCgroupStatsReaderPtr *reader);
+int virCgroupStatsReaderRead(virCgroupStatsReaderPtr reader,
+                             unsigned int flags,
+                             virCgroupStatsPtr stats);
+void virCgroupStatsReaderFree(virCgroupStatsReaderPtr reader);
+void virCgroupStatsClear(virCgroupStatsPtr stats);
+
+/* Only for use by test suite */
+int virCgroupStatsParsePercpu(const char *buf,
+                              virCgroupStatsPtr stats);
+int virCgroupStatsParseKeys(const char *buf,
+                            const char **keys,
+                            unsigned long long **values);
+int virCgroupStatsParseBlkio(const char *buf,
+                             virCgroupStatsPtr stats);
+
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state);
 int virCgroupGetFreezerState(virCgroupPtr group, char **state);
 
@@ -25,11 +25,14 @@
 
 #include "event.h"
 #include "event_poll.h"
+#include "event_epoll.h"
 #include "logging.h"
 #include "virterror_internal.h"
 
 #include <stdlib.h>
 
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
 static virEventAddHandleFunc addHandleImpl = NULL;
 static virEventUpdateHandleFunc updateHandleImpl = NULL;
 static virEventRemoveHandleFunc removeHandleImpl = NULL;
@@ -37,6 +40,9 @@ static virEventAddTimeoutFunc addTimeoutImpl = NULL;
 static virEventUpdateTimeoutFunc updateTimeoutImpl = NULL;
 static virEventRemoveTimeoutFunc removeTimeoutImpl = NULL;
 
+/* Whether the default implementation is the epoll() based one */
+static bool defaultImplEpoll = false;
+
 /**
  * virEventAddHandle: register a callback for monitoring file handle events
  *
@@ -193,6 +199,12 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  * not have a need to integrate with an external event
  * loop impl.
  *
+ * On platforms supporting it, an implementation based on
+ * epoll() can be used instead, which scales better with the
+ * number of file handles being monitored. It is selected at
+ * build time, and can be overridden by setting the
+ * LIBVIRT_EVENT_IMPL environment variable to "poll" or "epoll".
+ *
  * Once registered, the application has to invoke virEventRunDefaultImpl in
  * a loop to process events.  Failure to do so may result in connections being
  * closed unexpectedly as a result of keepalive timeout.
@@ -201,10 +213,54 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  */
 int virEventRegisterDefaultImpl(void)
 {
+    const char *impl = getenv("LIBVIRT_EVENT_IMPL");
+
     VIR_DEBUG("registering default event implementation");
 
     virResetLastError();
 
+#if WITH_EVENT_EPOLL_DEFAULT
+    defaultImplEpoll = true;
+#endif
+    if (impl && *impl) {
+        if (STREQ(impl, "epoll")) {
+            defaultImplEpoll = true;
+        } else if (STREQ(impl, "poll")) {
+            defaultImplEpoll = false;
+        } else {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("unknown event loop implementation '%s'"),
+                           impl);
+            virDispatchError(NULL);
+            return -1;
+        }
+    }
+
+    if (defaultImplEpoll && !virEventEpollAvailable()) {
+        VIR_WARN("epoll event loop not available, falling back to poll");
+        defaultImplEpoll = false;
+    }
+
+    VIR_DEBUG("using %s event loop", defaultImplEpoll ? "epoll" : "poll");
+
+    if (defaultImplEpoll) {
+        if (virEventEpollInit() < 0) {
+            virDispatchError(NULL);
+            return -1;
+        }
+
+        virEventRegisterImpl(
+            virEventEpollAddHandle,
+            virEventEpollUpdateHandle,
+            virEventEpollRemoveHandle,
+            virEventEpollAddTimeout,
+            virEventEpollUpdateTimeout,
+            virEventEpollRemoveTimeout
+            );
+
+        return 0;
+    }
+
     if (virEventPollInit() < 0) {
         virDispatchError(NULL);
         return -1;
@@ -244,7 +300,8 @@ int virEventRunDefaultImpl(void)
     VIR_DEBUG("running default event implementation");
     virResetLastError();
 
-    if (virEventPollRunOnce() < 0) {
+    if ((defaultImplEpoll ? virEventEpollRunOnce() :
+         virEventPollRunOnce()) < 0) {
         virDispatchError(NULL);
         return -1;
     }
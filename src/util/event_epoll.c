@@ -0,0 +1,1026 @@
+/*
+ * event_epoll.c: epoll based event loop for monitoring file handles
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#include "threads.h"
+#include "logging.h"
+#include "event_epoll.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "virterror_internal.h"
+#include "virtime.h"
+#include "event_timer.h"
+
+#define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+#if HAVE_SYS_EPOLL_H
+
+static int virEventEpollInterruptLocked(virEventEpollLoopPtr loop);
+
+/* State for a single file handle being monitored */
+struct virEventEpollHandle {
+    int watch;
+    int fd;
+    int events;
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    int deleted;
+};
+
+/* Kernel registration state for a single file descriptor. Several
+ * watches may refer to the same fd, in which case the union of their
+ * events is registered with the kernel */
+struct virEventEpollFD {
+    size_t nwatches;
+    size_t nwatchesAlloc;
+    int *watches;
+    int events;
+    bool registered;
+};
+
+/* Allocate extra slots for virEventEpollHandle records in this multiple */
+# define EVENT_ALLOC_EXTENT 10
+
+/* Maximum number of ready file handles collected per iteration.
+ * epoll is level triggered, so any remaining ready handles are
+ * simply reported again by the next epoll_wait() */
+# define EVENT_EPOLL_MAX_EVENTS 64
+
+/* State for an event loop */
+struct _virEventEpollLoop {
+    virMutex lock;
+    int running;
+    virThread leader;
+    int epollfd;
+    int wakeupfd[2];
+    /* Sorted by watch number, since watches are only ever appended
+     * with increasing numbers, allowing for binary search */
+    size_t handlesCount;
+    size_t handlesAlloc;
+    size_t handlesDeleted;
+    struct virEventEpollHandle *handles;
+    /* Indexed by file descriptor number */
+    size_t fdsAlloc;
+    struct virEventEpollFD *fds;
+    virEventTimerListPtr timers;
+    /* Unique ID for the next FD watch to be registered */
+    int nextWatch;
+};
+
+/* The loop behind the default event implementation */
+static virEventEpollLoopPtr eventLoop;
+
+
+bool virEventEpollAvailable(void)
+{
+    return true;
+}
+
+
+static struct virEventEpollHandle *
+virEventEpollFindHandleLocked(virEventEpollLoopPtr loop, int watch)
+{
+    size_t lo = 0;
+    size_t hi = loop->handlesCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (loop->handles[mid].watch == watch)
+            return &loop->handles[mid];
+        if (loop->handles[mid].watch < watch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Recompute the union of events wanted by all live watches on @fd
+ * and push it into the kernel if it changed. Watches with no events
+ * must not receive error/hangup notifications, so the fd is dropped
+ * from the epoll set entirely when nobody is interested in it
+ */
+static int virEventEpollUpdateFDLocked(virEventEpollLoopPtr loop, int fd)
+{
+    struct virEventEpollFD *efd = &loop->fds[fd];
+    struct epoll_event ev;
+    int events = 0;
+    size_t i;
+
+    for (i = 0 ; i < efd->nwatches ; i++) {
+        struct virEventEpollHandle *handle =
+            virEventEpollFindHandleLocked(loop, efd->watches[i]);
+        if (handle && !handle->deleted)
+            events |= handle->events;
+    }
+
+    if (efd->registered && events == efd->events)
+        return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (events == 0) {
+        if (efd->registered &&
+            epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, fd, &ev) < 0 &&
+            errno != ENOENT && errno != EBADF)
+            VIR_WARN("Unable to remove fd %d from epoll set: %d", fd, errno);
+        efd->registered = false;
+    } else if (!efd->registered) {
+        /* The fd may have been closed and re-opened behind our back
+         * in which case the kernel still knows it */
+        if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+            (errno != EEXIST ||
+             epoll_ctl(loop->epollfd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+            virReportSystemError(errno,
+                                 _("Unable to add fd %d to epoll set"), fd);
+            return -1;
+        }
+        efd->registered = true;
+    } else {
+        /* Closing the fd silently drops it from the epoll set */
+        if (epoll_ctl(loop->epollfd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+            (errno != ENOENT ||
+             epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0)) {
+            virReportSystemError(errno,
+                                 _("Unable to modify fd %d in epoll set"), fd);
+            return -1;
+        }
+    }
+    efd->events = events;
+
+    return 0;
+}
+
+
+/*
+ * Register a callback for monitoring file handle events.
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever append to existing list.
+ */
+int virEventEpollLoopAddHandle(virEventEpollLoopPtr loop,
+                               int fd, int events,
+                               virEventHandleCallback cb,
+                               void *opaque,
+                               virFreeCallback ff)
+{
+    int watch;
+    struct virEventEpollFD *efd;
+
+    if (fd < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid file handle %d"), fd);
+        return -1;
+    }
+
+    virMutexLock(&loop->lock);
+    if (loop->handlesCount == loop->handlesAlloc) {
+        EVENT_DEBUG("Used %zu handle slots, adding at least %d more",
+                    loop->handlesAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->handles, loop->handlesAlloc,
+                         loop->handlesCount, EVENT_ALLOC_EXTENT) < 0)
+            goto no_memory;
+    }
+
+    if (fd >= loop->fdsAlloc &&
+        VIR_EXPAND_N(loop->fds, loop->fdsAlloc,
+                     fd + EVENT_ALLOC_EXTENT - loop->fdsAlloc) < 0)
+        goto no_memory;
+
+    efd = &loop->fds[fd];
+    if (VIR_RESIZE_N(efd->watches, efd->nwatchesAlloc,
+                     efd->nwatches, 1) < 0)
+        goto no_memory;
+
+    watch = loop->nextWatch++;
+
+    loop->handles[loop->handlesCount].watch = watch;
+    loop->handles[loop->handlesCount].fd = fd;
+    loop->handles[loop->handlesCount].events =
+                                         virEventEpollToNativeEvents(events);
+    loop->handles[loop->handlesCount].cb = cb;
+    loop->handles[loop->handlesCount].ff = ff;
+    loop->handles[loop->handlesCount].opaque = opaque;
+    loop->handles[loop->handlesCount].deleted = 0;
+
+    loop->handlesCount++;
+    efd->watches[efd->nwatches++] = watch;
+
+    if (virEventEpollUpdateFDLocked(loop, fd) < 0) {
+        efd->nwatches--;
+        loop->handlesCount--;
+        virMutexUnlock(&loop->lock);
+        return -1;
+    }
+
+    PROBE(EVENT_EPOLL_ADD_HANDLE,
+          "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
+          watch, fd, events, cb, opaque, ff);
+    virMutexUnlock(&loop->lock);
+
+    return watch;
+
+no_memory:
+    virMutexUnlock(&loop->lock);
+    virReportOOMError();
+    return -1;
+}
+
+void virEventEpollLoopUpdateHandle(virEventEpollLoopPtr loop,
+                                   int watch, int events)
+{
+    struct virEventEpollHandle *handle;
+    PROBE(EVENT_EPOLL_UPDATE_HANDLE,
+          "watch=%d events=%d",
+          watch, events);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid update watch %d", watch);
+        return;
+    }
+
+    virMutexLock(&loop->lock);
+    if (!(handle = virEventEpollFindHandleLocked(loop, watch)) ||
+        handle->deleted) {
+        virMutexUnlock(&loop->lock);
+        VIR_WARN("Got update for non-existent handle watch %d", watch);
+        return;
+    }
+
+    handle->events = virEventEpollToNativeEvents(events);
+    if (virEventEpollUpdateFDLocked(loop, handle->fd) < 0)
+        VIR_WARN("Unable to update events for handle watch %d", watch);
+    virMutexUnlock(&loop->lock);
+}
+
+/*
+ * Unregister a callback from a file handle
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag in the existing list.
+ * Actual deletion will be done out-of-band, but the kernel
+ * registration is dropped immediately since the caller is
+ * free to close the file handle as soon as we return
+ */
+int virEventEpollLoopRemoveHandle(virEventEpollLoopPtr loop, int watch)
+{
+    struct virEventEpollHandle *handle;
+    PROBE(EVENT_EPOLL_REMOVE_HANDLE,
+          "watch=%d",
+          watch);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid remove watch %d", watch);
+        return -1;
+    }
+
+    virMutexLock(&loop->lock);
+    if (!(handle = virEventEpollFindHandleLocked(loop, watch)) ||
+        handle->deleted) {
+        virMutexUnlock(&loop->lock);
+        return -1;
+    }
+
+    EVENT_DEBUG("mark delete %d %d", watch, handle->fd);
+    handle->deleted = 1;
+    loop->handlesDeleted++;
+    ignore_value(virEventEpollUpdateFDLocked(loop, handle->fd));
+    virEventEpollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
+    return 0;
+}
+
+
+/*
+ * Register a callback for a timer event
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+{
+    virEventEpollLoopPtr loop = eventLoop;
+    unsigned long long now;
+    int ret;
+
+    if (virTimeMonotonicMillisNow(&now) < 0) {
+        return -1;
+    }
+
+    virMutexLock(&loop->lock);
+    if ((ret = virEventTimerListAdd(loop->timers, now, frequency,
+                                    cb, opaque, ff)) < 0) {
+        virMutexUnlock(&loop->lock);
+        return -1;
+    }
+
+    virEventEpollInterruptLocked(loop);
+
+    PROBE(EVENT_EPOLL_ADD_TIMEOUT,
+          "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
+          ret, frequency, cb, opaque, ff);
+    virMutexUnlock(&loop->lock);
+    return ret;
+}
+
+void virEventEpollUpdateTimeout(int timer, int frequency)
+{
+    virEventEpollLoopPtr loop = eventLoop;
+    unsigned long long now;
+    bool found = false;
+    PROBE(EVENT_EPOLL_UPDATE_TIMEOUT,
+          "timer=%d frequency=%d",
+          timer, frequency);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid update timer %d", timer);
+        return;
+    }
+
+    if (virTimeMonotonicMillisNow(&now) < 0) {
+        return;
+    }
+
+    virMutexLock(&loop->lock);
+    if (virEventTimerListUpdate(loop->timers, now, timer, frequency) == 0) {
+        virEventEpollInterruptLocked(loop);
+        found = true;
+    }
+    virMutexUnlock(&loop->lock);
+
+    if (!found)
+        VIR_WARN("Got update for non-existent timer %d", timer);
+}
+
+/*
+ * Unregister a callback for a timer
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason the timer is only disabled here.
+ * Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveTimeout(int timer) {
+    virEventEpollLoopPtr loop = eventLoop;
+    PROBE(EVENT_EPOLL_REMOVE_TIMEOUT,
+          "timer=%d",
+          timer);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid remove timer %d", timer);
+        return -1;
+    }
+
+    virMutexLock(&loop->lock);
+    if (virEventTimerListRemove(loop->timers, timer) == 0) {
+        virEventEpollInterruptLocked(loop);
+        virMutexUnlock(&loop->lock);
+        return 0;
+    }
+    virMutexUnlock(&loop->lock);
+    return -1;
+}
+
+/* Determine how long to wait until the first timer expires.
+ * @timeout: filled with expiry time of soonest timer, or -1 if
+ *           no timeout is pending
+ * returns: 0 on success, -1 on error
+ */
+static int virEventEpollCalculateTimeout(virEventEpollLoopPtr loop,
+                                         int *timeout)
+{
+    unsigned long long now;
+    EVENT_DEBUG("Calculate expiry of %zu timers",
+                virEventTimerListCount(loop->timers));
+
+    if (virTimeMonotonicMillisNow(&now) < 0)
+        return -1;
+
+    *timeout = virEventTimerListTimeout(loop->timers, now);
+
+    EVENT_DEBUG("Timeout due in %d ms", *timeout);
+
+    return 0;
+}
+
+/*
+ * Determine which timers have expired, and invoke the user
+ * supplied callback for each of them. Their next expiry is
+ * scheduled just before the callback runs.
+ *
+ * This method must cope with new timers being registered
+ * by a callback, and must skip any timers removed by one.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchTimeouts(virEventEpollLoopPtr loop)
+{
+    unsigned long long now;
+    virEventTimeoutCallback cb;
+    void *opaque;
+    int timer;
+
+    if (virTimeMonotonicMillisNow(&now) < 0)
+        return -1;
+
+    virEventTimerListCollectDue(loop->timers, now);
+    while (virEventTimerListNextDue(loop->timers, &timer, &cb, &opaque)) {
+        VIR_DEBUG("Dispatch timer %d", timer);
+        PROBE(EVENT_EPOLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&loop->lock);
+        (cb)(timer, opaque);
+        virMutexLock(&loop->lock);
+    }
+    return 0;
+}
+
+
+/* Iterate over the file handles reported ready by epoll_wait()
+ * and invoke the user supplied callback of every watch on them
+ * which is interested in the pending events.
+ *
+ * This method must cope with handles being registered or
+ * removed by a callback. Watches registered after the call
+ * to epoll_wait() (@lastWatch onwards) are skipped, since the
+ * fd they refer to may be a re-used number.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchHandles(virEventEpollLoopPtr loop,
+                                        int nevents,
+                                        struct epoll_event *events,
+                                        int lastWatch)
+{
+    int n;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (n = 0 ; n < nevents ; n++) {
+        int fd = events[n].data.fd;
+        size_t i, nwatches;
+
+        if (fd >= loop->fdsAlloc)
+            continue;
+
+        /* Watches are only dropped from the per-fd list during
+         * cleanup, so indexes are stable while we dispatch */
+        nwatches = loop->fds[fd].nwatches;
+        for (i = 0 ; i < nwatches ; i++) {
+            struct virEventEpollHandle *handle;
+            int watch = loop->fds[fd].watches[i];
+            int revents;
+
+            if (watch >= lastWatch ||
+                !(handle = virEventEpollFindHandleLocked(loop, watch)))
+                continue;
+
+            if (handle->deleted) {
+                EVENT_DEBUG("Skip deleted w=%d f=%d", watch, fd);
+                continue;
+            }
+
+            revents = events[n].events &
+                (handle->events | EPOLLERR | EPOLLHUP);
+            if (handle->events && revents) {
+                virEventHandleCallback cb = handle->cb;
+                void *opaque = handle->opaque;
+                int hEvents = virEventEpollFromNativeEvents(revents);
+                PROBE(EVENT_EPOLL_DISPATCH_HANDLE,
+                      "watch=%d events=%d",
+                      watch, hEvents);
+                virMutexUnlock(&loop->lock);
+                (cb)(watch, fd, hEvents, opaque);
+                virMutexLock(&loop->lock);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* Used post dispatch to actually free any timers that
+ * were previously removed. This asynchronous cleanup is
+ * needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupTimeouts(virEventEpollLoopPtr loop)
+{
+    virFreeCallback ff;
+    void *opaque;
+    int timer;
+    VIR_DEBUG("Cleanup %zu", virEventTimerListCount(loop->timers));
+
+    while (virEventTimerListNextDeleted(loop->timers,
+                                        &timer, &ff, &opaque)) {
+        PROBE(EVENT_EPOLL_PURGE_TIMEOUT,
+              "timer=%d",
+              timer);
+        if (ff) {
+            virMutexUnlock(&loop->lock);
+            ff(opaque);
+            virMutexLock(&loop->lock);
+        }
+    }
+}
+
+
+static void virEventEpollForgetWatchLocked(virEventEpollLoopPtr loop,
+                                           int fd, int watch)
+{
+    struct virEventEpollFD *efd = &loop->fds[fd];
+    size_t i;
+
+    for (i = 0 ; i < efd->nwatches ; i++) {
+        if (efd->watches[i] == watch) {
+            VIR_DELETE_ELEMENT_INPLACE(efd->watches, i, efd->nwatches);
+            break;
+        }
+    }
+}
+
+/* Used post dispatch to actually remove any handles that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ * Unlike the poll() implementation the handle list is only
+ * walked when something was actually deleted.
+ */
+static void virEventEpollCleanupHandles(virEventEpollLoopPtr loop)
+{
+    int i;
+    size_t gap;
+
+    if (loop->handlesDeleted == 0)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", loop->handlesCount);
+
+    /* Remove deleted entries, shuffling down remaining
+     * entries as needed to form contiguous series, which
+     * keeps the list sorted by watch number
+     */
+    for (i = 0 ; i < loop->handlesCount ;) {
+        if (!loop->handles[i].deleted) {
+            i++;
+            continue;
+        }
+
+        PROBE(EVENT_EPOLL_PURGE_HANDLE,
+              "watch=%d",
+              loop->handles[i].watch);
+        virEventEpollForgetWatchLocked(loop, loop->handles[i].fd,
+                                       loop->handles[i].watch);
+        if (loop->handles[i].ff) {
+            virFreeCallback ff = loop->handles[i].ff;
+            void *opaque = loop->handles[i].opaque;
+            virMutexUnlock(&loop->lock);
+            ff(opaque);
+            virMutexLock(&loop->lock);
+        }
+
+        if ((i+1) < loop->handlesCount) {
+            memmove(loop->handles+i,
+                    loop->handles+i+1,
+                    sizeof(struct virEventEpollHandle)*(loop->handlesCount
+                                                    -(i+1)));
+        }
+        loop->handlesCount--;
+        loop->handlesDeleted--;
+    }
+
+    /* Release some memory if we've got a big chunk free */
+    gap = loop->handlesAlloc - loop->handlesCount;
+    if (loop->handlesCount == 0 ||
+        (gap > loop->handlesCount && gap > EVENT_ALLOC_EXTENT)) {
+        EVENT_DEBUG("Found %zu out of %zu handles slots used, releasing %zu",
+                    loop->handlesCount, loop->handlesAlloc, gap);
+        VIR_SHRINK_N(loop->handles, loop->handlesAlloc, gap);
+    }
+}
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventEpollLoopRunOnce(virEventEpollLoopPtr loop)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX_EVENTS];
+    int ret, timeout, lastWatch, nhandles;
+
+    virMutexLock(&loop->lock);
+    loop->running = 1;
+    virThreadSelf(&loop->leader);
+
+    virEventEpollCleanupTimeouts(loop);
+    virEventEpollCleanupHandles(loop);
+
+    if (virEventEpollCalculateTimeout(loop, &timeout) < 0)
+        goto error;
+
+    lastWatch = loop->nextWatch;
+    nhandles = loop->handlesCount;
+    virMutexUnlock(&loop->lock);
+
+ retry:
+    PROBE(EVENT_EPOLL_RUN,
+          "nhandles=%d timeout=%d",
+          nhandles, timeout);
+    ret = epoll_wait(loop->epollfd, events,
+                     EVENT_EPOLL_MAX_EVENTS, timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        goto error_unlocked;
+    }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&loop->lock);
+    if (virEventEpollDispatchTimeouts(loop) < 0)
+        goto error;
+
+    if (ret > 0 &&
+        virEventEpollDispatchHandles(loop, ret, events, lastWatch) < 0)
+        goto error;
+
+    virEventEpollCleanupTimeouts(loop);
+    virEventEpollCleanupHandles(loop);
+
+    loop->running = 0;
+    virMutexUnlock(&loop->lock);
+    return 0;
+
+error:
+    virMutexUnlock(&loop->lock);
+error_unlocked:
+    return -1;
+}
+
+
+static void virEventEpollHandleWakeup(int watch ATTRIBUTE_UNUSED,
+                                      int fd,
+                                      int events ATTRIBUTE_UNUSED,
+                                      void *opaque)
+{
+    virEventEpollLoopPtr loop = opaque;
+    char c;
+    virMutexLock(&loop->lock);
+    ignore_value(saferead(fd, &c, sizeof(c)));
+    virMutexUnlock(&loop->lock);
+}
+
+virEventEpollLoopPtr virEventEpollLoopNew(void)
+{
+    virEventEpollLoopPtr loop;
+
+    if (VIR_ALLOC(loop) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+    loop->epollfd = -1;
+    loop->wakeupfd[0] = loop->wakeupfd[1] = -1;
+    loop->nextWatch = 1;
+
+    if (virMutexInit(&loop->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(loop);
+        return NULL;
+    }
+
+    if (!(loop->timers = virEventTimerListNew()))
+        goto error;
+
+    if ((loop->epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll file handle"));
+        goto error;
+    }
+
+    if (pipe2(loop->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        goto error;
+    }
+
+    if (virEventEpollLoopAddHandle(loop, loop->wakeupfd[0],
+                                   VIR_EVENT_HANDLE_READABLE,
+                                   virEventEpollHandleWakeup,
+                                   loop, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add handle %d to event loop"),
+                       loop->wakeupfd[0]);
+        goto error;
+    }
+
+    return loop;
+
+error:
+    virEventEpollLoopFree(loop);
+    return NULL;
+}
+
+/*
+ * Release a loop which no thread is running any more. Handles
+ * still registered are purged as if they had been removed, so
+ * their free callbacks get to release the opaque data
+ */
+void virEventEpollLoopFree(virEventEpollLoopPtr loop)
+{
+    size_t i;
+
+    if (!loop)
+        return;
+
+    virMutexLock(&loop->lock);
+    for (i = 0 ; i < loop->handlesCount ; i++) {
+        if (!loop->handles[i].deleted) {
+            loop->handles[i].deleted = 1;
+            loop->handlesDeleted++;
+        }
+    }
+    if (loop->timers)
+        virEventEpollCleanupTimeouts(loop);
+    virEventEpollCleanupHandles(loop);
+    virMutexUnlock(&loop->lock);
+
+    for (i = 0 ; i < loop->fdsAlloc ; i++)
+        VIR_FREE(loop->fds[i].watches);
+    VIR_FREE(loop->fds);
+    VIR_FREE(loop->handles);
+    virEventTimerListFree(loop->timers);
+    VIR_FORCE_CLOSE(loop->wakeupfd[0]);
+    VIR_FORCE_CLOSE(loop->wakeupfd[1]);
+    VIR_FORCE_CLOSE(loop->epollfd);
+    virMutexDestroy(&loop->lock);
+    VIR_FREE(loop);
+}
+
+static int virEventEpollInterruptLocked(virEventEpollLoopPtr loop)
+{
+    char c = '\0';
+
+    if (!loop->running ||
+        virThreadIsSelf(&loop->leader)) {
+        VIR_DEBUG("Skip interrupt, %d %d", loop->running,
+                  virThreadID(&loop->leader));
+        return 0;
+    }
+
+    VIR_DEBUG("Interrupting");
+    if (safewrite(loop->wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+        return -1;
+    return 0;
+}
+
+/*
+ * Unlike the internal wakeups this doesn't check whether the
+ * loop is currently running, so that a thread about to block
+ * in epoll_wait() is guaranteed to return from it
+ */
+int virEventEpollLoopInterrupt(virEventEpollLoopPtr loop)
+{
+    char c = '\0';
+    int ret = 0;
+
+    virMutexLock(&loop->lock);
+    if (!loop->running ||
+        !virThreadIsSelf(&loop->leader)) {
+        VIR_DEBUG("Interrupting loop %p", loop);
+        if (safewrite(loop->wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+            ret = -1;
+    }
+    virMutexUnlock(&loop->lock);
+    return ret;
+}
+
+
+int virEventEpollInit(void)
+{
+    if (!eventLoop &&
+        !(eventLoop = virEventEpollLoopNew()))
+        return -1;
+
+    return 0;
+}
+
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff)
+{
+    return virEventEpollLoopAddHandle(eventLoop, fd, events, cb, opaque, ff);
+}
+
+void virEventEpollUpdateHandle(int watch, int events)
+{
+    virEventEpollLoopUpdateHandle(eventLoop, watch, events);
+}
+
+int virEventEpollRemoveHandle(int watch)
+{
+    return virEventEpollLoopRemoveHandle(eventLoop, watch);
+}
+
+int virEventEpollRunOnce(void)
+{
+    return virEventEpollLoopRunOnce(eventLoop);
+}
+
+int virEventEpollInterrupt(void)
+{
+    int ret;
+    virMutexLock(&eventLoop->lock);
+    ret = virEventEpollInterruptLocked(eventLoop);
+    virMutexUnlock(&eventLoop->lock);
+    return ret;
+}
+
+int
+virEventEpollToNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        ret |= EPOLLIN;
+    if (events & VIR_EVENT_HANDLE_WRITABLE)
+        ret |= EPOLLOUT;
+    if (events & VIR_EVENT_HANDLE_ERROR)
+        ret |= EPOLLERR;
+    if (events & VIR_EVENT_HANDLE_HANGUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+int
+virEventEpollFromNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= VIR_EVENT_HANDLE_READABLE;
+    if (events & EPOLLOUT)
+        ret |= VIR_EVENT_HANDLE_WRITABLE;
+    if (events & EPOLLERR)
+        ret |= VIR_EVENT_HANDLE_ERROR;
+    if (events & EPOLLHUP)
+        ret |= VIR_EVENT_HANDLE_HANGUP;
+    return ret;
+}
+
+#else /* ! HAVE_SYS_EPOLL_H */
+
+static const char *unsupported = N_("epoll is not supported on this platform");
+
+bool virEventEpollAvailable(void)
+{
+    return false;
+}
+
+int virEventEpollAddHandle(int fd ATTRIBUTE_UNUSED,
+                           int events ATTRIBUTE_UNUSED,
+                           virEventHandleCallback cb ATTRIBUTE_UNUSED,
+                           void *opaque ATTRIBUTE_UNUSED,
+                           virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+void virEventEpollUpdateHandle(int watch ATTRIBUTE_UNUSED,
+                               int events ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveHandle(int watch ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollAddTimeout(int frequency ATTRIBUTE_UNUSED,
+                            virEventTimeoutCallback cb ATTRIBUTE_UNUSED,
+                            void *opaque ATTRIBUTE_UNUSED,
+                            virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+void virEventEpollUpdateTimeout(int timer ATTRIBUTE_UNUSED,
+                                int frequency ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveTimeout(int timer ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollInit(void)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int virEventEpollRunOnce(void)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int virEventEpollInterrupt(void)
+{
+    return -1;
+}
+
+virEventEpollLoopPtr virEventEpollLoopNew(void)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return NULL;
+}
+
+void virEventEpollLoopFree(virEventEpollLoopPtr loop ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollLoopAddHandle(virEventEpollLoopPtr loop ATTRIBUTE_UNUSED,
+                               int fd ATTRIBUTE_UNUSED,
+                               int events ATTRIBUTE_UNUSED,
+                               virEventHandleCallback cb ATTRIBUTE_UNUSED,
+                               void *opaque ATTRIBUTE_UNUSED,
+                               virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+void virEventEpollLoopUpdateHandle(virEventEpollLoopPtr loop ATTRIBUTE_UNUSED,
+                                   int watch ATTRIBUTE_UNUSED,
+                                   int events ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollLoopRemoveHandle(virEventEpollLoopPtr loop ATTRIBUTE_UNUSED,
+                                  int watch ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollLoopRunOnce(virEventEpollLoopPtr loop ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int virEventEpollLoopInterrupt(virEventEpollLoopPtr loop ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollToNativeEvents(int events ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+int virEventEpollFromNativeEvents(int events ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+#endif /* ! HAVE_SYS_EPOLL_H */
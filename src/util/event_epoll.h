@@ -0,0 +1,174 @@
+/*
+ * event_epoll.h: epoll based event loop for monitoring file handles
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_EVENT_EPOLL_H__
+# define __VIR_EVENT_EPOLL_H__
+
+# include "internal.h"
+
+/**
+ * virEventEpollAvailable: check whether the epoll event loop can be used
+ *
+ * returns true if the platform supports epoll
+ */
+bool virEventEpollAvailable(void);
+
+/**
+ * virEventEpollAddHandle: register a callback for monitoring file handle events
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from virEventHandleType constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ *
+ * The file handle is registered with the kernel until the watch is
+ * removed, so unlike the poll() implementation no per-iteration work
+ * is done for idle handles.
+ *
+ * returns -1 if the file handle cannot be registered, the watch
+ * number upon success
+ */
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff);
+
+/**
+ * virEventEpollUpdateHandle: change event set for a monitored file handle
+ *
+ * @watch: watch whose handle to update
+ * @events: bitset of events to watch from virEventHandleType constants
+ *
+ * Will not fail if fd exists
+ */
+void virEventEpollUpdateHandle(int watch, int events);
+
+/**
+ * virEventEpollRemoveHandle: unregister a callback from a file handle
+ *
+ * @watch: watch whose handle to remove
+ *
+ * returns -1 if the file handle was not registered, 0 upon success
+ */
+int virEventEpollRemoveHandle(int watch);
+
+/**
+ * virEventEpollAddTimeout: register a callback for a timer event
+ *
+ * @frequency: time between events in milliseconds
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ *
+ * Setting frequency to -1 will disable the timer. Setting the frequency
+ * to zero will cause it to fire on every event loop iteration.
+ *
+ * returns -1 if the timer cannot be registered, a positive
+ * integer timer id upon success
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff);
+
+/**
+ * virEventEpollUpdateTimeout: change frequency for a timer
+ *
+ * @timer: timer id to change
+ * @frequency: time between events in milliseconds
+ *
+ * Setting frequency to -1 will disable the timer. Setting the frequency
+ * to zero will cause it to fire on every event loop iteration.
+ *
+ * Will not fail if timer exists
+ */
+void virEventEpollUpdateTimeout(int timer, int frequency);
+
+/**
+ * virEventEpollRemoveTimeout: unregister a callback for a timer
+ *
+ * @timer: the timer id to remove
+ *
+ * returns -1 if the timer was not registered, 0 upon success
+ */
+int virEventEpollRemoveTimeout(int timer);
+
+/**
+ * virEventEpollInit: Initialize the event loop
+ *
+ * returns -1 if initialization failed
+ */
+int virEventEpollInit(void);
+
+/**
+ * virEventEpollRunOnce: run a single iteration of the event loop.
+ *
+ * Blocks the caller until at least one file handle has an
+ * event or the first timer expires.
+ *
+ * returns -1 if the event monitoring failed
+ */
+int virEventEpollRunOnce(void);
+
+int virEventEpollFromNativeEvents(int events);
+int virEventEpollToNativeEvents(int events);
+
+
+/**
+ * virEventEpollInterrupt: wakeup any thread waiting in epoll_wait()
+ *
+ * return -1 if wakup failed
+ */
+int virEventEpollInterrupt(void);
+
+
+/*
+ * Besides the default loop driven by the functions above, further
+ * independent loops can be created, eg to spread file handles over
+ * several threads. Each such loop must only be run by one thread at
+ * a time, but handles may be added, updated and removed from any
+ * thread. Watch numbers are only meaningful for the loop which
+ * returned them.
+ */
+typedef struct _virEventEpollLoop virEventEpollLoop;
+typedef virEventEpollLoop *virEventEpollLoopPtr;
+
+virEventEpollLoopPtr virEventEpollLoopNew(void);
+void virEventEpollLoopFree(virEventEpollLoopPtr loop);
+
+int virEventEpollLoopAddHandle(virEventEpollLoopPtr loop,
+                               int fd, int events,
+                               virEventHandleCallback cb,
+                               void *opaque,
+                               virFreeCallback ff)
+    ATTRIBUTE_NONNULL(1);
+void virEventEpollLoopUpdateHandle(virEventEpollLoopPtr loop,
+                                   int watch, int events)
+    ATTRIBUTE_NONNULL(1);
+int virEventEpollLoopRemoveHandle(virEventEpollLoopPtr loop,
+                                  int watch)
+    ATTRIBUTE_NONNULL(1);
+int virEventEpollLoopRunOnce(virEventEpollLoopPtr loop)
+    ATTRIBUTE_NONNULL(1);
+int virEventEpollLoopInterrupt(virEventEpollLoopPtr loop)
+    ATTRIBUTE_NONNULL(1);
+
+
+#endif /* __VIR_EVENT_EPOLL_H__ */
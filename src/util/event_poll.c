@@ -39,6 +39,7 @@
 #include "virfile.h"
 #include "virterror_internal.h"
 #include "virtime.h"
+#include "event_timer.h"
 
 #define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
 
@@ -57,19 +58,7 @@ struct virEventPollHandle {
     int deleted;
 };
 
-/* State for a single timer being generated */
-struct virEventPollTimeout {
-    int timer;
-    int frequency;
-    unsigned long long expiresAt;
-    virEventTimeoutCallback cb;
-    virFreeCallback ff;
-    void *opaque;
-    int deleted;
-};
-
-/* Allocate extra slots for virEventPollHandle/virEventPollTimeout
-   records in this multiple */
+/* Allocate extra slots for virEventPollHandle records in this multiple */
 #define EVENT_ALLOC_EXTENT 10
 
 /* State for the main event loop */
@@ -81,9 +70,7 @@ struct virEventPollLoop {
     size_t handlesCount;
     size_t handlesAlloc;
     struct virEventPollHandle *handles;
-    size_t timeoutsCount;
-    size_t timeoutsAlloc;
-    struct virEventPollTimeout *timeouts;
+    virEventTimerListPtr timers;
 };
 
 /* Only have one event loop */
@@ -92,9 +79,6 @@ static struct virEventPollLoop eventLoop;
 /* Unique ID for the next FD watch to be registered */
 static int nextWatch = 1;
 
-/* Unique ID for the next timer to be registered */
-static int nextTimer = 1;
-
 /*
  * Register a callback for monitoring file handle events.
  * NB, it *must* be safe to call this from within a callback
@@ -205,7 +189,6 @@ int virEventPollRemoveHandle(int watch) {
 /*
  * Register a callback for a timer event
  * NB, it *must* be safe to call this from within a callback
- * For this reason we only ever append to existing list.
  */
 int virEventPollAddTimeout(int frequency,
                            virEventTimeoutCallback cb,
@@ -215,32 +198,17 @@ int virEventPollAddTimeout(int frequency,
     unsigned long long now;
     int ret;
 
-    if (virTimeMillisNow(&now) < 0) {
+    if (virTimeMonotonicMillisNow(&now) < 0) {
         return -1;
     }
 
     virMutexLock(&eventLoop.lock);
-    if (eventLoop.timeoutsCount == eventLoop.timeoutsAlloc) {
-        EVENT_DEBUG("Used %zu timeout slots, adding at least %d more",
-                    eventLoop.timeoutsAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
-                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
-            return -1;
-        }
+    if ((ret = virEventTimerListAdd(eventLoop.timers, now, frequency,
+                                    cb, opaque, ff)) < 0) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
     }
 
-    eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
-    eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
-    eventLoop.timeouts[eventLoop.timeoutsCount].cb = cb;
-    eventLoop.timeouts[eventLoop.timeoutsCount].ff = ff;
-    eventLoop.timeouts[eventLoop.timeoutsCount].opaque = opaque;
-    eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
-    eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
-        frequency >= 0 ? frequency + now : 0;
-
-    eventLoop.timeoutsCount++;
-    ret = nextTimer-1;
     virEventPollInterruptLocked();
 
     PROBE(EVENT_POLL_ADD_TIMEOUT,
@@ -253,7 +221,6 @@ int virEventPollAddTimeout(int frequency,
 void virEventPollUpdateTimeout(int timer, int frequency)
 {
     unsigned long long now;
-    int i;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
@@ -264,22 +231,14 @@ void virEventPollUpdateTimeout(int timer, int frequency)
         return;
     }
 
-    if (virTimeMillisNow(&now) < 0) {
+    if (virTimeMonotonicMillisNow(&now) < 0) {
         return;
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    if (virEventTimerListUpdate(eventLoop.timers, now, timer, frequency) == 0) {
+        virEventPollInterruptLocked();
+        found = true;
     }
     virMutexUnlock(&eventLoop.lock);
 
@@ -290,11 +249,10 @@ void virEventPollUpdateTimeout(int timer, int frequency)
 /*
  * Unregister a callback for a timer
  * NB, it *must* be safe to call this from within a callback
- * For this reason we only ever set a flag in the existing list.
+ * For this reason the timer is only disabled here.
  * Actual deletion will be done out-of-band
  */
 int virEventPollRemoveTimeout(int timer) {
-    int i;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -305,60 +263,31 @@ int virEventPollRemoveTimeout(int timer) {
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    if (virEventTimerListRemove(eventLoop.timers, timer) == 0) {
+        virEventPollInterruptLocked();
+        virMutexUnlock(&eventLoop.lock);
+        return 0;
     }
     virMutexUnlock(&eventLoop.lock);
     return -1;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Determine how long to wait until the first timer expires.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
  */
 static int virEventPollCalculateTimeout(int *timeout) {
-    unsigned long long then = 0;
-    int i;
-    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
-    /* Figure out if we need a timeout */
-    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
-
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
-    }
-
-    /* Calculate how long we should wait for a timeout if needed */
-    if (then > 0) {
-        unsigned long long now;
+    unsigned long long now;
+    EVENT_DEBUG("Calculate expiry of %zu timers",
+                virEventTimerListCount(eventLoop.timers));
 
-        if (virTimeMillisNow(&now) < 0)
-            return -1;
+    if (virTimeMonotonicMillisNow(&now) < 0)
+        return -1;
 
-        EVENT_DEBUG("Schedule timeout then=%llu now=%llu", then, now);
-        *timeout = then - now;
-        if (*timeout < 0)
-            *timeout = 0;
-    } else {
-        *timeout = -1;
-    }
+    *timeout = virEventTimerListTimeout(eventLoop.timers, now);
 
-    EVENT_DEBUG("Timeout at %llu due in %d ms", then, *timeout);
+    EVENT_DEBUG("Timeout due in %d ms", *timeout);
 
     return 0;
 }
@@ -405,51 +334,34 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 
 
 /*
- * Iterate over all timers and determine if any have expired.
- * Invoke the user supplied callback for each timer whose
- * expiry time is met, and schedule the next timeout. Does
- * not try to 'catch up' on time if the actual expiry time
- * was later than the requested time.
+ * Determine which timers have expired, and invoke the user
+ * supplied callback for each of them. Their next expiry is
+ * scheduled just before the callback runs.
  *
  * This method must cope with new timers being registered
- * by a callback, and must skip any timers marked as deleted.
+ * by a callback, and must skip any timers removed by one.
  *
  * Returns 0 upon success, -1 if an error occurred
  */
 static int virEventPollDispatchTimeouts(void)
 {
     unsigned long long now;
-    int i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
+    virEventTimeoutCallback cb;
+    void *opaque;
+    int timer;
 
-    if (virTimeMillisNow(&now) < 0)
+    if (virTimeMonotonicMillisNow(&now) < 0)
         return -1;
 
-    for (i = 0 ; i < ntimeouts ; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
-            continue;
-
-        /* Add 20ms fuzz so we don't pointlessly spin doing
-         * <10ms sleeps, particularly on kernels with low HZ
-         * it is fine that a timer expires 20ms earlier than
-         * requested
-         */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
-
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
-        }
+    virEventTimerListCollectDue(eventLoop.timers, now);
+    while (virEventTimerListNextDue(eventLoop.timers, &timer, &cb, &opaque)) {
+        VIR_DEBUG("Dispatch timer %d", timer);
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
     }
     return 0;
 }
@@ -506,51 +418,26 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds) {
 }
 
 
-/* Used post dispatch to actually remove any timers that
- * were previously marked as deleted. This asynchronous
- * cleanup is needed to make dispatch re-entrant safe.
+/* Used post dispatch to actually free any timers that
+ * were previously removed. This asynchronous cleanup is
+ * needed to make dispatch re-entrant safe.
  */
 static void virEventPollCleanupTimeouts(void) {
-    int i;
-    size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsCount);
-
-    /* Remove deleted entries, shuffling down remaining
-     * entries as needed to form contiguous series
-     */
-    for (i = 0 ; i < eventLoop.timeoutsCount ;) {
-        if (!eventLoop.timeouts[i].deleted) {
-            i++;
-            continue;
-        }
+    virFreeCallback ff;
+    void *opaque;
+    int timer;
+    VIR_DEBUG("Cleanup %zu", virEventTimerListCount(eventLoop.timers));
 
+    while (virEventTimerListNextDeleted(eventLoop.timers,
+                                        &timer, &ff, &opaque)) {
         PROBE(EVENT_POLL_PURGE_TIMEOUT,
               "timer=%d",
-              eventLoop.timeouts[i].timer);
-        if (eventLoop.timeouts[i].ff) {
-            virFreeCallback ff = eventLoop.timeouts[i].ff;
-            void *opaque = eventLoop.timeouts[i].opaque;
+              timer);
+        if (ff) {
             virMutexUnlock(&eventLoop.lock);
             ff(opaque);
             virMutexLock(&eventLoop.lock);
         }
-
-        if ((i+1) < eventLoop.timeoutsCount) {
-            memmove(eventLoop.timeouts+i,
-                    eventLoop.timeouts+i+1,
-                    sizeof(struct virEventPollTimeout)*(eventLoop.timeoutsCount
-                                                    -(i+1)));
-        }
-        eventLoop.timeoutsCount--;
-    }
-
-    /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
-    if (eventLoop.timeoutsCount == 0 ||
-        (gap > eventLoop.timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
-        EVENT_DEBUG("Found %zu out of %zu timeout slots used, releasing %zu",
-                    eventLoop.timeoutsCount, eventLoop.timeoutsAlloc, gap);
-        VIR_SHRINK_N(eventLoop.timeouts, eventLoop.timeoutsAlloc, gap);
     }
 }
 
@@ -682,6 +569,12 @@ int virEventPollInit(void)
         return -1;
     }
 
+    /* Timers registered before the default implementation was
+     * registered again must keep running */
+    if (!eventLoop.timers &&
+        !(eventLoop.timers = virEventTimerListNew()))
+        return -1;
+
     if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
@@ -0,0 +1,519 @@
+/*
+ * event_timer.c: timer bookkeeping shared by the event loop impls
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "event_timer.h"
+#include "logging.h"
+#include "memory.h"
+#include "virterror_internal.h"
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+/* Timers which expire within this many milliseconds are treated
+ * as expired, so we don't pointlessly spin doing <10ms sleeps,
+ * particularly on kernels with low HZ. It is fine that a timer
+ * expires 20ms earlier than requested
+ */
+#define EVENT_TIMER_FUZZ 20
+
+/* Allocate extra slots for timer records in this multiple */
+#define EVENT_TIMER_ALLOC_EXTENT 10
+
+typedef struct _virEventTimer virEventTimer;
+typedef virEventTimer *virEventTimerPtr;
+
+/* State for a single timer being generated */
+struct _virEventTimer {
+    int timer;
+    int frequency;
+    unsigned long long expiresAt;
+    virEventTimeoutCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    /* Position in the heap, -1 if the timer is disabled, deleted
+     * or waiting to be dispatched */
+    int heapIndex;
+
+    /* Set while the timer sits on the list of due timers */
+    bool due;
+    virEventTimerPtr nextDue;
+    virEventTimerPtr nextDeleted;
+};
+
+struct _virEventTimerList {
+    /* Unique ID for the next timer to be registered */
+    int nextTimer;
+
+    /* All timers, including deleted ones not yet purged. Timer ids
+     * are handed out in increasing order and we only ever append,
+     * so this stays sorted and can be binary searched */
+    size_t ntimers;
+    size_t ntimersAlloc;
+    virEventTimerPtr *timers;
+
+    /* Enabled timers, ordered by expiry. Always allocated to hold
+     * every timer, so that re-inserting can never fail */
+    size_t nheap;
+    size_t nheapAlloc;
+    virEventTimerPtr *heap;
+
+    /* Timers collected by virEventTimerListCollectDue */
+    unsigned long long dueAt;
+    virEventTimerPtr dueHead;
+    virEventTimerPtr dueTail;
+
+    /* Timers removed, but whose free callback has not run yet */
+    virEventTimerPtr deleted;
+};
+
+
+static bool
+virEventTimerBefore(virEventTimerPtr a, virEventTimerPtr b)
+{
+    if (a->expiresAt != b->expiresAt)
+        return a->expiresAt < b->expiresAt;
+    return a->timer < b->timer;
+}
+
+static void
+virEventTimerHeapSet(virEventTimerListPtr list,
+                     size_t idx,
+                     virEventTimerPtr t)
+{
+    list->heap[idx] = t;
+    t->heapIndex = idx;
+}
+
+static void
+virEventTimerHeapSiftUp(virEventTimerListPtr list, size_t idx)
+{
+    virEventTimerPtr t = list->heap[idx];
+
+    while (idx > 0) {
+        size_t parent = (idx - 1) / 2;
+        if (!virEventTimerBefore(t, list->heap[parent]))
+            break;
+        virEventTimerHeapSet(list, idx, list->heap[parent]);
+        idx = parent;
+    }
+    virEventTimerHeapSet(list, idx, t);
+}
+
+static void
+virEventTimerHeapSiftDown(virEventTimerListPtr list, size_t idx)
+{
+    virEventTimerPtr t = list->heap[idx];
+
+    for (;;) {
+        size_t child = idx * 2 + 1;
+        if (child >= list->nheap)
+            break;
+        if (child + 1 < list->nheap &&
+            virEventTimerBefore(list->heap[child + 1], list->heap[child]))
+            child++;
+        if (!virEventTimerBefore(list->heap[child], t))
+            break;
+        virEventTimerHeapSet(list, idx, list->heap[child]);
+        idx = child;
+    }
+    virEventTimerHeapSet(list, idx, t);
+}
+
+static void
+virEventTimerHeapInsert(virEventTimerListPtr list, virEventTimerPtr t)
+{
+    sa_assert(list->nheap < list->nheapAlloc);
+    virEventTimerHeapSet(list, list->nheap++, t);
+    virEventTimerHeapSiftUp(list, t->heapIndex);
+}
+
+static void
+virEventTimerHeapDelete(virEventTimerListPtr list, virEventTimerPtr t)
+{
+    size_t idx = t->heapIndex;
+    virEventTimerPtr last;
+
+    if (t->heapIndex < 0)
+        return;
+
+    t->heapIndex = -1;
+    last = list->heap[--list->nheap];
+    list->heap[list->nheap] = NULL;
+    if (last == t)
+        return;
+
+    virEventTimerHeapSet(list, idx, last);
+    if (idx > 0 && virEventTimerBefore(last, list->heap[(idx - 1) / 2]))
+        virEventTimerHeapSiftUp(list, idx);
+    else
+        virEventTimerHeapSiftDown(list, idx);
+}
+
+
+static ssize_t
+virEventTimerListFindIndex(virEventTimerListPtr list, int timer)
+{
+    size_t lo = 0;
+    size_t hi = list->ntimers;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (list->timers[mid]->timer == timer)
+            return mid;
+        if (list->timers[mid]->timer < timer)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return -1;
+}
+
+
+virEventTimerListPtr
+virEventTimerListNew(void)
+{
+    virEventTimerListPtr list;
+
+    if (VIR_ALLOC(list) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    list->nextTimer = 1;
+
+    return list;
+}
+
+
+void
+virEventTimerListFree(virEventTimerListPtr list)
+{
+    size_t i;
+
+    if (!list)
+        return;
+
+    for (i = 0 ; i < list->ntimers ; i++)
+        VIR_FREE(list->timers[i]);
+    VIR_FREE(list->timers);
+    VIR_FREE(list->heap);
+    VIR_FREE(list);
+}
+
+
+/**
+ * virEventTimerListAdd:
+ * @list: the timer list
+ * @now: the current monotonic time
+ * @frequency: time between events in milliseconds, or -1 to disable
+ * @cb: callback to invoke when the timer expires
+ * @opaque: user data to pass to callback
+ * @ff: callback to free @opaque when the timer is purged
+ *
+ * Returns the new positive timer id, or -1 on error
+ */
+int
+virEventTimerListAdd(virEventTimerListPtr list,
+                     unsigned long long now,
+                     int frequency,
+                     virEventTimeoutCallback cb,
+                     void *opaque,
+                     virFreeCallback ff)
+{
+    virEventTimerPtr t;
+
+    if (list->ntimers == list->ntimersAlloc &&
+        VIR_RESIZE_N(list->timers, list->ntimersAlloc,
+                     list->ntimers, EVENT_TIMER_ALLOC_EXTENT) < 0)
+        goto no_memory;
+
+    if (list->ntimers == list->nheapAlloc &&
+        VIR_RESIZE_N(list->heap, list->nheapAlloc,
+                     list->ntimers, EVENT_TIMER_ALLOC_EXTENT) < 0)
+        goto no_memory;
+
+    if (VIR_ALLOC(t) < 0)
+        goto no_memory;
+
+    t->timer = list->nextTimer++;
+    t->frequency = frequency;
+    t->cb = cb;
+    t->ff = ff;
+    t->opaque = opaque;
+    t->heapIndex = -1;
+
+    list->timers[list->ntimers++] = t;
+
+    if (frequency >= 0) {
+        t->expiresAt = now + frequency;
+        virEventTimerHeapInsert(list, t);
+    }
+
+    return t->timer;
+
+no_memory:
+    virReportOOMError();
+    return -1;
+}
+
+
+/**
+ * virEventTimerListUpdate:
+ * @list: the timer list
+ * @now: the current monotonic time
+ * @timer: the timer id to change
+ * @frequency: time between events in milliseconds, or -1 to disable
+ *
+ * Returns 0 on success, -1 if the timer does not exist
+ */
+int
+virEventTimerListUpdate(virEventTimerListPtr list,
+                        unsigned long long now,
+                        int timer,
+                        int frequency)
+{
+    ssize_t idx;
+    virEventTimerPtr t;
+
+    if ((idx = virEventTimerListFindIndex(list, timer)) < 0)
+        return -1;
+
+    t = list->timers[idx];
+    t->frequency = frequency;
+    if (t->deleted)
+        return 0;
+
+    /* A timer waiting to be dispatched is rescheduled instead */
+    t->due = false;
+    virEventTimerHeapDelete(list, t);
+    if (frequency >= 0) {
+        t->expiresAt = now + frequency;
+        virEventTimerHeapInsert(list, t);
+    } else {
+        t->expiresAt = 0;
+    }
+
+    VIR_DEBUG("Set timer freq=%d expires=%llu", frequency, t->expiresAt);
+    return 0;
+}
+
+
+/**
+ * virEventTimerListRemove:
+ * @list: the timer list
+ * @timer: the timer id to remove
+ *
+ * Disables the timer and queues it for purging by
+ * virEventTimerListNextDeleted
+ *
+ * Returns 0 on success, -1 if the timer does not exist
+ */
+int
+virEventTimerListRemove(virEventTimerListPtr list,
+                        int timer)
+{
+    ssize_t idx;
+    virEventTimerPtr t;
+
+    if ((idx = virEventTimerListFindIndex(list, timer)) < 0)
+        return -1;
+
+    t = list->timers[idx];
+    if (t->deleted)
+        return -1;
+
+    t->deleted = true;
+    virEventTimerHeapDelete(list, t);
+    t->nextDeleted = list->deleted;
+    list->deleted = t;
+
+    return 0;
+}
+
+
+size_t
+virEventTimerListCount(virEventTimerListPtr list)
+{
+    return list->ntimers;
+}
+
+
+/**
+ * virEventTimerListTimeout:
+ * @list: the timer list
+ * @now: the current monotonic time
+ *
+ * Returns the number of milliseconds until the first timer
+ * expires, or -1 if no timer is pending
+ */
+int
+virEventTimerListTimeout(virEventTimerListPtr list,
+                         unsigned long long now)
+{
+    unsigned long long then;
+
+    if (list->nheap == 0)
+        return -1;
+
+    then = list->heap[0]->expiresAt;
+    VIR_DEBUG("Schedule timeout then=%llu now=%llu", then, now);
+    if (then <= now)
+        return 0;
+    if (then - now > INT_MAX)
+        return INT_MAX;
+    return then - now;
+}
+
+
+/**
+ * virEventTimerListCollectDue:
+ * @list: the timer list
+ * @now: the current monotonic time
+ *
+ * Moves all timers which expire at @now onto the list of timers to
+ * dispatch, which must then be drained with virEventTimerListNextDue.
+ * Timers added while dispatching are not considered until the next
+ * call, so each timer fires at most once per event loop iteration.
+ */
+void
+virEventTimerListCollectDue(virEventTimerListPtr list,
+                            unsigned long long now)
+{
+    list->dueAt = now;
+
+    while (list->nheap > 0 &&
+           list->heap[0]->expiresAt <= now + EVENT_TIMER_FUZZ) {
+        virEventTimerPtr t = list->heap[0];
+
+        virEventTimerHeapDelete(list, t);
+        t->due = true;
+        t->nextDue = NULL;
+        if (list->dueTail)
+            list->dueTail->nextDue = t;
+        else
+            list->dueHead = t;
+        list->dueTail = t;
+    }
+}
+
+
+/**
+ * virEventTimerListNextDue:
+ * @list: the timer list
+ * @timer: filled with the timer id
+ * @cb: filled with the callback to invoke
+ * @opaque: filled with the user data to pass to @cb
+ *
+ * Takes the next timer to dispatch, skipping any which were removed
+ * or updated since they were collected, and schedules its next
+ * expiry. Does not try to 'catch up' on time if the actual expiry
+ * time was later than the requested time.
+ *
+ * Returns true if a timer must be dispatched, false once there
+ * are no more.
+ */
+bool
+virEventTimerListNextDue(virEventTimerListPtr list,
+                         int *timer,
+                         virEventTimeoutCallback *cb,
+                         void **opaque)
+{
+    while (list->dueHead) {
+        virEventTimerPtr t = list->dueHead;
+
+        list->dueHead = t->nextDue;
+        if (!list->dueHead)
+            list->dueTail = NULL;
+        t->nextDue = NULL;
+
+        if (!t->due || t->deleted)
+            continue;
+
+        t->due = false;
+        t->expiresAt = list->dueAt + t->frequency;
+        virEventTimerHeapInsert(list, t);
+
+        *timer = t->timer;
+        *cb = t->cb;
+        *opaque = t->opaque;
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * virEventTimerListNextDeleted:
+ * @list: the timer list
+ * @timer: filled with the timer id
+ * @ff: filled with the free callback, possibly NULL
+ * @opaque: filled with the user data to pass to @ff
+ *
+ * Purges the next removed timer. Must not be called while
+ * there are still timers left to dispatch.
+ *
+ * Returns true if a timer was purged, false once there are no more.
+ */
+bool
+virEventTimerListNextDeleted(virEventTimerListPtr list,
+                             int *timer,
+                             virFreeCallback *ff,
+                             void **opaque)
+{
+    virEventTimerPtr t = list->deleted;
+    ssize_t idx;
+    size_t gap;
+
+    if (!t)
+        return false;
+
+    sa_assert(!list->dueHead);
+    list->deleted = t->nextDeleted;
+
+    if ((idx = virEventTimerListFindIndex(list, t->timer)) >= 0)
+        VIR_DELETE_ELEMENT_INPLACE(list->timers, idx, list->ntimers);
+
+    *timer = t->timer;
+    *ff = t->ff;
+    *opaque = t->opaque;
+    VIR_FREE(t);
+
+    /* Release some memory if we've got a big chunk free */
+    gap = list->ntimersAlloc - list->ntimers;
+    if (gap > list->ntimers && gap > EVENT_TIMER_ALLOC_EXTENT) {
+        VIR_DEBUG("Found %zu out of %zu timer slots used, releasing %zu",
+                  list->ntimers, list->ntimersAlloc, gap / 2);
+        VIR_SHRINK_N(list->timers, list->ntimersAlloc, gap / 2);
+        if (list->nheapAlloc > list->ntimersAlloc)
+            VIR_SHRINK_N(list->heap, list->nheapAlloc,
+                         list->nheapAlloc - list->ntimersAlloc);
+    }
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * event_timer.h: timer bookkeeping shared by the event loop impls
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_EVENT_TIMER_H__
+# define __VIR_EVENT_TIMER_H__
+
+# include "internal.h"
+
+/*
+ * A set of timers kept in a binary min-heap ordered by expiry time,
+ * so that adding, updating and removing a timer is O(log n) and
+ * finding the next one to expire is O(1).
+ *
+ * All times are in milliseconds of the monotonic clock, as returned
+ * by virTimeMonotonicMillisNow(). None of the functions do any
+ * locking, the event loop owning the list is expected to serialize
+ * access to it.
+ */
+typedef struct _virEventTimerList virEventTimerList;
+typedef virEventTimerList *virEventTimerListPtr;
+
+virEventTimerListPtr virEventTimerListNew(void);
+void virEventTimerListFree(virEventTimerListPtr list);
+
+int virEventTimerListAdd(virEventTimerListPtr list,
+                         unsigned long long now,
+                         int frequency,
+                         virEventTimeoutCallback cb,
+                         void *opaque,
+                         virFreeCallback ff)
+    ATTRIBUTE_NONNULL(1);
+int virEventTimerListUpdate(virEventTimerListPtr list,
+                            unsigned long long now,
+                            int timer,
+                            int frequency)
+    ATTRIBUTE_NONNULL(1);
+int virEventTimerListRemove(virEventTimerListPtr list,
+                            int timer)
+    ATTRIBUTE_NONNULL(1);
+
+size_t virEventTimerListCount(virEventTimerListPtr list)
+    ATTRIBUTE_NONNULL(1);
+int virEventTimerListTimeout(virEventTimerListPtr list,
+                             unsigned long long now)
+    ATTRIBUTE_NONNULL(1);
+
+void virEventTimerListCollectDue(virEventTimerListPtr list,
+                                 unsigned long long now)
+    ATTRIBUTE_NONNULL(1);
+bool virEventTimerListNextDue(virEventTimerListPtr list,
+                              int *timer,
+                              virEventTimeoutCallback *cb,
+                              void **opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+bool virEventTimerListNextDeleted(virEventTimerListPtr list,
+                                  int *timer,
+                                  virFreeCallback *ff,
+                                  void **opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+
+#endif /* __VIR_EVENT_TIMER_H__ */
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 #include "threads.h"
@@ -72,8 +73,132 @@ cleanup:
     return fd;
 }
 
+/* Sends the file to stdout as frames, so that its holes cross the
+ * pipe as such, see virFileFrame */
 static int
-runIO(const char *path, int fd, int oflags, unsigned long long length)
+runIOSparseRead(const char *path, int fd,
+                char *buf, size_t buflen,
+                unsigned long long length)
+{
+    unsigned long long total = 0;
+
+    while (!length || total < length) {
+        virFileFrame frame;
+        unsigned long long len;
+        int inData;
+        ssize_t got;
+
+        if (virFileInData(fd, &inData, &len) < 0)
+            return -1;
+
+        if (length && (length - total) < len)
+            len = length - total;
+        if (len == 0)
+            break; /* End of file */
+
+        if (inData) {
+            if (len > buflen)
+                len = buflen;
+            if ((got = saferead(fd, buf, len)) < 0) {
+                virReportSystemError(errno, _("Unable to read %s"), path);
+                return -1;
+            }
+            if (got == 0)
+                break; /* The file shrank meanwhile */
+            len = got;
+        } else if (lseek(fd, len, SEEK_CUR) == (off_t) -1) {
+            virReportSystemError(errno, _("Unable to seek %s"), path);
+            return -1;
+        }
+
+        memset(&frame, 0, sizeof(frame));
+        frame.type = inData ? VIR_FILE_FRAME_DATA : VIR_FILE_FRAME_HOLE;
+        frame.length = len;
+        if (safewrite(STDOUT_FILENO, &frame, sizeof(frame)) < 0 ||
+            (inData && safewrite(STDOUT_FILENO, buf, len) < 0)) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
+            return -1;
+        }
+
+        total += len;
+    }
+
+    return 0;
+}
+
+/* Writes the frames read from stdin to the file, making holes in
+ * it where they say so */
+static int
+runIOSparseWrite(const char *path, int fd,
+                 char *buf, size_t buflen,
+                 unsigned long long length)
+{
+    unsigned long long total = 0;
+
+    while (1) {
+        virFileFrame frame;
+        unsigned long long left;
+        ssize_t got;
+
+        if ((got = saferead(STDIN_FILENO, &frame, sizeof(frame))) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of stream */
+
+        if (got != sizeof(frame) ||
+            frame.length == 0 ||
+            (length && (length - total) < frame.length)) {
+            virReportSystemError(EINVAL, "%s", _("Malformed frame on stdin"));
+            return -1;
+        }
+
+        switch (frame.type) {
+        case VIR_FILE_FRAME_HOLE:
+            if (virFileMakeHole(fd, frame.length) < 0) {
+                virReportSystemError(errno, _("Unable to make hole in %s"),
+                                     path);
+                return -1;
+            }
+            break;
+
+        case VIR_FILE_FRAME_DATA:
+            for (left = frame.length ; left ; left -= got) {
+                size_t want = MIN(left, buflen);
+
+                if ((got = saferead(STDIN_FILENO, buf, want)) < 0) {
+                    virReportSystemError(errno, "%s",
+                                         _("Unable to read stdin"));
+                    return -1;
+                }
+                if (got < want) {
+                    virReportSystemError(EINVAL, "%s",
+                                         _("Truncated frame on stdin"));
+                    return -1;
+                }
+                if (safewrite(fd, buf, got) < 0) {
+                    virReportSystemError(errno, _("Unable to write %s"),
+                                         path);
+                    return -1;
+                }
+            }
+            break;
+
+        default:
+            virReportSystemError(EINVAL, "%s", _("Malformed frame on stdin"));
+            return -1;
+        }
+
+        total += frame.length;
+    }
+
+    return 0;
+}
+
+static int
+runIO(const char *path, int fd, int oflags, unsigned long long length,
+      bool sparse)
 {
     void *base = NULL; /* Location to be freed */
     char *buf = NULL; /* Aligned location within base */
@@ -138,7 +263,22 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
-    while (1) {
+    if (sparse) {
+        if (direct) {
+            virReportSystemError(EINVAL, "%s",
+                                 _("O_DIRECT cannot be used with holes"));
+            goto cleanup;
+        }
+        if (fdin == fd) {
+            if (runIOSparseRead(path, fd, buf, buflen, length) < 0)
+                goto cleanup;
+        } else {
+            if (runIOSparseWrite(path, fd, buf, buflen, length) < 0)
+                goto cleanup;
+        }
+    }
+
+    while (!sparse) {
         ssize_t got;
 
         if (length &&
@@ -210,7 +350,7 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
+                 "   or: %s FILENAME LENGTH FD [SPARSE]\n"),
                program_name, program_name);
     }
     exit(status);
@@ -226,6 +366,7 @@ main(int argc, char **argv)
     int oflags = -1;
     int mode;
     unsigned int delete = 0;
+    unsigned int sparse = 0;
     int fd = -1;
     int lengthIndex = 0;
 
@@ -271,13 +412,18 @@ main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
         fd = prepare(path, oflags, mode, offset);
-    } else if (argc == 4) { /* FILENAME LENGTH FD */
+    } else if (argc == 4 || argc == 5) { /* FILENAME LENGTH FD [SPARSE] */
         lengthIndex = 2;
         if (virStrToLong_i(argv[3], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
                     program_name, argv[3]);
             exit(EXIT_FAILURE);
         }
+        if (argc == 5 && virStrToLong_ui(argv[4], NULL, 10, &sparse) < 0) {
+            fprintf(stderr, _("%s: malformed sparse flag %s"),
+                    program_name, argv[4]);
+            exit(EXIT_FAILURE);
+        }
 #ifdef F_GETFL
         oflags = fcntl(fd, F_GETFL);
 #else
@@ -302,7 +448,7 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0 || runIO(path, fd, oflags, length, sparse) < 0)
         goto error;
 
     if (delete)
@@ -38,6 +38,8 @@
 # include "stats_linux.h"
 # include "memory.h"
 # include "virfile.h"
+# include "virnetlink.h"
+# include "logging.h"
 
 # define VIR_FROM_THIS VIR_FROM_STATS_LINUX
 
@@ -48,9 +50,9 @@
  * the interface of a domain they own.  We do no such checking.
  */
 
-int
-linuxDomainInterfaceStats(const char *path,
-                          struct _virDomainInterfaceStats *stats)
+static int
+linuxDomainInterfaceStatsProc(const char *path,
+                              struct _virDomainInterfaceStats *stats)
 {
     int path_len;
     FILE *fp;
@@ -119,4 +121,36 @@ linuxDomainInterfaceStats(const char *path,
     return -1;
 }
 
+int
+linuxDomainInterfaceStats(const char *path,
+                          struct _virDomainInterfaceStats *stats)
+{
+# ifdef HAVE_LIBNL
+    virNetlinkLinkStats link;
+
+    if (virNetlinkGetLinkStats(path, &link) == 0) {
+        /* The counters are those of the host side of the link, so
+         * bytes TRANSMITTED by the host are bytes RECEIVED by the
+         * domain, just as with /proc/net/dev.
+         */
+        stats->rx_bytes = link.tx_bytes;
+        stats->rx_packets = link.tx_packets;
+        stats->rx_errs = link.tx_errs;
+        stats->rx_drop = link.tx_drop;
+        stats->tx_bytes = link.rx_bytes;
+        stats->tx_packets = link.rx_packets;
+        stats->tx_errs = link.rx_errs;
+        stats->tx_drop = link.rx_drop;
+        return 0;
+    }
+
+    /* Netlink sockets may be denied, eg by a sandbox. The error
+     * was logged already */
+    VIR_DEBUG("Falling back to /proc/net/dev for interface %s", path);
+    virResetLastError();
+# endif /* HAVE_LIBNL */
+
+    return linuxDomainInterfaceStatsProc(path, stats);
+}
+
 #endif /* __linux__ */
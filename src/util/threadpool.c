@@ -25,41 +25,99 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include "threadpool.h"
 #include "memory.h"
 #include "threads.h"
+#include "viratomic.h"
 #include "virterror_internal.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
-typedef struct _virThreadPoolJob virThreadPoolJob;
-typedef virThreadPoolJob *virThreadPoolJobPtr;
-
-struct _virThreadPoolJob {
-    virThreadPoolJobPtr prev;
-    virThreadPoolJobPtr next;
-    unsigned int priority;
+/* Maximum number of jobs a worker moves into its own queue
+ * at once, whether from the injection queue or from a peer */
+#define VIR_THREADPOOL_MAX_BATCH 16
 
-    void *data;
-};
+/* A FIFO of jobs with its own lock. The depth is only changed
+ * with the lock held, but may be read without it to cheaply
+ * skip empty queues */
+typedef struct _virThreadPoolJobQueue virThreadPoolJobQueue;
+typedef virThreadPoolJobQueue *virThreadPoolJobQueuePtr;
 
-typedef struct _virThreadPoolJobList virThreadPoolJobList;
-typedef virThreadPoolJobList *virThreadPoolJobListPtr;
-
-struct _virThreadPoolJobList {
+struct _virThreadPoolJobQueue {
+    virMutex lock;
     virThreadPoolJobPtr head;
     virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
+    int depth;
 };
 
+typedef struct _virThreadPoolWorker virThreadPoolWorker;
+typedef virThreadPoolWorker *virThreadPoolWorkerPtr;
+
+struct _virThreadPoolWorker {
+    virThreadPoolPtr pool;
+    size_t id;
+    bool priority;
+    virThread thread;
+    /* Whether a thread is using this record, protected by the
+     * pool mutex */
+    bool running;
+
+    /* Jobs queued by this worker itself, or moved here from the
+     * injection queue. Idle peers steal from it. Unused by
+     * priority workers */
+    virThreadPoolJobQueue queue;
+
+    /* Only updated by the thread using this record, and summed
+     * up without locking by virThreadPoolGetStats */
+    unsigned long long jobs;
+    unsigned long long waitTime[VIR_THREADPOOL_HISTOGRAM_BUCKETS];
+    unsigned long long runTime[VIR_THREADPOOL_HISTOGRAM_BUCKETS];
+};
 
+/*
+ * Jobs submitted from outside the pool land on the injection
+ * queue, priority jobs on the priority lane, and jobs submitted
+ * by a worker on its own queue. Normal workers serve their own
+ * queue first, then the priority lane, then grab a batch from
+ * the injection queue, and finally steal from their peers, so
+ * that most of the time they do not contend on a shared lock.
+ * Priority workers only ever serve the priority lane.
+ *
+ * The pool mutex is only taken to start threads and to put
+ * idle workers to sleep or wake them up. Submitters bump
+ * jobQueueDepth before checking freeWorkers, and idle workers
+ * bump freeWorkers before checking jobQueueDepth, so a wakeup
+ * can not be lost. Signals which have not been picked up yet
+ * are counted, so that a burst of jobs doesn't signal a
+ * sleeping worker over and over again.
+ *
+ * Normal workers which are looking for a job rather than
+ * running one are counted in searchingWorkers. As long as one
+ * of them, or a worker which was signalled, is around, nobody
+ * else is woken up. When the last searching worker finds a job
+ * and more are queued, it wakes up a peer itself, so bursts
+ * still fan out over the pool without every submission paying
+ * for a wakeup.
+ *
+ * Normal worker records are never freed or moved until the pool
+ * is, since peers access their queues without the pool mutex.
+ * When maxWorkers is lowered, surplus workers exit once they are
+ * done with their current job, handing their queue over to the
+ * injection queue, and their records are reused by workers
+ * started later on. Grown slot arrays keep the old ones around
+ * for the same reason.
+ */
 struct _virThreadPool {
-    bool quit;
+    int quit;
 
     virThreadPoolJobFunc jobFunc;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
-    size_t jobQueueDepth;
+    virThreadPoolJobQueue injectQueue;
+    virThreadPoolJobQueue prioQueue;
+    int jobQueueDepth;
 
     virMutex mutex;
     virCond cond;
@@ -67,95 +125,519 @@ struct _virThreadPool {
 
     size_t maxWorkers;
     size_t minWorkers;
-    size_t freeWorkers;
-    size_t nWorkers;
-    virThreadPtr workers;
+    int freeWorkers;
+    int pendingWakeups;
+    int searchingWorkers;
+    int nWorkers;
+    virThreadPoolWorkerPtr *workers;
+    size_t nWorkerSlots;
+    size_t workerSlotsAlloc;
+    virThreadPoolWorkerPtr **oldWorkers;
+    size_t nOldWorkers;
 
     size_t nPrioWorkers;
-    virThreadPtr prioWorkers;
+    int freePrioWorkers;
+    int pendingPrioWakeups;
+    virThreadPoolWorkerPtr prioWorkers;
     virCond prioCond;
-};
 
-struct virThreadPoolWorkerData {
-    virThreadPoolPtr pool;
-    virCondPtr cond;
-    bool priority;
+    /* Threads which have not exited yet */
+    size_t nRunning;
 };
 
-static void virThreadPoolWorker(void *opaque)
+static virThreadLocal virThreadPoolCurrentWorker;
+
+static int virThreadPoolOnceInit(void)
 {
-    struct virThreadPoolWorkerData *data = opaque;
-    virThreadPoolPtr pool = data->pool;
-    virCondPtr cond = data->cond;
-    bool priority = data->priority;
-    virThreadPoolJobPtr job = NULL;
+    if (virThreadLocalInit(&virThreadPoolCurrentWorker, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize thread local variable"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virThreadPool)
+
+
+static int virThreadPoolJobQueueInit(virThreadPoolJobQueuePtr queue)
+{
+    queue->head = queue->tail = NULL;
+    queue->depth = 0;
+    return virMutexInit(&queue->lock);
+}
 
-    VIR_FREE(data);
+static void virThreadPoolJobQueueDestroy(virThreadPoolJobQueuePtr queue)
+{
+    virThreadPoolJobPtr job;
+
+    while ((job = queue->head)) {
+        queue->head = job->next;
+        if (!job->embedded)
+            VIR_FREE(job);
+    }
+    virMutexDestroy(&queue->lock);
+}
+
+/* Append the chain @head..@tail of @count jobs to the locked @queue */
+static void virThreadPoolJobQueueAppendLocked(virThreadPoolJobQueuePtr queue,
+                                              virThreadPoolJobPtr head,
+                                              virThreadPoolJobPtr tail,
+                                              int count)
+{
+    tail->next = NULL;
+    if (queue->tail)
+        queue->tail->next = head;
+    else
+        queue->head = head;
+    queue->tail = tail;
+    virAtomicIntAdd(&queue->depth, count);
+}
 
+/* The pool wide job count is only ever changed with the lock of
+ * the queue holding the job, so that when it is positive, there
+ * is a job to be found */
+static void virThreadPoolJobQueuePush(virThreadPoolPtr pool,
+                                      virThreadPoolJobQueuePtr queue,
+                                      virThreadPoolJobPtr job)
+{
+    virMutexLock(&queue->lock);
+    virThreadPoolJobQueueAppendLocked(queue, job, job, 1);
+    virAtomicIntInc(&pool->jobQueueDepth);
+    virMutexUnlock(&queue->lock);
+}
+
+/*
+ * Detach up to @max jobs from the head of @queue. Any jobs beyond
+ * the first are moved to @dst. Both queues are locked during the
+ * move, in address order, so that peers never see the moved jobs
+ * accounted for but unreachable. Returns the first job, or NULL
+ * if @queue was empty.
+ */
+static virThreadPoolJobPtr
+virThreadPoolJobQueueTake(virThreadPoolPtr pool,
+                          virThreadPoolJobQueuePtr queue,
+                          virThreadPoolJobQueuePtr dst,
+                          int max)
+{
+    virThreadPoolJobPtr job;
+    virThreadPoolJobPtr last;
+    int count;
+
+    if (queue->depth == 0)
+        return NULL;
+
+    if (max < 1 || !dst || dst == queue)
+        max = 1;
+
+    if (max > 1 && dst < queue)
+        virMutexLock(&dst->lock);
+    virMutexLock(&queue->lock);
+    if (max > 1 && dst > queue)
+        virMutexLock(&dst->lock);
+
+    if ((job = queue->head)) {
+        last = job;
+        for (count = 1 ; count < max && last->next ; count++)
+            last = last->next;
+
+        queue->head = last->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        virAtomicIntAdd(&queue->depth, -count);
+        virAtomicIntAdd(&pool->jobQueueDepth, -1);
+
+        if (count > 1)
+            virThreadPoolJobQueueAppendLocked(dst, job->next, last, count - 1);
+        job->next = NULL;
+    }
+
+    virMutexUnlock(&queue->lock);
+    if (max > 1)
+        virMutexUnlock(&dst->lock);
+
+    return job;
+}
+
+
+/* Find the next job for a normal worker, see above for the order */
+static virThreadPoolJobPtr
+virThreadPoolNextJob(virThreadPoolPtr pool,
+                     virThreadPoolWorkerPtr worker)
+{
+    virThreadPoolJobPtr job;
+    virThreadPoolWorkerPtr *workers;
+    size_t nSlots;
+    int nWorkers;
+    int batch;
+    size_t i;
+
+    if ((job = virThreadPoolJobQueueTake(pool, &worker->queue, NULL, 1)) ||
+        (job = virThreadPoolJobQueueTake(pool, &pool->prioQueue, NULL, 1)))
+        return job;
+
+    if ((nWorkers = pool->nWorkers) < 1)
+        nWorkers = 1;
+
+    /* Take a fair share of the injected jobs, leaving the rest
+     * for the other workers */
+    batch = pool->injectQueue.depth / nWorkers + 1;
+    if (batch > VIR_THREADPOOL_MAX_BATCH)
+        batch = VIR_THREADPOOL_MAX_BATCH;
+    if ((job = virThreadPoolJobQueueTake(pool, &pool->injectQueue,
+                                         &worker->queue, batch)))
+        return job;
+
+    /* The slot array may be replaced by a larger copy at any time */
     virMutexLock(&pool->mutex);
+    workers = pool->workers;
+    nSlots = pool->nWorkerSlots;
+    virMutexUnlock(&pool->mutex);
 
-    while (1) {
-        while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
-            if (!priority)
-                pool->freeWorkers++;
-            if (virCondWait(cond, &pool->mutex) < 0) {
-                if (!priority)
-                    pool->freeWorkers--;
-                goto out;
-            }
-            if (!priority)
-                pool->freeWorkers--;
-        }
+    /* Steal half the queue of the first busy peer */
+    for (i = 1 ; i < nSlots ; i++) {
+        virThreadPoolWorkerPtr victim = workers[(worker->id + i) % nSlots];
+
+        batch = (victim->queue.depth + 1) / 2;
+        if (batch > VIR_THREADPOOL_MAX_BATCH)
+            batch = VIR_THREADPOOL_MAX_BATCH;
+        if (batch &&
+            (job = virThreadPoolJobQueueTake(pool, &victim->queue,
+                                             &worker->queue, batch)))
+            return job;
+    }
+
+    return NULL;
+}
 
-        if (pool->quit)
-            break;
 
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
+/*
+ * Sleep until there may be work for @worker, or the pool is
+ * shutting down. Returns -1 if waiting failed
+ */
+static int virThreadPoolWorkerWait(virThreadPoolPtr pool,
+                                   virThreadPoolWorkerPtr worker)
+{
+    int *freeWorkers;
+    int *pendingWakeups;
+    int *depth;
+    virCondPtr cond;
+    int ret = 0;
+
+    if (worker->priority) {
+        freeWorkers = &pool->freePrioWorkers;
+        pendingWakeups = &pool->pendingPrioWakeups;
+        depth = &pool->prioQueue.depth;
+        cond = &pool->prioCond;
+    } else {
+        freeWorkers = &pool->freeWorkers;
+        pendingWakeups = &pool->pendingWakeups;
+        depth = &pool->jobQueueDepth;
+        cond = &pool->cond;
+    }
+
+    virMutexLock(&pool->mutex);
+    virAtomicIntInc(freeWorkers);
+    while (!pool->quit &&
+           virAtomicIntGet(depth) <= 0 &&
+           (worker->priority ||
+            (size_t)pool->nWorkers <= pool->maxWorkers)) {
+        if (virCondWait(cond, &pool->mutex) < 0) {
+            ret = -1;
+            break;
         }
+        /* Signalled or not, one less wakeup is outstanding */
+        if (*pendingWakeups > 0)
+            virAtomicIntAdd(pendingWakeups, -1);
+    }
+    virAtomicIntAdd(freeWorkers, -1);
+    virMutexUnlock(&pool->mutex);
+
+    return ret;
+}
+
+
+/* Signal a sleeping worker, unless all of them already were,
+ * or one which will pick up the job is already awake */
+static void virThreadPoolWakeup(virThreadPoolPtr pool,
+                                int *freeWorkers,
+                                int *pendingWakeups,
+                                int *searchingWorkers,
+                                virCondPtr cond)
+{
+    int pending = virAtomicIntGet(pendingWakeups);
+
+    if (searchingWorkers &&
+        (pending > 0 || virAtomicIntGet(searchingWorkers) > 0))
+        return;
+    if (virAtomicIntGet(freeWorkers) <= pending)
+        return;
+
+    virMutexLock(&pool->mutex);
+    if (*freeWorkers > *pendingWakeups) {
+        virAtomicIntInc(pendingWakeups);
+        virCondSignal(cond);
+    }
+    virMutexUnlock(&pool->mutex);
+}
+
+
+size_t virThreadPoolHistogramBucket(unsigned long long usecs)
+{
+    size_t bucket = 0;
+
+    while (usecs && bucket < VIR_THREADPOOL_HISTOGRAM_BUCKETS - 1) {
+        usecs >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/*
+ * The job function may well free an embedded job, so the job must
+ * not be touched once it is called. @now holds the time the previous
+ * job finished, which is close enough to the start of this one if
+ * the worker did not sleep in between, or 0 to read the clock.
+ */
+static void virThreadPoolRunJob(virThreadPoolPtr pool,
+                                virThreadPoolWorkerPtr worker,
+                                virThreadPoolJobPtr job,
+                                unsigned long long *now)
+{
+    void *data = job->data;
+    unsigned long long queued = job->queued;
+    unsigned long long start = *now;
+    unsigned long long end;
+
+    if (!job->embedded)
+        VIR_FREE(job);
+
+    /* A job queued after the previous one finished was picked
+     * up straight away, unless we slept */
+    if (start == 0 &&
+        virTimeMonotonicMicrosNowRaw(&start) < 0)
+        start = queued;
+    if (start < queued)
+        start = queued;
+
+    (pool->jobFunc)(data, pool->jobOpaque);
+
+    if (virTimeMonotonicMicrosNowRaw(&end) < 0)
+        end = start;
+    *now = end;
+
+    worker->jobs++;
+    worker->waitTime[virThreadPoolHistogramBucket(start > queued ?
+                                                  start - queued : 0)]++;
+    worker->runTime[virThreadPoolHistogramBucket(end > start ?
+                                                 end - start : 0)]++;
+}
+
+
+/* Move all jobs of @src to @dst, without changing the pool
+ * wide job count */
+static void virThreadPoolJobQueueMove(virThreadPoolJobQueuePtr src,
+                                      virThreadPoolJobQueuePtr dst)
+{
+    virThreadPoolJobQueuePtr first = src < dst ? src : dst;
+    virThreadPoolJobQueuePtr second = src < dst ? dst : src;
+
+    virMutexLock(&first->lock);
+    virMutexLock(&second->lock);
+    if (src->head) {
+        virThreadPoolJobQueueAppendLocked(dst, src->head, src->tail,
+                                          src->depth);
+        src->head = src->tail = NULL;
+        virAtomicIntSet(&src->depth, 0);
+    }
+    virMutexUnlock(&second->lock);
+    virMutexUnlock(&first->lock);
+}
+
+
+/* Whether the calling worker is to exit, since maxWorkers
+ * was lowered below the number of running workers */
+static bool virThreadPoolWorkerRetire(virThreadPoolPtr pool)
+{
+    bool ret = false;
+
+    if ((size_t)pool->nWorkers <= pool->maxWorkers)
+        return false;
+
+    virMutexLock(&pool->mutex);
+    if ((size_t)pool->nWorkers > pool->maxWorkers) {
+        virAtomicIntAdd(&pool->nWorkers, -1);
+        ret = true;
+    }
+    virMutexUnlock(&pool->mutex);
+
+    return ret;
+}
+
+
+static void virThreadPoolWorkerFunc(void *opaque)
+{
+    virThreadPoolWorkerPtr worker = opaque;
+    virThreadPoolPtr pool = worker->pool;
+    virThreadPoolJobPtr job = NULL;
+    unsigned long long now = 0;
+
+    ignore_value(virThreadLocalSet(&virThreadPoolCurrentWorker, worker));
 
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority) {
+    if (worker->priority) {
+        while (!pool->quit) {
+            job = virThreadPoolJobQueueTake(pool, &pool->prioQueue, NULL, 1);
+            if (!job) {
+                if (virThreadPoolWorkerWait(pool, worker) < 0)
                     break;
-                }
-                tmp = tmp->next;
+                now = 0;
+                continue;
             }
-            pool->jobList.firstPrio = tmp;
+
+            virThreadPoolRunJob(pool, worker, job, &now);
         }
+        goto cleanup;
+    }
 
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
+    virAtomicIntInc(&pool->searchingWorkers);
+    while (!pool->quit) {
+        if (virThreadPoolWorkerRetire(pool))
+            break;
 
-        pool->jobQueueDepth--;
+        job = virThreadPoolNextJob(pool, worker);
+        if (!job) {
+            int ret;
+
+            virAtomicIntAdd(&pool->searchingWorkers, -1);
+            ret = virThreadPoolWorkerWait(pool, worker);
+            virAtomicIntInc(&pool->searchingWorkers);
+            if (ret < 0)
+                break;
+            now = 0;
+            continue;
+        }
 
-        virMutexUnlock(&pool->mutex);
-        (pool->jobFunc)(job->data, pool->jobOpaque);
-        VIR_FREE(job);
-        virMutexLock(&pool->mutex);
+        /* If we were the last one looking for work, make sure
+         * somebody picks up whatever is still queued */
+        if (virAtomicIntAdd(&pool->searchingWorkers, -1) == 1 &&
+            virAtomicIntGet(&pool->jobQueueDepth) > 0)
+            virThreadPoolWakeup(pool, &pool->freeWorkers,
+                                &pool->pendingWakeups,
+                                &pool->searchingWorkers, &pool->cond);
+
+        virThreadPoolRunJob(pool, worker, job, &now);
+        virAtomicIntInc(&pool->searchingWorkers);
+    }
+    virAtomicIntAdd(&pool->searchingWorkers, -1);
+
+    /* Leave whatever we queued ourselves to the others */
+    if (!pool->quit) {
+        virThreadPoolJobQueueMove(&worker->queue, &pool->injectQueue);
+        if (virAtomicIntGet(&pool->jobQueueDepth) > 0)
+            virThreadPoolWakeup(pool, &pool->freeWorkers,
+                                &pool->pendingWakeups,
+                                &pool->searchingWorkers, &pool->cond);
     }
 
-out:
-    if (priority)
-        pool->nPrioWorkers--;
-    else
-        pool->nWorkers--;
-    if (pool->nWorkers == 0 && pool->nPrioWorkers==0)
+cleanup:
+    virMutexLock(&pool->mutex);
+    worker->running = false;
+    pool->nRunning--;
+    if (pool->nRunning == 0)
         virCondSignal(&pool->quit_cond);
     virMutexUnlock(&pool->mutex);
 }
 
+
+/* Find an unused worker record, or add a new one. Must be
+ * called with the pool mutex held */
+static virThreadPoolWorkerPtr
+virThreadPoolGetWorkerSlotLocked(virThreadPoolPtr pool)
+{
+    virThreadPoolWorkerPtr worker;
+    size_t i;
+
+    for (i = 0 ; i < pool->nWorkerSlots ; i++) {
+        if (!pool->workers[i]->running)
+            return pool->workers[i];
+    }
+
+    if (pool->nWorkerSlots == pool->workerSlotsAlloc) {
+        virThreadPoolWorkerPtr *workers;
+        size_t alloc = pool->workerSlotsAlloc * 2;
+
+        if (alloc < pool->maxWorkers)
+            alloc = pool->maxWorkers;
+
+        /* Peers may still be looking at the old array */
+        if (VIR_RESIZE_N(pool->oldWorkers, pool->nOldWorkers,
+                         pool->nOldWorkers, 1) < 0 ||
+            VIR_ALLOC_N(workers, alloc) < 0) {
+            virReportOOMError();
+            return NULL;
+        }
+
+        if (pool->workers) {
+            memcpy(workers, pool->workers,
+                   sizeof(*workers) * pool->nWorkerSlots);
+            pool->oldWorkers[pool->nOldWorkers++] = pool->workers;
+        }
+        pool->workers = workers;
+        pool->workerSlotsAlloc = alloc;
+    }
+
+    if (VIR_ALLOC(worker) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virThreadPoolJobQueueInit(&worker->queue) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(worker);
+        return NULL;
+    }
+
+    worker->pool = pool;
+    worker->id = pool->nWorkerSlots;
+    pool->workers[pool->nWorkerSlots++] = worker;
+
+    return worker;
+}
+
+
+/* Start one more normal worker. Must be called with the pool
+ * mutex held and nWorkers < maxWorkers */
+static int virThreadPoolStartWorkerLocked(virThreadPoolPtr pool)
+{
+    virThreadPoolWorkerPtr worker;
+
+    if (!(worker = virThreadPoolGetWorkerSlotLocked(pool)))
+        return -1;
+
+    /* Count the worker before it runs, since it divides the
+     * injected jobs by the number of workers */
+    virAtomicIntInc(&pool->nWorkers);
+    worker->running = true;
+
+    if (virThreadCreate(&worker->thread,
+                        false,
+                        virThreadPoolWorkerFunc,
+                        worker) < 0) {
+        worker->running = false;
+        virAtomicIntAdd(&pool->nWorkers, -1);
+        virReportSystemError(errno, "%s",
+                             _("Unable to create worker thread"));
+        return -1;
+    }
+
+    pool->nRunning++;
+    return 0;
+}
+
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -164,7 +646,9 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
 {
     virThreadPoolPtr pool;
     size_t i;
-    struct virThreadPoolWorkerData *data = NULL;
+
+    if (virThreadPoolInitialize() < 0)
+        return NULL;
 
     if (minWorkers > maxWorkers)
         minWorkers = maxWorkers;
@@ -174,8 +658,6 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
         return NULL;
     }
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobOpaque = opaque;
 
@@ -185,59 +667,57 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
         goto error;
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
-
-    if (VIR_ALLOC_N(pool->workers, minWorkers) < 0)
+    if (virCondInit(&pool->prioCond) < 0)
+        goto error;
+    if (virThreadPoolJobQueueInit(&pool->injectQueue) < 0)
+        goto error;
+    if (virThreadPoolJobQueueInit(&pool->prioQueue) < 0)
         goto error;
 
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
 
+    virMutexLock(&pool->mutex);
     for (i = 0; i < minWorkers; i++) {
-        if (VIR_ALLOC(data) < 0) {
-            virReportOOMError();
-            goto error;
-        }
-        data->pool = pool;
-        data->cond = &pool->cond;
-
-        if (virThreadCreate(&pool->workers[i],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
+        if (virThreadPoolStartWorkerLocked(pool) < 0) {
+            virMutexUnlock(&pool->mutex);
             goto error;
         }
-        pool->nWorkers++;
     }
 
     if (prioWorkers) {
-        if (virCondInit(&pool->prioCond) < 0)
-            goto error;
-        if (VIR_ALLOC_N(pool->prioWorkers, prioWorkers) < 0)
+        if (VIR_ALLOC_N(pool->prioWorkers, prioWorkers) < 0) {
+            virMutexUnlock(&pool->mutex);
+            virReportOOMError();
             goto error;
+        }
 
         for (i = 0; i < prioWorkers; i++) {
-            if (VIR_ALLOC(data) < 0) {
-                virReportOOMError();
-                goto error;
-            }
-            data->pool = pool;
-            data->cond = &pool->prioCond;
-            data->priority = true;
-
-            if (virThreadCreate(&pool->prioWorkers[i],
-                                true,
-                                virThreadPoolWorker,
-                                data) < 0) {
+            virThreadPoolWorkerPtr worker = &pool->prioWorkers[i];
+
+            worker->pool = pool;
+            worker->id = i;
+            worker->priority = true;
+
+            worker->running = true;
+            if (virThreadCreate(&worker->thread,
+                                false,
+                                virThreadPoolWorkerFunc,
+                                worker) < 0) {
+                virMutexUnlock(&pool->mutex);
+                virReportSystemError(errno, "%s",
+                                     _("Unable to create worker thread"));
                 goto error;
             }
             pool->nPrioWorkers++;
+            pool->nRunning++;
         }
     }
+    virMutexUnlock(&pool->mutex);
 
     return pool;
 
 error:
-    VIR_FREE(data);
     virThreadPoolFree(pool);
     return NULL;
 
@@ -245,38 +725,37 @@ error:
 
 void virThreadPoolFree(virThreadPoolPtr pool)
 {
-    virThreadPoolJobPtr job;
-    bool priority = false;
+    size_t i;
 
     if (!pool)
         return;
 
     virMutexLock(&pool->mutex);
-    pool->quit = true;
-    if (pool->nWorkers > 0)
-        virCondBroadcast(&pool->cond);
-    if (pool->nPrioWorkers > 0) {
-        priority = true;
-        virCondBroadcast(&pool->prioCond);
-    }
+    virAtomicIntSet(&pool->quit, 1);
+    virCondBroadcast(&pool->cond);
+    virCondBroadcast(&pool->prioCond);
 
-    while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
+    while (pool->nRunning > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
+    virMutexUnlock(&pool->mutex);
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
+    /* All threads have exited, so nobody else touches the
+     * worker records anymore */
+    for (i = 0; i < pool->nWorkerSlots; i++) {
+        virThreadPoolJobQueueDestroy(&pool->workers[i]->queue);
+        VIR_FREE(pool->workers[i]);
     }
-
     VIR_FREE(pool->workers);
-    virMutexUnlock(&pool->mutex);
+    for (i = 0; i < pool->nOldWorkers; i++)
+        VIR_FREE(pool->oldWorkers[i]);
+    VIR_FREE(pool->oldWorkers);
+    VIR_FREE(pool->prioWorkers);
+    virThreadPoolJobQueueDestroy(&pool->injectQueue);
+    virThreadPoolJobQueueDestroy(&pool->prioQueue);
     virMutexDestroy(&pool->mutex);
     ignore_value(virCondDestroy(&pool->quit_cond));
     ignore_value(virCondDestroy(&pool->cond));
-    if (priority) {
-        VIR_FREE(pool->prioWorkers);
-        ignore_value(virCondDestroy(&pool->prioCond));
-    }
+    ignore_value(virCondDestroy(&pool->prioCond));
     VIR_FREE(pool);
 }
 
@@ -297,75 +776,193 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool)
 }
 
 /*
- * @priority - job priority
+ * @minWorkers - new minimum number of normal workers
+ * @maxWorkers - new maximum number of normal workers
+ *
+ * Workers missing to reach @minWorkers are started right away, while
+ * surplus workers above @maxWorkers exit as soon as they finish the
+ * job they are running. The number of priority workers is fixed.
+ *
  * Return: 0 on success, -1 otherwise
  */
-int virThreadPoolSendJob(virThreadPoolPtr pool,
-                         unsigned int priority,
-                         void *jobData)
+int virThreadPoolSetParameters(virThreadPoolPtr pool,
+                               size_t minWorkers,
+                               size_t maxWorkers)
 {
-    virThreadPoolJobPtr job;
-    struct virThreadPoolWorkerData *data = NULL;
+    int ret = -1;
+
+    if (maxWorkers == 0 || minWorkers > maxWorkers) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Invalid worker limits min=%zu max=%zu"),
+                       minWorkers, maxWorkers);
+        return -1;
+    }
 
     virMutexLock(&pool->mutex);
-    if (pool->quit)
-        goto error;
+    if (pool->quit) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Thread pool is shutting down"));
+        goto cleanup;
+    }
 
-    if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
-        pool->nWorkers < pool->maxWorkers) {
-        if (VIR_EXPAND_N(pool->workers, pool->nWorkers, 1) < 0) {
-            virReportOOMError();
-            goto error;
-        }
+    pool->minWorkers = minWorkers;
+    pool->maxWorkers = maxWorkers;
 
-        if (VIR_ALLOC(data) < 0) {
-            pool->nWorkers--;
-            virReportOOMError();
-            goto error;
-        }
+    while ((size_t)pool->nWorkers < minWorkers) {
+        if (virThreadPoolStartWorkerLocked(pool) < 0)
+            goto cleanup;
+    }
 
-        data->pool = pool;
-        data->cond = &pool->cond;
+    /* Let idle surplus workers notice they are not needed */
+    if ((size_t)pool->nWorkers > maxWorkers)
+        virCondBroadcast(&pool->cond);
 
-        if (virThreadCreate(&pool->workers[pool->nWorkers - 1],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
-            VIR_FREE(data);
-            pool->nWorkers--;
-            goto error;
-        }
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&pool->mutex);
+    return ret;
+}
+
+static void virThreadPoolAddWorkerStats(virThreadPoolStatsPtr stats,
+                                        virThreadPoolWorkerPtr worker)
+{
+    size_t i;
+
+    stats->jobs += worker->jobs;
+    for (i = 0 ; i < VIR_THREADPOOL_HISTOGRAM_BUCKETS ; i++) {
+        stats->waitTime[i] += worker->waitTime[i];
+        stats->runTime[i] += worker->runTime[i];
     }
+}
 
-    if (VIR_ALLOC(job) < 0) {
-        virReportOOMError();
-        goto error;
+/*
+ * @stats - filled with the current state of the pool
+ *
+ * The job counters are read while workers may be updating them, so
+ * they are only roughly consistent with each other.
+ */
+void virThreadPoolGetStats(virThreadPoolPtr pool,
+                           virThreadPoolStatsPtr stats)
+{
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    virMutexLock(&pool->mutex);
+    stats->minWorkers = pool->minWorkers;
+    stats->maxWorkers = pool->maxWorkers;
+    stats->nWorkers = pool->nWorkers;
+    stats->freeWorkers = pool->freeWorkers;
+    stats->nPrioWorkers = pool->nPrioWorkers;
+    stats->freePrioWorkers = pool->freePrioWorkers;
+    stats->jobQueueDepth = virAtomicIntGet(&pool->jobQueueDepth);
+
+    for (i = 0 ; i < pool->nWorkerSlots ; i++)
+        virThreadPoolAddWorkerStats(stats, pool->workers[i]);
+    for (i = 0 ; i < pool->nPrioWorkers ; i++)
+        virThreadPoolAddWorkerStats(stats, &pool->prioWorkers[i]);
+    virMutexUnlock(&pool->mutex);
+}
+
+static int virThreadPoolQueueJob(virThreadPoolPtr pool,
+                                 unsigned int priority,
+                                 virThreadPoolJobPtr job)
+{
+    virThreadPoolWorkerPtr self;
+    virThreadPoolJobQueuePtr queue;
+
+    if (pool->quit)
+        return -1;
+
+    /* Spawn another worker if all of them may be busy */
+    if ((size_t)pool->nWorkers < pool->maxWorkers &&
+        pool->freeWorkers <= pool->jobQueueDepth) {
+        int ret = 0;
+
+        virMutexLock(&pool->mutex);
+        if (pool->quit)
+            ret = -1;
+        else if ((size_t)pool->nWorkers < pool->maxWorkers)
+            ret = virThreadPoolStartWorkerLocked(pool);
+        virMutexUnlock(&pool->mutex);
+        if (ret < 0)
+            return -1;
     }
 
-    job->data = jobData;
     job->priority = priority;
+    if (job->queued == 0 &&
+        virTimeMonotonicMicrosNowRaw(&job->queued) < 0)
+        job->queued = 0;
+
+    self = virThreadLocalGet(&virThreadPoolCurrentWorker);
+    if (priority)
+        queue = &pool->prioQueue;
+    else if (self && self->pool == pool && !self->priority)
+        queue = &self->queue;
+    else
+        queue = &pool->injectQueue;
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
+    virThreadPoolJobQueuePush(pool, queue, job);
 
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
+    virThreadPoolWakeup(pool, &pool->freeWorkers, &pool->pendingWakeups,
+                        &pool->searchingWorkers, &pool->cond);
+    if (priority)
+        virThreadPoolWakeup(pool, &pool->freePrioWorkers,
+                            &pool->pendingPrioWakeups, NULL,
+                            &pool->prioCond);
 
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    return 0;
+}
 
-    pool->jobQueueDepth++;
+/*
+ * @priority - job priority
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendJob(virThreadPoolPtr pool,
+                         unsigned int priority,
+                         void *jobData)
+{
+    virThreadPoolJobPtr job;
 
-    virCondSignal(&pool->cond);
-    if (priority)
-        virCondSignal(&pool->prioCond);
+    if (VIR_ALLOC(job) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    job->data = jobData;
+
+    if (virThreadPoolQueueJob(pool, priority, job) < 0) {
+        VIR_FREE(job);
+        return -1;
+    }
 
-    virMutexUnlock(&pool->mutex);
     return 0;
+}
 
-error:
-    virMutexUnlock(&pool->mutex);
-    return -1;
+/*
+ * @priority - job priority
+ * @job - caller provided job, typically embedded in @jobData
+ *
+ * Like virThreadPoolSendJob, but without allocating anything. The
+ * pool stops touching @job right before the job function is called
+ * with @jobData, so the job function may free or reuse it. Queued
+ * jobs are dropped without being run when the pool is freed.
+ *
+ * @job must be zeroed, except that its queued field may be set to
+ * the virTimeMonotonicMicrosNowRaw time at which the job was first
+ * queued by the caller, for the wait time statistics to cover it.
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendEmbeddedJob(virThreadPoolPtr pool,
+                                 unsigned int priority,
+                                 virThreadPoolJobPtr job,
+                                 void *jobData)
+{
+    job->next = NULL;
+    job->embedded = true;
+    job->data = jobData;
+
+    return virThreadPoolQueueJob(pool, priority, job);
 }
@@ -33,6 +33,44 @@ typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+typedef struct _virThreadPoolJob virThreadPoolJob;
+typedef virThreadPoolJob *virThreadPoolJobPtr;
+
+/* Only public so that callers can embed it in their own data
+ * for virThreadPoolSendEmbeddedJob, the fields are private
+ * to the pool */
+struct _virThreadPoolJob {
+    virThreadPoolJobPtr next;
+    unsigned int priority;
+    bool embedded;
+    unsigned long long queued;
+
+    void *data;
+};
+
+# define VIR_THREADPOOL_HISTOGRAM_BUCKETS 24
+
+typedef struct _virThreadPoolStats virThreadPoolStats;
+typedef virThreadPoolStats *virThreadPoolStatsPtr;
+
+/* The wait and run time histograms count jobs by the time they spent
+ * queued and running: bucket 0 holds those which took less than one
+ * microsecond, bucket N those which took between 2^(N-1) and 2^N
+ * microseconds, and the last bucket all longer ones */
+struct _virThreadPoolStats {
+    size_t minWorkers;
+    size_t maxWorkers;
+    size_t nWorkers;
+    size_t freeWorkers;
+    size_t nPrioWorkers;
+    size_t freePrioWorkers;
+    size_t jobQueueDepth;
+
+    unsigned long long jobs;
+    unsigned long long waitTime[VIR_THREADPOOL_HISTOGRAM_BUCKETS];
+    unsigned long long runTime[VIR_THREADPOOL_HISTOGRAM_BUCKETS];
+};
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -43,6 +81,15 @@ size_t virThreadPoolGetMinWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetMaxWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool);
 
+int virThreadPoolSetParameters(virThreadPoolPtr pool,
+                               size_t minWorkers,
+                               size_t maxWorkers) ATTRIBUTE_NONNULL(1);
+void virThreadPoolGetStats(virThreadPoolPtr pool,
+                           virThreadPoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+size_t virThreadPoolHistogramBucket(unsigned long long usecs);
+
 void virThreadPoolFree(virThreadPoolPtr pool);
 
 int virThreadPoolSendJob(virThreadPoolPtr pool,
@@ -50,4 +97,11 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendEmbeddedJob(virThreadPoolPtr pool,
+                                 unsigned int priority,
+                                 virThreadPoolJobPtr job,
+                                 void *jobdata) ATTRIBUTE_NONNULL(1)
+                                                ATTRIBUTE_NONNULL(3)
+                                                ATTRIBUTE_RETURN_CHECK;
+
 #endif
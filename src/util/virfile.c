@@ -34,6 +34,7 @@
 
 #ifdef __linux__
 # include <linux/loop.h>
+# include <linux/falloc.h>
 # include <sys/ioctl.h>
 #endif
 
@@ -727,3 +728,171 @@ int virFileLoopDeviceAssociate(const char *file,
 }
 
 #endif /* __linux__ */
+
+
+/**
+ * virFileInData:
+ * @fd: the file to look at
+ * @inData: set to 1 if the current position is in data, 0 if in a hole
+ * @length: set to the number of bytes until the data or hole ends
+ *
+ * Tells whether the current position of @fd is in data or in a hole,
+ * and for how long. The position itself is left untouched. At the
+ * end of the file, *@inData and *@length are both set to 0. Where
+ * holes cannot be found, the whole file is reported as data.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virFileInData(int fd,
+                  int *inData,
+                  unsigned long long *length)
+{
+    int ret = -1;
+    off_t cur;
+    off_t end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current position in file"));
+        return -1;
+    }
+
+    if ((end = lseek(fd, 0, SEEK_END)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seek to the end of file"));
+        goto cleanup;
+    }
+
+    if (cur >= end) {
+        *inData = 0;
+        *length = 0;
+    } else {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t data;
+        off_t hole;
+
+        if ((data = lseek(fd, cur, SEEK_DATA)) == (off_t) -1) {
+            if (errno != ENXIO) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to seek to data in file"));
+                goto cleanup;
+            }
+            /* Nothing but a hole up to the end of the file */
+            *inData = 0;
+            *length = end - cur;
+        } else if (data > cur) {
+            *inData = 0;
+            *length = data - cur;
+        } else {
+            /* There is always a hole at the end of the file, so
+             * this finds one even for a file without holes */
+            if ((hole = lseek(fd, cur, SEEK_HOLE)) == (off_t) -1) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to seek to hole in file"));
+                goto cleanup;
+            }
+            *inData = 1;
+            *length = hole - cur;
+        }
+#else
+        *inData = 1;
+        *length = end - cur;
+#endif
+    }
+
+    ret = 0;
+
+cleanup:
+    if (lseek(fd, cur, SEEK_SET) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to restore position in file"));
+        ret = -1;
+    }
+    return ret;
+}
+
+
+/**
+ * virFilePunchHole:
+ * @fd: the file to change
+ * @offset: where the hole starts
+ * @length: how long the hole is
+ *
+ * Makes the given range of @fd read back as zeros, deallocating it
+ * where the filesystem allows and writing zeros out otherwise. The
+ * size of the file is kept, and its position is left undefined.
+ *
+ * Returns 0 on success, -1 with errno set on error
+ */
+int virFilePunchHole(int fd, off_t offset, off_t length)
+{
+    static const char zeros[64 * 1024];
+
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_KEEP_SIZE)
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, length) == 0)
+        return 0;
+
+    if (errno != EOPNOTSUPP && errno != ENOSYS && errno != ENODEV)
+        return -1;
+#endif
+
+    if (lseek(fd, offset, SEEK_SET) == (off_t) -1)
+        return -1;
+
+    while (length > 0) {
+        size_t n = MIN(length, sizeof(zeros));
+
+        if (safewrite(fd, zeros, n) < 0)
+            return -1;
+        length -= n;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virFileMakeHole:
+ * @fd: the file to change
+ * @length: how long the hole is
+ *
+ * Makes the @length bytes from the current position of @fd read back
+ * as zeros, and moves the position past them. A regular file has the
+ * hole punched into it, or is extended, while block devices and the
+ * like have zeros written to them.
+ *
+ * Returns 0 on success, -1 with errno set on error
+ */
+int virFileMakeHole(int fd, off_t length)
+{
+    struct stat sb;
+    off_t cur;
+    off_t end;
+
+    if (fstat(fd, &sb) < 0 ||
+        (cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1)
+        return -1;
+    end = cur + length;
+
+    if (!S_ISREG(sb.st_mode)) {
+        if (virFilePunchHole(fd, cur, length) < 0)
+            return -1;
+    } else {
+        /* Whatever the file held there before must read back as
+         * zeros, while past its end a hole comes for free */
+        if (cur < sb.st_size &&
+            virFilePunchHole(fd, cur, MIN(end, sb.st_size) - cur) < 0)
+            return -1;
+
+        if (end > sb.st_size &&
+            ftruncate(fd, end) < 0)
+            return -1;
+    }
+
+    if (lseek(fd, end, SEEK_SET) == (off_t) -1)
+        return -1;
+
+    return 0;
+}
@@ -110,4 +110,24 @@ int virFileUpdatePerm(const char *path,
 int virFileLoopDeviceAssociate(const char *file,
                                char **dev);
 
+int virFileInData(int fd,
+                  int *inData,
+                  unsigned long long *length);
+int virFilePunchHole(int fd, off_t offset, off_t length);
+int virFileMakeHole(int fd, off_t length);
+
+/* Sparse streams send data and holes through the pipe of the
+ * I/O helper as frames: this header, followed by @length bytes
+ * for data, or by nothing for a hole */
+typedef enum {
+    VIR_FILE_FRAME_DATA = 1,
+    VIR_FILE_FRAME_HOLE,
+} virFileFrameType;
+
+typedef struct _virFileFrame virFileFrame;
+struct _virFileFrame {
+    unsigned int type; /* virFileFrameType */
+    unsigned long long length;
+};
+
 #endif /* __VIR_FILES_H */
@@ -39,8 +39,10 @@
 #include "logging.h"
 #include "memory.h"
 #include "threads.h"
+#include "virhash.h"
 #include "virmacaddr.h"
 #include "virterror_internal.h"
+#include "virtime.h"
 
 #ifndef SOL_NETLINK
 # define SOL_NETLINK 270
@@ -51,6 +53,8 @@
 #define NETLINK_ACK_TIMEOUT_S  2
 
 #if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/rtnetlink.h>
+
 /* State for a single netlink event handle */
 struct virNetlinkEventHandle {
     int watch;
@@ -274,6 +278,376 @@ error:
     return rc;
 }
 
+/**
+ * virNetlinkDumpCommand:
+ * @nl_msg: the dump request, with NLM_F_DUMP set
+ * @callback: called for each message of the reply
+ * @opaque: passed along to @callback
+ * @protocol: netlink protocol
+ *
+ * Send the given dump request to the kernel and hand each message of
+ * the multi-part reply to @callback, until the kernel signals its end.
+ *
+ * Returns 0 on success, -1 on error or if @callback failed.
+ */
+int virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                          virNetlinkDumpCallback callback,
+                          void *opaque,
+                          unsigned int protocol)
+{
+    int ret = -1;
+    bool end = false;
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = 0,
+            .nl_groups = 0,
+    };
+    struct timeval tv;
+    fd_set readfds;
+    int fd;
+    int n;
+    int len;
+    unsigned char *recvbuf = NULL;
+    struct nlmsghdr *msg;
+    struct nlmsgerr *err;
+    struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
+    virNetlinkHandle *nlhandle = NULL;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %d"), protocol);
+        return -1;
+    }
+
+    nlhandle = virNetlinkAlloc();
+    if (!nlhandle) {
+        virReportSystemError(errno,
+                             "%s", _("cannot allocate nlhandle for netlink"));
+        return -1;
+    }
+
+    if (nl_connect(nlhandle, protocol) < 0) {
+        virReportSystemError(errno,
+                        _("cannot connect to netlink socket with protocol %d"),
+                             protocol);
+        goto cleanup;
+    }
+
+    fd = nl_socket_get_fd(nlhandle);
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot get netlink socket fd"));
+        goto cleanup;
+    }
+
+    nlmsg_set_dst(nl_msg, &nladdr);
+
+    nlmsg->nlmsg_pid = getpid();
+
+    if (nl_send_auto_complete(nlhandle, nl_msg) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto cleanup;
+    }
+
+    while (!end) {
+        tv.tv_sec = NETLINK_ACK_TIMEOUT_S;
+        tv.tv_usec = 0;
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+
+        n = select(fd + 1, &readfds, NULL, NULL, &tv);
+        if (n <= 0) {
+            if (n < 0)
+                virReportSystemError(errno, "%s",
+                                     _("error in select call"));
+            if (n == 0)
+                virReportSystemError(ETIMEDOUT, "%s",
+                                     _("no valid netlink response was received"));
+            goto cleanup;
+        }
+
+        len = nl_recv(nlhandle, &nladdr, &recvbuf, NULL);
+        if (len <= 0) {
+            virReportSystemError(errno,
+                                 "%s", _("nl_recv failed"));
+            goto cleanup;
+        }
+
+        /* A buffer holds as many messages of the reply as fit */
+        for (msg = (struct nlmsghdr *)recvbuf;
+             NLMSG_OK(msg, len);
+             msg = NLMSG_NEXT(msg, len)) {
+            if (msg->nlmsg_type == NLMSG_DONE) {
+                end = true;
+                break;
+            }
+
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                err = (struct nlmsgerr *)NLMSG_DATA(msg);
+                if (msg->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                   _("malformed netlink response message"));
+                    goto cleanup;
+                }
+                if (err->error) {
+                    virReportSystemError(-err->error, "%s",
+                                         _("netlink dump failed"));
+                    goto cleanup;
+                }
+                continue;
+            }
+
+            if (callback(msg, opaque) < 0)
+                goto cleanup;
+        }
+
+        VIR_FREE(recvbuf);
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(recvbuf);
+    virNetlinkFree(nlhandle);
+    return ret;
+}
+
+
+/* Counters of all links, refreshed with one RTM_GETLINK dump when
+ * they are older than linkStatsMaxAge milliseconds, so that polling
+ * many interfaces one after another costs a single dump */
+static virMutex linkStatsLock;
+static virHashTablePtr linkStats = NULL;
+static unsigned long long linkStatsTime = 0;
+static unsigned int linkStatsMaxAge = 1000;
+
+/* A link missing from a dump younger than this many milliseconds is
+ * not worth another dump, so that asking for links which are not
+ * there does not dump all of them each time */
+#define LINK_STATS_MIN_AGE 100
+
+static int
+virNetlinkLinkStatsOnceInit(void)
+{
+    if (virMutexInit(&linkStatsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetlinkLinkStats)
+
+static void
+virNetlinkLinkStatsFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+/**
+ * virNetlinkLinkStatsParse:
+ * @resp: a message of the reply to a RTM_GETLINK dump
+ * @opaque: the virHashTablePtr to add the counters of the link to
+ *
+ * A virNetlinkDumpCallback storing the counters of the link described
+ * by @resp in the table, keyed by its name. Messages which are not
+ * about a link, or hold no name or counters, are skipped.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetlinkLinkStatsParse(const struct nlmsghdr *resp, void *opaque)
+{
+    virHashTablePtr table = opaque;
+    struct nlattr *tb[IFLA_MAX + 1];
+    virNetlinkLinkStatsPtr stats;
+    const char *ifname;
+
+    if (resp->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    if (nlmsg_parse((struct nlmsghdr *)resp, sizeof(struct ifinfomsg),
+                    tb, IFLA_MAX, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed netlink response message"));
+        return -1;
+    }
+
+    if (!tb[IFLA_IFNAME])
+        return 0;
+    ifname = nla_data(tb[IFLA_IFNAME]);
+
+    if (VIR_ALLOC(stats) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    /* Attributes are only 4 byte aligned, hence the copies */
+    if (tb[IFLA_STATS64] &&
+        nla_len(tb[IFLA_STATS64]) >= sizeof(struct rtnl_link_stats64)) {
+        struct rtnl_link_stats64 s;
+
+        memcpy(&s, nla_data(tb[IFLA_STATS64]), sizeof(s));
+        stats->rx_bytes = s.rx_bytes;
+        stats->rx_packets = s.rx_packets;
+        stats->rx_errs = s.rx_errors;
+        stats->rx_drop = s.rx_dropped;
+        stats->tx_bytes = s.tx_bytes;
+        stats->tx_packets = s.tx_packets;
+        stats->tx_errs = s.tx_errors;
+        stats->tx_drop = s.tx_dropped;
+    } else if (tb[IFLA_STATS] &&
+               nla_len(tb[IFLA_STATS]) >= sizeof(struct rtnl_link_stats)) {
+        struct rtnl_link_stats s;
+
+        memcpy(&s, nla_data(tb[IFLA_STATS]), sizeof(s));
+        stats->rx_bytes = s.rx_bytes;
+        stats->rx_packets = s.rx_packets;
+        stats->rx_errs = s.rx_errors;
+        stats->rx_drop = s.rx_dropped;
+        stats->tx_bytes = s.tx_bytes;
+        stats->tx_packets = s.tx_packets;
+        stats->tx_errs = s.tx_errors;
+        stats->tx_drop = s.tx_dropped;
+    } else {
+        VIR_FREE(stats);
+        return 0;
+    }
+
+    if (virHashUpdateEntry(table, ifname, stats) < 0) {
+        VIR_FREE(stats);
+        return -1;
+    }
+
+    return 0;
+}
+
+static virHashTablePtr
+virNetlinkLinkStatsDump(void)
+{
+    virHashTablePtr table = NULL;
+    struct nl_msg *nl_msg = NULL;
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+    };
+
+    if (!(table = virHashCreate(64, virNetlinkLinkStatsFree)))
+        return NULL;
+
+    nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    if (!nl_msg) {
+        virReportOOMError();
+        goto error;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto error;
+    }
+
+    if (virNetlinkDumpCommand(nl_msg, virNetlinkLinkStatsParse,
+                              table, NETLINK_ROUTE) < 0)
+        goto error;
+
+    nlmsg_free(nl_msg);
+    return table;
+
+error:
+    if (nl_msg)
+        nlmsg_free(nl_msg);
+    virHashFree(table);
+    return NULL;
+}
+
+/**
+ * virNetlinkGetLinkStats:
+ * @ifname: name of the link
+ * @stats: filled with the counters of the link
+ *
+ * Get the counters of a link from a dump of all of them, which is
+ * reused for the following calls until it is older than the maximum
+ * age set with virNetlinkSetLinkStatsMaxAge. A link missing from a
+ * very recent dump is reported as an error rather than dumping the
+ * links again, so callers should have another way to get them.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetlinkGetLinkStats(const char *ifname,
+                       virNetlinkLinkStatsPtr stats)
+{
+    virNetlinkLinkStatsPtr cached;
+    virHashTablePtr table;
+    unsigned long long now;
+    bool fresh = false;
+    int ret = -1;
+
+    if (virNetlinkLinkStatsInitialize() < 0)
+        return -1;
+
+    if (virTimeMonotonicMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&linkStatsLock);
+
+    if (!linkStats ||
+        now < linkStatsTime ||
+        now - linkStatsTime >= linkStatsMaxAge) {
+        if (!(table = virNetlinkLinkStatsDump()))
+            goto cleanup;
+        virHashFree(linkStats);
+        linkStats = table;
+        linkStatsTime = now;
+        fresh = true;
+    }
+
+    /* The link may have been created since the last dump */
+    if (!(cached = virHashLookup(linkStats, ifname)) && !fresh &&
+        now - linkStatsTime >= LINK_STATS_MIN_AGE) {
+        if (!(table = virNetlinkLinkStatsDump()))
+            goto cleanup;
+        virHashFree(linkStats);
+        linkStats = table;
+        linkStatsTime = now;
+        cached = virHashLookup(linkStats, ifname);
+    }
+
+    if (!cached) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("no statistics found for interface '%s'"), ifname);
+        goto cleanup;
+    }
+
+    *stats = *cached;
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&linkStatsLock);
+    return ret;
+}
+
+/**
+ * virNetlinkSetLinkStatsMaxAge:
+ * @msecs: how long a dump of the link counters may be reused
+ *
+ * A value of 0 makes each call to virNetlinkGetLinkStats dump the
+ * counters afresh.
+ */
+void
+virNetlinkSetLinkStatsMaxAge(unsigned int msecs)
+{
+    if (virNetlinkLinkStatsInitialize() < 0)
+        return;
+
+    virMutexLock(&linkStatsLock);
+    linkStatsMaxAge = msecs;
+    virMutexUnlock(&linkStatsLock);
+}
+
 static void
 virNetlinkEventServerLock(virNetlinkEventSrvPrivatePtr driver)
 {
@@ -761,6 +1135,37 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int virNetlinkDumpCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
+                          virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
+                          void *opaque ATTRIBUTE_UNUSED,
+                          unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int
+virNetlinkLinkStatsParse(const struct nlmsghdr *resp ATTRIBUTE_UNUSED,
+                         void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int
+virNetlinkGetLinkStats(const char *ifname ATTRIBUTE_UNUSED,
+                       virNetlinkLinkStatsPtr stats ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+void
+virNetlinkSetLinkStatsMaxAge(unsigned int msecs ATTRIBUTE_UNUSED)
+{
+    return;
+}
+
 /**
  * stopNetlinkEventServer: stop the monitor to receive netlink
  * messages for libvirtd
@@ -41,6 +41,7 @@
 struct nl_msg;
 struct sockaddr_nl;
 struct nlattr;
+struct nlmsghdr;
 
 # endif /* __linux__ */
 
@@ -52,6 +53,36 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
                       uint32_t src_pid, uint32_t dst_pid,
                       unsigned int protocol, unsigned int groups);
 
+typedef int (*virNetlinkDumpCallback)(const struct nlmsghdr *resp, void *opaque);
+
+int virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                          virNetlinkDumpCallback callback,
+                          void *opaque,
+                          unsigned int protocol);
+
+typedef struct _virNetlinkLinkStats virNetlinkLinkStats;
+typedef virNetlinkLinkStats *virNetlinkLinkStatsPtr;
+
+/* Counters of a link as the host sees them, so that rx holds
+ * what a guest sent through its end of a tap device */
+struct _virNetlinkLinkStats {
+    unsigned long long rx_bytes;
+    unsigned long long rx_packets;
+    unsigned long long rx_errs;
+    unsigned long long rx_drop;
+    unsigned long long tx_bytes;
+    unsigned long long tx_packets;
+    unsigned long long tx_errs;
+    unsigned long long tx_drop;
+};
+
+int virNetlinkLinkStatsParse(const struct nlmsghdr *resp, void *opaque);
+
+int virNetlinkGetLinkStats(const char *ifname,
+                           virNetlinkLinkStatsPtr stats);
+
+void virNetlinkSetLinkStatsMaxAge(unsigned int msecs);
+
 typedef void (*virNetlinkEventHandleCallback)(unsigned char *msg, int length, struct sockaddr_nl *peer, bool *handled, void *opaque);
 
 typedef void (*virNetlinkEventRemoveCallback)(int watch, const virMacAddrPtr macaddr, void *opaque);
@@ -0,0 +1,404 @@
+/*
+ * virstatshistory.c: ring buffers of statistics samples
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virstatshistory.h"
+#include "memory.h"
+#include "threads.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "virtypedparam.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/*
+ * A fixed number of samples, the oldest of which is overwritten by
+ * each new one once the ring is full. Readers get copies, so that
+ * the samples can be handed out while the sampler keeps adding.
+ */
+struct _virStatsHistory {
+    virMutex lock;
+
+    virStatsHistorySamplePtr samples;
+    size_t size;
+    size_t first;   /* index of the oldest sample */
+    size_t count;
+};
+
+/* Suffixes of the fields which are cumulative counters, whose
+ * difference between two samples makes sense as a rate */
+static const char *virStatsHistoryCounters[] = {
+    ".time", ".user", ".system", ".kernel", ".idle", ".iowait",
+    ".bytes", ".pkts", ".reqs", ".errs", ".drop", ".errors",
+    NULL
+};
+
+
+/**
+ * virStatsHistoryNew:
+ * @size: number of samples kept
+ *
+ * Returns a new, empty, history or NULL on error
+ */
+virStatsHistoryPtr
+virStatsHistoryNew(size_t size)
+{
+    virStatsHistoryPtr history;
+
+    if (size == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("the size of a stats history must not be 0"));
+        return NULL;
+    }
+
+    if (VIR_ALLOC(history) < 0)
+        goto no_memory;
+
+    if (virMutexInit(&history->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(history);
+        return NULL;
+    }
+
+    if (VIR_ALLOC_N(history->samples, size) < 0) {
+        virMutexDestroy(&history->lock);
+        VIR_FREE(history);
+        goto no_memory;
+    }
+    history->size = size;
+
+    return history;
+
+no_memory:
+    virReportOOMError();
+    return NULL;
+}
+
+
+static void
+virStatsHistorySampleClear(virStatsHistorySamplePtr sample)
+{
+    virTypedParameterArrayClear(sample->params, sample->nparams);
+    VIR_FREE(sample->params);
+    sample->nparams = 0;
+    sample->timestamp = 0;
+    sample->monotonic = 0;
+}
+
+
+/**
+ * virStatsHistoryClear:
+ * @history: the history
+ *
+ * Drop all the samples, eg when the statistics of a domain start
+ * again from zero.
+ */
+void
+virStatsHistoryClear(virStatsHistoryPtr history)
+{
+    size_t i;
+
+    virMutexLock(&history->lock);
+    for (i = 0 ; i < history->count ; i++)
+        virStatsHistorySampleClear(&history->samples[(history->first + i) %
+                                                     history->size]);
+    history->first = 0;
+    history->count = 0;
+    virMutexUnlock(&history->lock);
+}
+
+
+void
+virStatsHistoryFree(virStatsHistoryPtr history)
+{
+    if (!history)
+        return;
+
+    virStatsHistoryClear(history);
+    VIR_FREE(history->samples);
+    virMutexDestroy(&history->lock);
+    VIR_FREE(history);
+}
+
+
+/**
+ * virStatsHistoryAdd:
+ * @history: the history
+ * @timestamp: when the sample was taken, in milliseconds since the Epoch
+ * @monotonic: when the sample was taken, in milliseconds of the
+ *             monotonic clock, so that rates are not thrown off by
+ *             the system clock being set
+ * @params: the values of the sample
+ * @nparams: number of values in @params
+ *
+ * Record a sample, dropping the oldest one if the history is full.
+ * The history takes ownership of @params.
+ */
+void
+virStatsHistoryAdd(virStatsHistoryPtr history,
+                   unsigned long long timestamp,
+                   unsigned long long monotonic,
+                   virTypedParameterPtr params,
+                   int nparams)
+{
+    virStatsHistorySamplePtr sample;
+
+    virMutexLock(&history->lock);
+
+    if (history->count == history->size) {
+        sample = &history->samples[history->first];
+        virStatsHistorySampleClear(sample);
+        history->first = (history->first + 1) % history->size;
+    } else {
+        sample = &history->samples[(history->first + history->count) %
+                                   history->size];
+        history->count++;
+    }
+
+    sample->timestamp = timestamp;
+    sample->monotonic = monotonic;
+    sample->params = params;
+    sample->nparams = nparams;
+
+    virMutexUnlock(&history->lock);
+}
+
+
+/**
+ * virStatsHistoryIsCounter:
+ * @field: name of a statistic
+ *
+ * Returns true if @field names a cumulative counter, such as a cpu
+ * time or a number of bytes transferred.
+ */
+bool
+virStatsHistoryIsCounter(const char *field)
+{
+    size_t len = strlen(field);
+    size_t i;
+
+    for (i = 0 ; virStatsHistoryCounters[i] ; i++) {
+        size_t suffix = strlen(virStatsHistoryCounters[i]);
+
+        if (len > suffix &&
+            STREQ(field + len - suffix, virStatsHistoryCounters[i]))
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+virStatsHistoryCopyParam(virTypedParameterPtr dst,
+                         virTypedParameterPtr src)
+{
+    *dst = *src;
+
+    if (src->type == VIR_TYPED_PARAM_STRING &&
+        !(dst->value.s = strdup(src->value.s))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Find @field in @sample, starting at @hint where it is likely to be
+ * since successive samples usually hold the same fields */
+static virTypedParameterPtr
+virStatsHistoryFindParam(virStatsHistorySamplePtr sample,
+                         const char *field,
+                         int hint)
+{
+    int i;
+
+    if (hint < sample->nparams && STREQ(sample->params[hint].field, field))
+        return &sample->params[hint];
+
+    for (i = 0 ; i < sample->nparams ; i++) {
+        if (STREQ(sample->params[i].field, field))
+            return &sample->params[i];
+    }
+
+    return NULL;
+}
+
+
+/* Copy @cur into @dst, replacing the counters by their per second
+ * rates since @prev, or leaving them out if they went backwards */
+static int
+virStatsHistoryRate(virStatsHistorySamplePtr dst,
+                    virStatsHistorySamplePtr prev,
+                    virStatsHistorySamplePtr cur)
+{
+    unsigned long long elapsed = 0;
+    virTypedParameterPtr old;
+    int i;
+
+    if (cur->monotonic > prev->monotonic)
+        elapsed = cur->monotonic - prev->monotonic;
+
+    dst->timestamp = cur->timestamp;
+    dst->monotonic = cur->monotonic;
+
+    if (VIR_ALLOC_N(dst->params, cur->nparams) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0 ; i < cur->nparams ; i++) {
+        virTypedParameterPtr param = &cur->params[i];
+
+        if (param->type != VIR_TYPED_PARAM_ULLONG ||
+            !virStatsHistoryIsCounter(param->field)) {
+            if (virStatsHistoryCopyParam(&dst->params[dst->nparams],
+                                         param) < 0)
+                return -1;
+            dst->nparams++;
+            continue;
+        }
+
+        if (!elapsed ||
+            !(old = virStatsHistoryFindParam(prev, param->field, i)) ||
+            old->type != VIR_TYPED_PARAM_ULLONG ||
+            old->value.ul > param->value.ul)
+            continue;
+
+        dst->params[dst->nparams] = *param;
+        dst->params[dst->nparams].value.ul =
+            (param->value.ul - old->value.ul) * 1000 / elapsed;
+        dst->nparams++;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virStatsHistoryGet:
+ * @history: the history
+ * @nsamples: maximum number of samples to get
+ * @rates: whether to get the rates of the counters between samples
+ * @samples: filled with an array of samples, oldest first
+ * @nret: filled with the number of samples in @samples
+ *
+ * Get copies of the last @nsamples samples. With @rates, each sample
+ * holds the per second rates of the counters between the sample
+ * before it and itself, so that one more sample than returned is
+ * needed.
+ *
+ * Returns 0 on success, -1 on error. @samples must be freed with
+ * virStatsHistorySampleListFree.
+ */
+int
+virStatsHistoryGet(virStatsHistoryPtr history,
+                   size_t nsamples,
+                   bool rates,
+                   virStatsHistorySamplePtr *samples,
+                   size_t *nret)
+{
+    virStatsHistorySamplePtr tmp = NULL;
+    virStatsHistorySamplePtr src;
+    size_t available;
+    size_t start;
+    size_t n = 0;
+    size_t i;
+    int j;
+
+    *samples = NULL;
+    *nret = 0;
+
+    virMutexLock(&history->lock);
+
+    available = history->count;
+    if (rates)
+        available = available ? available - 1 : 0;
+    if (nsamples > available)
+        nsamples = available;
+    start = history->count - nsamples;
+
+    if (nsamples && VIR_ALLOC_N(tmp, nsamples) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    for (i = 0 ; i < nsamples ; i++) {
+        src = &history->samples[(history->first + start + i) % history->size];
+
+        if (rates) {
+            virStatsHistorySamplePtr prev =
+                &history->samples[(history->first + start + i - 1) %
+                                  history->size];
+
+            n++;
+            if (virStatsHistoryRate(&tmp[i], prev, src) < 0)
+                goto error;
+            continue;
+        }
+
+        tmp[i].timestamp = src->timestamp;
+        tmp[i].monotonic = src->monotonic;
+        if (VIR_ALLOC_N(tmp[i].params, src->nparams) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        n++;
+
+        for (j = 0 ; j < src->nparams ; j++) {
+            if (virStatsHistoryCopyParam(&tmp[i].params[j],
+                                         &src->params[j]) < 0)
+                goto error;
+            tmp[i].nparams++;
+        }
+    }
+
+    virMutexUnlock(&history->lock);
+
+    *samples = tmp;
+    *nret = nsamples;
+    return 0;
+
+error:
+    virMutexUnlock(&history->lock);
+    virStatsHistorySampleListFree(tmp, n);
+    return -1;
+}
+
+
+void
+virStatsHistorySampleListFree(virStatsHistorySamplePtr samples,
+                              size_t nsamples)
+{
+    size_t i;
+
+    if (!samples)
+        return;
+
+    for (i = 0 ; i < nsamples ; i++)
+        virStatsHistorySampleClear(&samples[i]);
+    VIR_FREE(samples);
+}
@@ -0,0 +1,60 @@
+/*
+ * virstatshistory.h: ring buffers of statistics samples
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_STATS_HISTORY_H__
+# define __VIR_STATS_HISTORY_H__
+
+# include "internal.h"
+
+typedef struct _virStatsHistorySample virStatsHistorySample;
+typedef virStatsHistorySample *virStatsHistorySamplePtr;
+struct _virStatsHistorySample {
+    unsigned long long timestamp; /* milliseconds since the Epoch */
+    unsigned long long monotonic; /* milliseconds of the monotonic clock,
+                                   * which rates are computed with */
+    virTypedParameterPtr params;
+    int nparams;
+};
+
+typedef struct _virStatsHistory virStatsHistory;
+typedef virStatsHistory *virStatsHistoryPtr;
+
+virStatsHistoryPtr virStatsHistoryNew(size_t size);
+void virStatsHistoryFree(virStatsHistoryPtr history);
+
+void virStatsHistoryAdd(virStatsHistoryPtr history,
+                        unsigned long long timestamp,
+                        unsigned long long monotonic,
+                        virTypedParameterPtr params,
+                        int nparams);
+void virStatsHistoryClear(virStatsHistoryPtr history);
+
+int virStatsHistoryGet(virStatsHistoryPtr history,
+                       size_t nsamples,
+                       bool rates,
+                       virStatsHistorySamplePtr *samples,
+                       size_t *nret);
+void virStatsHistorySampleListFree(virStatsHistorySamplePtr samples,
+                                   size_t nsamples);
+
+bool virStatsHistoryIsCounter(const char *field);
+
+#endif /* __VIR_STATS_HISTORY_H__ */
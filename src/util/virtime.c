@@ -79,6 +79,64 @@ int virTimeMillisNowRaw(unsigned long long *now)
 }
 
 
+/**
+ * virTimeMonotonicMillisNowRaw:
+ * @now: filled with current monotonic time in milliseconds
+ *
+ * Retrieves the current time of a clock which is not affected by
+ * changes to the system time, in milliseconds since an unspecified
+ * starting point. Only useful for measuring intervals. Falls back
+ * to the system time on platforms lacking a monotonic clock.
+ *
+ * Returns 0 on success, -1 on error with errno set
+ */
+int virTimeMonotonicMillisNowRaw(unsigned long long *now)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return -1;
+
+    *now = (ts.tv_sec * 1000ull) + (ts.tv_nsec / (1000ull * 1000ull));
+    return 0;
+#else
+    return virTimeMillisNowRaw(now);
+#endif
+}
+
+
+/**
+ * virTimeMonotonicMicrosNowRaw:
+ * @now: filled with current monotonic time in microseconds
+ *
+ * Like virTimeMonotonicMillisNowRaw, but with microsecond
+ * resolution, for timing short operations.
+ *
+ * Returns 0 on success, -1 on error with errno set
+ */
+int virTimeMonotonicMicrosNowRaw(unsigned long long *now)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return -1;
+
+    *now = (ts.tv_sec * 1000ull * 1000ull) + (ts.tv_nsec / 1000ull);
+    return 0;
+#else
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0)
+        return -1;
+
+    *now = (tv.tv_sec * 1000ull * 1000ull) + tv.tv_usec;
+    return 0;
+#endif
+}
+
+
 /**
  * virTimeFieldsNowRaw:
  * @fields: filled with current time fields
@@ -249,6 +307,27 @@ int virTimeMillisNow(unsigned long long *now)
 }
 
 
+/**
+ * virTimeMonotonicMillisNow:
+ * @now: filled with current monotonic time in milliseconds
+ *
+ * Retrieves the current time of a clock which is not affected by
+ * changes to the system time, in milliseconds since an unspecified
+ * starting point.
+ *
+ * Returns 0 on success, -1 on error with error reported
+ */
+int virTimeMonotonicMillisNow(unsigned long long *now)
+{
+    if (virTimeMonotonicMillisNowRaw(now) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current time"));
+        return -1;
+    }
+    return 0;
+}
+
+
 /**
  * virTimeFieldsNowRaw:
  * @fields: filled with current time fields
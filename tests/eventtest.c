@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <time.h>
 
@@ -33,6 +34,8 @@
 #include "util.h"
 #include "event.h"
 #include "event_poll.h"
+#include "event_epoll.h"
+#include "event_timer.h"
 
 #define NUM_FDS 31
 #define NUM_TIME 31
@@ -53,6 +56,31 @@ static struct timerInfo {
     int delete;
 } timers[NUM_TIME];
 
+struct testEventImpl {
+    const char *name;
+    int (*init)(void);
+    int (*runOnce)(void);
+    virEventAddHandleFunc addHandle;
+    virEventRemoveHandleFunc removeHandle;
+    virEventAddTimeoutFunc addTimeout;
+    virEventUpdateTimeoutFunc updateTimeout;
+    virEventRemoveTimeoutFunc removeTimeout;
+};
+
+static const struct testEventImpl testEventImpls[] = {
+    { "poll", virEventPollInit, virEventPollRunOnce,
+      virEventPollAddHandle, virEventPollRemoveHandle,
+      virEventPollAddTimeout, virEventPollUpdateTimeout,
+      virEventPollRemoveTimeout },
+    { "epoll", virEventEpollInit, virEventEpollRunOnce,
+      virEventEpollAddHandle, virEventEpollRemoveHandle,
+      virEventEpollAddTimeout, virEventEpollUpdateTimeout,
+      virEventEpollRemoveTimeout },
+};
+
+/* The implementation currently under test */
+static const struct testEventImpl *impl;
+
 enum {
     EV_ERROR_NONE,
     EV_ERROR_WATCH,
@@ -90,7 +118,7 @@ testPipeReader(int watch, int fd, int events, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveHandle(info->delete);
+        impl->removeHandle(info->delete);
 }
 
 
@@ -109,7 +137,7 @@ testTimer(int timer, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveTimeout(info->delete);
+        impl->removeTimeout(info->delete);
 }
 
 static pthread_mutex_t eventThreadMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -128,7 +156,7 @@ ATTRIBUTE_NORETURN static void *eventThreadLoop(void *data ATTRIBUTE_UNUSED) {
         eventThreadRunOnce = 0;
         pthread_mutex_unlock(&eventThreadMutex);
 
-        virEventPollRunOnce();
+        impl->runOnce();
 
         pthread_mutex_lock(&eventThreadMutex);
         eventThreadJobDone = 1;
@@ -258,11 +286,14 @@ resetAll(void)
     }
 }
 
+/*
+ * Run the full set of checks against @impl. Must be called with
+ * eventThreadMutex held, and the event thread idle
+ */
 static int
-mymain(void)
+testEventImplRun(void)
 {
     int i;
-    pthread_t eventThread;
     char one = '1';
 
     for (i = 0 ; i < NUM_FDS ; i++) {
@@ -272,38 +303,31 @@ mymain(void)
         }
     }
 
-    if (virThreadInitialize() < 0)
-        return EXIT_FAILURE;
-    char *debugEnv = getenv("LIBVIRT_DEBUG");
-    if (debugEnv && *debugEnv && (virLogParseDefaultPriority(debugEnv) == -1)) {
-        fprintf(stderr, "Invalid log level setting.\n");
+    if (impl->init() < 0) {
+        fprintf(stderr, "Cannot initialize %s event loop\n", impl->name);
         return EXIT_FAILURE;
     }
 
-    virEventPollInit();
+    resetAll();
 
     for (i = 0 ; i < NUM_FDS ; i++) {
         handles[i].delete = -1;
         handles[i].watch =
-            virEventPollAddHandle(handles[i].pipeFD[0],
-                                  VIR_EVENT_HANDLE_READABLE,
-                                  testPipeReader,
-                                  &handles[i], NULL);
+            impl->addHandle(handles[i].pipeFD[0],
+                            VIR_EVENT_HANDLE_READABLE,
+                            testPipeReader,
+                            &handles[i], NULL);
     }
 
     for (i = 0 ; i < NUM_TIME ; i++) {
         timers[i].delete = -1;
         timers[i].timeout = -1;
         timers[i].timer =
-            virEventPollAddTimeout(timers[i].timeout,
-                                   testTimer,
-                                   &timers[i], NULL);
+            impl->addTimeout(timers[i].timeout,
+                             testTimer,
+                             &timers[i], NULL);
     }
 
-    pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
-
-    pthread_mutex_lock(&eventThreadMutex);
-
     /* First time, is easy - just try triggering one of our
      * registered handles */
     startJob();
@@ -316,7 +340,7 @@ mymain(void)
 
     /* Now lets delete one before starting poll(), and
      * try triggering another handle */
-    virEventPollRemoveHandle(handles[0].watch);
+    impl->removeHandle(handles[0].watch);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
@@ -336,7 +360,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveHandle(handles[1].watch);
+    impl->removeHandle(handles[1].watch);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -372,22 +396,22 @@ mymain(void)
 
 
     /* Run a timer on its own */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
+    impl->updateTimeout(timers[1].timer, 100);
     startJob();
     if (finishJob("Firing a timer", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    impl->updateTimeout(timers[1].timer, -1);
 
     resetAll();
 
     /* Now lets delete one before starting poll(), and
      * try triggering another timer */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
-    virEventPollRemoveTimeout(timers[0].timer);
+    impl->updateTimeout(timers[1].timer, 100);
+    impl->removeTimeout(timers[0].timer);
     startJob();
     if (finishJob("Deleted before poll", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    impl->updateTimeout(timers[1].timer, -1);
 
     resetAll();
 
@@ -402,7 +426,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveTimeout(timers[1].timer);
+    impl->removeTimeout(timers[1].timer);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -415,27 +439,27 @@ mymain(void)
      * before poll() exits for the first safewrite(). We don't
      * see a hard failure in other cases, so nothing to worry
      * about */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
-    virEventPollUpdateTimeout(timers[3].timer, 100);
+    impl->updateTimeout(timers[2].timer, 100);
+    impl->updateTimeout(timers[3].timer, 100);
     startJob();
     timers[2].delete = timers[3].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[2].timer, -1);
+    impl->updateTimeout(timers[2].timer, -1);
 
     resetAll();
 
     /* Extreme fun, lets delete ourselves during dispatch */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
+    impl->updateTimeout(timers[2].timer, 100);
     startJob();
     timers[2].delete = timers[2].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
     for (i = 0 ; i < NUM_FDS - 1 ; i++)
-        virEventPollRemoveHandle(handles[i].watch);
+        impl->removeHandle(handles[i].watch);
     for (i = 0 ; i < NUM_TIME - 1 ; i++)
-        virEventPollRemoveTimeout(timers[i].timer);
+        impl->removeTimeout(timers[i].timer);
 
     resetAll();
 
@@ -456,20 +480,313 @@ mymain(void)
     handles[0].pipeFD[0] = handles[1].pipeFD[0];
     handles[0].pipeFD[1] = handles[1].pipeFD[1];
 
-    handles[0].watch = virEventPollAddHandle(handles[0].pipeFD[0],
-                                             0,
-                                             testPipeReader,
-                                             &handles[0], NULL);
-    handles[1].watch = virEventPollAddHandle(handles[1].pipeFD[0],
-                                             VIR_EVENT_HANDLE_READABLE,
-                                             testPipeReader,
-                                             &handles[1], NULL);
+    handles[0].watch = impl->addHandle(handles[0].pipeFD[0],
+                                       0,
+                                       testPipeReader,
+                                       &handles[0], NULL);
+    handles[1].watch = impl->addHandle(handles[1].pipeFD[0],
+                                       VIR_EVENT_HANDLE_READABLE,
+                                       testPipeReader,
+                                       &handles[1], NULL);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * Direct checks of the timer list shared by the event loops, driven
+ * by a clock of our own rather than the monotonic one
+ */
+static void
+testTimerListCallback(int timer ATTRIBUTE_UNUSED,
+                      void *data ATTRIBUTE_UNUSED)
+{
+}
+
+/* Collect the timers due at @now and check they are dispatched in
+ * the order of @expect */
+static int
+testTimerListDue(virEventTimerListPtr list,
+                 unsigned long long now,
+                 const int *expect,
+                 size_t nexpect)
+{
+    virEventTimeoutCallback cb;
+    void *opaque;
+    int timer;
+    size_t n = 0;
+
+    virEventTimerListCollectDue(list, now);
+    while (virEventTimerListNextDue(list, &timer, &cb, &opaque)) {
+        if (n >= nexpect || timer != expect[n]) {
+            fprintf(stderr, "Timer %d fired at %llu, expected %d\n",
+                    timer, now, n < nexpect ? expect[n] : -1);
+            return -1;
+        }
+        n++;
+    }
+
+    if (n != nexpect) {
+        fprintf(stderr, "%zu timers fired at %llu, expected %zu\n",
+                n, now, nexpect);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testTimerListTimeout(virEventTimerListPtr list,
+                     unsigned long long now,
+                     int expect)
+{
+    int timeout = virEventTimerListTimeout(list, now);
+
+    if (timeout != expect) {
+        fprintf(stderr, "Timeout at %llu is %d, expected %d\n",
+                now, timeout, expect);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testTimerListOrder(const void *data ATTRIBUTE_UNUSED)
+{
+    virEventTimerListPtr list;
+    int t1, t2, t3;
+    int ret = -1;
+
+    if (!(list = virEventTimerListNew()))
+        return -1;
+
+    if ((t1 = virEventTimerListAdd(list, 1000, 300, testTimerListCallback,
+                                   NULL, NULL)) < 0 ||
+        (t2 = virEventTimerListAdd(list, 1000, 100, testTimerListCallback,
+                                   NULL, NULL)) < 0 ||
+        (t3 = virEventTimerListAdd(list, 1000, 200, testTimerListCallback,
+                                   NULL, NULL)) < 0 ||
+        virEventTimerListAdd(list, 1000, -1, testTimerListCallback,
+                             NULL, NULL) < 0)
+        goto cleanup;
+
+    {
+        const int at1100[] = { t2 };
+        const int at1200[] = { t2, t3 };
+        const int at1300[] = { t1, t2 };
+
+        /* Disabled timers never count, and each timer which fired
+         * is rescheduled from the time it was dispatched at */
+        if (testTimerListTimeout(list, 1000, 100) < 0 ||
+            testTimerListDue(list, 1000, NULL, 0) < 0 ||
+            testTimerListDue(list, 1100, at1100, 1) < 0 ||
+            testTimerListTimeout(list, 1100, 100) < 0 ||
+            testTimerListDue(list, 1200, at1200, 2) < 0 ||
+            testTimerListTimeout(list, 1200, 100) < 0 ||
+            testTimerListDue(list, 1300, at1300, 2) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virEventTimerListFree(list);
+    return ret;
+}
+
+/* Many timers with scattered expiries fire ordered by expiry, then
+ * by timer id */
+static int
+testTimerListMany(const void *data ATTRIBUTE_UNUSED)
+{
+    virEventTimerListPtr list;
+    int ids[NUM_TIME];
+    int freqs[NUM_TIME];
+    int expect[NUM_TIME];
+    size_t nexpect = 0;
+    int freq;
+    int i;
+    int ret = -1;
+
+    if (!(list = virEventTimerListNew()))
+        return -1;
+
+    for (i = 0 ; i < NUM_TIME ; i++) {
+        freqs[i] = ((i * 7) % 10) * 100;
+        if ((ids[i] = virEventTimerListAdd(list, 0, freqs[i],
+                                           testTimerListCallback,
+                                           NULL, NULL)) < 0)
+            goto cleanup;
+    }
+
+    for (freq = 0 ; freq < 1000 ; freq += 100) {
+        for (i = 0 ; i < NUM_TIME ; i++) {
+            if (freqs[i] == freq)
+                expect[nexpect++] = ids[i];
+        }
+    }
+
+    if (testTimerListDue(list, 1000, expect, nexpect) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    virEventTimerListFree(list);
+    return ret;
+}
+
+static int
+testTimerListRemove(const void *data ATTRIBUTE_UNUSED)
+{
+    virEventTimerListPtr list;
+    virFreeCallback ff;
+    void *opaque;
+    int removed = 0;
+    int ta, tb, tc;
+    int timer;
+    int ret = -1;
+
+    if (!(list = virEventTimerListNew()))
+        return -1;
+
+    if ((ta = virEventTimerListAdd(list, 0, 100, testTimerListCallback,
+                                   NULL, NULL)) < 0 ||
+        (tb = virEventTimerListAdd(list, 0, 100, testTimerListCallback,
+                                   NULL, NULL)) < 0 ||
+        (tc = virEventTimerListAdd(list, 0, 100, testTimerListCallback,
+                                   &removed, NULL)) < 0)
+        goto cleanup;
+
+    /* Timers disabled or removed after being collected for dispatch
+     * are skipped */
+    virEventTimerListCollectDue(list, 100);
+    if (virEventTimerListUpdate(list, 100, tb, -1) < 0 ||
+        virEventTimerListRemove(list, tc) < 0)
+        goto cleanup;
+
+    {
+        virEventTimeoutCallback cb;
+
+        if (!virEventTimerListNextDue(list, &timer, &cb, &opaque) ||
+            timer != ta ||
+            virEventTimerListNextDue(list, &timer, &cb, &opaque)) {
+            fprintf(stderr, "Only timer %d should have fired\n", ta);
+            goto cleanup;
+        }
+    }
+
+    if (virEventTimerListRemove(list, tc) != -1 ||
+        virEventTimerListRemove(list, 4242) != -1 ||
+        virEventTimerListUpdate(list, 100, 4242, 100) != -1) {
+        fprintf(stderr, "Unknown or removed timers were accepted\n");
+        goto cleanup;
+    }
+
+    /* Rescheduling a timer moves it in the heap */
+    if (virEventTimerListUpdate(list, 100, ta, 1000) < 0 ||
+        virEventTimerListUpdate(list, 100, tb, 500) < 0 ||
+        testTimerListTimeout(list, 100, 500) < 0 ||
+        virEventTimerListUpdate(list, 100, tb, -1) < 0 ||
+        testTimerListTimeout(list, 100, 1000) < 0 ||
+        virEventTimerListUpdate(list, 100, ta, -1) < 0 ||
+        testTimerListTimeout(list, 100, -1) < 0 ||
+        testTimerListDue(list, 10000, NULL, 0) < 0)
+        goto cleanup;
+
+    if (!virEventTimerListNextDeleted(list, &timer, &ff, &opaque) ||
+        timer != tc || opaque != &removed ||
+        virEventTimerListNextDeleted(list, &timer, &ff, &opaque)) {
+        fprintf(stderr, "Timer %d should have been purged alone\n", tc);
+        goto cleanup;
+    }
+
+    if (virEventTimerListCount(list) != 2) {
+        fprintf(stderr, "%zu timers left, expected 2\n",
+                virEventTimerListCount(list));
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virEventTimerListFree(list);
+    return ret;
+}
+
+static int
+testTimerListTimeouts(const void *data ATTRIBUTE_UNUSED)
+{
+    virEventTimerListPtr list;
+    int ret = -1;
+
+    if (!(list = virEventTimerListNew()))
+        return -1;
+
+    if (testTimerListTimeout(list, 0, -1) < 0)
+        goto cleanup;
+
+    /* Far away timers do not overflow the timeout */
+    if (virEventTimerListAdd(list, 1000, INT_MAX, testTimerListCallback,
+                             NULL, NULL) < 0 ||
+        testTimerListTimeout(list, 0, INT_MAX) < 0 ||
+        testTimerListTimeout(list, 1000, INT_MAX) < 0)
+        goto cleanup;
+
+    /* Overdue timers must be run right away */
+    if (virEventTimerListAdd(list, 1000, 50, testTimerListCallback,
+                             NULL, NULL) < 0 ||
+        testTimerListTimeout(list, 1000, 50) < 0 ||
+        testTimerListTimeout(list, 5000, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    virEventTimerListFree(list);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int i;
+    pthread_t eventThread;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+    char *debugEnv = getenv("LIBVIRT_DEBUG");
+    if (debugEnv && *debugEnv && (virLogParseDefaultPriority(debugEnv) == -1)) {
+        fprintf(stderr, "Invalid log level setting.\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
+
+    if (virtTestRun("Timer list order", 1, testTimerListOrder, NULL) < 0 ||
+        virtTestRun("Timer list many", 1, testTimerListMany, NULL) < 0 ||
+        virtTestRun("Timer list remove", 1, testTimerListRemove, NULL) < 0 ||
+        virtTestRun("Timer list timeouts", 1, testTimerListTimeouts,
+                    NULL) < 0)
+        return EXIT_FAILURE;
+
+    pthread_mutex_lock(&eventThreadMutex);
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(testEventImpls) ; i++) {
+        impl = &testEventImpls[i];
+
+        if (STREQ(impl->name, "epoll") && !virEventEpollAvailable())
+            continue;
+
+        if (virTestGetVerbose())
+            fprintf(stderr, "Testing %s event loop\n", impl->name);
+
+        if (testEventImplRun() != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
     //pthread_kill(eventThread, SIGTERM);
 
     return EXIT_SUCCESS;
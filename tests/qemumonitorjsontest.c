@@ -423,6 +423,85 @@ cleanup:
 }
 
 
+static int
+testQemuMonitorJSONGetAllBlockStatsInfo(const void *data)
+{
+    virCapsPtr caps = (virCapsPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, caps);
+    virHashTablePtr blockstats = NULL;
+    qemuBlockStatsPtr bstats;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               "{ "
+                               "  \"return\": [ "
+                               "   { "
+                               "     \"device\": \"drive-virtio-disk0\", "
+                               "     \"stats\": { "
+                               "       \"rd_bytes\": 5557760, "
+                               "       \"rd_operations\": 462, "
+                               "       \"wr_bytes\": 4096, "
+                               "       \"wr_operations\": 1 "
+                               "     } "
+                               "   }, "
+                               "   { "
+                               "     \"device\": \"drive-ide0-1-0\", "
+                               "     \"stats\": { "
+                               "       \"rd_bytes\": 0, "
+                               "       \"rd_operations\": 0, "
+                               "       \"wr_bytes\": 0, "
+                               "       \"wr_operations\": 0 "
+                               "     } "
+                               "   } "
+                               "  ]"
+                               "}") < 0)
+        goto cleanup;
+
+    if (!(blockstats = qemuMonitorGetAllBlockStatsInfo(
+              qemuMonitorTestGetMonitor(test))))
+        goto cleanup;
+
+    if (virHashSize(blockstats) != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%zd devices instead of 2", virHashSize(blockstats));
+        goto cleanup;
+    }
+
+#define CHECK(dev, rdreq, rdbytes, wrreq, wrbytes)                      \
+    do {                                                                \
+        if (!(bstats = virHashLookup(blockstats, (dev)))) {             \
+            virReportError(VIR_ERR_INTERNAL_ERROR,                      \
+                           "device %s is missing", (dev));              \
+            goto cleanup;                                               \
+        }                                                               \
+        if (bstats->rd_req != (rdreq) ||                                \
+            bstats->rd_bytes != (rdbytes) ||                            \
+            bstats->wr_req != (wrreq) ||                                \
+            bstats->wr_bytes != (wrbytes) ||                            \
+            bstats->errs != -1) {                                       \
+            virReportError(VIR_ERR_INTERNAL_ERROR,                      \
+                           "stats of device %s do not match", (dev));   \
+            goto cleanup;                                               \
+        }                                                               \
+    } while (0)
+
+    CHECK("virtio-disk0", 462, 5557760, 1, 4096);
+    CHECK("ide0-1-0", 0, 0, 0, 0);
+
+#undef CHECK
+
+    ret = 0;
+
+cleanup:
+    virHashFree(blockstats);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -446,6 +525,7 @@ mymain(void)
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
+    DO_TEST(GetAllBlockStatsInfo);
 
     virCapabilitiesFree(caps);
 
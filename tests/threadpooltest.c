@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "threadpool.h"
+#include "threads.h"
+#include "memory.h"
+#include "util.h"
+#include "viratomic.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+struct testPoolData {
+    virThreadPoolPtr pool;
+    virMutex lock;
+    virCond cond;
+    int expected;
+    int done;
+
+    /* Used to hold up normal workers */
+    bool blocked;
+};
+
+static int testPoolDataInit(struct testPoolData *data, int expected)
+{
+    memset(data, 0, sizeof(*data));
+    data->expected = expected;
+    if (virMutexInit(&data->lock) < 0)
+        return -1;
+    if (virCondInit(&data->cond) < 0) {
+        virMutexDestroy(&data->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void testPoolDataDestroy(struct testPoolData *data)
+{
+    virThreadPoolFree(data->pool);
+    ignore_value(virCondDestroy(&data->cond));
+    virMutexDestroy(&data->lock);
+}
+
+static void testPoolJobDone(struct testPoolData *data)
+{
+    if (virAtomicIntInc(&data->done) == data->expected) {
+        virMutexLock(&data->lock);
+        virCondBroadcast(&data->cond);
+        virMutexUnlock(&data->lock);
+    }
+}
+
+/* Wait for all expected jobs, giving up after a few seconds */
+static int testPoolWaitDone(struct testPoolData *data)
+{
+    unsigned long long then;
+    int ret = 0;
+
+    if (virTimeMillisNow(&then) < 0)
+        return -1;
+    then += 10 * 1000;
+
+    virMutexLock(&data->lock);
+    while (virAtomicIntGet(&data->done) < data->expected) {
+        if (virCondWaitUntil(&data->cond, &data->lock, then) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    virMutexUnlock(&data->lock);
+
+    return ret;
+}
+
+
+static void testPoolCountJob(void *jobdata ATTRIBUTE_UNUSED,
+                             void *opaque)
+{
+    testPoolJobDone(opaque);
+}
+
+static int testSendJobs(const void *unused ATTRIBUTE_UNUSED)
+{
+    struct testPoolData data;
+    int ret = -1;
+    int i;
+
+    if (testPoolDataInit(&data, 10000) < 0)
+        return -1;
+
+    if (!(data.pool = virThreadPoolNew(1, 4, 0, testPoolCountJob, &data)))
+        goto cleanup;
+
+    for (i = 0 ; i < data.expected ; i++) {
+        if (virThreadPoolSendJob(data.pool, 0, NULL) < 0)
+            goto cleanup;
+    }
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testPoolDataDestroy(&data);
+    return ret;
+}
+
+
+struct testEmbeddedJob {
+    virThreadPoolJob job;
+    struct testPoolData *data;
+};
+
+/* The pool must not touch the job once it was handed back */
+static void testPoolEmbeddedJob(void *jobdata,
+                                void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testEmbeddedJob *job = jobdata;
+    struct testPoolData *data = job->data;
+
+    memset(job, 0xff, sizeof(*job));
+    VIR_FREE(job);
+    testPoolJobDone(data);
+}
+
+static int testEmbeddedJobs(const void *unused ATTRIBUTE_UNUSED)
+{
+    struct testPoolData data;
+    int ret = -1;
+    int i;
+
+    if (testPoolDataInit(&data, 1000) < 0)
+        return -1;
+
+    if (!(data.pool = virThreadPoolNew(1, 4, 1, testPoolEmbeddedJob, NULL)))
+        goto cleanup;
+
+    for (i = 0 ; i < data.expected ; i++) {
+        struct testEmbeddedJob *job;
+
+        if (VIR_ALLOC(job) < 0)
+            goto cleanup;
+        job->data = &data;
+
+        if (virThreadPoolSendEmbeddedJob(data.pool, i % 2,
+                                         &job->job, job) < 0) {
+            VIR_FREE(job);
+            goto cleanup;
+        }
+    }
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testPoolDataDestroy(&data);
+    return ret;
+}
+
+
+/* Each job queues two more from within the worker, until the
+ * requested depth is reached, so the jobs have to be stolen */
+static void testPoolNestedJob(void *jobdata,
+                              void *opaque)
+{
+    struct testPoolData *data = opaque;
+    intptr_t depth = (intptr_t)jobdata;
+
+    if (depth > 0) {
+        if (virThreadPoolSendJob(data->pool, 0, (void *)(depth - 1)) < 0 ||
+            virThreadPoolSendJob(data->pool, 0, (void *)(depth - 1)) < 0)
+            abort();
+    }
+    testPoolJobDone(data);
+}
+
+static int testNestedJobs(const void *unused ATTRIBUTE_UNUSED)
+{
+    struct testPoolData data;
+    int ret = -1;
+
+    /* A complete binary tree of depth 12 */
+    if (testPoolDataInit(&data, (1 << 13) - 1) < 0)
+        return -1;
+
+    if (!(data.pool = virThreadPoolNew(4, 4, 0, testPoolNestedJob, &data)))
+        goto cleanup;
+
+    if (virThreadPoolSendJob(data.pool, 0, (void *)(intptr_t)12) < 0)
+        goto cleanup;
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testPoolDataDestroy(&data);
+    return ret;
+}
+
+
+/* Jobs without data block until released, the others complete */
+static void testPoolBlockingJob(void *jobdata,
+                                void *opaque)
+{
+    struct testPoolData *data = opaque;
+
+    if (!jobdata) {
+        virMutexLock(&data->lock);
+        while (data->blocked)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+        virMutexUnlock(&data->lock);
+    }
+    testPoolJobDone(data);
+}
+
+static int testBlockedJobs(const void *opaque)
+{
+    const size_t *nPrioWorkers = opaque;
+    struct testPoolData data;
+    size_t nWorkers;
+    int ret = -1;
+    int i;
+
+    if (testPoolDataInit(&data, 4) < 0)
+        return -1;
+    data.blocked = true;
+
+    /* Either one normal and one priority worker, or two normal */
+    nWorkers = *nPrioWorkers ? 1 : 2;
+    if (!(data.pool = virThreadPoolNew(nWorkers, nWorkers, *nPrioWorkers,
+                                       testPoolBlockingJob, &data)))
+        goto cleanup;
+
+    if (virThreadPoolSendJob(data.pool, 0, NULL) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < 4 ; i++) {
+        if (virThreadPoolSendJob(data.pool, *nPrioWorkers ? 1 : 0,
+                                 &data) < 0)
+            goto cleanup;
+    }
+
+    /* One worker is stuck, so the remaining normal or priority
+     * worker has to get the count to 4 */
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    virMutexLock(&data.lock);
+    data.expected = 5;
+    data.blocked = false;
+    virCondBroadcast(&data.cond);
+    virMutexUnlock(&data.lock);
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        virMutexLock(&data.lock);
+        data.blocked = false;
+        virCondBroadcast(&data.cond);
+        virMutexUnlock(&data.lock);
+    }
+    testPoolDataDestroy(&data);
+    return ret;
+}
+
+
+/* Poll the pool stats until @check is happy, for a few seconds */
+static int testPoolWaitStats(virThreadPoolPtr pool,
+                             bool (*check)(virThreadPoolStatsPtr stats,
+                                           const void *opaque),
+                             const void *opaque)
+{
+    virThreadPoolStats stats;
+    int i;
+
+    for (i = 0 ; i < 10 * 1000 ; i++) {
+        virThreadPoolGetStats(pool, &stats);
+        if (check(&stats, opaque))
+            return 0;
+        usleep(1000);
+    }
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "workers=%zu depth=%zu jobs=%llu\n",
+                stats.nWorkers, stats.jobQueueDepth, stats.jobs);
+    return -1;
+}
+
+static bool testPoolHasWorkers(virThreadPoolStatsPtr stats,
+                               const void *opaque)
+{
+    const size_t *nWorkers = opaque;
+
+    return stats->nWorkers == *nWorkers;
+}
+
+static bool testPoolHasRunJobs(virThreadPoolStatsPtr stats,
+                               const void *opaque)
+{
+    const int *jobs = opaque;
+    unsigned long long waited = 0;
+    unsigned long long ran = 0;
+    size_t i;
+
+    for (i = 0 ; i < VIR_THREADPOOL_HISTOGRAM_BUCKETS ; i++) {
+        waited += stats->waitTime[i];
+        ran += stats->runTime[i];
+    }
+
+    return stats->jobs == *jobs && waited == *jobs && ran == *jobs &&
+        stats->jobQueueDepth == 0;
+}
+
+static int testResize(const void *unused ATTRIBUTE_UNUSED)
+{
+    struct testPoolData data;
+    virThreadPoolStats stats;
+    size_t nWorkers;
+    int ret = -1;
+    int i;
+
+    if (testPoolDataInit(&data, 1000) < 0)
+        return -1;
+
+    if (!(data.pool = virThreadPoolNew(1, 1, 0, testPoolCountJob, &data)))
+        goto cleanup;
+
+    if (virThreadPoolSetParameters(data.pool, 2, 1) == 0 ||
+        virThreadPoolSetParameters(data.pool, 0, 0) == 0)
+        goto cleanup;
+
+    /* Growing the minimum starts workers straight away */
+    if (virThreadPoolSetParameters(data.pool, 4, 8) < 0)
+        goto cleanup;
+    virThreadPoolGetStats(data.pool, &stats);
+    if (stats.minWorkers != 4 || stats.maxWorkers != 8 ||
+        stats.nWorkers != 4)
+        goto cleanup;
+
+    for (i = 0 ; i < data.expected / 2 ; i++) {
+        if (virThreadPoolSendJob(data.pool, 0, NULL) < 0)
+            goto cleanup;
+    }
+
+    /* Surplus workers go away, but their jobs still get done */
+    if (virThreadPoolSetParameters(data.pool, 1, 1) < 0)
+        goto cleanup;
+
+    for (; i < data.expected ; i++) {
+        if (virThreadPoolSendJob(data.pool, 0, NULL) < 0)
+            goto cleanup;
+    }
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    nWorkers = 1;
+    if (testPoolWaitStats(data.pool, testPoolHasWorkers, &nWorkers) < 0 ||
+        testPoolWaitStats(data.pool, testPoolHasRunJobs, &data.expected) < 0)
+        goto cleanup;
+
+    /* And later ones can be started again in their place */
+    if (virThreadPoolSetParameters(data.pool, 3, 3) < 0)
+        goto cleanup;
+    virThreadPoolGetStats(data.pool, &stats);
+    if (stats.nWorkers != 3)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testPoolDataDestroy(&data);
+    return ret;
+}
+
+
+struct testPoolThroughput {
+    size_t workers;
+    int jobs;
+    double rate;
+};
+
+static int testThroughput(const void *opaque)
+{
+    struct testPoolThroughput *info = (struct testPoolThroughput *)opaque;
+    struct testPoolData data;
+    unsigned long long start, end;
+    int ret = -1;
+    int i;
+
+    if (testPoolDataInit(&data, info->jobs) < 0)
+        return -1;
+
+    if (!(data.pool = virThreadPoolNew(info->workers, info->workers, 0,
+                                       testPoolCountJob, &data)))
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < info->jobs ; i++) {
+        if (virThreadPoolSendJob(data.pool, 0, NULL) < 0)
+            goto cleanup;
+    }
+
+    if (testPoolWaitDone(&data) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    info->rate = info->jobs * 1000.0 / (end > start ? end - start : 1);
+    ret = 0;
+
+cleanup:
+    testPoolDataDestroy(&data);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    size_t workers[] = { 1, 2, 4, 8 };
+    size_t noPrioWorkers = 0;
+    size_t prioWorkers = 1;
+    size_t i;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Send jobs", 1, testSendJobs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Embedded jobs", 1, testEmbeddedJobs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Nested jobs", 1, testNestedJobs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Jobs behind a busy worker", 1,
+                    testBlockedJobs, &noPrioWorkers) < 0)
+        ret = -1;
+    if (virtTestRun("Priority jobs", 1, testBlockedJobs, &prioWorkers) < 0)
+        ret = -1;
+    if (virtTestRun("Resize", 1, testResize, NULL) < 0)
+        ret = -1;
+
+    /* Not a pass/fail check, but run with VIR_TEST_EXPENSIVE=1 and
+     * VIR_TEST_VERBOSE=1 to see how throughput scales with the number
+     * of workers */
+    if (!virTestGetExpensive())
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(workers) ; i++) {
+        struct testPoolThroughput info = { workers[i], 100000, 0 };
+        char *title;
+
+        if (virAsprintf(&title, "Throughput with %zu workers",
+                        workers[i]) < 0)
+            return EXIT_FAILURE;
+
+        if (virtTestRun(title, 1, testThroughput, &info) < 0)
+            ret = -1;
+        else if (virTestGetVerbose())
+            fprintf(stderr, "      %zu workers: %.0f jobs/sec\n",
+                    info.workers, info.rate);
+        VIR_FREE(title);
+    }
+
+cleanup:
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
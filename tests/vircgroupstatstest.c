@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "util.h"
+#include "cgroup.h"
+
+#define MAX_PERCPU 4
+
+struct testPercpuInfo
+{
+    const char *buf;
+    int ret;
+    size_t n;
+    unsigned long long usage[MAX_PERCPU];
+};
+
+static int testPercpuHelper(const void *data)
+{
+    const struct testPercpuInfo *info = data;
+    virCgroupStats stats;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+
+    if ((rc = virCgroupStatsParsePercpu(info->buf, &stats)) != info->ret) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect %d Actual %d\n", info->ret, rc);
+        goto cleanup;
+    }
+
+    if (rc < 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (stats.npercpuUsage != info->n) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect %zu cpus Actual %zu\n",
+                    info->n, stats.npercpuUsage);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < info->n ; i++) {
+        if (stats.percpuUsage[i] != info->usage[i]) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Cpu %zu Expect %llu Actual %llu\n",
+                        i, info->usage[i], stats.percpuUsage[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupStatsClear(&stats);
+    return ret;
+}
+
+
+struct testKeysInfo
+{
+    const char *buf;
+    int ret;
+    unsigned long long user;
+    unsigned long long system;
+};
+
+static int testKeysHelper(const void *data)
+{
+    const struct testKeysInfo *info = data;
+    const char *keys[] = { "user", "system", NULL };
+    unsigned long long user = 0;
+    unsigned long long system = 0;
+    unsigned long long *values[] = { &user, &system };
+    int rc;
+
+    if ((rc = virCgroupStatsParseKeys(info->buf, keys, values)) != info->ret) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect %d Actual %d\n", info->ret, rc);
+        return -1;
+    }
+
+    if (rc == 0 &&
+        (user != info->user || system != info->system)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect %llu %llu Actual %llu %llu\n",
+                    info->user, info->system, user, system);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* As read from memory.stat, where the hierarchical total_ keys must
+ * not be taken for the ones of the group itself */
+static const char *testMemoryStatBuf =
+    "cache 4096\n"
+    "rss 8192\n"
+    "mapped_file 1024\n"
+    "swap 0\n"
+    "pgpgin 77\n"
+    "pgpgout 66\n"
+    "pgfault 5000\n"
+    "pgmajfault 12\n"
+    "unevictable 2048\n"
+    "hierarchical_memory_limit 9223372036854775807\n"
+    "total_cache 40960\n"
+    "total_rss 81920\n"
+    "total_pgfault 50000\n";
+
+static int testMemoryStat(const void *data ATTRIBUTE_UNUSED)
+{
+    const char *keys[] = {
+        "cache", "rss", "mapped_file", "swap",
+        "pgfault", "pgmajfault", "unevictable", NULL
+    };
+    unsigned long long expect[] = { 4096, 8192, 1024, 0, 5000, 12, 2048 };
+    unsigned long long got[ARRAY_CARDINALITY(expect)];
+    unsigned long long *values[ARRAY_CARDINALITY(expect)];
+    size_t i;
+    int rc;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(expect) ; i++) {
+        got[i] = -1;
+        values[i] = &got[i];
+    }
+
+    if ((rc = virCgroupStatsParseKeys(testMemoryStatBuf, keys, values)) < 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect 0 Actual %d\n", rc);
+        return -1;
+    }
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(expect) ; i++) {
+        if (got[i] != expect[i]) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Key %s Expect %llu Actual %llu\n",
+                        keys[i], expect[i], got[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+#define MAX_BLKIO 3
+
+struct testBlkioInfo
+{
+    const char *buf;
+    int ret;
+    size_t n;
+    virCgroupBlkioStats devs[MAX_BLKIO];
+};
+
+static int testBlkioHelper(const void *data)
+{
+    const struct testBlkioInfo *info = data;
+    virCgroupStats stats;
+    const virCgroupBlkioStats *want;
+    const virCgroupBlkioStats *dev;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+
+    if ((rc = virCgroupStatsParseBlkio(info->buf, &stats)) != info->ret) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect %d Actual %d\n", info->ret, rc);
+        goto cleanup;
+    }
+
+    if (rc < 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (stats.nblkio != info->n) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Expect %zu devices Actual %zu\n",
+                    info->n, stats.nblkio);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < info->n ; i++) {
+        want = &info->devs[i];
+        dev = &stats.blkio[i];
+        if (dev->major != want->major || dev->minor != want->minor ||
+            dev->read != want->read || dev->write != want->write ||
+            dev->sync != want->sync || dev->async != want->async) {
+            if (virTestGetDebug())
+                fprintf(stderr,
+                        "Device %zu Expect %d:%d %llu %llu %llu %llu "
+                        "Actual %d:%d %llu %llu %llu %llu\n", i,
+                        want->major, want->minor, want->read, want->write,
+                        want->sync, want->async,
+                        dev->major, dev->minor, dev->read, dev->write,
+                        dev->sync, dev->async);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupStatsClear(&stats);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST_PERCPU(name, buf, rc, n, ...)                          \
+    do {                                                               \
+        struct testPercpuInfo info = { buf, rc, n, { __VA_ARGS__ } };  \
+        if (virtTestRun("Percpu " name,                                \
+                        1, testPercpuHelper, &info) < 0)               \
+            ret = -1;                                                  \
+    } while (0)
+
+    /* As read from cpuacct.usage_percpu */
+    DO_TEST_PERCPU("4 cpus", "1000 2000 3000 4000 \n", 0, 4,
+                   1000, 2000, 3000, 4000);
+    DO_TEST_PERCPU("1 cpu", "12345678901234\n", 0, 1, 12345678901234ULL);
+    DO_TEST_PERCPU("no newline", "7 8", 0, 2, 7, 8);
+    DO_TEST_PERCPU("empty", "", 0, 0, 0);
+    DO_TEST_PERCPU("blank", " \n", 0, 0, 0);
+
+    /* Not a number */
+    DO_TEST_PERCPU("garbage", "1 x 2\n", -EINVAL, 0, 0);
+    DO_TEST_PERCPU("suffix", "1 2x\n", -EINVAL, 0, 0);
+
+#define DO_TEST_KEYS(name, buf, rc, user, system)                      \
+    do {                                                               \
+        struct testKeysInfo info = { buf, rc, user, system };          \
+        if (virtTestRun("Keys " name,                                  \
+                        1, testKeysHelper, &info) < 0)                 \
+            ret = -1;                                                  \
+    } while (0)
+
+    /* As read from cpuacct.stat */
+    DO_TEST_KEYS("stat", "user 1234\nsystem 567\n", 0, 1234, 567);
+    DO_TEST_KEYS("no newline", "user 1\nsystem 2", 0, 1, 2);
+    DO_TEST_KEYS("any order", "system 2\nuser 1\n", 0, 1, 2);
+    DO_TEST_KEYS("unknown keys", "nice 9\nuser 1\nusers 8\nsystem 2\n",
+                 0, 1, 2);
+    DO_TEST_KEYS("missing key", "user 1\n", 0, 1, 0);
+    DO_TEST_KEYS("empty", "", 0, 0, 0);
+
+    /* Lines which are not "key value" */
+    DO_TEST_KEYS("no value", "user\nsystem 2\n", -EINVAL, 0, 0);
+    DO_TEST_KEYS("bad value", "user 1x\nsystem 2\n", -EINVAL, 0, 0);
+    DO_TEST_KEYS("extra field", "user 1 2\nsystem 2\n", -EINVAL, 0, 0);
+
+    if (virtTestRun("Memory stat", 1, testMemoryStat, NULL) < 0)
+        ret = -1;
+
+#define DO_TEST_BLKIO(name, buf, rc, n, ...)                           \
+    do {                                                               \
+        struct testBlkioInfo info = { buf, rc, n, { __VA_ARGS__ } };   \
+        if (virtTestRun("Blkio " name,                                 \
+                        1, testBlkioHelper, &info) < 0)                \
+            ret = -1;                                                  \
+    } while (0)
+
+    /* As read from blkio.throttle.io_service_bytes */
+    DO_TEST_BLKIO("2 devices",
+                  "8:0 Read 1000\n"
+                  "8:0 Write 2000\n"
+                  "8:0 Sync 2500\n"
+                  "8:0 Async 500\n"
+                  "8:0 Total 3000\n"
+                  "253:1 Read 10\n"
+                  "253:1 Write 20\n"
+                  "253:1 Sync 30\n"
+                  "253:1 Async 0\n"
+                  "253:1 Total 30\n"
+                  "Total 3030\n",
+                  0, 2,
+                  { 8, 0, 1000, 2000, 2500, 500 },
+                  { 253, 1, 10, 20, 30, 0 });
+    DO_TEST_BLKIO("no io", "Total 0\n", 0, 0, { 0 });
+    DO_TEST_BLKIO("empty", "", 0, 0, { 0 });
+    DO_TEST_BLKIO("no newline", "8:16 Read 7\n8:16 Write 8", 0, 1,
+                  { 8, 16, 7, 8, 0, 0 });
+
+    /* Lines which are not "major:minor operation bytes" */
+    DO_TEST_BLKIO("no minor", "8 Read 1\n", -EINVAL, 0, { 0 });
+    DO_TEST_BLKIO("no bytes", "8:0 Read\n", -EINVAL, 0, { 0 });
+    DO_TEST_BLKIO("bad bytes", "8:0 Read 1x\n", -EINVAL, 0, { 0 });
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
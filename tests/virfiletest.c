@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "virfile.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Large enough a unit for any filesystem to keep holes of */
+#define EXTENT (1024 * 1024)
+
+/*
+ * The test file holds 1 extent of data, a hole of 2 extents, 1 more
+ * extent of data, and ends with a hole of 2 extents: DHHDHH.
+ */
+static int
+testFileCreate(char **path)
+{
+    char *buf = NULL;
+    int fd = -1;
+
+    if (virAsprintf(path, "%s/virfiletest-XXXXXX", abs_builddir) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if ((fd = mkstemp(*path)) < 0) {
+        virReportSystemError(errno, _("Unable to create %s"), *path);
+        goto error;
+    }
+
+    if (VIR_ALLOC_N(buf, EXTENT) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    memset(buf, 'x', EXTENT);
+
+    if (safewrite(fd, buf, EXTENT) < 0 ||
+        lseek(fd, 3 * EXTENT, SEEK_SET) < 0 ||
+        safewrite(fd, buf, EXTENT) < 0 ||
+        ftruncate(fd, 6 * EXTENT) < 0 ||
+        lseek(fd, 0, SEEK_SET) < 0) {
+        virReportSystemError(errno, _("Unable to write %s"), *path);
+        goto error;
+    }
+
+    VIR_FREE(buf);
+    return fd;
+
+error:
+    VIR_FREE(buf);
+    VIR_FORCE_CLOSE(fd);
+    if (*path)
+        unlink(*path);
+    VIR_FREE(*path);
+    return -1;
+}
+
+
+static void
+testFileRemove(char *path, int fd)
+{
+    VIR_FORCE_CLOSE(fd);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+}
+
+
+/* Check that the @length bytes at @offset all read back as @expect */
+static int
+testFileCheckContent(int fd, off_t offset, off_t length, char expect)
+{
+    char buf[4096];
+    ssize_t got;
+    ssize_t i;
+
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return -1;
+
+    while (length > 0) {
+        if ((got = saferead(fd, buf, MIN(length, sizeof(buf)))) <= 0) {
+            fprintf(stderr, "Short read at %lld\n", (long long)offset);
+            return -1;
+        }
+        for (i = 0 ; i < got ; i++) {
+            if (buf[i] != expect) {
+                fprintf(stderr, "Byte at %lld is %d, expected %d\n",
+                        (long long)(offset + i), buf[i], expect);
+                return -1;
+            }
+        }
+        offset += got;
+        length -= got;
+    }
+
+    return 0;
+}
+
+
+struct testInDataData {
+    off_t offset;
+    int inData;
+    unsigned long long length;
+};
+
+static int
+testFileInData(const void *args ATTRIBUTE_UNUSED)
+{
+    static const struct testInDataData expect[] = {
+        { 0, 1, EXTENT },
+        { EXTENT / 2, 1, EXTENT / 2 },
+        { EXTENT, 0, 2 * EXTENT },
+        { 2 * EXTENT, 0, EXTENT },
+        { 3 * EXTENT, 1, EXTENT },
+        { 4 * EXTENT, 0, 2 * EXTENT },
+        { 6 * EXTENT, 0, 0 },
+    };
+    char *path = NULL;
+    int fd;
+    size_t i;
+    int ret = -1;
+
+    if ((fd = testFileCreate(&path)) < 0)
+        return -1;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(expect) ; i++) {
+        int inData;
+        unsigned long long length;
+
+        if (lseek(fd, expect[i].offset, SEEK_SET) < 0 ||
+            virFileInData(fd, &inData, &length) < 0)
+            goto cleanup;
+
+        if (i == 0 && length == 6 * EXTENT) {
+            /* Holes cannot be found here, so all is data */
+            VIR_DEBUG("No holes found in %s", path);
+            ret = 0;
+            goto cleanup;
+        }
+
+        if (inData != expect[i].inData || length != expect[i].length) {
+            fprintf(stderr,
+                    "At %lld got inData=%d length=%llu, "
+                    "expected inData=%d length=%llu\n",
+                    (long long)expect[i].offset, inData, length,
+                    expect[i].inData, expect[i].length);
+            goto cleanup;
+        }
+
+        if (lseek(fd, 0, SEEK_CUR) != expect[i].offset) {
+            fprintf(stderr, "Position moved from %lld\n",
+                    (long long)expect[i].offset);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    testFileRemove(path, fd);
+    return ret;
+}
+
+
+static int
+testFilePunchHole(const void *args ATTRIBUTE_UNUSED)
+{
+    char *path = NULL;
+    struct stat sb;
+    int fd;
+    int ret = -1;
+
+    if ((fd = testFileCreate(&path)) < 0)
+        return -1;
+
+    /* Across the end of the first extent of data and into the hole */
+    if (virFilePunchHole(fd, EXTENT / 2, EXTENT) < 0) {
+        virReportSystemError(errno, _("Unable to punch hole in %s"), path);
+        goto cleanup;
+    }
+
+    if (fstat(fd, &sb) < 0 || sb.st_size != 6 * EXTENT) {
+        fprintf(stderr, "Punching a hole changed the size of the file\n");
+        goto cleanup;
+    }
+
+    if (testFileCheckContent(fd, 0, EXTENT / 2, 'x') < 0 ||
+        testFileCheckContent(fd, EXTENT / 2, 5 * EXTENT / 2, 0) < 0 ||
+        testFileCheckContent(fd, 3 * EXTENT, EXTENT, 'x') < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testFileRemove(path, fd);
+    return ret;
+}
+
+
+static int
+testFileMakeHole(const void *args ATTRIBUTE_UNUSED)
+{
+    char *path = NULL;
+    struct stat sb;
+    int fd;
+    int ret = -1;
+
+    if ((fd = testFileCreate(&path)) < 0)
+        return -1;
+
+    /* Over the second extent of data and past the end of the file */
+    if (lseek(fd, 3 * EXTENT + EXTENT / 2, SEEK_SET) < 0 ||
+        virFileMakeHole(fd, 4 * EXTENT) < 0) {
+        virReportSystemError(errno, _("Unable to make hole in %s"), path);
+        goto cleanup;
+    }
+
+    if (lseek(fd, 0, SEEK_CUR) != 7 * EXTENT + EXTENT / 2) {
+        fprintf(stderr, "Position is not past the hole\n");
+        goto cleanup;
+    }
+
+    if (fstat(fd, &sb) < 0 || sb.st_size != 7 * EXTENT + EXTENT / 2) {
+        fprintf(stderr, "The file was not extended up to the hole end\n");
+        goto cleanup;
+    }
+
+    if (testFileCheckContent(fd, 0, EXTENT, 'x') < 0 ||
+        testFileCheckContent(fd, 3 * EXTENT, EXTENT / 2, 'x') < 0 ||
+        testFileCheckContent(fd, 3 * EXTENT + EXTENT / 2,
+                             4 * EXTENT, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testFileRemove(path, fd);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("InData", 1, testFileInData, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("PunchHole", 1, testFilePunchHole, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("MakeHole", 1, testFileMakeHole, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "threads.h"
+#include "viratomic.h"
+#include "event.h"
+
+#include "rpc/virkeepalive.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/*
+ * Keepalives driven by a wheel, with the default event loop run by
+ * a thread of its own. Intervals are counted in whole seconds, so
+ * each test takes a few seconds.
+ */
+
+typedef struct _testPeer testPeer;
+typedef testPeer *testPeerPtr;
+struct _testPeer {
+    virKeepAlivePtr ka;
+    int pings;
+    int dead;
+};
+
+static virThread eventThread;
+static int eventQuit;
+
+
+static void
+testEventRun(void *opaque ATTRIBUTE_UNUSED)
+{
+    while (!virAtomicIntGet(&eventQuit)) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+}
+
+
+static void
+testEventWakeup(int timer, void *opaque ATTRIBUTE_UNUSED)
+{
+    virEventRemoveTimeout(timer);
+}
+
+
+static int
+testPeerSend(void *client, virNetMessagePtr msg)
+{
+    testPeerPtr peer = client;
+
+    virAtomicIntInc(&peer->pings);
+    virNetMessageFree(msg);
+    return 0;
+}
+
+
+static void
+testPeerDead(void *client)
+{
+    testPeerPtr peer = client;
+
+    /* As a server closing the connection would */
+    virAtomicIntInc(&peer->dead);
+    virKeepAliveStop(peer->ka);
+}
+
+
+static void
+testPeerFree(void *client ATTRIBUTE_UNUSED)
+{
+}
+
+
+/* Start keepalives for @npeers peers sharing @wheel */
+static int
+testPeersStart(virKeepAliveWheelPtr wheel,
+               testPeerPtr peers,
+               size_t npeers,
+               int interval,
+               unsigned int count)
+{
+    size_t i;
+
+    memset(peers, 0, sizeof(*peers) * npeers);
+
+    for (i = 0 ; i < npeers ; i++) {
+        if (!(peers[i].ka = virKeepAliveNew(interval, count, wheel,
+                                            &peers[i],
+                                            testPeerSend, testPeerDead,
+                                            testPeerFree)) ||
+            virKeepAliveStart(peers[i].ka, 0, 0) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+testPeersStop(testPeerPtr peers,
+              size_t npeers)
+{
+    size_t i;
+
+    for (i = 0 ; i < npeers ; i++) {
+        if (!peers[i].ka)
+            continue;
+        virKeepAliveStop(peers[i].ka);
+        virObjectUnref(peers[i].ka);
+        peers[i].ka = NULL;
+    }
+}
+
+
+/* Pretend @peer received a message other than a keepalive */
+static void
+testPeerReceive(testPeerPtr peer)
+{
+    virNetMessage msg;
+    virNetMessagePtr response;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.header.prog = 0x11223344;
+    msg.header.type = VIR_NET_CALL;
+
+    ignore_value(virKeepAliveCheckMessage(peer->ka, &msg, &response));
+}
+
+
+#define IDLE_NPEERS 10
+
+/*
+ * Peers which never answer get a ping per interval, and are
+ * declared dead once they missed as many as allowed.
+ */
+static int
+testIdle(const void *args ATTRIBUTE_UNUSED)
+{
+    virKeepAliveWheelPtr wheel;
+    testPeer peers[IDLE_NPEERS];
+    size_t i;
+    int ret = -1;
+
+    if (!(wheel = virKeepAliveWheelNew()))
+        return -1;
+
+    if (testPeersStart(wheel, peers, IDLE_NPEERS, 1, 1) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < 50 ; i++) {
+        size_t j;
+
+        for (j = 0 ; j < IDLE_NPEERS ; j++) {
+            if (!virAtomicIntGet(&peers[j].dead))
+                break;
+        }
+        if (j == IDLE_NPEERS)
+            break;
+        usleep(100 * 1000);
+    }
+
+    for (i = 0 ; i < IDLE_NPEERS ; i++) {
+        if (virAtomicIntGet(&peers[i].pings) != 1 ||
+            virAtomicIntGet(&peers[i].dead) != 1) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Peer %zu got %d pings and died %d times\n",
+                        i, peers[i].pings, peers[i].dead);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    testPeersStop(peers, IDLE_NPEERS);
+    virObjectUnref(wheel);
+    return ret;
+}
+
+
+#define BUSY_NPEERS 20
+
+/*
+ * Peers receiving messages more often than the interval are never
+ * pinged, while the idle ones on the same wheel are. The interval
+ * is 2 seconds, since a message just before a second starts is
+ * already counted a second old.
+ */
+static int
+testBusy(const void *args ATTRIBUTE_UNUSED)
+{
+    virKeepAliveWheelPtr wheel;
+    testPeer peers[BUSY_NPEERS];
+    size_t i;
+    int ret = -1;
+
+    if (!(wheel = virKeepAliveWheelNew()))
+        return -1;
+
+    if (testPeersStart(wheel, peers, BUSY_NPEERS, 2, 10) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < 15 ; i++) {
+        size_t j;
+
+        for (j = 0 ; j < BUSY_NPEERS ; j += 2)
+            testPeerReceive(&peers[j]);
+        usleep(200 * 1000);
+    }
+
+    for (i = 0 ; i < BUSY_NPEERS ; i++) {
+        int pings = virAtomicIntGet(&peers[i].pings);
+
+        if ((i % 2 == 0 && pings != 0) ||
+            (i % 2 == 1 && pings == 0) ||
+            virAtomicIntGet(&peers[i].dead)) {
+            if (virTestGetDebug())
+                fprintf(stderr, "%s peer %zu got %d pings and died %d times\n",
+                        i % 2 ? "Idle" : "Busy", i, pings, peers[i].dead);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    testPeersStop(peers, BUSY_NPEERS);
+    virObjectUnref(wheel);
+    return ret;
+}
+
+
+#define STOP_NPEERS 10
+
+/*
+ * Stopped keepalives leave the wheel, and are not pinged any more,
+ * even those stopped while the wheel deals with them.
+ */
+static int
+testStop(const void *args ATTRIBUTE_UNUSED)
+{
+    virKeepAliveWheelPtr wheel;
+    testPeer peers[STOP_NPEERS];
+    size_t i;
+    int ret = -1;
+
+    if (!(wheel = virKeepAliveWheelNew()))
+        return -1;
+
+    if (testPeersStart(wheel, peers, STOP_NPEERS, 1, 10) < 0)
+        goto cleanup;
+
+    /* Half of them right away, the others around their deadline */
+    for (i = 0 ; i < STOP_NPEERS ; i += 2)
+        virKeepAliveStop(peers[i].ka);
+    usleep(1000 * 1000);
+    for (i = 1 ; i < STOP_NPEERS ; i += 2)
+        virKeepAliveStop(peers[i].ka);
+    usleep(2000 * 1000);
+
+    for (i = 0 ; i < STOP_NPEERS ; i++) {
+        int pings = virAtomicIntGet(&peers[i].pings);
+
+        if ((i % 2 == 0 && pings != 0) || pings > 1) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Stopped peer %zu got %d pings\n", i, pings);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    testPeersStop(peers, STOP_NPEERS);
+    virObjectUnref(wheel);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virEventRegisterDefaultImpl() < 0) {
+        virDispatchError(NULL);
+        return EXIT_FAILURE;
+    }
+
+    if (virThreadCreate(&eventThread, true, testEventRun, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create event loop thread"));
+        virDispatchError(NULL);
+        return EXIT_FAILURE;
+    }
+
+    if (virtTestRun("Idle", 1, testIdle, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Busy", 1, testBusy, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stop", 1, testStop, NULL) < 0)
+        ret = -1;
+
+    virAtomicIntSet(&eventQuit, 1);
+    virEventAddTimeout(0, testEventWakeup, NULL, NULL);
+    virThreadJoin(&eventThread);
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
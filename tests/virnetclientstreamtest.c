@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+
+#include "rpc/virnetclientstream.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#define TEST_PROGRAM 0x11223344
+#define TEST_PROC 0x666
+#define TEST_SERIAL 0x99
+
+/* Hand @st a packet as if it had been read off the wire, holding
+ * either @len bytes of @data, or a hole of @len bytes if @data is
+ * NULL */
+static int
+testStreamQueue(virNetClientStreamPtr st,
+                const char *data,
+                long long len)
+{
+    virNetMessagePtr msg;
+    int ret = -1;
+
+    if (!(msg = virNetMessageNew(false))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    msg->header.prog = TEST_PROGRAM;
+    msg->header.vers = 1;
+    msg->header.proc = TEST_PROC;
+    msg->header.type = data ? VIR_NET_STREAM : VIR_NET_STREAM_HOLE;
+    msg->header.serial = TEST_SERIAL;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (data) {
+        if (virNetMessageEncodePayloadRaw(msg, data, len) < 0)
+            goto cleanup;
+    } else {
+        virNetStreamHole hole = { len, 0 };
+
+        if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                       &hole) < 0)
+            goto cleanup;
+    }
+
+    /* Back to where the stream finds a received packet */
+    if (virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+
+    ret = virNetClientStreamQueuePacket(st, msg);
+
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+/* Receive from @st, expecting @len bytes of @expect, or -3 for a
+ * hole of @len bytes if @expect is NULL */
+static int
+testStreamRecv(virNetClientStreamPtr st,
+               const char *expect,
+               long long len)
+{
+    char buf[64];
+    long long hole;
+    int rv;
+
+    rv = virNetClientStreamRecvPacket(st, NULL, buf, sizeof(buf), true,
+                                      VIR_STREAM_RECV_STOP_AT_HOLE);
+
+    if (!expect) {
+        if (rv != -3) {
+            fprintf(stderr, "Got %d instead of a hole\n", rv);
+            return -1;
+        }
+        if (virNetClientStreamRecvHole(st, &hole) < 0)
+            return -1;
+        if (hole != len) {
+            fprintf(stderr, "Got a hole of %lld bytes, expected %lld\n",
+                    hole, len);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (rv != len || memcmp(buf, expect, len) != 0) {
+        fprintf(stderr, "Got %d bytes, expected %lld of '%s'\n",
+                rv, len, expect);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testStreamHoles(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetClientProgramPtr prog;
+    virNetClientStreamPtr st = NULL;
+    char buf[64];
+    int ret = -1;
+
+    if (!(prog = virNetClientProgramNew(TEST_PROGRAM, 1, NULL, 0, NULL)) ||
+        !(st = virNetClientStreamNew(prog, TEST_PROC, TEST_SERIAL, true)))
+        goto cleanup;
+
+    /* Successive holes add up, data in between splits them */
+    if (testStreamQueue(st, "abc", 3) < 0 ||
+        testStreamQueue(st, NULL, 1000) < 0 ||
+        testStreamQueue(st, NULL, 24) < 0 ||
+        testStreamQueue(st, "de", 2) < 0 ||
+        testStreamQueue(st, NULL, 5) < 0)
+        goto cleanup;
+
+    if (testStreamRecv(st, "abc", 3) < 0 ||
+        testStreamRecv(st, NULL, 1024) < 0 ||
+        testStreamRecv(st, "de", 2) < 0)
+        goto cleanup;
+
+    /* Without stopping at holes, they read back as zeros */
+    if (virNetClientStreamRecvPacket(st, NULL, buf, sizeof(buf),
+                                     true, 0) != 5 ||
+        memcmp(buf, "\0\0\0\0\0", 5) != 0) {
+        fprintf(stderr, "The last hole did not read back as zeros\n");
+        goto cleanup;
+    }
+
+    /* Nothing is left */
+    if (virNetClientStreamRecvPacket(st, NULL, buf, sizeof(buf),
+                                     true, 0) != -2) {
+        fprintf(stderr, "Got more than was queued\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(st);
+    virObjectUnref(prog);
+    return ret;
+}
+
+
+static int
+testStreamHoleInvalid(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetClientProgramPtr prog;
+    virNetClientStreamPtr st = NULL;
+    int ret = -1;
+
+    if (!(prog = virNetClientProgramNew(TEST_PROGRAM, 1, NULL, 0, NULL)) ||
+        !(st = virNetClientStreamNew(prog, TEST_PROC, TEST_SERIAL, true)))
+        goto cleanup;
+
+    /* An empty hole would be taken for the end of the stream */
+    if (testStreamQueue(st, NULL, 0) == 0) {
+        fprintf(stderr, "An empty hole was queued\n");
+        goto cleanup;
+    }
+    if (testStreamQueue(st, NULL, -1) == 0) {
+        fprintf(stderr, "A negative hole was queued\n");
+        goto cleanup;
+    }
+    virObjectUnref(st);
+
+    /* Holes only come on streams which asked for them */
+    if (!(st = virNetClientStreamNew(prog, TEST_PROC, TEST_SERIAL, false)))
+        goto cleanup;
+    if (testStreamQueue(st, NULL, 1) == 0) {
+        fprintf(stderr, "A hole was queued on a stream without holes\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(st);
+    virObjectUnref(prog);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Holes", 1, testStreamHoles, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Invalid holes", 1, testStreamHoleInvalid, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
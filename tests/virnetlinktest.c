@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <linux/rtnetlink.h>
+
+# include "util.h"
+# include "virterror_internal.h"
+# include "memory.h"
+# include "logging.h"
+# include "virhash.h"
+# include "virnetlink.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Room for a link message holding a name and both kinds of counters */
+# define TEST_MSG_SIZE 1024
+
+/* Start a message of @type about a link in @buf */
+static struct nlmsghdr *
+testLinkMsgNew(char *buf, int type)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    struct ifinfomsg *ifinfo;
+
+    memset(buf, 0, TEST_MSG_SIZE);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifinfo));
+    nlh->nlmsg_type = type;
+    ifinfo = NLMSG_DATA(nlh);
+    ifinfo->ifi_family = AF_UNSPEC;
+
+    return nlh;
+}
+
+
+static void
+testLinkMsgAddAttr(struct nlmsghdr *nlh, int type,
+                   const void *data, size_t len)
+{
+    struct rtattr *rta;
+
+    rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+
+static void
+testLinkMsgAddName(struct nlmsghdr *nlh, const char *ifname)
+{
+    testLinkMsgAddAttr(nlh, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+}
+
+
+/* Each counter is @base plus a number of its own, so that mixing
+ * any two of them up shows */
+static void
+testLinkMsgAddStats64(struct nlmsghdr *nlh, unsigned long long base,
+                      size_t len)
+{
+    struct rtnl_link_stats64 s;
+
+    memset(&s, 0, sizeof(s));
+    s.rx_bytes = base + 1;
+    s.rx_packets = base + 2;
+    s.rx_errors = base + 3;
+    s.rx_dropped = base + 4;
+    s.tx_bytes = base + 5;
+    s.tx_packets = base + 6;
+    s.tx_errors = base + 7;
+    s.tx_dropped = base + 8;
+
+    testLinkMsgAddAttr(nlh, IFLA_STATS64, &s, len);
+}
+
+
+static void
+testLinkMsgAddStats(struct nlmsghdr *nlh, unsigned int base)
+{
+    struct rtnl_link_stats s;
+
+    memset(&s, 0, sizeof(s));
+    s.rx_bytes = base + 1;
+    s.rx_packets = base + 2;
+    s.rx_errors = base + 3;
+    s.rx_dropped = base + 4;
+    s.tx_bytes = base + 5;
+    s.tx_packets = base + 6;
+    s.tx_errors = base + 7;
+    s.tx_dropped = base + 8;
+
+    testLinkMsgAddAttr(nlh, IFLA_STATS, &s, sizeof(s));
+}
+
+
+static int
+testLinkCheck(virHashTablePtr table, const char *ifname,
+              unsigned long long base)
+{
+    virNetlinkLinkStatsPtr stats;
+
+    if (!(stats = virHashLookup(table, ifname))) {
+        fprintf(stderr, "No counters for %s\n", ifname);
+        return -1;
+    }
+
+    if (stats->rx_bytes != base + 1 ||
+        stats->rx_packets != base + 2 ||
+        stats->rx_errs != base + 3 ||
+        stats->rx_drop != base + 4 ||
+        stats->tx_bytes != base + 5 ||
+        stats->tx_packets != base + 6 ||
+        stats->tx_errs != base + 7 ||
+        stats->tx_drop != base + 8) {
+        fprintf(stderr,
+                "Counters of %s do not match: rx %llu %llu %llu %llu "
+                "tx %llu %llu %llu %llu, expected a base of %llu\n",
+                ifname, stats->rx_bytes, stats->rx_packets,
+                stats->rx_errs, stats->rx_drop, stats->tx_bytes,
+                stats->tx_packets, stats->tx_errs, stats->tx_drop, base);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+testLinkStatsFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+
+/* Beyond what the 32 bit counters hold */
+# define BIG_BASE (5ULL << 32)
+
+static int
+testParseStats(const void *args ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr table;
+    char buf[TEST_MSG_SIZE];
+    struct nlmsghdr *nlh;
+    int ret = -1;
+
+    if (!(table = virHashCreate(8, testLinkStatsFree)))
+        return -1;
+
+    /* The 64 bit counters are preferred */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    testLinkMsgAddName(nlh, "vnet0");
+    testLinkMsgAddStats(nlh, 100);
+    testLinkMsgAddStats64(nlh, BIG_BASE, sizeof(struct rtnl_link_stats64));
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    /* Older kernels only have the 32 bit ones */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    testLinkMsgAddName(nlh, "vnet1");
+    testLinkMsgAddStats(nlh, 200);
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    /* 64 bit counters too short to be trusted are ignored */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    testLinkMsgAddName(nlh, "vnet2");
+    testLinkMsgAddStats64(nlh, BIG_BASE, 4 * sizeof(unsigned long long));
+    testLinkMsgAddStats(nlh, 300);
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    if (virHashSize(table) != 3 ||
+        testLinkCheck(table, "vnet0", BIG_BASE) < 0 ||
+        testLinkCheck(table, "vnet1", 200) < 0 ||
+        testLinkCheck(table, "vnet2", 300) < 0)
+        goto cleanup;
+
+    /* A link seen again replaces what was known of it */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    testLinkMsgAddName(nlh, "vnet1");
+    testLinkMsgAddStats(nlh, 400);
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    if (virHashSize(table) != 3 ||
+        testLinkCheck(table, "vnet1", 400) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virHashFree(table);
+    return ret;
+}
+
+
+static int
+testParseSkip(const void *args ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr table;
+    char buf[TEST_MSG_SIZE];
+    struct nlmsghdr *nlh;
+    int ret = -1;
+
+    if (!(table = virHashCreate(8, testLinkStatsFree)))
+        return -1;
+
+    /* Not about a link */
+    nlh = testLinkMsgNew(buf, RTM_NEWADDR);
+    testLinkMsgAddName(nlh, "vnet0");
+    testLinkMsgAddStats(nlh, 100);
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    /* Without a name */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    testLinkMsgAddStats(nlh, 100);
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    /* Without counters */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    testLinkMsgAddName(nlh, "vnet1");
+    if (virNetlinkLinkStatsParse(nlh, table) < 0)
+        goto cleanup;
+
+    if (virHashSize(table) != 0) {
+        fprintf(stderr, "Got counters of %zd links, expected none\n",
+                virHashSize(table));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virHashFree(table);
+    return ret;
+}
+
+
+static int
+testParseMalformed(const void *args ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr table;
+    char buf[TEST_MSG_SIZE];
+    struct nlmsghdr *nlh;
+    int ret = -1;
+
+    if (!(table = virHashCreate(8, testLinkStatsFree)))
+        return -1;
+
+    /* Too short to hold the link header */
+    nlh = testLinkMsgNew(buf, RTM_NEWLINK);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg) / 2);
+    if (virNetlinkLinkStatsParse(nlh, table) == 0) {
+        fprintf(stderr, "A truncated message was parsed\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virHashFree(table);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Parse stats", 1, testParseStats, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Parse skip", 1, testParseSkip, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Parse malformed", 1, testParseMalformed, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif
@@ -46,7 +46,7 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
         0x00, 0x00, 0x00, 0x00,  /* Status */
     };
     /* According to doc to virNetMessageEncodeHeader(&msg):
-     * msg->buffer will be this long */
+     * msg->buffer starts out smaller than this */
     unsigned long msg_buf_size = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
     int ret = -1;
 
@@ -71,8 +71,9 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
         goto cleanup;
     }
 
-    if (msg->bufferLength != msg_buf_size) {
-        VIR_DEBUG("Expect message offset %lu got %zu",
+    if (msg->bufferLength <= msg->bufferOffset ||
+        msg->bufferLength >= msg_buf_size) {
+        VIR_DEBUG("Expect message length below %lu got %zu",
                   msg_buf_size, msg->bufferLength);
         goto cleanup;
     }
@@ -527,6 +528,286 @@ cleanup:
 }
 
 
+static int testMessagePayloadEncodeLarge(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    size_t len = 200 * 1024;
+    char *str = NULL;
+    int ret = -1;
+
+    if (!msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    memset(&err, 0, sizeof(err));
+    memset(&decoded, 0, sizeof(decoded));
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+
+    /* Much larger than the buffer encoding starts out with */
+    if (VIR_ALLOC_N(str, len + 1) < 0 ||
+        VIR_ALLOC(err.message) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    memset(str, 'x', len);
+    *err.message = str;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength < len) {
+        VIR_DEBUG("Expect message length at least %zu got %zu",
+                  len, msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodeHeader(msg) < 0 ||
+        virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &decoded) < 0)
+        goto cleanup;
+
+    if (decoded.code != VIR_ERR_INTERNAL_ERROR ||
+        decoded.message == NULL ||
+        STRNEQ(*decoded.message, str)) {
+        VIR_DEBUG("Decoded message does not match encoded one");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&decoded);
+    VIR_FREE(str);
+    VIR_FREE(err.message);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+/* An opaque blob of any size, unlike the strings of real replies */
+typedef struct {
+    u_int len;
+    char *val;
+} testBlob;
+
+static bool_t xdr_testBlob(XDR *xdrs, testBlob *blob)
+{
+    return xdr_bytes(xdrs, &blob->val, &blob->len, ~0);
+}
+
+static int testMessagePayloadFragment(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessagePtr fragments = NULL;
+    virNetMessagePtr whole = NULL;
+    virNetMessagePtr frag;
+    testBlob blob = { 10 * 1024 * 1024, NULL };
+    testBlob decoded = { 0, NULL };
+    size_t nfragments = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(blob.val, blob.len) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    for (i = 0 ; i < blob.len ; i++)
+        blob.val[i] = i % 251;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    /* Too large for a single message */
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_testBlob, &blob) == 0) {
+        VIR_DEBUG("Expect encoding beyond the message size to fail");
+        goto cleanup;
+    }
+
+    msg->allowFragments = true;
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_testBlob, &blob) < 0 ||
+        virNetMessageFragment(msg, &fragments) < 0)
+        goto cleanup;
+
+    /* Receive the fragments and then the last part as a peer would */
+    while ((frag = virNetMessageQueueServe(&fragments))) {
+        int rv;
+
+        nfragments++;
+        frag->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        if (virNetMessageDecodeLength(frag) < 0 ||
+            virNetMessageDecodeHeader(frag) < 0) {
+            virNetMessageFree(frag);
+            goto cleanup;
+        }
+        rv = virNetMessageAddFragment(&whole, frag);
+        virNetMessageFree(frag);
+        if (rv != 0) {
+            VIR_DEBUG("Expect more fragments to follow");
+            goto cleanup;
+        }
+    }
+
+    if (nfragments != 2) {
+        VIR_DEBUG("Expect 2 fragments got %zu", nfragments);
+        goto cleanup;
+    }
+
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+    if (virNetMessageAddFragment(&whole, msg) != 1 || whole) {
+        VIR_DEBUG("Expect the reply to be complete");
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_testBlob, &decoded) < 0)
+        goto cleanup;
+
+    if (msg->header.type != VIR_NET_REPLY ||
+        msg->header.serial != 0x99) {
+        VIR_DEBUG("Decoded header does not match encoded one");
+        goto cleanup;
+    }
+
+    if (decoded.len != blob.len ||
+        memcmp(decoded.val, blob.val, blob.len) != 0) {
+        VIR_DEBUG("Decoded payload does not match encoded one");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    while ((frag = virNetMessageQueueServe(&fragments)))
+        virNetMessageFree(frag);
+    virNetMessageFree(whole);
+    xdr_free((xdrproc_t)xdr_testBlob, (void*)&decoded);
+    VIR_FREE(blob.val);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+#if HAVE_ZLIB
+static int testMessagePayloadCompress(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    size_t len = 200 * 1024;
+    size_t encodedLen;
+    char *str = NULL;
+    int ret = -1;
+
+    if (!msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    memset(&err, 0, sizeof(err));
+    memset(&decoded, 0, sizeof(decoded));
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+
+    if (VIR_ALLOC_N(str, len + 1) < 0 ||
+        VIR_ALLOC(err.message) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    memset(str, 'x', len);
+    *err.message = str;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+    encodedLen = msg->bufferLength;
+
+    /* Too small to be compressed */
+    if (virNetMessageCompress(msg, encodedLen) < 0)
+        goto cleanup;
+    if (msg->bufferLength != encodedLen) {
+        VIR_DEBUG("Expect message below threshold to be left alone");
+        goto cleanup;
+    }
+
+    if (virNetMessageCompress(msg, 1024) < 0)
+        goto cleanup;
+    if (msg->bufferLength >= len / 10) {
+        VIR_DEBUG("Expect message length below %zu got %zu",
+                  len / 10, msg->bufferLength);
+        goto cleanup;
+    }
+
+    /* Receive it as a peer would */
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0 ||
+        virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &decoded) < 0)
+        goto cleanup;
+
+    if (msg->header.type != VIR_NET_REPLY ||
+        msg->header.serial != 0x99) {
+        VIR_DEBUG("Decoded header does not match encoded one");
+        goto cleanup;
+    }
+
+    if (decoded.code != VIR_ERR_INTERNAL_ERROR ||
+        decoded.message == NULL ||
+        STRNEQ(*decoded.message, str)) {
+        VIR_DEBUG("Decoded message does not match encoded one");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&decoded);
+    VIR_FREE(str);
+    VIR_FREE(err.message);
+    virNetMessageFree(msg);
+    return ret;
+}
+#endif
+
+
 static int
 mymain(void)
 {
@@ -549,6 +830,17 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", 1, testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Message Payload Encode Large", 1, testMessagePayloadEncodeLarge, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Fragment", 1, testMessagePayloadFragment, NULL) < 0)
+        ret = -1;
+
+#if HAVE_ZLIB
+    if (virtTestRun("Message Payload Compress", 1, testMessagePayloadCompress, NULL) < 0)
+        ret = -1;
+#endif
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
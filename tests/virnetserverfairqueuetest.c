@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+
+#include "rpc/virnetserverfairqueue.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/* Queue @n calls on @flow, numbered from @serial on */
+static int testQueueCalls(virNetServerFairQueuePtr queue,
+                          virNetServerFairQueueFlowPtr flow,
+                          int serial, int n)
+{
+    int i;
+
+    for (i = 0 ; i < n ; i++) {
+        virNetMessagePtr msg;
+
+        if (!(msg = virNetMessageNew(false)))
+            return -1;
+        msg->header.serial = serial + i;
+        virNetServerFairQueuePush(queue, flow, msg);
+    }
+
+    return 0;
+}
+
+/* Check that the next calls handed out are @expect, in order */
+static int testExpectCalls(virNetServerFairQueuePtr queue,
+                           size_t limit,
+                           const int *expect, size_t nexpect)
+{
+    size_t i;
+
+    for (i = 0 ; i < nexpect ; i++) {
+        virNetMessagePtr msg = virNetServerFairQueuePop(queue, limit);
+        int serial;
+
+        if (!msg) {
+            VIR_DEBUG("Expected call %d, got nothing", expect[i]);
+            return -1;
+        }
+        serial = msg->header.serial;
+        virNetMessageFree(msg);
+
+        if (serial != expect[i]) {
+            VIR_DEBUG("Expected call %d, got %d", expect[i], serial);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void testDrainQueue(virNetServerFairQueuePtr queue)
+{
+    virNetMessagePtr msg;
+
+    while ((msg = virNetServerFairQueuePop(queue, SIZE_MAX)))
+        virNetMessageFree(msg);
+    virNetServerFairQueueFree(queue);
+}
+
+
+static int testFairQueueWeights(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetServerFairQueuePtr queue;
+    virNetServerFairQueueFlow a = { .identity = "a", .weight = 1 };
+    virNetServerFairQueueFlow b = { .identity = "b", .weight = 3 };
+    static const int expect[] = {
+        100, 200, 201, 202, 101, 203, 102, 103,
+    };
+    int ret = -1;
+
+    if (!(queue = virNetServerFairQueueNew()))
+        return -1;
+
+    if (testQueueCalls(queue, &a, 100, 4) < 0 ||
+        testQueueCalls(queue, &b, 200, 4) < 0)
+        goto cleanup;
+
+    if (testExpectCalls(queue, SIZE_MAX,
+                        expect, ARRAY_CARDINALITY(expect)) < 0)
+        goto cleanup;
+
+    if (virNetServerFairQueueGetDepth(queue) != 0) {
+        VIR_DEBUG("Expected an empty queue");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    testDrainQueue(queue);
+    return ret;
+}
+
+
+static int testFairQueueLimit(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetServerFairQueuePtr queue;
+    virNetServerFairQueueFlow a = { .identity = "a", .weight = 1 };
+    virNetServerFairQueueFlow b = { .identity = NULL, .weight = 0 };
+    static const int first[] = { 100, 200 };
+    static const int second[] = { 101 };
+    int ret = -1;
+
+    if (!(queue = virNetServerFairQueueNew()))
+        return -1;
+
+    if (testQueueCalls(queue, &a, 100, 2) < 0 ||
+        testQueueCalls(queue, &b, 200, 1) < 0)
+        goto cleanup;
+
+    if (testExpectCalls(queue, 2, first, ARRAY_CARDINALITY(first)) < 0)
+        goto cleanup;
+
+    if (virNetServerFairQueuePop(queue, 2) != NULL) {
+        VIR_DEBUG("Expected no call beyond the limit");
+        goto cleanup;
+    }
+
+    virNetServerFairQueueDone(queue);
+
+    if (testExpectCalls(queue, 2, second, ARRAY_CARDINALITY(second)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testDrainQueue(queue);
+    return ret;
+}
+
+
+static int testFairQueueUndo(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetServerFairQueuePtr queue;
+    virNetServerFairQueueFlow a = { .identity = "a", .weight = 1 };
+    virNetServerFairQueueFlow b = { .identity = "b", .weight = 1 };
+    virNetMessagePtr msg;
+    static const int expect[] = { 200, 201 };
+    int ret = -1;
+
+    if (!(queue = virNetServerFairQueueNew()))
+        return -1;
+
+    if (testQueueCalls(queue, &a, 100, 1) < 0 ||
+        testQueueCalls(queue, &b, 200, 2) < 0)
+        goto cleanup;
+
+    /* A call put back by the caller keeps its place */
+    if (!(msg = virNetServerFairQueuePop(queue, 1)))
+        goto cleanup;
+    virNetServerFairQueueUndo(queue, &a, msg);
+
+    if (!(msg = virNetServerFairQueuePop(queue, 1)))
+        goto cleanup;
+    if (msg->header.serial != 100) {
+        VIR_DEBUG("Expected call 100 again, got %d", msg->header.serial);
+        virNetMessageFree(msg);
+        goto cleanup;
+    }
+    virNetMessageFree(msg);
+    virNetServerFairQueueDone(queue);
+
+    if (testExpectCalls(queue, SIZE_MAX,
+                        expect, ARRAY_CARDINALITY(expect)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testDrainQueue(queue);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Fair queue weights", 1, testFairQueueWeights, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Fair queue limit", 1, testFairQueueLimit, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Fair queue undo", 1, testFairQueueUndo, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
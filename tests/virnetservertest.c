@@ -0,0 +1,702 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "threads.h"
+#include "viratomic.h"
+#include "event.h"
+#include "virtime.h"
+
+#include "rpc/virnetserver.h"
+#include "rpc/virnetclient.h"
+#include "rpc/virnetclientprogram.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/*
+ * A server and its clients in one process, talking over a UNIX
+ * socket with a program of a single procedure, which returns its
+ * argument, or fails if it is negative.
+ */
+#define TEST_PROGRAM 0x20121016
+#define TEST_PROGRAM_VERSION 1
+
+enum {
+    TEST_PROC_ECHO = 1,
+};
+
+static int
+testDispatchEcho(virNetServerPtr server ATTRIBUTE_UNUSED,
+                 virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                 virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                 virNetMessageErrorPtr rerr ATTRIBUTE_UNUSED,
+                 void *args,
+                 void *ret)
+{
+    int value = *(int *)args;
+
+    if (value < 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Cannot echo negative value %d"), value);
+        return -1;
+    }
+
+    *(int *)ret = value;
+    return 0;
+}
+
+static virNetServerProgramProc testProcs[] = {
+    { NULL, 0, NULL, 0, NULL, false, 0, NULL },
+    { testDispatchEcho, sizeof(int), (xdrproc_t)xdr_int,
+      sizeof(int), (xdrproc_t)xdr_int, false, 0, "ECHO" },
+};
+
+typedef struct _testServer testServer;
+typedef testServer *testServerPtr;
+struct _testServer {
+    virNetServerPtr srv;
+    virThread thread;
+    bool running;
+    char tmpdir[sizeof("/tmp/libvirt_XXXXXX")];
+    char *path;
+};
+
+static int testSerial;
+
+
+static void
+testServerRun(void *opaque)
+{
+    virNetServerRun(opaque);
+}
+
+
+static void
+testServerWakeup(int timer, void *opaque ATTRIBUTE_UNUSED)
+{
+    virEventRemoveTimeout(timer);
+}
+
+
+static void
+testServerStop(testServerPtr server)
+{
+    if (server->running) {
+        virNetServerQuit(server->srv);
+        virEventAddTimeout(0, testServerWakeup, NULL, NULL);
+        virThreadJoin(&server->thread);
+        server->running = false;
+    }
+
+    if (server->srv) {
+        virNetServerClose(server->srv);
+        virObjectUnref(server->srv);
+        server->srv = NULL;
+    }
+
+    if (server->path) {
+        unlink(server->path);
+        VIR_FREE(server->path);
+        rmdir(server->tmpdir);
+    }
+}
+
+
+/* Start a server with @nworkers worker threads, whose clients are
+ * watched by @nloops event loops besides the main one */
+static int
+testServerStart(testServerPtr server,
+                size_t nloops,
+                size_t nworkers)
+{
+    virNetServerServicePtr svc = NULL;
+    virNetServerProgramPtr prog = NULL;
+    int ret = -1;
+
+    memset(server, 0, sizeof(*server));
+    strcpy(server->tmpdir, "/tmp/libvirt_XXXXXX");
+
+    if (!mkdtemp(server->tmpdir)) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to create temporary directory"));
+        return -1;
+    }
+    if (virAsprintf(&server->path, "%s/test.sock", server->tmpdir) < 0) {
+        virReportOOMError();
+        rmdir(server->tmpdir);
+        return -1;
+    }
+
+    if (!(server->srv = virNetServerNew(nworkers, nworkers, 0, 100,
+                                        -1, 0, false, NULL,
+                                        NULL, NULL, NULL, NULL)))
+        goto cleanup;
+
+    if (virNetServerSetEventLoops(server->srv, nloops) < 0)
+        goto cleanup;
+
+    if (!(svc = virNetServerServiceNewUNIX(server->path, 0077, getegid(),
+                                           VIR_NET_SERVER_SERVICE_AUTH_NONE,
+                                           false, 20, NULL)) ||
+        virNetServerAddService(server->srv, svc, NULL) < 0)
+        goto cleanup;
+
+    if (!(prog = virNetServerProgramNew(TEST_PROGRAM, TEST_PROGRAM_VERSION,
+                                        testProcs, ARRAY_CARDINALITY(testProcs))) ||
+        virNetServerAddProgram(server->srv, prog) < 0)
+        goto cleanup;
+
+    virNetServerUpdateServices(server->srv, true);
+
+    if (virThreadCreate(&server->thread, true,
+                        testServerRun, server->srv) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create server thread"));
+        goto cleanup;
+    }
+    server->running = true;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(svc);
+    virObjectUnref(prog);
+    if (ret < 0)
+        testServerStop(server);
+    return ret;
+}
+
+
+typedef struct _testClient testClient;
+typedef testClient *testClientPtr;
+struct _testClient {
+    virNetClientPtr client;
+    virNetClientProgramPtr prog;
+};
+
+static void
+testClientClose(testClientPtr client)
+{
+    if (client->client) {
+        virNetClientClose(client->client);
+        virObjectUnref(client->client);
+        client->client = NULL;
+    }
+    virObjectUnref(client->prog);
+    client->prog = NULL;
+}
+
+
+static int
+testClientOpen(testServerPtr server,
+               testClientPtr client)
+{
+    memset(client, 0, sizeof(*client));
+
+    if (!(client->client = virNetClientNewUNIX(server->path, false, NULL)) ||
+        !(client->prog = virNetClientProgramNew(TEST_PROGRAM,
+                                                TEST_PROGRAM_VERSION,
+                                                NULL, 0, NULL)) ||
+        virNetClientAddProgram(client->client, client->prog) < 0) {
+        testClientClose(client);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testClientEcho(testClientPtr client, int value)
+{
+    int ret = -1;
+
+    if (virNetClientProgramCall(client->prog, client->client,
+                                virAtomicIntInc(&testSerial),
+                                TEST_PROC_ECHO, 0, NULL, NULL, NULL,
+                                (xdrproc_t)xdr_int, &value,
+                                (xdrproc_t)xdr_int, &ret) < 0)
+        return -1;
+
+    if (ret != value) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Echo of %d returned %d"), value, ret);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* One of the threads making calls on a client */
+typedef struct _testCaller testCaller;
+typedef testCaller *testCallerPtr;
+struct _testCaller {
+    testClientPtr client;
+    virThread thread;
+    size_t ncalls;
+    size_t done;
+    bool failed;
+};
+
+static void
+testCallerRun(void *opaque)
+{
+    testCallerPtr caller = opaque;
+
+    for (caller->done = 0 ; caller->done < caller->ncalls ; caller->done++) {
+        if (testClientEcho(caller->client, caller->done) < 0) {
+            caller->failed = true;
+            break;
+        }
+    }
+}
+
+
+#define CLOSE_NCLIENTS 12
+#define CLOSE_NCALLERS 2
+#define CLOSE_NCALLS 500
+
+/*
+ * With several event loops, messages are dispatched from each of
+ * them while the main loop closes clients. Close half the clients
+ * while their calls are in flight, the other half must complete
+ * all their calls.
+ */
+static int
+testCloseInFlight(const void *args ATTRIBUTE_UNUSED)
+{
+    testServer server;
+    testClient clients[CLOSE_NCLIENTS];
+    testCaller callers[CLOSE_NCLIENTS * CLOSE_NCALLERS];
+    size_t ncallers = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(clients, 0, sizeof(clients));
+
+    if (testServerStart(&server, 3, 4) < 0)
+        return -1;
+
+    for (i = 0 ; i < CLOSE_NCLIENTS ; i++) {
+        if (testClientOpen(&server, &clients[i]) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(callers) ; i++) {
+        testCallerPtr caller = &callers[i];
+
+        memset(caller, 0, sizeof(*caller));
+        caller->client = &clients[i % CLOSE_NCLIENTS];
+        caller->ncalls = CLOSE_NCALLS;
+        if (virThreadCreate(&caller->thread, true,
+                            testCallerRun, caller) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create caller thread"));
+            goto cleanup;
+        }
+        ncallers++;
+    }
+
+    /* Let the calls get going */
+    while (callers[0].done < CLOSE_NCALLS / 10 && !callers[0].failed)
+        usleep(1000);
+
+    for (i = 0 ; i < CLOSE_NCLIENTS ; i += 2)
+        virNetClientClose(clients[i].client);
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < ncallers ; i++)
+        virThreadJoin(&callers[i].thread);
+
+    for (i = 0 ; i < ncallers ; i++) {
+        /* Those on the clients closed above are allowed to fail */
+        if (i % 2 == 0)
+            continue;
+        if (callers[i].failed || callers[i].done != CLOSE_NCALLS) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Caller %zu failed after %zu calls\n",
+                        i, callers[i].done);
+            ret = -1;
+        }
+    }
+
+    for (i = 0 ; i < CLOSE_NCLIENTS ; i++)
+        testClientClose(&clients[i]);
+    testServerStop(&server);
+    return ret;
+}
+
+
+#define BATCH_NCALLS 64
+
+/*
+ * Send more calls in one batch than the server reads from a client
+ * before replying, one of which fails without spoiling the others.
+ */
+static int
+testBatch(const void *args ATTRIBUTE_UNUSED)
+{
+    testServer server;
+    testClient client;
+    virNetClientProgramBatchCall calls[BATCH_NCALLS];
+    int values[BATCH_NCALLS];
+    int rets[BATCH_NCALLS];
+    size_t i;
+    int ret = -1;
+
+    if (testServerStart(&server, 0, 4) < 0)
+        return -1;
+
+    if (testClientOpen(&server, &client) < 0)
+        goto cleanup;
+
+    memset(calls, 0, sizeof(calls));
+    for (i = 0 ; i < BATCH_NCALLS ; i++) {
+        values[i] = i == 10 ? -1 : i;
+        rets[i] = -1;
+        calls[i].serial = virAtomicIntInc(&testSerial);
+        calls[i].proc = TEST_PROC_ECHO;
+        calls[i].args_filter = (xdrproc_t)xdr_int;
+        calls[i].args = &values[i];
+        calls[i].ret_filter = (xdrproc_t)xdr_int;
+        calls[i].ret = &rets[i];
+    }
+
+    if (virNetClientProgramCallBatch(client.prog, client.client,
+                                     calls, BATCH_NCALLS) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < BATCH_NCALLS ; i++) {
+        if (i == 10) {
+            if (calls[i].result == 0) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "Call %zu should have failed\n", i);
+                goto cleanup;
+            }
+            continue;
+        }
+        if (calls[i].result < 0 || rets[i] != values[i]) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Call %zu returned %d, expected %d\n",
+                        i, rets[i], values[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    testClientClose(&client);
+    testServerStop(&server);
+    return ret;
+}
+
+
+#define ASYNC_NCALLS 200
+
+/* One asynchronous call, whose callback runs in the event loop of
+ * the server thread */
+typedef struct _testAsyncCall testAsyncCall;
+typedef testAsyncCall *testAsyncCallPtr;
+struct _testAsyncCall {
+    int *ndone;
+    int value;
+    int ret;
+    int result;
+    int ncompleted;
+};
+
+static void
+testAsyncComplete(int result, void *opaque)
+{
+    testAsyncCallPtr call = opaque;
+
+    call->result = result;
+    call->ncompleted++;
+    virAtomicIntInc(call->ndone);
+}
+
+
+/* Wait up to 10 seconds for @ncalls callbacks to have run */
+static int
+testAsyncWait(int *ndone, int ncalls)
+{
+    size_t i;
+
+    for (i = 0 ; i < 10000 && virAtomicIntGet(ndone) < ncalls ; i++)
+        usleep(1000);
+
+    if (virAtomicIntGet(ndone) != ncalls) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Only %d of %d calls completed\n",
+                    virAtomicIntGet(ndone), ncalls);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Queue calls without waiting for them, along with synchronous
+ * calls which take the buck in between, then close a client with
+ * calls still in flight. Each callback must run exactly once, with
+ * the reply, or a failure once the client is closed.
+ */
+static int
+testAsync(const void *args ATTRIBUTE_UNUSED)
+{
+    testServer server;
+    testClient client;
+    testAsyncCall calls[ASYNC_NCALLS];
+    int ndone = 0;
+    int nqueued = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&client, 0, sizeof(client));
+    memset(calls, 0, sizeof(calls));
+
+    if (testServerStart(&server, 0, 4) < 0)
+        return -1;
+
+    if (testClientOpen(&server, &client) < 0 ||
+        virNetClientRegisterAsyncIO(client.client) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ASYNC_NCALLS / 2 ; i++) {
+        testAsyncCallPtr call = &calls[i];
+
+        call->ndone = &ndone;
+        call->value = i == 10 ? -1 : i;
+        call->ret = -1;
+        if (virNetClientProgramCallAsync(client.prog, client.client,
+                                         virAtomicIntInc(&testSerial),
+                                         TEST_PROC_ECHO,
+                                         (xdrproc_t)xdr_int, &call->value,
+                                         (xdrproc_t)xdr_int, &call->ret,
+                                         testAsyncComplete, call) < 0)
+            goto cleanup;
+        nqueued++;
+
+        if (i % 10 == 0 && testClientEcho(&client, i) < 0)
+            goto cleanup;
+    }
+
+    if (testAsyncWait(&ndone, nqueued) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < nqueued ; i++) {
+        if (calls[i].ncompleted != 1) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Call %zu completed %d times\n",
+                        i, calls[i].ncompleted);
+            goto cleanup;
+        }
+        if (i == 10) {
+            if (calls[i].result == 0) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "Call %zu should have failed\n", i);
+                goto cleanup;
+            }
+            continue;
+        }
+        if (calls[i].result < 0 || calls[i].ret != calls[i].value) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Call %zu returned %d, expected %d\n",
+                        i, calls[i].ret, calls[i].value);
+            goto cleanup;
+        }
+    }
+
+    /* Those still in flight when the client is closed fail */
+    for (; i < ASYNC_NCALLS ; i++) {
+        testAsyncCallPtr call = &calls[i];
+
+        call->ndone = &ndone;
+        call->value = i;
+        if (virNetClientProgramCallAsync(client.prog, client.client,
+                                         virAtomicIntInc(&testSerial),
+                                         TEST_PROC_ECHO,
+                                         (xdrproc_t)xdr_int, &call->value,
+                                         (xdrproc_t)xdr_int, &call->ret,
+                                         testAsyncComplete, call) < 0)
+            goto cleanup;
+        nqueued++;
+    }
+
+    virNetClientClose(client.client);
+
+    if (testAsyncWait(&ndone, nqueued) < 0)
+        goto cleanup;
+
+    for (i = ASYNC_NCALLS / 2 ; i < nqueued ; i++) {
+        if (calls[i].ncompleted != 1 ||
+            (calls[i].result == 0 && calls[i].ret != calls[i].value)) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Call %zu completed %d times with %d\n",
+                        i, calls[i].ncompleted, calls[i].result);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    /* Callbacks may not run once the event loop is gone */
+    if (ret < 0 && nqueued) {
+        virNetClientClose(client.client);
+        ignore_value(testAsyncWait(&ndone, nqueued));
+    }
+    testClientClose(&client);
+    testServerStop(&server);
+    return ret;
+}
+
+
+#define THROUGHPUT_NCALLS 4000
+#define THROUGHPUT_MAX_THREADS 32
+
+/*
+ * Make calls from a growing number of threads sharing one client,
+ * either taking turns at polling the socket, or leaving it to the
+ * I/O thread of the client. The calls per second are printed with
+ * --verbose.
+ */
+static int
+testThroughput(const void *args)
+{
+    const bool *ioThread = args;
+    static const size_t nthreads[] = { 1, 2, 4, 8, 16,
+                                       THROUGHPUT_MAX_THREADS };
+    testServer server;
+    testClient client;
+    testCaller callers[THROUGHPUT_MAX_THREADS];
+    size_t ncallers = 0;
+    size_t i, j;
+    int ret = -1;
+
+    memset(&client, 0, sizeof(client));
+
+    if (testServerStart(&server, 0, 8) < 0)
+        return -1;
+
+    if (testClientOpen(&server, &client) < 0)
+        goto cleanup;
+
+    if (*ioThread && virNetClientStartIOThread(client.client) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(nthreads) ; i++) {
+        unsigned long long start, end;
+
+        if (virTimeMillisNow(&start) < 0)
+            goto cleanup;
+
+        for (ncallers = 0 ; ncallers < nthreads[i] ; ncallers++) {
+            testCallerPtr caller = &callers[ncallers];
+
+            memset(caller, 0, sizeof(*caller));
+            caller->client = &client;
+            caller->ncalls = THROUGHPUT_NCALLS / nthreads[i];
+            if (virThreadCreate(&caller->thread, true,
+                                testCallerRun, caller) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to create caller thread"));
+                goto cleanup;
+            }
+        }
+
+        for (j = 0 ; j < ncallers ; j++)
+            virThreadJoin(&callers[j].thread);
+        ncallers = 0;
+
+        if (virTimeMillisNow(&end) < 0)
+            goto cleanup;
+
+        for (j = 0 ; j < nthreads[i] ; j++) {
+            if (callers[j].failed) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "Caller %zu of %zu failed\n",
+                            j, nthreads[i]);
+                goto cleanup;
+            }
+        }
+
+        if (virTestGetVerbose())
+            fprintf(stderr, "%s%2zu threads: %llu calls/s\n",
+                    i ? "" : "\n", nthreads[i],
+                    THROUGHPUT_NCALLS * 1000ULL / (end - start + 1));
+    }
+
+    ret = 0;
+
+cleanup:
+    for (j = 0 ; j < ncallers ; j++)
+        virThreadJoin(&callers[j].thread);
+    testClientClose(&client);
+    testServerStop(&server);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    bool ioThread;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (virtTestRun("Close clients in flight", 1,
+                    testCloseInFlight, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Batch", 1, testBatch, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Asynchronous calls", 1, testAsync, NULL) < 0)
+        ret = -1;
+
+    /* Slow, and only interesting with VIR_TEST_VERBOSE=1 */
+    if (virTestGetExpensive()) {
+        ioThread = false;
+        if (virtTestRun("Throughput taking turns", 1,
+                        testThroughput, &ioThread) < 0)
+            ret = -1;
+        ioThread = true;
+        if (virtTestRun("Throughput with I/O thread", 1,
+                        testThroughput, &ioThread) < 0)
+            ret = -1;
+    }
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "virobject.h"
+
+#include "rpc/virnetshmsession.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+struct testShmPair {
+    virNetShmSessionPtr client;
+    virNetShmSessionPtr server;
+};
+
+static int testShmPairNew(struct testShmPair *pair)
+{
+    pair->server = NULL;
+    if (!(pair->client = virNetShmSessionNewClient()))
+        return -1;
+
+    /* The server maps the same memory, as if passed over a socket */
+    if (!(pair->server =
+          virNetShmSessionNewServer(virNetShmSessionGetFD(pair->client)))) {
+        virObjectUnref(pair->client);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void testShmPairFree(struct testShmPair *pair)
+{
+    virObjectUnref(pair->client);
+    virObjectUnref(pair->server);
+}
+
+
+/* Push far more data than the ring holds, in odd sized pieces, so
+ * that the indexes wrap around many times */
+static int testShmStream(const void *args ATTRIBUTE_UNUSED)
+{
+    struct testShmPair pair;
+    char buf[65537];
+    char out[65537];
+    unsigned char wseq = 0;
+    unsigned char rseq = 0;
+    size_t total = 0;
+    int ret = -1;
+
+    if (testShmPairNew(&pair) < 0)
+        return -1;
+
+    while (total < 64 * 1024 * 1024) {
+        size_t len = 1 + (total * 7) % sizeof(buf);
+        size_t off = 0;
+        size_t i;
+
+        for (i = 0 ; i < len ; i++)
+            buf[i] = wseq++;
+
+        while (off < len) {
+            bool wakeup = false;
+            ssize_t done;
+            ssize_t got;
+
+            if ((done = virNetShmSessionWrite(pair.client, buf + off,
+                                              len - off, &wakeup)) < 0)
+                goto cleanup;
+            off += done;
+            if (done > 0)
+                continue;
+
+            /* Full, so the writer waits for the reader to wake it */
+            if (virNetShmSessionCanWrite(pair.client, false)) {
+                VIR_DEBUG("Ring should be full");
+                goto cleanup;
+            }
+            if ((got = virNetShmSessionRead(pair.server, out,
+                                            sizeof(out) / 3,
+                                            &wakeup)) <= 0)
+                goto cleanup;
+            if (!wakeup) {
+                VIR_DEBUG("Expected a wakeup for the writer");
+                goto cleanup;
+            }
+            for (i = 0 ; i < got ; i++) {
+                if ((unsigned char)out[i] != rseq++) {
+                    VIR_DEBUG("Data mismatch at %zu", total + i);
+                    goto cleanup;
+                }
+            }
+            total += got;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    testShmPairFree(&pair);
+    return ret;
+}
+
+
+static int testShmWakeup(const void *args ATTRIBUTE_UNUSED)
+{
+    struct testShmPair pair;
+    bool wakeup = false;
+    char buf[8];
+    int ret = -1;
+
+    if (testShmPairNew(&pair) < 0)
+        return -1;
+
+    /* Finding the ring empty arms the reader */
+    if (virNetShmSessionRead(pair.client, buf, sizeof(buf), &wakeup) != 0 ||
+        wakeup)
+        goto cleanup;
+
+    if (virNetShmSessionWrite(pair.server, "hello", 5, &wakeup) != 5 ||
+        !wakeup) {
+        VIR_DEBUG("Expected a wakeup for the waiting reader");
+        goto cleanup;
+    }
+
+    /* Only the first write after the reader gave up wakes it */
+    wakeup = false;
+    if (virNetShmSessionWrite(pair.server, "world", 5, &wakeup) != 5 ||
+        wakeup) {
+        VIR_DEBUG("Expected no further wakeup");
+        goto cleanup;
+    }
+
+    if (!virNetShmSessionCanRead(pair.client, false) ||
+        virNetShmSessionRead(pair.client, buf, sizeof(buf), &wakeup) != 8 ||
+        memcmp(buf, "hellowor", 8) != 0)
+        goto cleanup;
+
+    /* Nothing went the other way */
+    if (virNetShmSessionCanRead(pair.server, false))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testShmPairFree(&pair);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!virNetShmSessionAvailable())
+        return EXIT_AM_SKIP;
+
+    if (virtTestRun("Shared memory stream", 1, testShmStream, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Shared memory wakeup", 1, testShmWakeup, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -250,6 +250,82 @@ cleanup:
 }
 
 
+static int testSocketUNIXWritev(const void *data ATTRIBUTE_UNUSED)
+{
+    virNetSocketPtr lsock = NULL; /* Listen socket */
+    virNetSocketPtr ssock = NULL; /* Server socket */
+    virNetSocketPtr csock = NULL; /* Client socket */
+    char one[] = "Hello ";
+    char two[] = "vectored ";
+    char three[] = "World";
+    struct iovec iov[] = {
+        { one, strlen(one) },
+        { two, strlen(two) },
+        { three, strlen(three) },
+    };
+    const char *expect = "Hello vectored World";
+    char buf[64];
+    size_t got = 0;
+    int ret = -1;
+
+    char *path = NULL;
+    char *tmpdir;
+    char template[] = "/tmp/libvirt_XXXXXX";
+
+    tmpdir = mkdtemp(template);
+    if (tmpdir == NULL) {
+        VIR_WARN("Failed to create temporary directory");
+        goto cleanup;
+    }
+    if (virAsprintf(&path, "%s/test.sock", tmpdir) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewListenUNIX(path, 0700, -1, getgid(), &lsock) < 0)
+        goto cleanup;
+
+    if (virNetSocketListen(lsock, 0) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewConnectUNIX(path, false, NULL, &csock) < 0)
+        goto cleanup;
+
+    if (virNetSocketAccept(lsock, &ssock) < 0 || !ssock) {
+        VIR_DEBUG("Unexpected server socket missing");
+        goto cleanup;
+    }
+
+    if (virNetSocketWritev(csock, iov, ARRAY_CARDINALITY(iov)) !=
+        strlen(expect)) {
+        VIR_DEBUG("Expected all data to be sent at once");
+        goto cleanup;
+    }
+
+    while (got < strlen(expect)) {
+        ssize_t n = virNetSocketRead(ssock, buf + got, sizeof(buf) - got - 1);
+        if (n <= 0)
+            goto cleanup;
+        got += n;
+    }
+    buf[got] = '\0';
+
+    if (STRNEQ(buf, expect)) {
+        VIR_DEBUG("Expected '%s' got '%s'", expect, buf);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    virObjectUnref(lsock);
+    virObjectUnref(ssock);
+    virObjectUnref(csock);
+    if (tmpdir)
+        rmdir(tmpdir);
+    return ret;
+}
+
+
 static int testSocketUNIXAddrs(const void *data ATTRIBUTE_UNUSED)
 {
     virNetSocketPtr lsock = NULL; /* Listen socket */
@@ -496,6 +572,9 @@ mymain(void)
     if (virtTestRun("Socket UNIX Addrs", 1, testSocketUNIXAddrs, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Socket UNIX Writev", 1, testSocketUNIXWritev, NULL) < 0)
+        ret = -1;
+
     if (virtTestRun("Socket External Command /dev/zero", 1, testSocketCommandNormal, NULL) < 0)
         ret = -1;
     if (virtTestRun("Socket External Command /dev/does-not-exist", 1, testSocketCommandFail, NULL) < 0)
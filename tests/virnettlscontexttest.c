@@ -621,8 +621,8 @@ static int testTLSSessionInit(const void *opaque)
 
 
     /* Now the real part of the test, setup the sessions */
-    serverSess = virNetTLSSessionNew(serverCtxt, NULL);
-    clientSess = virNetTLSSessionNew(clientCtxt, data->hostname);
+    serverSess = virNetTLSSessionNew(serverCtxt, NULL, NULL);
+    clientSess = virNetTLSSessionNew(clientCtxt, data->hostname, NULL);
 
     if (!serverSess) {
         VIR_WARN("Unexpected failure using %s against %s",
@@ -735,6 +735,201 @@ cleanup:
 }
 
 
+# if LIBGNUTLS_VERSION_NUMBER >= 0x020a00
+struct testTLSResumeData {
+    struct testTLSCertReq careq;
+    struct testTLSCertReq serverreq;
+    struct testTLSCertReq clientreq;
+    struct testTLSCertReq otherclientreq;
+};
+
+
+/*
+ * Connect a client session to a server session over a socketpair,
+ * and have the server send a byte, so that the client also gets any
+ * ticket sent after the handshake. Sets @resumed to whether the
+ * handshake resumed an earlier session.
+ */
+static int testTLSSessionConnect(virNetTLSContextPtr serverCtxt,
+                                 virNetTLSContextPtr clientCtxt,
+                                 const char *hostname,
+                                 const char *peer,
+                                 bool *resumed)
+{
+    virNetTLSSessionPtr clientSess = NULL;
+    virNetTLSSessionPtr serverSess = NULL;
+    unsigned long long before, after, full;
+    bool clientShake = false;
+    bool serverShake = false;
+    int channel[2] = { -1, -1 };
+    char buf[1] = { 'x' };
+    ssize_t rv;
+    size_t i;
+    int ret = -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel) < 0)
+        abort();
+    ignore_value(virSetNonBlock(channel[0]));
+    ignore_value(virSetNonBlock(channel[1]));
+
+    virNetTLSContextGetResumeStats(serverCtxt, &before, &full);
+
+    if (!(serverSess = virNetTLSSessionNew(serverCtxt, NULL, NULL)) ||
+        !(clientSess = virNetTLSSessionNew(clientCtxt, hostname, peer)))
+        goto cleanup;
+
+    virNetTLSSessionSetIOCallbacks(serverSess, testWrite, testRead, &channel[0]);
+    virNetTLSSessionSetIOCallbacks(clientSess, testWrite, testRead, &channel[1]);
+
+    while (!serverShake || !clientShake) {
+        if (!serverShake) {
+            if ((rv = virNetTLSSessionHandshake(serverSess)) < 0)
+                goto cleanup;
+            if (rv == VIR_NET_TLS_HANDSHAKE_COMPLETE)
+                serverShake = true;
+        }
+        if (!clientShake) {
+            if ((rv = virNetTLSSessionHandshake(clientSess)) < 0)
+                goto cleanup;
+            if (rv == VIR_NET_TLS_HANDSHAKE_COMPLETE)
+                clientShake = true;
+        }
+    }
+
+    if (virNetTLSSessionWrite(serverSess, buf, 1) != 1) {
+        VIR_WARN("Unable to send data over the session");
+        goto cleanup;
+    }
+    /* A ticket ahead of the data may be all one read gets */
+    for (i = 0 ; (rv = virNetTLSSessionRead(clientSess, buf, 1)) != 1 ; i++) {
+        if ((rv < 0 && errno != EAGAIN) || i == 10) {
+            VIR_WARN("Unable to receive data over the session");
+            goto cleanup;
+        }
+    }
+
+    virNetTLSContextGetResumeStats(serverCtxt, &after, &full);
+    *resumed = after != before;
+    ret = 0;
+
+cleanup:
+    /* The client session stores its ticket as it goes */
+    virObjectUnref(clientSess);
+    virObjectUnref(serverSess);
+    VIR_FORCE_CLOSE(channel[0]);
+    VIR_FORCE_CLOSE(channel[1]);
+    return ret;
+}
+
+
+/*
+ * A client only resumes a session with the server, reached at the
+ * same address, and with the same certificates, that it was made
+ * with, whichever context made it.
+ */
+static int testTLSSessionResume(const void *opaque)
+{
+    struct testTLSResumeData *data = (struct testTLSResumeData *)opaque;
+    virNetTLSContextPtr serverCtxt = NULL;
+    virNetTLSContextPtr clientCtxt = NULL;
+    virNetTLSContextPtr otherClientCtxt = NULL;
+    struct {
+        virNetTLSContextPtr *ctxt;
+        const char *hostname;
+        const char *peer;
+        bool resumed;
+    } steps[] = {
+        { &clientCtxt, "libvirt.org", "192.168.122.1;16514", false },
+        { &clientCtxt, "libvirt.org", "192.168.122.1;16514", true },
+        { &clientCtxt, "libvirt.org", "192.168.122.1;16515", false },
+        { &clientCtxt, "www.libvirt.org", "192.168.122.1;16514", false },
+        { &otherClientCtxt, "libvirt.org", "192.168.122.1;16514", false },
+        { &clientCtxt, "libvirt.org", "192.168.122.1;16514", true },
+    };
+    size_t i;
+    int ret = -1;
+
+    testTLSGenerateCert(&data->careq);
+    data->serverreq.cacrt = data->careq.crt;
+    testTLSGenerateCert(&data->serverreq);
+    data->clientreq.cacrt = data->careq.crt;
+    testTLSGenerateCert(&data->clientreq);
+    data->otherclientreq.cacrt = data->careq.crt;
+    testTLSGenerateCert(&data->otherclientreq);
+
+    if (!(serverCtxt = virNetTLSContextNewServer(data->careq.filename,
+                                                 NULL,
+                                                 data->serverreq.filename,
+                                                 keyfile,
+                                                 NULL,
+                                                 false,
+                                                 true)) ||
+        !(clientCtxt = virNetTLSContextNewClient(data->careq.filename,
+                                                 NULL,
+                                                 data->clientreq.filename,
+                                                 keyfile,
+                                                 false,
+                                                 true)) ||
+        !(otherClientCtxt = virNetTLSContextNewClient(data->careq.filename,
+                                                      NULL,
+                                                      data->otherclientreq.filename,
+                                                      keyfile,
+                                                      false,
+                                                      true)))
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(steps) ; i++) {
+        bool resumed;
+
+        /* The remote driver makes a new context for each connection */
+        if (i == ARRAY_CARDINALITY(steps) - 1) {
+            virObjectUnref(clientCtxt);
+            if (!(clientCtxt = virNetTLSContextNewClient(data->careq.filename,
+                                                         NULL,
+                                                         data->clientreq.filename,
+                                                         keyfile,
+                                                         false,
+                                                         true)))
+                goto cleanup;
+        }
+
+        if (testTLSSessionConnect(serverCtxt, *steps[i].ctxt,
+                                  steps[i].hostname, steps[i].peer,
+                                  &resumed) < 0)
+            goto cleanup;
+
+        if (resumed != steps[i].resumed) {
+            VIR_WARN("Connection %zu to %s at %s %s resumed",
+                     i, steps[i].hostname, steps[i].peer,
+                     resumed ? "was" : "was not");
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(serverCtxt);
+    virObjectUnref(clientCtxt);
+    virObjectUnref(otherClientCtxt);
+    gnutls_x509_crt_deinit(data->careq.crt);
+    gnutls_x509_crt_deinit(data->serverreq.crt);
+    gnutls_x509_crt_deinit(data->clientreq.crt);
+    gnutls_x509_crt_deinit(data->otherclientreq.crt);
+    data->careq.crt = data->serverreq.crt = NULL;
+    data->clientreq.crt = data->otherclientreq.crt = NULL;
+
+    if (getenv("VIRT_TEST_DEBUG_CERTS") == NULL) {
+        unlink(data->careq.filename);
+        unlink(data->serverreq.filename);
+        unlink(data->clientreq.filename);
+        unlink(data->otherclientreq.filename);
+    }
+    return ret;
+}
+# endif
+
+
 static int
 mymain(void)
 {
@@ -1257,6 +1452,27 @@ mymain(void)
     DO_SESS_TEST(cacertreq, servercertreq, clientcertreq, false, false, "libvirt.org", wildcards5);
     DO_SESS_TEST(cacertreq, servercertreq, clientcertreq, false, false, "libvirt.org", wildcards6);
 
+# if LIBGNUTLS_VERSION_NUMBER >= 0x020a00
+    /* A good client, but another one */
+    static struct testTLSCertReq clientcert11req = {
+        NULL, NULL, "clientcert11.pem", "UK",
+        "libvirt11", NULL, NULL, NULL, NULL,
+        true, true, false,
+        true, true, GNUTLS_KEY_DIGITAL_SIGNATURE | GNUTLS_KEY_KEY_ENCIPHERMENT,
+        true, true, GNUTLS_KP_TLS_WWW_CLIENT, NULL,
+        0, 0,
+    };
+    static struct testTLSResumeData resumedata;
+
+    resumedata.careq = cacertreq;
+    resumedata.serverreq = servercertreq;
+    resumedata.clientreq = clientcertreq;
+    resumedata.otherclientreq = clientcert11req;
+    if (virtTestRun("TLS Session resume", 1,
+                    testTLSSessionResume, &resumedata) < 0)
+        ret = -1;
+# endif
+
     unlink(keyfile);
 
     asn1_delete_structure(&pkix_asn1);
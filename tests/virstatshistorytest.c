@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "virtypedparam.h"
+
+#include "virstatshistory.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Each sample holds a counter, "net.0.rx.bytes", and a gauge,
+ * "balloon.current" */
+static int
+testAddSample(virStatsHistoryPtr history,
+              unsigned long long timestamp,
+              unsigned long long monotonic,
+              unsigned long long bytes,
+              unsigned long long current)
+{
+    virTypedParameterPtr params;
+
+    if (VIR_ALLOC_N(params, 2) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (virTypedParameterAssign(&params[0], "net.0.rx.bytes",
+                                VIR_TYPED_PARAM_ULLONG, bytes) < 0 ||
+        virTypedParameterAssign(&params[1], "balloon.current",
+                                VIR_TYPED_PARAM_ULLONG, current) < 0) {
+        VIR_FREE(params);
+        return -1;
+    }
+
+    virStatsHistoryAdd(history, timestamp, monotonic, params, 2);
+    return 0;
+}
+
+
+static int
+testCheckParam(virStatsHistorySamplePtr sample,
+               const char *field,
+               unsigned long long expect)
+{
+    int i;
+
+    for (i = 0 ; i < sample->nparams ; i++) {
+        if (STRNEQ(sample->params[i].field, field))
+            continue;
+        if (sample->params[i].value.ul != expect) {
+            fprintf(stderr, "%s at %llu is %llu, expected %llu\n",
+                    field, sample->timestamp,
+                    sample->params[i].value.ul, expect);
+            return -1;
+        }
+        return 0;
+    }
+
+    fprintf(stderr, "%s missing at %llu\n", field, sample->timestamp);
+    return -1;
+}
+
+
+static int
+testRing(const void *args ATTRIBUTE_UNUSED)
+{
+    virStatsHistoryPtr history;
+    virStatsHistorySamplePtr samples = NULL;
+    size_t nsamples = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(history = virStatsHistoryNew(3)))
+        return -1;
+
+    for (i = 0 ; i < 5 ; i++) {
+        if (testAddSample(history, 1000 * i, 500 * i, 100 * i, i) < 0)
+            goto cleanup;
+    }
+
+    /* Only the last 3 are left, oldest first */
+    if (virStatsHistoryGet(history, 10, false, &samples, &nsamples) < 0)
+        goto cleanup;
+    if (nsamples != 3) {
+        fprintf(stderr, "Got %zu samples, expected 3\n", nsamples);
+        goto cleanup;
+    }
+    for (i = 0 ; i < nsamples ; i++) {
+        if (samples[i].timestamp != 1000 * (i + 2) ||
+            testCheckParam(&samples[i], "net.0.rx.bytes", 100 * (i + 2)) < 0 ||
+            testCheckParam(&samples[i], "balloon.current", i + 2) < 0)
+            goto cleanup;
+    }
+    virStatsHistorySampleListFree(samples, nsamples);
+    samples = NULL;
+
+    if (virStatsHistoryGet(history, 1, false, &samples, &nsamples) < 0)
+        goto cleanup;
+    if (nsamples != 1 || samples[0].timestamp != 4000) {
+        fprintf(stderr, "Did not get the last sample alone\n");
+        goto cleanup;
+    }
+    virStatsHistorySampleListFree(samples, nsamples);
+    samples = NULL;
+
+    virStatsHistoryClear(history);
+    if (virStatsHistoryGet(history, 10, false, &samples, &nsamples) < 0)
+        goto cleanup;
+    if (nsamples != 0) {
+        fprintf(stderr, "Got %zu samples after clearing\n", nsamples);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virStatsHistorySampleListFree(samples, nsamples);
+    virStatsHistoryFree(history);
+    return ret;
+}
+
+
+static int
+testRates(const void *args ATTRIBUTE_UNUSED)
+{
+    virStatsHistoryPtr history;
+    virStatsHistorySamplePtr samples = NULL;
+    size_t nsamples = 0;
+    int ret = -1;
+
+    if (!(history = virStatsHistoryNew(10)))
+        return -1;
+
+    if (testAddSample(history, 10000, 100, 1000, 7) < 0 ||
+        testAddSample(history, 12000, 2100, 5000, 8) < 0 ||
+        testAddSample(history, 12500, 2600, 5500, 9) < 0 ||
+        /* the counter was reset, eg by a device being plugged again */
+        testAddSample(history, 13500, 3600, 100, 10) < 0)
+        goto cleanup;
+
+    if (virStatsHistoryGet(history, 10, true, &samples, &nsamples) < 0)
+        goto cleanup;
+    if (nsamples != 3) {
+        fprintf(stderr, "Got %zu rates, expected 3\n", nsamples);
+        goto cleanup;
+    }
+
+    if (samples[0].timestamp != 12000 ||
+        testCheckParam(&samples[0], "net.0.rx.bytes", 2000) < 0 ||
+        testCheckParam(&samples[0], "balloon.current", 8) < 0 ||
+        testCheckParam(&samples[1], "net.0.rx.bytes", 1000) < 0 ||
+        testCheckParam(&samples[1], "balloon.current", 9) < 0 ||
+        testCheckParam(&samples[2], "balloon.current", 10) < 0)
+        goto cleanup;
+
+    if (samples[2].nparams != 1) {
+        fprintf(stderr, "A counter going backwards got a rate\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virStatsHistorySampleListFree(samples, nsamples);
+    virStatsHistoryFree(history);
+    return ret;
+}
+
+
+/* Rates only depend on the monotonic times of the samples, whatever
+ * the system clock does in between */
+static int
+testRatesClockStep(const void *args ATTRIBUTE_UNUSED)
+{
+    virStatsHistoryPtr history;
+    virStatsHistorySamplePtr samples = NULL;
+    size_t nsamples = 0;
+    int ret = -1;
+
+    if (!(history = virStatsHistoryNew(10)))
+        return -1;
+
+    if (testAddSample(history, 1000000, 100, 1000, 7) < 0 ||
+        /* the clock was set back by 10 minutes */
+        testAddSample(history, 402000, 2100, 5000, 8) < 0 ||
+        /* and forward by an hour */
+        testAddSample(history, 4002500, 2600, 5500, 9) < 0)
+        goto cleanup;
+
+    if (virStatsHistoryGet(history, 10, true, &samples, &nsamples) < 0)
+        goto cleanup;
+    if (nsamples != 2) {
+        fprintf(stderr, "Got %zu rates, expected 2\n", nsamples);
+        goto cleanup;
+    }
+
+    if (samples[0].timestamp != 402000 ||
+        samples[1].timestamp != 4002500 ||
+        testCheckParam(&samples[0], "net.0.rx.bytes", 2000) < 0 ||
+        testCheckParam(&samples[1], "net.0.rx.bytes", 1000) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    virStatsHistorySampleListFree(samples, nsamples);
+    virStatsHistoryFree(history);
+    return ret;
+}
+
+
+struct testCounterData {
+    const char *field;
+    bool counter;
+};
+
+static int
+testCounter(const void *args)
+{
+    const struct testCounterData *data = args;
+
+    if (virStatsHistoryIsCounter(data->field) != data->counter) {
+        fprintf(stderr, "%s should%s be a counter\n",
+                data->field, data->counter ? "" : " not");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Ring", 1, testRing, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Rates", 1, testRates, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Rates clock step", 1, testRatesClockStep, NULL) < 0)
+        ret = -1;
+
+#define TEST_COUNTER(name, isCounter)                                   \
+    do {                                                                \
+        struct testCounterData data = {                                 \
+            .field = name,                                              \
+            .counter = isCounter,                                       \
+        };                                                              \
+        if (virtTestRun("Counter " name, 1, testCounter, &data) < 0)    \
+            ret = -1;                                                   \
+    } while (0)
+
+    TEST_COUNTER("cpu.time", true);
+    TEST_COUNTER("cpu.user", true);
+    TEST_COUNTER("vcpu.3.time", true);
+    TEST_COUNTER("net.0.tx.pkts", true);
+    TEST_COUNTER("block.1.wr.reqs", true);
+    TEST_COUNTER("cpu.iowait", true);
+    TEST_COUNTER("mem.free", false);
+    TEST_COUNTER("balloon.current", false);
+    TEST_COUNTER("vcpu.current", false);
+    TEST_COUNTER("time", false);
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -1555,6 +1555,7 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
     char *title;
     char uuid[VIR_UUID_STRING_BUFLEN];
     int state;
+    int *states = NULL;
     bool ret = false;
     vshDomainListPtr list = NULL;
     virDomainPtr dom;
@@ -1600,6 +1601,17 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
     if (!(list = vshDomainListCollect(ctl, flags)))
         goto cleanup;
 
+    /* Query the states of all domains at once rather than paying a
+     * round trip per domain; fall back to asking one by one */
+    if (optTable && list->ndomains > 0 && !ctl->useGetInfo) {
+        states = vshCalloc(ctl, list->ndomains, sizeof(*states));
+        if (virDomainListGetState(list->domains, list->ndomains,
+                                  states, NULL, 0) < 0) {
+            VIR_FREE(states);
+            vshResetLibvirtError();
+        }
+    }
+
     /* print table header in legacy mode */
     if (optTable) {
         if (optTitle)
@@ -1622,7 +1634,10 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
         else
             ignore_value(virStrcpyStatic(id_buf, "-"));
 
-        state = vshDomainState(ctl, dom, NULL);
+        if (states)
+            state = states[i];
+        else
+            state = vshDomainState(ctl, dom, NULL);
         if (optTable && managed && state == VIR_DOMAIN_SHUTOFF &&
             virDomainHasManagedSaveImage(dom, 0) > 0)
             state = -2;
@@ -1656,6 +1671,7 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
 
     ret = true;
 cleanup:
+    VIR_FREE(states);
     vshDomainListFree(list);
     return ret;
 }
@@ -530,6 +530,7 @@ static const vshCmdOptDef opts_vol_upload[] = {
     {"pool", VSH_OT_STRING, 0, N_("pool name or uuid")},
     {"offset", VSH_OT_INT, 0, N_("volume offset to upload to") },
     {"length", VSH_OT_INT, 0, N_("amount of data to upload") },
+    {"sparse", VSH_OT_BOOL, 0, N_("preserve sparseness of the file") },
     {NULL, 0, 0, NULL}
 };
 
@@ -542,6 +543,73 @@ cmdVolUploadSource(virStreamPtr st ATTRIBUTE_UNUSED,
     return saferead(*fd, bytes, nbytes);
 }
 
+/*
+ * Send the file open on @fd, skipping over its holes rather
+ * than sending them as zeros
+ */
+static int
+cmdVolUploadSparse(virStreamPtr st, int fd)
+{
+    char *buf = NULL;
+    size_t buflen = 64 * 1024;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, buflen) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (;;) {
+        int inData;
+        unsigned long long length;
+
+        if (virFileInData(fd, &inData, &length) < 0)
+            goto cleanup;
+
+        if (length == 0)
+            break;
+
+        if (!inData) {
+            if (virStreamSendHole(st, length, 0) < 0)
+                goto cleanup;
+            if (lseek(fd, length, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to seek past hole"));
+                goto cleanup;
+            }
+            continue;
+        }
+
+        while (length > 0) {
+            size_t want = length > buflen ? buflen : length;
+            ssize_t got;
+            size_t off = 0;
+
+            if ((got = saferead(fd, buf, want)) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to read file"));
+                goto cleanup;
+            }
+            if (got == 0)
+                break;
+
+            while (off < got) {
+                int done = virStreamSend(st, buf + off, got - off);
+                if (done < 0)
+                    goto cleanup;
+                off += done;
+            }
+            length -= got;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
 static bool
 cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -552,6 +620,8 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     virStreamPtr st = NULL;
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
+    unsigned int flags = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
 
     if (vshCommandOptULongLong(cmd, "offset", &offset) < 0) {
         vshError(ctl, _("Unable to parse integer"));
@@ -563,6 +633,9 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
         return false;
     }
 
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
+
     if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name))) {
         return false;
     }
@@ -578,12 +651,18 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     }
 
     st = virStreamNew(ctl->conn, 0);
-    if (virStorageVolUpload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolUpload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot upload to volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
+    if (sparse) {
+        if (cmdVolUploadSparse(st, fd) < 0) {
+            vshError(ctl, _("cannot send data to volume %s"), name);
+            virStreamAbort(st);
+            goto cleanup;
+        }
+    } else if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
         vshError(ctl, _("cannot send data to volume %s"), name);
         goto cleanup;
     }
@@ -625,9 +704,72 @@ static const vshCmdOptDef opts_vol_download[] = {
     {"pool", VSH_OT_STRING, 0, N_("pool name or uuid")},
     {"offset", VSH_OT_INT, 0, N_("volume offset to download from") },
     {"length", VSH_OT_INT, 0, N_("amount of data to download") },
+    {"sparse", VSH_OT_BOOL, 0, N_("preserve sparseness of the volume") },
     {NULL, 0, 0, NULL}
 };
 
+/*
+ * Receive the volume into the file open on @fd, seeking over
+ * holes so that they stay unallocated in the file
+ */
+static int
+cmdVolDownloadSparse(virStreamPtr st, int fd)
+{
+    char *buf = NULL;
+    size_t buflen = 64 * 1024;
+    off_t end;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, buflen) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (;;) {
+        int got = virStreamRecvFlags(st, buf, buflen,
+                                     VIR_STREAM_RECV_STOP_AT_HOLE);
+
+        if (got == 0)
+            break;
+
+        if (got == -3) {
+            long long length;
+
+            if (virStreamRecvHole(st, &length, 0) < 0)
+                goto cleanup;
+            if (lseek(fd, length, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to seek past hole"));
+                goto cleanup;
+            }
+            continue;
+        }
+
+        if (got < 0)
+            goto cleanup;
+
+        if (safewrite(fd, buf, got) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to write file"));
+            goto cleanup;
+        }
+    }
+
+    /* A trailing hole only moved the file position */
+    if ((end = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+        ftruncate(fd, end) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to set file size"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
 static bool
 cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -639,6 +781,8 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
     bool created = false;
+    unsigned int flags = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
 
     if (vshCommandOptULongLong(cmd, "offset", &offset) < 0) {
         vshError(ctl, _("Unable to parse integer"));
@@ -650,6 +794,9 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
         return false;
     }
 
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
+
     if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
         return false;
 
@@ -669,12 +816,18 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     }
 
     st = virStreamNew(ctl->conn, 0);
-    if (virStorageVolDownload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolDownload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot download from volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
+    if (sparse) {
+        if (cmdVolDownloadSparse(st, fd) < 0) {
+            vshError(ctl, _("cannot receive data from volume %s"), name);
+            virStreamAbort(st);
+            goto cleanup;
+        }
+    } else if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
         vshError(ctl, _("cannot receive data from volume %s"), name);
         goto cleanup;
     }